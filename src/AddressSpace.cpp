@@ -0,0 +1,191 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include "AddressSpace.h"
+
+CAddressSpace::CAddressSpace()
+   : mMaps(),
+     mText(),
+     mScratch(),
+     mPid(0),
+     mFd(-1),
+     mStale(true),
+     mGeneration(0),
+     mRefreshes(0)
+{
+}
+
+CAddressSpace::~CAddressSpace()
+{
+   if (mFd != -1)
+      close(mFd);
+}
+
+void CAddressSpace::SetPid(pid_t Pid)
+{
+   char filename[64];
+
+   if (mFd != -1)
+      close(mFd);
+
+   mPid = Pid;
+   mMaps.clear();
+   mText.clear();
+   mStale = true;
+   mGeneration++;
+
+   sprintf(filename, "/proc/%d/maps", Pid);
+   mFd = (Pid > 0) ? open(filename, O_RDONLY | O_CLOEXEC) : -1;
+}
+
+bool CAddressSpace::Update()
+{
+   if (!mStale || mFd == -1)
+      return false;
+
+   return Read();
+}
+
+bool CAddressSpace::ChangesLayout(s64 Number)
+{
+   switch (Number)
+   {
+      case SYS_mmap:
+      case SYS_munmap:
+      case SYS_mremap:
+      case SYS_mprotect:
+      case SYS_pkey_mprotect:
+      case SYS_brk:
+      case SYS_shmat:
+      case SYS_shmdt:
+      case SYS_execve:
+      case SYS_execveat:
+      case SYS_clone:
+      case SYS_clone3:
+      case SYS_fork:
+      case SYS_vfork:
+         return true;
+      default:
+         return false;
+   }
+}
+
+bool CAddressSpace::Read()
+{
+   u64 size = 0;
+
+   mStale = false;
+   mRefreshes++;
+
+   if (mScratch.size() < 16384)
+      mScratch.resize(16384);
+
+   // the whole file is generated again for every read from offset 0
+   for (;;)
+   {
+      ssize_t bytes = pread(mFd, &mScratch[size], mScratch.size() - size, size);
+
+      if (bytes <= 0)
+         break;
+
+      size += bytes;
+      if (size == mScratch.size())
+         mScratch.resize(size * 2);
+   }
+
+   if (size == mText.size() && memcmp(mScratch.data(), mText.data(), size) == 0)
+      return false;
+
+   mText.assign(mScratch.data(), size);
+   mMaps.clear();
+
+   char line[4096];
+
+   for (size_t start = 0; start < mText.size(); )
+   {
+      size_t end = mText.find('\n', start);
+      size_t length;
+
+      if (end == std::string::npos)
+         end = mText.size();
+
+      length = std::min(end - start, sizeof(line) - 1);
+      memcpy(line, &mText[start], length);
+      line[length] = '\0';
+
+      TMemoryMap map;
+
+      if (ParseProcessMapsLine(line, &map))
+         mMaps.push_back(map);
+
+      start = end + 1;
+   }
+
+   // the kernel lists them in order already, sorting keeps the search safe regardless
+   if (!std::is_sorted(mMaps.begin(), mMaps.end(), [](const TMemoryMap& a, const TMemoryMap& b) { return a.Start < b.Start; }))
+      std::sort(mMaps.begin(), mMaps.end(), [](const TMemoryMap& a, const TMemoryMap& b) { return a.Start < b.Start; });
+
+   mGeneration++;
+
+   return true;
+}
+
+const TMemoryMap* CAddressSpace::Lookup(u64 Address) const
+{
+   auto next = std::upper_bound(mMaps.begin(), mMaps.end(), Address,
+                                [](u64 address, const TMemoryMap& map) { return address < map.Start; });
+
+   if (next == mMaps.begin() || Address >= (next - 1)->End)
+      return nullptr;
+
+   return &*(next - 1);
+}
+
+const TMemoryMap* CAddressSpace::Find(u64 Address)
+{
+   Update();
+
+   return Lookup(Address);
+}
+
+u64 CAddressSpace::GetExtent(u64 Address, u64 Size, u32 Flags)
+{
+   const TMemoryMap* map = Find(Address);
+   u64               end = Address;
+
+   while (map && (map->Flags & Flags) == Flags && end < Address + Size)
+   {
+      end = map->End;
+
+      // mappings are sorted, the next one continues the range only when it is adjacent
+      map = (map + 1 < mMaps.data() + mMaps.size() && (map + 1)->Start == end) ? map + 1 : nullptr;
+   }
+
+   return (end - Address < Size) ? end - Address : Size;
+}
+
+u64 CAddressSpace::GetBase(const char* Path)
+{
+   size_t length = strlen(Path);
+
+   Update();
+
+   for (const TMemoryMap& map : mMaps)
+   {
+      // a file replaced while it was mapped shows up with " (deleted)" after its name
+      if (map.Offset == 0 && map.Path.compare(0, length, Path) == 0 &&
+          (map.Path.size() == length || map.Path.compare(length, std::string::npos, " (deleted)") == 0))
+         return map.Start;
+   }
+
+   return 0;
+}
+
+const std::vector<TMemoryMap>& CAddressSpace::GetMaps()
+{
+   Update();
+
+   return mMaps;
+}
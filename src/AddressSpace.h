@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "DebugTypes.h"
+#include "DebugUtils.h"
+
+// Memory layout of the target from /proc/pid/maps. The maps file stays open and is read
+// again with pread, but only after Invalidate: the backend calls that whenever the target
+// ran freely, and after a step over a system call that maps, unmaps or execs. A re-read that
+// comes back with the same text keeps the parsed mappings. A lookup that finds nothing never
+// re-reads, reads of bad pointers stay cheap.
+//
+// Mappings never overlap, they are kept sorted by start address and a lookup is a binary
+// search.
+class CAddressSpace
+{
+public:
+
+   CAddressSpace();
+   ~CAddressSpace();
+
+   void SetPid(pid_t Pid);
+   pid_t GetPid() const { return mPid; }
+   bool IsValid() const { return mFd != -1; }
+
+   void Invalidate() { mStale = true; }
+
+   // system calls that can change the layout, Number is orig_rax after a step over one
+   static bool ChangesLayout(s64 Number);
+
+   // re-reads the maps when stale, returns true when the layout changed
+   bool Update();
+
+   // bumped every time the layout changes, to know when derived data is out of date
+   u64 GetGeneration() const { return mGeneration; }
+   u64 GetRefreshes() const { return mRefreshes; }
+
+   const TMemoryMap* Find(u64 Address);
+
+   // bytes from Address up to Size that lie in adjacent mappings which all have Flags
+   u64 GetExtent(u64 Address, u64 Size, u32 Flags);
+
+   // where the file at Path is mapped with offset 0, 0 when it isn't mapped
+   u64 GetBase(const char* Path);
+
+   const std::vector<TMemoryMap>& GetMaps();
+
+private:
+
+   bool Read();
+   const TMemoryMap* Lookup(u64 Address) const;
+
+   std::vector<TMemoryMap> mMaps;
+   std::string             mText;    // maps as last parsed
+   std::string             mScratch;
+   pid_t                   mPid;
+   int                     mFd;
+   bool                    mStale;
+   u64                     mGeneration;
+   u64                     mRefreshes; // times the maps file was read
+};
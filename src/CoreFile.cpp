@@ -0,0 +1,502 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/procfs.h>
+#include <algorithm>
+#include "CoreFile.h"
+
+static inline u64 AlignUp(u64 Value, u64 Alignment) { return (Value + Alignment - 1) & ~(Alignment - 1); }
+
+CCoreWriter::CCoreWriter()
+   : mMaps(),
+     mNotes(),
+     mChunk(nullptr),
+     mFd(-1),
+     mError{}
+{
+}
+
+CCoreWriter::~CCoreWriter()
+{
+   delete [] mChunk;
+
+   if (mFd != -1)
+      close(mFd);
+}
+
+bool CCoreWriter::Write(const char* Filename, pid_t Pid, int Signal, const TRegister* Registers,
+                        const user_fpregs_struct* FpRegisters, TReadMemoryFunc Read, void* Context, TCoreStats* Stats)
+{
+   TElfHeader64 header = {};
+
+   *Stats = {};
+
+   if (!ReadProcessMaps(Pid, mMaps))
+   {
+      sprintf(mError, "can't read the memory maps of pid %d", Pid);
+      return false;
+   }
+
+   BuildNotes(Pid, Signal, Registers, FpRegisters);
+
+   std::vector<TElfProgramHeader64> segments(mMaps.size() + 1);
+
+   u64 notes_offset = sizeof(TElfHeader64) + segments.size() * sizeof(TElfProgramHeader64);
+   u64 section_offset = notes_offset + mNotes.size();
+   u64 offset = AlignUp(section_offset + sizeof(TElfSectionHeader64), PAGE_SIZE);
+
+   segments[0].p_type = ELF_SEGMENT_TYPE_NOTE;
+   segments[0].p_offset = notes_offset;
+   segments[0].p_filesz = mNotes.size();
+   segments[0].p_align = 4;
+
+   for (size_t i = 0; i < mMaps.size(); i++)
+   {
+      const TMemoryMap&    map = mMaps[i];
+      TElfProgramHeader64& segment = segments[i + 1];
+
+      segment.p_type = ELF_SEGMENT_TYPE_LOAD;
+      segment.p_flags |= (map.Flags & MEMORY_MAP_READ) ? ELF_SEGMENT_FLAG_R : 0;
+      segment.p_flags |= (map.Flags & MEMORY_MAP_WRITE) ? ELF_SEGMENT_FLAG_W : 0;
+      segment.p_flags |= (map.Flags & MEMORY_MAP_EXEC) ? ELF_SEGMENT_FLAG_X : 0;
+      segment.p_offset = offset;
+      segment.p_vaddr = map.Start;
+      segment.p_memsz = map.End - map.Start;
+      segment.p_align = PAGE_SIZE;
+
+      // guard pages and [vsyscall] can't be read, they only keep their place in the address space
+      segment.p_filesz = (map.Flags & MEMORY_MAP_READ) ? segment.p_memsz : 0;
+
+      offset += segment.p_filesz;
+   }
+
+   memcpy(header.e_ident, ELF_MAGIC, ELF_MAGIC_SIZE);
+   header.e_ident[ELF_CLASS] = ELF_CLASS_64BIT;
+   header.e_ident[ELF_DATA] = ELF_DATA_LSB;
+   header.e_ident[ELF_VERSION] = ELF_VERSION_CURRENT;
+   header.e_type = ELF_TYPE_CORE;
+   header.e_machine = ELF_MACHINE_X86_64;
+   header.e_version = ELF_VERSION_CURRENT;
+   header.e_phoff = sizeof(TElfHeader64);
+   header.e_ehsize = sizeof(TElfHeader64);
+   header.e_phentsize = sizeof(TElfProgramHeader64);
+   header.e_phnum = segments.size();
+
+   // more segments than e_phnum can hold, the real count goes into section header 0
+   TElfSectionHeader64 section = {};
+
+   if (segments.size() >= ELF_PN_XNUM)
+   {
+      header.e_phnum = ELF_PN_XNUM;
+      header.e_shoff = section_offset;
+      header.e_shentsize = sizeof(TElfSectionHeader64);
+      header.e_shnum = 1;
+      section.sh_info = segments.size();
+   }
+
+   mFd = open(Filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (mFd < 0)
+   {
+      sprintf(mError, "can't create %.80s: %s", Filename, strerror(errno));
+      return false;
+   }
+
+   bool result = WriteAt(&header, sizeof(header), 0) &&
+                 WriteAt(segments.data(), segments.size() * sizeof(TElfProgramHeader64), sizeof(header)) &&
+                 WriteAt(mNotes.data(), mNotes.size(), notes_offset) &&
+                 (header.e_shnum == 0 || WriteAt(&section, sizeof(section), section_offset));
+
+   if (result)
+   {
+      if (!mChunk)
+         mChunk = new u8[CHUNK_SIZE];
+
+      for (size_t i = 0; result && i < mMaps.size(); i++)
+      {
+         if (segments[i + 1].p_filesz)
+            result = CopySegment(mMaps[i], segments[i + 1].p_offset, Read, Context, Stats);
+      }
+   }
+
+   // the tail of the file may be a hole, the size has to be set explicitly
+   if (result && ftruncate(mFd, offset) < 0)
+   {
+      sprintf(mError, "can't set the file size: %s", strerror(errno));
+      result = false;
+   }
+
+   close(mFd);
+   mFd = -1;
+
+   Stats->Segments = mMaps.size();
+   Stats->FileBytes = offset;
+
+   return result;
+}
+
+void CCoreWriter::BuildNotes(pid_t Pid, int Signal, const TRegister* Registers, const user_fpregs_struct* FpRegisters)
+{
+   struct elf_prstatus status = {};
+   struct elf_prpsinfo info = {};
+   char                filename[64];
+
+   mNotes.clear();
+
+   status.pr_info.si_signo = Signal;
+   status.pr_cursig = Signal;
+   status.pr_pid = Pid;
+   status.pr_ppid = getpid();
+   status.pr_pgrp = getpgid(Pid);
+   status.pr_sid = getsid(Pid);
+
+   static_assert(sizeof(status.pr_reg) == sizeof(Registers->Reg), "TRegister has to match elf_gregset_t");
+   memcpy(&status.pr_reg, &Registers->Reg, sizeof(status.pr_reg));
+
+   AddNote(ELF_NOTE_PRSTATUS, &status, sizeof(status));
+
+   info.pr_state = 't';
+   info.pr_sname = 't';
+   info.pr_pid = Pid;
+   info.pr_ppid = getpid();
+   info.pr_pgrp = status.pr_pgrp;
+   info.pr_sid = status.pr_sid;
+
+   sprintf(filename, "/proc/%d/comm", Pid);
+   TBuffer comm = ReadEntireProcFile(filename);
+   if (comm.Data)
+   {
+      strncpy(info.pr_fname, (char*)comm.Data, sizeof(info.pr_fname) - 1);
+      free(comm.Data);
+   }
+
+   // the arguments are separated by terminators in cmdline, gdb shows them with spaces
+   sprintf(filename, "/proc/%d/cmdline", Pid);
+   TBuffer cmdline = ReadEntireProcFile(filename);
+   if (cmdline.Data)
+   {
+      u64 size = (cmdline.Size < sizeof(info.pr_psargs)) ? cmdline.Size : sizeof(info.pr_psargs) - 1;
+
+      memcpy(info.pr_psargs, cmdline.Data, size);
+      for (u64 i = 0; i + 1 < size; i++)
+      {
+         if (info.pr_psargs[i] == '\0')
+            info.pr_psargs[i] = ' ';
+      }
+      info.pr_psargs[size] = '\0';
+      free(cmdline.Data);
+   }
+
+   AddNote(ELF_NOTE_PRPSINFO, &info, sizeof(info));
+
+   if (FpRegisters)
+      AddNote(ELF_NOTE_FPREGSET, FpRegisters, sizeof(*FpRegisters));
+
+   sprintf(filename, "/proc/%d/auxv", Pid);
+   TBuffer auxv = ReadEntireProcFile(filename);
+   if (auxv.Data)
+   {
+      AddNote(ELF_NOTE_AUXV, auxv.Data, auxv.Size);
+      free(auxv.Data);
+   }
+
+   // NT_FILE: count, page size, a start/end/page offset triple per file, then the file names
+   std::vector<u64> files = { 0, PAGE_SIZE };
+   std::string      names;
+
+   for (const TMemoryMap& map : mMaps)
+   {
+      if (map.Path.empty() || map.Path[0] != '/')
+         continue;
+
+      files.push_back(map.Start);
+      files.push_back(map.End);
+      files.push_back(map.Offset / PAGE_SIZE);
+      names.append(map.Path.c_str(), map.Path.size() + 1);
+      files[0]++;
+   }
+
+   if (files[0])
+   {
+      std::vector<u8> data(files.size() * sizeof(u64) + names.size());
+
+      memcpy(data.data(), files.data(), files.size() * sizeof(u64));
+      memcpy(data.data() + files.size() * sizeof(u64), names.data(), names.size());
+      AddNote(ELF_NOTE_FILE, data.data(), data.size());
+   }
+}
+
+void CCoreWriter::AddNote(u32 Type, const void* Data, u32 Size)
+{
+   // every note is owned by "CORE" except a few linux specific ones we don't write
+   static const char name[8] = "CORE";
+   TElfNoteHeader    note = { 5, Size, Type };
+   size_t            start = mNotes.size();
+
+   mNotes.resize(start + sizeof(note) + sizeof(name) + AlignUp(Size, 4));
+
+   memcpy(&mNotes[start], &note, sizeof(note));
+   memcpy(&mNotes[start + sizeof(note)], name, sizeof(name));
+   memcpy(&mNotes[start + sizeof(note) + sizeof(name)], Data, Size);
+}
+
+bool CCoreWriter::WriteAt(const void* Data, u64 Size, u64 Offset)
+{
+   while (Size)
+   {
+      ssize_t written = pwrite(mFd, Data, Size, Offset);
+
+      if (written <= 0)
+      {
+         sprintf(mError, "write failed: %s", (written < 0) ? strerror(errno) : "disk full");
+         return false;
+      }
+
+      Data = (const u8*)Data + written;
+      Size -= written;
+      Offset += written;
+   }
+
+   return true;
+}
+
+bool CCoreWriter::CopySegment(const TMemoryMap& Map, u64 Offset, TReadMemoryFunc Read, void* Context, TCoreStats* Stats)
+{
+   for (u64 address = Map.Start; address < Map.End; )
+   {
+      u64 size = (Map.End - address < CHUNK_SIZE) ? Map.End - address : CHUNK_SIZE;
+      u64 bytes = Read(Context, address, mChunk, size);
+
+      // pages that can't be read, [vvar] or io mappings, go into the core as zeroes
+      if (bytes < size)
+         memset(mChunk + bytes, 0, size - bytes);
+
+      // write runs of non-zero pages, zero pages become holes
+      u64 run = 0;
+
+      for (u64 page = 0; page <= size; page += PAGE_SIZE)
+      {
+         if (page < size && !IsZeroPage(mChunk + page, PAGE_SIZE))
+            continue;
+
+         if (page > run && !WriteAt(mChunk + run, page - run, Offset + run))
+            return false;
+
+         Stats->WrittenBytes += page - run;
+         run = page + PAGE_SIZE;
+      }
+
+      Stats->MemoryBytes += size;
+      address += size;
+      Offset += size;
+   }
+
+   return true;
+}
+
+CCoreFile::CCoreFile()
+   : mData(nullptr),
+     mSize(0),
+     mSegments(),
+     mAuxv(),
+     mRegisters{},
+     mPid(0),
+     mSignal(0),
+     mCommandLine{}
+{
+}
+
+CCoreFile::~CCoreFile()
+{
+   Close();
+}
+
+bool CCoreFile::Open(const char* Filename)
+{
+   struct stat info;
+
+   Close();
+
+   int fd = open(Filename, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return false;
+
+   if (fstat(fd, &info) < 0 || (u64)info.st_size < sizeof(TElfHeader64))
+   {
+      close(fd);
+      return false;
+   }
+
+   void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (data == MAP_FAILED)
+      return false;
+
+   mData = (const u8*)data;
+   mSize = info.st_size;
+
+   const TElfHeader64* header = (const TElfHeader64*)mData;
+
+   if (memcmp(header->e_ident, ELF_MAGIC, ELF_MAGIC_SIZE) != 0 || header->e_ident[ELF_CLASS] != ELF_CLASS_64BIT ||
+       header->e_type != ELF_TYPE_CORE || header->e_machine != ELF_MACHINE_X86_64 ||
+       header->e_phentsize != sizeof(TElfProgramHeader64))
+   {
+      Close();
+      return false;
+   }
+
+   u64 count = header->e_phnum;
+
+   if (count == ELF_PN_XNUM && header->e_shoff && header->e_shoff + sizeof(TElfSectionHeader64) <= mSize)
+      count = ((const TElfSectionHeader64*)(mData + header->e_shoff))->sh_info;
+
+   if (header->e_phoff + count * sizeof(TElfProgramHeader64) > mSize)
+   {
+      Close();
+      return false;
+   }
+
+   const TElfProgramHeader64* segments = (const TElfProgramHeader64*)(mData + header->e_phoff);
+
+   for (u64 i = 0; i < count; i++)
+   {
+      const TElfProgramHeader64& segment = segments[i];
+
+      // a truncated core still has everything up to the end of the file
+      u64 file_size = 0;
+
+      if (segment.p_offset < mSize)
+         file_size = (segment.p_filesz < mSize - segment.p_offset) ? segment.p_filesz : mSize - segment.p_offset;
+
+      if (segment.p_type == ELF_SEGMENT_TYPE_NOTE)
+         ReadNotes(mData + segment.p_offset, file_size);
+      else if (segment.p_type == ELF_SEGMENT_TYPE_LOAD && segment.p_memsz)
+      {
+         if (file_size > segment.p_memsz)
+            file_size = segment.p_memsz;
+
+         mSegments.push_back({ segment.p_vaddr, segment.p_vaddr + segment.p_memsz, file_size, mData + segment.p_offset,
+                               segment.p_flags });
+      }
+   }
+
+   std::sort(mSegments.begin(), mSegments.end(), [](const TCoreSegment& a, const TCoreSegment& b) { return a.Start < b.Start; });
+
+   return true;
+}
+
+void CCoreFile::Close()
+{
+   if (mData)
+      munmap((void*)mData, mSize);
+
+   mData = nullptr;
+   mSize = 0;
+   mSegments.clear();
+   mAuxv.clear();
+   mRegisters = {};
+   mPid = 0;
+   mSignal = 0;
+   mCommandLine[0] = '\0';
+}
+
+void CCoreFile::ReadNotes(const u8* Notes, u64 Size)
+{
+   bool have_status = false;
+
+   for (u64 offset = 0; offset + sizeof(TElfNoteHeader) <= Size; )
+   {
+      const TElfNoteHeader* note = (const TElfNoteHeader*)(Notes + offset);
+      u64                   desc = offset + sizeof(TElfNoteHeader) + AlignUp(note->n_namesz, 4);
+
+      if (desc + note->n_descsz > Size)
+         break;
+
+      const u8* data = Notes + desc;
+
+      // every thread has an NT_PRSTATUS, the first one is the thread that took the signal
+      if (note->n_type == ELF_NOTE_PRSTATUS && !have_status && note->n_descsz >= sizeof(elf_prstatus))
+      {
+         const elf_prstatus* status = (const elf_prstatus*)data;
+
+         memcpy(&mRegisters.Reg, &status->pr_reg, sizeof(mRegisters.Reg));
+         mPid = status->pr_pid;
+         mSignal = status->pr_cursig;
+         have_status = true;
+      }
+      else if (note->n_type == ELF_NOTE_PRPSINFO && note->n_descsz >= sizeof(elf_prpsinfo))
+      {
+         const elf_prpsinfo* info = (const elf_prpsinfo*)data;
+
+         memcpy(mCommandLine, info->pr_psargs, sizeof(info->pr_psargs));
+         mCommandLine[sizeof(info->pr_psargs)] = '\0';
+      }
+      else if (note->n_type == ELF_NOTE_AUXV)
+      {
+         mAuxv.assign((const u64*)data, (const u64*)data + note->n_descsz / sizeof(u64));
+      }
+
+      offset = desc + AlignUp(note->n_descsz, 4);
+   }
+}
+
+const TCoreSegment* CCoreFile::FindSegment(u64 Address) const
+{
+   auto next = std::upper_bound(mSegments.begin(), mSegments.end(), Address,
+                                [](u64 address, const TCoreSegment& segment) { return address < segment.Start; });
+
+   if (next == mSegments.begin() || Address >= (next - 1)->End)
+      return nullptr;
+
+   return &*(next - 1);
+}
+
+const u8* CCoreFile::Find(u64 Address, u64* Available) const
+{
+   const TCoreSegment* segment = FindSegment(Address);
+
+   if (!segment || Address - segment->Start >= segment->FileSize)
+      return nullptr;
+
+   *Available = segment->FileSize - (Address - segment->Start);
+
+   return segment->Data + (Address - segment->Start);
+}
+
+u64 CCoreFile::Read(u64 Address, void* Buffer, u64 Size) const
+{
+   u64 bytes = 0;
+
+   // a read may run on into the next segment when the mappings were adjacent
+   while (bytes < Size)
+   {
+      u64       available;
+      const u8* data = Find(Address + bytes, &available);
+
+      if (!data)
+         break;
+
+      u64 count = (available < Size - bytes) ? available : Size - bytes;
+
+      memcpy((u8*)Buffer + bytes, data, count);
+      bytes += count;
+   }
+
+   return bytes;
+}
+
+u64 CCoreFile::GetAuxValue(u64 Type) const
+{
+   for (size_t i = 0; i + 1 < mAuxv.size() && mAuxv[i] != AUX_TYPE_NULL; i += 2)
+   {
+      if (mAuxv[i] == Type)
+         return mAuxv[i + 1];
+   }
+
+   return 0;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vector>
+#include <sys/user.h>
+#include "DebugTypes.h"
+#include "DebugUtils.h"
+#include "Unwinder.h"
+
+// ELF core file of a stopped process, the same layout the kernel and gcore write:
+//
+//   TElfHeader64
+//   program headers, one PT_NOTE then one PT_LOAD per mapping
+//   notes: NT_PRSTATUS, NT_PRPSINFO, NT_FPREGSET, NT_AUXV, NT_FILE
+//   section header 0, only with PN_XNUM or more program headers
+//   memory of each mapping, page aligned
+//
+// Memory is copied through one CHUNK_SIZE buffer, so a 20 GB process takes no more memory to
+// dump than a small one. Pages that are all zero are skipped with the file offset moving past
+// them, which leaves holes in the file instead of writing zeroes.
+//
+// Reading a core maps the file and keeps the PT_LOAD segments sorted by address, a memory
+// read is a binary search and a copy out of the mapping, nothing is loaded up front.
+
+#define ELF_VERSION_CURRENT 1 // e_version and e_ident[ELF_VERSION]
+#define ELF_DATA            5 // Data encoding byte index
+#define ELF_DATA_LSB        1 // 2's complement, little endian
+#define ELF_VERSION         6 // File version byte index
+#define ELF_MACHINE_X86_64  62
+#define ELF_PN_XNUM         0xffff // e_phnum when the count is in sh_info of section 0
+
+#define ELF_NOTE_PRSTATUS 1          // struct elf_prstatus
+#define ELF_NOTE_FPREGSET 2          // struct user_fpregs_struct
+#define ELF_NOTE_PRPSINFO 3          // struct elf_prpsinfo
+#define ELF_NOTE_AUXV     6          // contents of /proc/pid/auxv
+#define ELF_NOTE_FILE     0x46494c45 // mapped files
+
+struct TElfNoteHeader
+{
+   u32 n_namesz; // name size including the terminator
+   u32 n_descsz; // descriptor size
+   u32 n_type;
+};
+
+struct TCoreStats
+{
+   u64 Segments;
+   u64 MemoryBytes;  // size of every dumped mapping
+   u64 WrittenBytes; // bytes actually written, the rest are holes
+   u64 FileBytes;
+};
+
+class CCoreWriter
+{
+public:
+
+   static constexpr u32 CHUNK_SIZE = 4 * 1024 * 1024;
+
+   CCoreWriter();
+   ~CCoreWriter();
+
+   // Signal is the signal the thread stopped with, Registers and FpRegisters its state,
+   // FpRegisters may be null. Memory is read through Read so the caller can hide its
+   // breakpoints.
+   bool Write(const char* Filename, pid_t Pid, int Signal, const TRegister* Registers,
+              const user_fpregs_struct* FpRegisters, TReadMemoryFunc Read, void* Context, TCoreStats* Stats);
+
+   const char* GetError() const { return mError; }
+
+private:
+
+   void BuildNotes(pid_t Pid, int Signal, const TRegister* Registers, const user_fpregs_struct* FpRegisters);
+   void AddNote(u32 Type, const void* Data, u32 Size);
+   bool WriteAt(const void* Data, u64 Size, u64 Offset);
+   bool CopySegment(const TMemoryMap& Map, u64 Offset, TReadMemoryFunc Read, void* Context, TCoreStats* Stats);
+
+   std::vector<TMemoryMap> mMaps;
+   std::vector<u8>         mNotes;
+   u8*                     mChunk;
+   int                     mFd;
+   char                    mError[128];
+};
+
+// PT_LOAD segment of a mapped core, bytes past FileSize up to End weren't dumped, the kernel
+// leaves out the text of mapped files that way
+struct TCoreSegment
+{
+   u64       Start;
+   u64       End;
+   u64       FileSize;
+   const u8* Data;
+   u32       Flags;    // ELF_SEGMENT_FLAG_*
+};
+
+class CCoreFile
+{
+public:
+
+   CCoreFile();
+   ~CCoreFile();
+
+   bool Open(const char* Filename);
+   void Close();
+
+   bool IsOpen() const { return mData != nullptr; }
+
+   // bytes at Address straight out of the mapping, Available is how many of them follow in
+   // the file, null when Address isn't in the file
+   const u8* Find(u64 Address, u64* Available) const;
+
+   // copies memory up to the first byte that isn't in the file, returns the bytes copied
+   u64 Read(u64 Address, void* Buffer, u64 Size) const;
+
+   const TCoreSegment* FindSegment(u64 Address) const;
+   const std::vector<TCoreSegment>& GetSegments() const { return mSegments; }
+
+   // state of the first thread, the one that took the signal
+   const TRegister* GetRegisters() const { return &mRegisters; }
+   pid_t GetPid() const { return mPid; }
+   int GetSignal() const { return mSignal; }
+   const char* GetCommandLine() const { return mCommandLine; }
+   u64 GetAuxValue(u64 Type) const;
+
+private:
+
+   void ReadNotes(const u8* Notes, u64 Size);
+
+   const u8*                 mData;
+   u64                       mSize;
+   std::vector<TCoreSegment> mSegments;
+   std::vector<u64>          mAuxv;
+   TRegister                 mRegisters;
+   pid_t                     mPid;
+   int                       mSignal;
+   char                      mCommandLine[81];
+};
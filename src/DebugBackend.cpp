@@ -10,13 +10,22 @@
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <unordered_map>
 #include "DebugBackend.h"
 #include "DebugUtils.h"
 
 #define PTRACE(Request, Pid, Addr, Data) ({ \
    long retval = 0; \
    errno = 0; \
-   retval = ptrace(Request, Pid, Addr, Data); \
+   retval = Ptrace(Request, Pid, Addr, Data); \
    if (errno) \
    { \
       char msg[256]; \
@@ -28,6 +37,89 @@
 
 const char* TargetOutputStr = "tmpOutput";
 
+const char* DebugCommandStr[] =
+{
+   "unknown",
+   "continue",
+   "interrupt",
+   "set_breakpoint",
+   "delete_breakpoint",
+   "enable_breakpoint",
+   "disable_breakpoint",
+   "list_breakpoints",
+   "step_over",
+   "step_into",
+   "step_single",
+   "register_read",
+   "register_read_all",
+   "register_write",
+   "data_read",
+   "get_target",
+   "set_target",
+   "run",
+   "start",
+   "stop",
+   "quit",
+   "attach",
+   "backtrace",
+   "disassemble",
+   "next_instruction",
+   "finish",
+   "step_until",
+   "trace_blocks",
+   "stats",
+   "record",
+   "replay",
+   "checkpoint",
+   "restore_checkpoint",
+   "delete_checkpoint",
+   "list_checkpoints",
+   "generate_core",
+   "list_libraries",
+   "find",
+   "snapshot",
+   "diff",
+   "set_watchpoint",
+   "delete_watchpoint",
+   "list_watchpoints",
+   "call",
+   "profile",
+   "processed"
+};
+
+static_assert(ArrayCount(DebugCommandStr) == DEBUG_CMD_COUNT, "a command is missing a name");
+
+// ptrace requests counted separately in the stats, the rest go into the last counter
+static const struct
+{
+   int         Request;
+   const char* Name;
+} PtraceRequests[] =
+{
+   { PTRACE_TRACEME,     "traceme" },
+   { PTRACE_PEEKTEXT,    "peektext" },
+   { PTRACE_PEEKDATA,    "peekdata" },
+   { PTRACE_POKETEXT,    "poketext" },
+   { PTRACE_POKEDATA,    "pokedata" },
+   { PTRACE_CONT,        "cont" },
+   { PTRACE_KILL,        "kill" },
+   { PTRACE_SINGLESTEP,  "singlestep" },
+   { PTRACE_SINGLEBLOCK, "singleblock" },
+   { PTRACE_GETREGS,     "getregs" },
+   { PTRACE_SETREGS,     "setregs" },
+   { PTRACE_GETFPREGS,   "getfpregs" },
+   { PTRACE_SETFPREGS,   "setfpregs" },
+   { PTRACE_ATTACH,      "attach" },
+   { PTRACE_DETACH,      "detach" },
+   { PTRACE_SETOPTIONS,  "setoptions" },
+   { PTRACE_GETEVENTMSG, "geteventmsg" },
+   { PTRACE_GETSIGINFO,  "getsiginfo" },
+   { PTRACE_SEIZE,       "seize" },
+   { PTRACE_INTERRUPT,   "interrupt" },
+};
+
+static_assert(ArrayCount(PtraceRequests) < PTRACE_STATS, "PTRACE_STATS is too small");
+
 const char* RegisterStr[] =
 {
    "r15",
@@ -68,21 +160,64 @@ void SigHandler(int Signal)
 
 CDebugBackend::CDebugBackend()
    : mTarget(),
+     mLaunch(),
      mThread(),
      mMutex(),
+     mWakeMutex(),
+     mWake(),
+     mProcessed(),
      mBreakpoints(),
-     mTargetData{},
+     mTemporaryBreakpoints(),
+     mCheckpoints(),
+     mElf(),
+     mUnwinder(),
+     mInstructionCache(),
+     mLineTable(),
+     mTraceReader(),
+     mCore(),
+     mAddressSpace(),
+     mSearch(),
+     mSearchMaps(),
+     mSnapshot(),
+     mProfile(),
+     mWatchpoints(),
+     mWatchedPages(),
+     mLibraries(),
+     mTraceFilename(),
+     mRegisters{},
+     mSignalInfo{},
+     mStepStats{},
+     mStats{},
      mOutputBuffer(nullptr),
      mBufferIndex(0),
+     mLoadBias(0),
+     mCodeRangesGeneration(0),
+     mRendezvousAddress(0),
+     mDebugAddress(0),
+     mRendezvousStops(0),
+     mRendezvousSavedData(0),
+     mWatchFaults(0),
+     mWatchMisses(0),
+     mWatchSeconds(0.0),
      mChildPid(0),
+     mStandbyPid(0),
+     mMemoryPid(0),
      mBreakpointHit(-1),
      mWaitStatus(0),
      mOutputFd(0),
+     mMemoryFd(-1),
      mCommand{},
+     mCommandStart(),
      mRunning(false),
-     mTargetRunning(false)
+     mWakePending(false),
+     mTargetRunning(false),
+     mRegistersValid(false),
+     mBlockStepSupported(true),
+     mBlockStepVerified(false)
 {
    mBreakpoints.reserve(64);
+   mTemporaryBreakpoints.reserve(64);
+   mUnwinder.SetMemoryReader(ReadMemoryCallback, this);
 }
 
 CDebugBackend::~CDebugBackend()
@@ -91,25 +226,236 @@ CDebugBackend::~CDebugBackend()
 
 u64 CDebugBackend::GetData(u64 Address)
 {
+   if (mCore.IsOpen())
+   {
+      u64 data = 0;
+
+      errno = (ReadCoreMemory(Address, &data, sizeof(data)) == sizeof(data)) ? 0 : EIO;
+      return data;
+   }
+
    u64 data = PTRACE(PTRACE_PEEKDATA, mChildPid, Address, nullptr);
 
+   mStats.BytesRead += sizeof(data);
+
    return data;
 }
 
 void CDebugBackend::SetData(u64 Address, u64 Value)
 {
+   // a core is read only, breakpoints are only kept in the list until the target runs
+   if (mCore.IsOpen())
+      return;
+
    PTRACE(PTRACE_POKEDATA, mChildPid, Address, Value);
+   mStats.BytesWritten += sizeof(Value);
+
+   // every write to text goes through here, breakpoints included
+   mInstructionCache.Invalidate(Address, sizeof(u64));
+}
+
+u64 CDebugBackend::ReadMemory(u64 Address, void* Buffer, u64 Size)
+{
+   ssize_t bytes = 0;
+   u64     readable = Size;
+
+   if (mCore.IsOpen())
+   {
+      bytes = ReadCoreMemory(Address, Buffer, Size);
+      mStats.BytesRead += bytes;
+      return bytes;
+   }
+
+   UpdateAddressSpace();
+
+   // nothing past the mapped part of the range is attempted, and only the readable part
+   // in front goes to process_vm_readv
+   if (mAddressSpace.IsValid())
+   {
+      Size = mAddressSpace.GetExtent(Address, Size, 0);
+      readable = mAddressSpace.GetExtent(Address, Size, MEMORY_MAP_READ);
+   }
+
+   if (readable)
+   {
+      struct iovec local = { Buffer, readable };
+      struct iovec remote = { (void*)Address, readable };
+
+      // one syscall for the whole range instead of a PEEKDATA per word
+      bytes = process_vm_readv(mChildPid, &local, 1, &remote, 1, 0);
+
+      if (bytes < 0)
+         bytes = 0;
+   }
+
+   if ((u64)bytes == Size)
+   {
+      mStats.BytesRead += Size;
+      return Size;
+   }
+
+   // process_vm_readv refuses pages without read permission, /proc/pid/mem goes through
+   // the tracer's access and reads those too
+   if (mMemoryPid != mChildPid)
+   {
+      char filename[64];
+
+      if (mMemoryFd != -1)
+         close(mMemoryFd);
+
+      sprintf(filename, "/proc/%d/mem", mChildPid);
+      mMemoryFd = open(filename, O_RDONLY | O_CLOEXEC);
+      mMemoryPid = mChildPid;
+   }
+
+   if (mMemoryFd != -1)
+   {
+      ssize_t remaining = pread(mMemoryFd, (u8*)Buffer + bytes, Size - bytes, Address + bytes);
+
+      if (remaining > 0)
+         bytes += remaining;
+   }
+
+   mStats.BytesRead += bytes;
+
+   return bytes;
+}
+
+u64 CDebugBackend::ReadCoreMemory(u64 Address, void* Buffer, u64 Size) const
+{
+   u32                        count;
+   const TElfProgramHeader64* segments = mElf.GetProgramHeaders(&count);
+   TBuffer                    image = mElf.GetImage();
+   u64                        bytes = 0;
+
+   while (bytes < Size)
+   {
+      u64 copied = mCore.Read(Address + bytes, (u8*)Buffer + bytes, Size - bytes);
+
+      // the kernel leaves the text of mapped files out of the core, it comes from the executable
+      if (copied == 0)
+      {
+         u64 address = Address + bytes - mLoadBias;
+
+         for (u32 i = 0; segments && i < count; i++)
+         {
+            if (segments[i].p_type != ELF_SEGMENT_TYPE_LOAD || address < segments[i].p_vaddr ||
+                address >= segments[i].p_vaddr + segments[i].p_filesz ||
+                segments[i].p_offset + segments[i].p_filesz > image.Size)
+               continue;
+
+            copied = segments[i].p_vaddr + segments[i].p_filesz - address;
+            if (copied > Size - bytes)
+               copied = Size - bytes;
+
+            memcpy((u8*)Buffer + bytes, image.Data + segments[i].p_offset + (address - segments[i].p_vaddr), copied);
+            break;
+         }
+      }
+
+      if (copied == 0)
+         break;
+
+      bytes += copied;
+   }
+
+   return bytes;
+}
+
+u64 CDebugBackend::ReadMemoryCallback(void* Context, u64 Address, void* Buffer, u64 Size)
+{
+   return ((CDebugBackend*)Context)->ReadMemory(Address, Buffer, Size);
+}
+
+u64 CDebugBackend::ReadCode(u64 Address, void* Buffer, u64 Size)
+{
+   u64 bytes = ReadMemory(Address, Buffer, Size);
+
+   HideBreakpoints(Address, Buffer, bytes);
+
+   return bytes;
+}
+
+// show the original instruction bytes instead of our int3 patches
+void CDebugBackend::HideBreakpoints(u64 Address, void* Buffer, u64 Size) const
+{
+   for (size_t i = 0; i < mBreakpoints.size(); i++)
+   {
+      if (mBreakpoints[i].Enabled && mBreakpoints[i].Address >= Address && mBreakpoints[i].Address < Address + Size)
+         ((u8*)Buffer)[mBreakpoints[i].Address - Address] = mBreakpoints[i].SavedData;
+   }
+
+   for (size_t i = 0; i < mTemporaryBreakpoints.size(); i++)
+   {
+      const TTemporaryBreakpoint& bp = mTemporaryBreakpoints[i];
+
+      if (bp.Inserted && bp.Address >= Address && bp.Address < Address + Size)
+         ((u8*)Buffer)[bp.Address - Address] = bp.SavedData;
+   }
+}
+
+// called from the search workers, all at once, so nothing here may touch the address space
+// or the /proc/pid/mem descriptor
+u64 CDebugBackend::ReadSearchMemory(u64 Address, void* Buffer, u64 Size) const
+{
+   ssize_t bytes;
+
+   if (mCore.IsOpen())
+   {
+      bytes = ReadCoreMemory(Address, Buffer, Size);
+   }
+   else
+   {
+      struct iovec local = { Buffer, Size };
+      struct iovec remote = { (void*)Address, Size };
+
+      bytes = process_vm_readv(mChildPid, &local, 1, &remote, 1, 0);
+
+      if (bytes < 0)
+         bytes = 0;
+   }
+
+   HideBreakpoints(Address, Buffer, bytes);
+
+   return bytes;
+}
+
+u64 CDebugBackend::ReadSearchCallback(void* Context, u64 Address, void* Buffer, u64 Size)
+{
+   return ((CDebugBackend*)Context)->ReadSearchMemory(Address, Buffer, Size);
+}
+
+u64 CDebugBackend::ReadCodeCallback(void* Context, u64 Address, void* Buffer, u64 Size)
+{
+   return ((CDebugBackend*)Context)->ReadCode(Address, Buffer, Size);
+}
+
+const TInstruction* CDebugBackend::DecodeAt(u64 Address, TInstruction* Scratch)
+{
+   const TInstruction* inst = mInstructionCache.Find(Address);
+
+   if (inst)
+      return inst;
+
+   u8  code[MAX_INSTRUCTION_LENGTH];
+   u64 bytes = ReadCode(Address, code, sizeof(code));
+
+   if (bytes == 0)
+      return nullptr;
+
+   // an instruction cut short by the end of the mapping decodes as invalid, don't keep those
+   if (!CDecoder::Decode(code, bytes, Address, Scratch) && bytes < sizeof(code))
+      return Scratch;
+
+   return mInstructionCache.Insert(Scratch);
 }
 
 u64 CDebugBackend::GetRegister(eRegister Register)
 {
    TRegister registers;
    u64       result = 0;
-   long      status;
 
-   status = PTRACE(PTRACE_GETREGS, mChildPid, nullptr, &registers.Reg);
-
-   if (status != -1)
+   if (GetRegisters(&registers))
    {
       result = registers.RegArray[Register];
    }
@@ -119,17 +465,26 @@ u64 CDebugBackend::GetRegister(eRegister Register)
 
 bool CDebugBackend::GetRegisters(TRegister* Registers)
 {
-   bool result = false;
-   long status;
-
-   status = PTRACE(PTRACE_GETREGS, mChildPid, nullptr, &Registers->Reg);
+   if (mCore.IsOpen())
+   {
+      *Registers = *mCore.GetRegisters();
+      return true;
+   }
 
-   if (status != -1)
+   // registers only change when the target runs, so one GETREGS per stop is enough
+   if (!mRegistersValid)
    {
-      result = true;
+      long status = PTRACE(PTRACE_GETREGS, mChildPid, nullptr, &mRegisters.Reg);
+
+      if (status == -1)
+         return false;
+
+      mRegistersValid = true;
    }
 
-   return result;
+   *Registers = mRegisters;
+
+   return true;
 }
 
 bool CDebugBackend::SetRegister(eRegister Register, u64 Value)
@@ -138,15 +493,18 @@ bool CDebugBackend::SetRegister(eRegister Register, u64 Value)
    bool      result = false;
    long      status;
 
-   status = PTRACE(PTRACE_GETREGS, mChildPid, nullptr, &registers.Reg);
-
-   if (status != -1)
+   if (GetRegisters(&registers))
    {
       registers.RegArray[Register] = Value;
 
       status = PTRACE(PTRACE_SETREGS, mChildPid, nullptr, &registers.Reg);
 
       result = (status != -1);
+
+      if (result)
+         mRegisters = registers;
+      else
+         mRegistersValid = false;
    }
 
    return result;
@@ -156,6 +514,16 @@ void CDebugBackend::AddBreakpoint(u64 Address)
 {
    TBreakpoint bp = {};
 
+   UpdateAddressSpace();
+
+   if (!mCore.IsOpen() && mAddressSpace.IsValid() && !mAddressSpace.Find(Address))
+   {
+      char msg[256];
+      sprintf(msg, "Can't set a breakpoint at 0x%lx, nothing is mapped there", Address);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
    u64 data = GetData(Address);
 
    if (errno == 0)
@@ -253,440 +621,3885 @@ int CDebugBackend::CheckBreakpoints()
    return -1;
 }
 
-void CDebugBackend::Continue()
+void CDebugBackend::Backtrace(eUnwindMode Mode, int MaxFrames)
 {
-   if (mBreakpointHit != -1)
-      StepOverBreakpoint();
+   static TFrame frames[MAX_FRAMES];
+   TRegister     registers;
+   char          msg[256];
+   int           count;
 
-   PTRACE(PTRACE_CONT, mChildPid, nullptr, nullptr);
+   if (MaxFrames <= 0 || MaxFrames > (int)MAX_FRAMES)
+      MaxFrames = MAX_FRAMES;
 
-   Wait();
+   if (!GetRegisters(&registers))
+   {
+      sprintf(msg, "Failed to read registers");
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   RefreshCodeRanges();
+
+   auto start = std::chrono::steady_clock::now();
+   if (Mode == UNWIND_MODE_FRAME_POINTER)
+      count = mUnwinder.UnwindFramePointer(&registers, frames, MaxFrames);
+   else
+      count = mUnwinder.Unwind(&registers, frames, MaxFrames);
+   auto end = std::chrono::steady_clock::now();
+
+   for (int i = 0; i < count; i++)
+   {
+      u64               offset;
+      const TElfSymbol* symbol = FindSymbol(frames[i].Pc, &offset);
+      const char*       method = "";
+
+      // show which frames the fast path had to hand over to CFI
+      if (Mode == UNWIND_MODE_FRAME_POINTER && frames[i].Type == FRAME_TYPE_CFI)
+         method = " [cfi]";
+
+      if (symbol)
+         sprintf(msg, "#%-3d 0x%016lx in %s+0x%lx%s", i, frames[i].Pc, symbol->Name, offset, method);
+      else
+         sprintf(msg, "#%-3d 0x%016lx in ??%s", i, frames[i].Pc, method);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+
+   f64 elapsed_us = std::chrono::duration<f64, std::micro>(end - start).count();
+   sprintf(msg, "Backtrace (%s): %d frames in %.1f us (%lu cached unwind rules)",
+           (Mode == UNWIND_MODE_FRAME_POINTER) ? "frame pointer" : "cfi", count, elapsed_us, mUnwinder.GetCachedRules());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
 }
 
-void CDebugBackend::StepSingle()
+void CDebugBackend::Disassemble(u64 Address, int Count)
 {
-   if (mBreakpointHit != -1)
+   TInstruction scratch;
+   char         msg[256];
+
+   if (Count <= 0 || Count > (int)MAX_INSTRUCTIONS)
+      Count = MAX_INSTRUCTIONS;
+
+   if (Address == 0)
    {
-      StepOverBreakpoint();
+      TRegister registers;
+
+      if (!GetRegisters(&registers))
+      {
+         sprintf(msg, "Failed to read registers");
+         PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         return;
+      }
+
+      Address = registers.RegArray[REGISTER_RIP];
    }
 
-   PTRACE(PTRACE_SINGLESTEP, mChildPid, nullptr, nullptr);
-   
-   Wait();
+   for (int i = 0; i < Count; i++)
+   {
+      const TInstruction* inst = DecodeAt(Address, &scratch);
+      char                bytes[3 * MAX_INSTRUCTION_LENGTH + 1] = {};
+      char                mnemonic[64];
+      int                 length = 0;
+
+      if (!inst)
+      {
+         sprintf(msg, "Failed to read memory at 0x%lx", Address);
+         PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         return;
+      }
+
+      for (u32 b = 0; b < inst->Length; b++)
+         sprintf(&bytes[b * 3], "%02x ", inst->Bytes[b]);
+
+      CDecoder::GetMnemonic(inst, mnemonic, sizeof(mnemonic));
+      length = sprintf(msg, "0x%016lx: %-30s %s", Address, bytes, mnemonic);
+
+      if (inst->Target)
+      {
+         u64               offset;
+         const TElfSymbol* symbol = FindSymbol(inst->Target, &offset);
+
+         if (symbol && offset == 0)
+            sprintf(&msg[length], " 0x%lx <%s>", inst->Target, symbol->Name);
+         else if (symbol)
+            sprintf(&msg[length], " 0x%lx <%s+0x%lx>", inst->Target, symbol->Name, offset);
+         else
+            sprintf(&msg[length], " 0x%lx", inst->Target);
+      }
+
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+      Address += inst->Length;
+   }
 }
 
-void CDebugBackend::StepOverBreakpoint()
+void CDebugBackend::UpdateAddressSpace()
 {
-   assert(mBreakpointHit >= 0 && mBreakpointHit < mBreakpoints.size());
+   // checkpoints and restarts switch to another process
+   if (mAddressSpace.GetPid() != mChildPid)
+      mAddressSpace.SetPid(mChildPid);
 
-   int bp = mBreakpointHit;
+   mAddressSpace.Update();
+}
 
-   u64 data = (GetData(mBreakpoints[mBreakpointHit].Address) & ~0xff) | mBreakpoints[mBreakpointHit].SavedData;
-   SetData(mBreakpoints[mBreakpointHit].Address, data);
+void CDebugBackend::RefreshCodeRanges()
+{
+   std::vector<TCodeRange> ranges;
 
-   mBreakpointHit = -1;
-   StepSingle();
+   if (mCore.IsOpen())
+   {
+      for (const TCoreSegment& segment : mCore.GetSegments())
+      {
+         if (segment.Flags & ELF_SEGMENT_FLAG_X)
+            ranges.push_back({ segment.Start, segment.End });
+      }
 
-   // re-enable breakpoint
-   u64 data_w_int = ((GetData(mBreakpoints[bp].Address) & ~0xff) | SW_INTERRUPT_3);
-   SetData(mBreakpoints[bp].Address, data_w_int);
+      mUnwinder.SetCodeRanges(ranges);
+      mCodeRangesGeneration = 0;
+      return;
+   }
+
+   UpdateAddressSpace();
+
+   if (mAddressSpace.GetGeneration() == mCodeRangesGeneration)
+      return;
+
+   mCodeRangesGeneration = mAddressSpace.GetGeneration();
+
+   for (const TMemoryMap& map : mAddressSpace.GetMaps())
+   {
+      if (map.Flags & MEMORY_MAP_EXEC)
+         ranges.push_back({ map.Start, map.End });
+   }
+
+   mUnwinder.SetCodeRanges(ranges);
 }
 
-void CDebugBackend::SetCommand(TDebugCommand Command)
+const TElfSymbol* CDebugBackend::FindSymbol(u64 Address, u64* Offset)
 {
-   mMutex.lock();
-   mCommand = Command;
+   const TElfSymbol* symbol = mElf.FindSymbol(Address - mLoadBias);
 
-   if (mCommand.Command == DEBUG_CMD_QUIT)
+   if (symbol)
    {
-      mRunning = false;
-      if (mThread.joinable())
-         mThread.join();
-      mCommand.Command = DEBUG_CMD_PROCESSED;
+      *Offset = Address - mLoadBias - symbol->Address;
+      return symbol;
    }
-   else if (mCommand.Command == DEBUG_CMD_ATTACH)
+
+   auto next = std::upper_bound(mLibraries.begin(), mLibraries.end(), Address,
+                                [](u64 address, const TSharedLibrary& library) { return address < library.Start; });
+
+   if (next == mLibraries.begin() || Address >= (next - 1)->End)
+      return nullptr;
+
+   TSharedLibrary& library = *(next - 1);
+
+   if (!GetLibraryElf(library))
+      return nullptr;
+
+   symbol = library.Elf->FindSymbol(Address - library.Bias);
+   if (symbol)
+      *Offset = Address - library.Bias - symbol->Address;
+
+   return symbol;
+}
+
+// Where function Name is in the target, the executable first and then the libraries in load order
+bool CDebugBackend::FindSymbolAddress(const char* Name, u64* Address)
+{
+   const TElfSymbol* symbol = mElf.FindSymbol(Name);
+
+   if (symbol)
    {
-      mRunning = false;
-      if (mThread.joinable())
-         mThread.join();
-      Attach(mCommand.Data.Pid.Value);
-      // {
-      //    char msg[256];
-      //    sprintf(msg, "Could not attach to %d, starting debug on target %s", mCommand.Data.Pid.Value, mTarget.c_str());
-      //    PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
-      //    Run(mTarget.c_str());
-      // }
-      mCommand.Command = DEBUG_CMD_PROCESSED;
+      *Address = symbol->Address + mLoadBias;
+      return true;
    }
-   mMutex.unlock();
+
+   for (size_t i = 0; i < mLibraries.size(); i++)
+   {
+      if (GetLibraryElf(mLibraries[i]) && (symbol = mLibraries[i].Elf->FindSymbol(Name)))
+      {
+         *Address = symbol->Address + mLibraries[i].Bias;
+         return true;
+      }
+   }
+
+   return false;
 }
 
-void CDebugBackend::HandleCommand()
+// symbols are read the first time anything in the library needs a name
+CElfFile* CDebugBackend::GetLibraryElf(TSharedLibrary& Library)
 {
-   char msg[256];
+   if (!Library.Elf && !Library.Failed)
+   {
+      Library.Elf.reset(new CElfFile());
 
-   switch (mCommand.Command)
+      if (!Library.Elf->Open(Library.Path.c_str()))
+      {
+         Library.Elf.reset();
+         Library.Failed = true;
+      }
+   }
+
+   return Library.Elf.get();
+}
+
+void CDebugBackend::FindRendezvous()
+{
+   char filename[64];
+   u64  base = 0;
+
+   sprintf(filename, "/proc/%d/auxv", mChildPid);
+
+   TBuffer auxv = ReadEntireProcFile(filename);
+   const u64* entries = (const u64*)auxv.Data;
+
+   for (u64 i = 0; entries && i + 1 < auxv.Size / sizeof(u64) && entries[i] != AUX_TYPE_NULL; i += 2)
    {
-      case DEBUG_CMD_CONTINUE:
-         if (!mTargetRunning)
-         {
-            sprintf(msg, "Target is not running");
-            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-         }
-         else
-            Continue();
-         break;
-      case DEBUG_CMD_RUN:
-         if (mTarget.length() == 0)
-         {
-            sprintf(msg, "No Target is defined");
-            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
-         }
-         else if (mTargetRunning)
-         {
-            sprintf(msg, "Target is already running, pid %d", mChildPid);
-            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-         }
-         else
+      if (entries[i] == AUX_TYPE_BASE)
+         base = entries[i + 1];
+   }
+
+   free(auxv.Data);
+
+   // static executables have no dynamic linker and no libraries
+   if (!base)
+      return;
+
+   UpdateAddressSpace();
+
+   const TMemoryMap* map = mAddressSpace.Find(base);
+   CElfFile          interpreter;
+
+   if (!map || !interpreter.Open(map->Path.c_str()))
+      return;
+
+   const TElfSymbol* symbol = interpreter.FindSymbol("_dl_debug_state");
+
+   if (symbol)
+      mRendezvousAddress = base + symbol->Address;
+}
+
+void CDebugBackend::UpdateLibraries()
+{
+   TRendezvous rendezvous;
+
+   // DT_DEBUG is filled in by the dynamic linker before it loads anything
+   if (!mDebugAddress)
+   {
+      u32                        count;
+      const TElfProgramHeader64* segments = mElf.GetProgramHeaders(&count);
+
+      for (u32 i = 0; segments && i < count && !mDebugAddress; i++)
+      {
+         if (segments[i].p_type != ELF_SEGMENT_TYPE_DYNAMIC)
+            continue;
+
+         for (u64 address = segments[i].p_vaddr + mLoadBias; ; address += sizeof(TElfDynamic64))
          {
-            if (WIFEXITED(mWaitStatus))
+            TElfDynamic64 entry;
+
+            if (ReadMemory(address, &entry, sizeof(entry)) != sizeof(entry) || entry.d_tag == ELF_DYNAMIC_NULL)
+               break;
+
+            if (entry.d_tag == ELF_DYNAMIC_DEBUG)
             {
-               StartTarget();
+               mDebugAddress = entry.d_val;
+               break;
             }
-            mTargetRunning = true;
-            Continue();
-         }
-         break;
-      case DEBUG_CMD_STEP_SINGLE:
-         if (!mTargetRunning)
-         {
-            sprintf(msg, "Target is not running");
-            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
          }
-         else
-            StepSingle();
-         break;
-      case DEBUG_CMD_LIST_BREAKPOINTS:
-         ListBreakpoints();
-         break;
-      case DEBUG_CMD_SET_BREAKPOINT:
-         AddBreakpoint(mCommand.Data.BpAddr.Address);
-         break;
-      case DEBUG_CMD_DELETE_BREAKPOINT:
-         DeleteBreakpoint(mCommand.Data.BpIdx.Index);
-         break;
-      case DEBUG_CMD_ENABLE_BREAKPOINT:
-         EnableBreakpoint(mCommand.Data.BpIdx.Index);
-         break;
-      case DEBUG_CMD_DISABLE_BREAKPOINT:
-         DisableBreakpoint(mCommand.Data.BpIdx.Index);
+      }
+
+      if (!mDebugAddress)
+         return;
+   }
+
+   // the list is only walked once the dynamic linker is done changing it
+   if (ReadMemory(mDebugAddress, &rendezvous, sizeof(rendezvous)) != sizeof(rendezvous) ||
+       rendezvous.State != RENDEZVOUS_CONSISTENT)
+      return;
+
+   // attached to a running target, the dynamic linker tells where to stop
+   if (!mRendezvousAddress && !mCore.IsOpen())
+      mRendezvousAddress = rendezvous.Break;
+
+   // libraries already in the list are moved over as they are, only new link_map entries
+   // have their name and headers read, so loading one more plugin costs one small read per
+   // loaded object
+   std::unordered_map<u64, size_t> known;
+   std::vector<TSharedLibrary>     libraries;
+   TLinkMap                        map;
+
+   for (size_t i = 0; i < mLibraries.size(); i++)
+      known[mLibraries[i].LinkMap] = i;
+
+   libraries.reserve(mLibraries.size() + 1);
+
+   u32 count = 0;
+
+   for (u64 node = rendezvous.Map; node && count < MAX_LIBRARIES; node = map.Next, count++)
+   {
+      if (ReadMemory(node, &map, sizeof(map)) != sizeof(map))
          break;
-      case DEBUG_CMD_REGISTER_READ:
+
+      auto found = known.find(node);
+
+      if (found != known.end() && mLibraries[found->second].Bias == map.Address)
       {
-         sprintf(msg, "Register %s contents: 0x%x", RegisterStr[mCommand.Data.Reg.Index], GetRegister((eRegister)mCommand.Data.Reg.Index));
-         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-         break;
+         libraries.push_back(std::move(mLibraries[found->second]));
+         continue;
       }
-      case DEBUG_CMD_REGISTER_READ_ALL:
+
+      char name[PATH_MAX];
+      u64  length = ReadMemory(map.Name, name, sizeof(name) - 1);
+
+      name[length] = '\0';
+
+      // the executable is the first entry and has no name
+      if (!map.Name || name[0] == '\0')
+         continue;
+
+      TSharedLibrary library = { node, map.Address, 0, 0, name, nullptr, false };
+      TElfHeader64   header;
+
+      // the headers are mapped at the start of the first segment, which is at the bias for
+      // anything linked at 0
+      if (ReadMemory(map.Address, &header, sizeof(header)) == sizeof(header) &&
+          memcmp(header.e_ident, ELF_MAGIC, ELF_MAGIC_SIZE) == 0 && header.e_phnum <= 64 &&
+          header.e_phentsize == sizeof(TElfProgramHeader64))
       {
-         TRegister registers;
+         TElfProgramHeader64 segments[64];
+         u64                 size = header.e_phnum * sizeof(TElfProgramHeader64);
 
-         if (GetRegisters(&registers))
-         {
-            PushData(DATA_TYPE_REGISTERS, (u8*)&registers, sizeof(TRegister));
-         }
-         else
+         if (ReadMemory(map.Address + header.e_phoff, segments, size) == size)
          {
-            sprintf(msg, "Failed to read registers");
-            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+            for (u32 i = 0; i < header.e_phnum; i++)
+            {
+               if (segments[i].p_type != ELF_SEGMENT_TYPE_LOAD)
+                  continue;
+
+               u64 start = map.Address + segments[i].p_vaddr;
+               u64 end = start + segments[i].p_memsz;
+
+               library.Start = (library.Start && library.Start < start) ? library.Start : start;
+               library.End = (library.End > end) ? library.End : end;
+            }
          }
-         break;
       }
-      case DEBUG_CMD_REGISTER_WRITE:
-      {
-         // if writing to instruction pointer, clear breakpoint hit index
-         if (mCommand.Data.Reg.Index == REGISTER_RIP)
-            mBreakpointHit = -1;
 
-         SetRegister((eRegister)mCommand.Data.Reg.Index, mCommand.Data.Reg.Value);
-         sprintf(msg, "Wrote Register %s contents: 0x%x", RegisterStr[mCommand.Data.Reg.Index], mCommand.Data.Reg.Value);
-         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-         break;
-      }
-      case DEBUG_CMD_DATA_READ:
+      libraries.push_back(std::move(library));
+   }
+
+   std::sort(libraries.begin(), libraries.end(), [](const TSharedLibrary& a, const TSharedLibrary& b) { return a.Start < b.Start; });
+
+   mLibraries = std::move(libraries);
+}
+
+void CDebugBackend::ListLibraries()
+{
+   char msg[512];
+
+   sprintf(msg, "Number of shared libraries: %lu", mLibraries.size());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   for (size_t i = 0; i < mLibraries.size(); i++)
+   {
+      const TSharedLibrary& library = mLibraries[i];
+
+      snprintf(msg, sizeof(msg), "  0x%016lx-0x%016lx %s%s", library.Start, library.End, library.Path.c_str(),
+               library.Elf ? " (symbols loaded)" : "");
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+}
+
+void CDebugBackend::LoadTargetInfo()
+{
+   mLoadBias = 0;
+   mInstructionCache.Clear();
+
+   // PIE executables are relocated as a whole, for a core the bias is where the kernel put
+   // the entry point minus where the linker put it, a live target shows where the start of
+   // the file is mapped
+   if (mElf.IsPositionIndependent() && mCore.IsOpen())
+   {
+      if (mCore.GetAuxValue(AUX_TYPE_ENTRY))
+         mLoadBias = mCore.GetAuxValue(AUX_TYPE_ENTRY) - mElf.GetHeader()->e_entry;
+   }
+   else if (mElf.IsPositionIndependent())
+   {
+      char                       path[PATH_MAX];
+      u32                        count;
+      const TElfProgramHeader64* segments = mElf.GetProgramHeaders(&count);
+      u64                        first = ~0ull;
+
+      for (u32 i = 0; segments && i < count; i++)
       {
-         u64 address = mCommand.Data.Read.Address;
-         u8 data[MAX_DATA + sizeof(u64)];
-         u8 index = 0;
+         if (segments[i].p_type == ELF_SEGMENT_TYPE_LOAD && segments[i].p_vaddr < first)
+            first = segments[i].p_vaddr & ~(u64)(PAGE_SIZE - 1);
+      }
 
-         // put address in first 8 bytes of data buffer going back to front end
-         *(u64*)data = address;
+      mAddressSpace.Invalidate();
+      UpdateAddressSpace();
 
-         for (int i = 0; i < (mCommand.Data.Read.Bytes+7) / 8; i++)
-         {
-            index = (i * 8) + 8;
-            errno = 0;
-            *(u64*)&data[index] = GetData(address);
-            address += 8;
+      u64 base = realpath(mElf.GetFilename().c_str(), path) ? mAddressSpace.GetBase(path) : 0;
 
-            if (errno)
-               break;
-         }
+      if (base && first != ~0ull)
+         mLoadBias = base - first;
+   }
 
-         if (errno)
-         {
-            sprintf(msg, "Failed to read data");
-            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
-         }
-         else
-         {
-            PushData(DATA_TYPE_DATA, (u8*)data, mCommand.Data.Read.Bytes + sizeof(u64));
-         }
+   mUnwinder.Initialize(&mElf, mLoadBias);
+   mAddressSpace.Invalidate();
+
+   // a new process or core, libraries are found again
+   mLibraries.clear();
+   mRendezvousAddress = 0;
+   mDebugAddress = 0;
+
+   if (!mCore.IsOpen())
+      FindRendezvous();
+
+   // cores and attached targets have their libraries loaded already
+   UpdateLibraries();
+
+   if (!mCore.IsOpen())
+      ReapplyWatchpoints();
+}
+
+void CDebugBackend::Continue()
+{
+   if (mBreakpointHit != -1)
+      StepOverBreakpoint();
+
+   // anything could be mapped or unmapped while the target runs freely
+   mAddressSpace.Invalidate();
+
+   Resume();
+}
+
+// PTRACE_CONT until a stop that matters to the user. The rendezvous breakpoint is only in
+// place while the target runs freely, so stepping never sees it; when it is hit the library
+// list is updated and the target goes on without anything being reported.
+void CDebugBackend::Resume()
+{
+   for (;;)
+   {
+      bool inserted = InsertRendezvousBreakpoint();
+
+      PTRACE(PTRACE_CONT, mChildPid, nullptr, nullptr);
+      eWaitResult result = WaitStop();
+
+      if (inserted && WIFSTOPPED(mWaitStatus))
+         RemoveRendezvousBreakpoint();
+
+      if (!WIFSTOPPED(mWaitStatus) || result == WAIT_WATCH_HIT)
          break;
-      }
-      case DEBUG_CMD_GET_TARGET:
-         if (mTarget.length())
-         {
-            char target_pid[100] = {};
 
-            if (mChildPid)
-            {
-               sprintf(target_pid, " (pid %d%s)", mChildPid, mTargetRunning ? " running" : "");
-            }
+      // writes to watched pages that miss the watched bytes don't stop the target
+      if (result == WAIT_WATCH_MISS)
+         continue;
 
-            sprintf(msg, "Target: %s%s", mTarget.c_str(), target_pid);
-            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-         }
-         else
-         {
-            sprintf(msg, "No Target is defined");
-            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-         }
-         //PushData(DATA_TYPE_DATA, (u8*)mTarget.c_str(), mTarget.length() + sizeof(u64));
+      if (!inserted || WSTOPSIG(mWaitStatus) != SIGTRAP)
          break;
-      case DEBUG_CMD_SET_TARGET:
-         if (mCommand.Data.String.String)
-         {
-            mTarget = (char*)mCommand.Data.String.String;
 
-            if (mChildPid)
-               StopTarget();
+      GetSignalInfo();
 
-            mBreakpoints.clear();
-            VerifyTarget();
-            StartTarget();
-            delete [] mCommand.Data.String.String;
-            sprintf(msg, "Target is now: %s", mTarget.c_str());
-            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-         }
+      if (!IsBreakpointTrap() || GetRegister(REGISTER_RIP) != mRendezvousAddress + 1)
          break;
-      case DEBUG_CMD_START:
-         if (mChildPid)
-         {
-            sprintf(msg, "Target has already been started, pid %d", mChildPid);
-            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
-         }
-         else
+
+      SetRegister(REGISTER_RIP, mRendezvousAddress);
+      mRendezvousStops++;
+      UpdateLibraries();
+
+      // reading the list refreshed the maps, the target goes on changing them
+      mAddressSpace.Invalidate();
+
+      // run the real instruction before the int3 goes back in
+      Ptrace(PTRACE_SINGLESTEP, mChildPid, nullptr, nullptr);
+
+      if (WaitStop() == WAIT_WATCH_HIT || !WIFSTOPPED(mWaitStatus) || WSTOPSIG(mWaitStatus) != SIGTRAP)
+         break;
+   }
+
+   ProcessStop();
+}
+
+bool CDebugBackend::InsertRendezvousBreakpoint()
+{
+   if (!mRendezvousAddress || FindTemporaryBreakpoint(mRendezvousAddress) != -1)
+      return false;
+
+   // a user breakpoint there traps anyway, the library list isn't updated for that stop
+   for (size_t i = 0; i < mBreakpoints.size(); i++)
+   {
+      if (mBreakpoints[i].Enabled && mBreakpoints[i].Address == mRendezvousAddress)
+         return false;
+   }
+
+   errno = 0;
+   u64 data = Ptrace(PTRACE_PEEKDATA, mChildPid, mRendezvousAddress, nullptr);
+
+   if (errno)
+   {
+      mRendezvousAddress = 0;
+      return false;
+   }
+
+   mRendezvousSavedData = data & 0xff;
+   SetData(mRendezvousAddress, (data & ~0xff) | SW_INTERRUPT_3);
+
+   return true;
+}
+
+void CDebugBackend::RemoveRendezvousBreakpoint()
+{
+   errno = 0;
+   u64 data = Ptrace(PTRACE_PEEKDATA, mChildPid, mRendezvousAddress, nullptr);
+
+   if (errno == 0)
+      SetData(mRendezvousAddress, (data & ~0xff) | mRendezvousSavedData);
+}
+
+void CDebugBackend::StepSingle()
+{
+   // stepping over the breakpoint is the single step
+   if (mBreakpointHit != -1)
+   {
+      StepOverBreakpoint();
+      return;
+   }
+
+   PTRACE(PTRACE_SINGLESTEP, mChildPid, nullptr, nullptr);
+   
+   Wait();
+}
+
+void CDebugBackend::StepOverBreakpoint()
+{
+   assert(mBreakpointHit >= 0 && mBreakpointHit < mBreakpoints.size());
+
+   int bp = mBreakpointHit;
+
+   u64 data = (GetData(mBreakpoints[mBreakpointHit].Address) & ~0xff) | mBreakpoints[mBreakpointHit].SavedData;
+   SetData(mBreakpoints[mBreakpointHit].Address, data);
+
+   mBreakpointHit = -1;
+   StepSingle();
+
+   // re-enable breakpoint
+   u64 data_w_int = ((GetData(mBreakpoints[bp].Address) & ~0xff) | SW_INTERRUPT_3);
+   SetData(mBreakpoints[bp].Address, data_w_int);
+}
+
+void CDebugBackend::AddTemporaryBreakpoint(u64 Address, eTemporaryBreakpoint Type)
+{
+   if (FindTemporaryBreakpoint(Address) == -1)
+      mTemporaryBreakpoints.push_back({ Address, 0, (u8)Type, false });
+}
+
+int CDebugBackend::FindTemporaryBreakpoint(u64 Address) const
+{
+   for (size_t i = 0; i < mTemporaryBreakpoints.size(); i++)
+   {
+      if (mTemporaryBreakpoints[i].Address == Address)
+         return i;
+   }
+
+   return -1;
+}
+
+void CDebugBackend::InsertTemporaryBreakpoints()
+{
+   for (size_t i = 0; i < mTemporaryBreakpoints.size(); i++)
+   {
+      TTemporaryBreakpoint& bp = mTemporaryBreakpoints[i];
+      bool                  user = false;
+
+      for (size_t j = 0; j < mBreakpoints.size(); j++)
+         user = user || (mBreakpoints[j].Enabled && mBreakpoints[j].Address == bp.Address);
+
+      if (user)
+         continue;
+
+      errno = 0;
+      u64 data = GetData(bp.Address);
+
+      if (errno == 0)
+      {
+         bp.SavedData = data & 0xff;
+         bp.Inserted = true;
+         SetData(bp.Address, (data & ~0xff) | SW_INTERRUPT_3);
+      }
+   }
+}
+
+void CDebugBackend::RemoveTemporaryBreakpoints()
+{
+   // nothing to restore once the process is gone
+   bool restore = mTargetRunning && WIFSTOPPED(mWaitStatus);
+
+   for (size_t i = mTemporaryBreakpoints.size(); i > 0; i--)
+   {
+      TTemporaryBreakpoint& bp = mTemporaryBreakpoints[i - 1];
+
+      if (bp.Inserted && restore)
+         SetData(bp.Address, (GetData(bp.Address) & ~0xff) | bp.SavedData);
+
+      bp.Inserted = false;
+   }
+}
+
+bool CDebugBackend::IsStoppedByTrap() const
+{
+   return mTargetRunning && WIFSTOPPED(mWaitStatus) && WSTOPSIG(mWaitStatus) == SIGTRAP && mBreakpointHit == -1;
+}
+
+int CDebugBackend::ContinueToTemporary()
+{
+   u64 pc = GetRegister(REGISTER_RIP);
+
+   // get off the current instruction first, a breakpoint planted there would trap right away
+   if (mBreakpointHit != -1 || FindTemporaryBreakpoint(pc) != -1)
+   {
+      StepSingle();
+
+      if (!IsStoppedByTrap())
+         return -1;
+
+      int index = FindTemporaryBreakpoint(GetRegister(REGISTER_RIP));
+      if (index != -1)
+         return index;
+   }
+
+   InsertTemporaryBreakpoints();
+
+   mAddressSpace.Invalidate();
+   Resume();
+
+   RemoveTemporaryBreakpoints();
+
+   // a user breakpoint, a signal or the end of the target, Wait() has reported it
+   if (!IsStoppedByTrap() || !IsBreakpointTrap())
+      return -1;
+
+   pc = GetRegister(REGISTER_RIP) - 1;
+
+   int index = FindTemporaryBreakpoint(pc);
+   if (index != -1)
+      SetRegister(REGISTER_RIP, pc);
+
+   return index;
+}
+
+u64 CDebugBackend::GetFrameAddress(u64* ReturnAddress)
+{
+   TRegister registers;
+   TFrame    frames[2] = {};
+
+   if (!GetRegisters(&registers))
+      return 0;
+
+   int count = mUnwinder.Unwind(&registers, frames, 2);
+
+   // no CFI for this pc (code outside the executable), the rbp chain may still know
+   if (count < 2)
+      count = mUnwinder.UnwindFramePointer(&registers, frames, 2);
+
+   *ReturnAddress = (count > 1) ? frames[1].Pc : 0;
+
+   // without CFI the stack pointer is the best approximation there is
+   return frames[0].Cfa ? frames[0].Cfa : registers.Reg.rsp;
+}
+
+u64 CDebugBackend::SkipPrologue(u64 Address)
+{
+   const TElfSymbol* symbol = mElf.FindSymbol(Address - mLoadBias);
+
+   if (!symbol || symbol->Address != Address - mLoadBias)
+      return Address;
+
+   return mLineTable.FindPrologueEnd(symbol->Address, symbol->Address + symbol->Size) + mLoadBias;
+}
+
+void CDebugBackend::PlanLineStep(const TLineInfo* Line, bool Into, u64 ReturnAddress)
+{
+   TInstruction scratch;
+   u64          start = Line->Start + mLoadBias;
+   u64          end = Line->End + mLoadBias;
+
+   mTemporaryBreakpoints.clear();
+
+   // every way out of the line: branches leaving it, the next line and the caller
+   for (u64 address = start; address < end; )
+   {
+      const TInstruction* inst = DecodeAt(address, &scratch);
+
+      if (!inst)
+         break;
+
+      switch (inst->Branch)
+      {
+         case BRANCH_JUMP:
+         case BRANCH_CONDITIONAL:
+            if (inst->Target < start || inst->Target >= end)
+               AddTemporaryBreakpoint(inst->Target, TEMPORARY_BREAKPOINT_EXIT);
+            break;
+         case BRANCH_JUMP_INDIRECT:
+            AddTemporaryBreakpoint(address, TEMPORARY_BREAKPOINT_INDIRECT);
+            break;
+         case BRANCH_CALL:
+            // calls into code without line information are always stepped over
+            if (Into && mLineTable.FindLine(inst->Target - mLoadBias, nullptr))
+               AddTemporaryBreakpoint(SkipPrologue(inst->Target), TEMPORARY_BREAKPOINT_CALL);
+            break;
+         case BRANCH_CALL_INDIRECT:
+            if (Into)
+               AddTemporaryBreakpoint(address, TEMPORARY_BREAKPOINT_INDIRECT);
+            break;
+         default:
+            break;
+      }
+
+      address += inst->Length;
+   }
+
+   AddTemporaryBreakpoint(end, TEMPORARY_BREAKPOINT_EXIT);
+
+   if (ReturnAddress)
+      AddTemporaryBreakpoint(ReturnAddress, TEMPORARY_BREAKPOINT_RETURN);
+}
+
+void CDebugBackend::StepLine(bool Into)
+{
+   char      msg[256];
+   TLineInfo line;
+   u64       return_address = 0;
+   u64       pc = GetRegister(REGISTER_RIP);
+   int       stops = 0;
+
+   if (!mLineTable.FindLine(pc - mLoadBias, &line))
+   {
+      sprintf(msg, "No line information at 0x%lx, stepping one instruction", pc);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+      StepSingle();
+      return;
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   u64  frame = GetFrameAddress(&return_address);
+
+   PlanLineStep(&line, Into, return_address);
+
+   // The target runs freely between temporary breakpoints, so a call in the line costs
+   // nothing however long it runs. A stop only ends the step once it is known to be in the
+   // right frame, recursion can hit the same breakpoints in deeper frames.
+   for (;;)
+   {
+      int index = ContinueToTemporary();
+      stops++;
+
+      if (index == -1)
+      {
+         mTemporaryBreakpoints.clear();
+
+         if (mTargetRunning && WIFSTOPPED(mWaitStatus) && WSTOPSIG(mWaitStatus) != SIGTRAP)
+         {
+            sprintf(msg, "Target stopped by signal %s while stepping", strsignal(WSTOPSIG(mWaitStatus)));
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         return;
+      }
+
+      TTemporaryBreakpoint bp = mTemporaryBreakpoints[index];
+      u64                  caller = 0;
+      u64                  current = GetFrameAddress(&caller);
+
+      pc = bp.Address;
+
+      if (bp.Type == TEMPORARY_BREAKPOINT_RETURN)
+      {
+         // the caller's frame is above ours, or exactly at our CFA when it has no CFI
+         if (current < frame)
+            continue;
+
+         // back in the caller, stop right after the call like any other debugger
+         break;
+      }
+      else if (bp.Type == TEMPORARY_BREAKPOINT_CALL)
+      {
+         if (current >= frame)
+            continue;
+
+         break;
+      }
+      else if (current < frame)
+      {
+         continue;
+      }
+
+      if (bp.Type == TEMPORARY_BREAKPOINT_INDIRECT)
+      {
+         StepSingle();
+         stops++;
+
+         if (!IsStoppedByTrap())
+         {
+            mTemporaryBreakpoints.clear();
+            return;
+         }
+
+         pc = GetRegister(REGISTER_RIP);
+
+         if (GetFrameAddress(&caller) < frame)
+         {
+            // into a function through a pointer, code without line information is stepped
+            // over by the breakpoints already planted in the line
+            if (!mLineTable.FindLine(pc - mLoadBias, nullptr))
+               continue;
+
+            u64 body = SkipPrologue(pc);
+            u64 back = 0;
+
+            if (body == pc || ReadMemory(GetRegister(REGISTER_RSP), &back, sizeof(back)) != sizeof(back))
+               break;
+
+            // run through the prologue, or back out if the function returns before its body
+            mTemporaryBreakpoints.clear();
+            AddTemporaryBreakpoint(body, TEMPORARY_BREAKPOINT_CALL);
+            AddTemporaryBreakpoint(back, TEMPORARY_BREAKPOINT_RETURN);
+            continue;
+         }
+
+         if (pc >= line.Start + mLoadBias && pc < line.End + mLoadBias)
+            continue;
+      }
+
+      // a jump to the middle of a line keeps stepping through the rest of that line
+      if (!mLineTable.FindLine(pc - mLoadBias, &line) || pc == line.Start + mLoadBias)
+         break;
+
+      frame = current;
+      PlanLineStep(&line, Into, caller);
+   }
+
+   mTemporaryBreakpoints.clear();
+
+   auto end = std::chrono::steady_clock::now();
+   ReportLocation(pc, stops, std::chrono::duration<f64, std::micro>(end - start).count());
+}
+
+void CDebugBackend::NextInstruction()
+{
+   TInstruction scratch;
+   u64          pc = GetRegister(REGISTER_RIP);
+   const TInstruction* inst = DecodeAt(pc, &scratch);
+
+   if (!inst || !CDecoder::IsCall(inst))
+   {
+      StepSingle();
+      return;
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   u64  caller = 0;
+   u64  frame = GetFrameAddress(&caller);
+   int  stops = 0;
+
+   // the whole callee runs at full speed, one trap when it comes back
+   mTemporaryBreakpoints.clear();
+   AddTemporaryBreakpoint(pc + inst->Length, TEMPORARY_BREAKPOINT_EXIT);
+
+   for (;;)
+   {
+      int index = ContinueToTemporary();
+      stops++;
+
+      if (index == -1)
+      {
+         mTemporaryBreakpoints.clear();
+         return;
+      }
+
+      // a recursive call coming back to the same spot deeper down
+      if (GetFrameAddress(&caller) >= frame)
+         break;
+   }
+
+   mTemporaryBreakpoints.clear();
+
+   auto end = std::chrono::steady_clock::now();
+   ReportLocation(pc + inst->Length, stops, std::chrono::duration<f64, std::micro>(end - start).count());
+}
+
+void CDebugBackend::Finish()
+{
+   char msg[256];
+   u64  return_address = 0;
+   u64  caller = 0;
+   int  stops = 0;
+
+   auto start = std::chrono::steady_clock::now();
+   u64  frame = GetFrameAddress(&return_address);
+
+   if (return_address == 0)
+   {
+      sprintf(msg, "Can't find the caller of 0x%lx", GetRegister(REGISTER_RIP));
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   mTemporaryBreakpoints.clear();
+   AddTemporaryBreakpoint(return_address, TEMPORARY_BREAKPOINT_RETURN);
+
+   for (;;)
+   {
+      int index = ContinueToTemporary();
+      stops++;
+
+      if (index == -1)
+      {
+         mTemporaryBreakpoints.clear();
+         return;
+      }
+
+      // the caller's frame is above ours, or exactly at our CFA when it has no CFI
+      if (GetFrameAddress(&caller) >= frame)
+         break;
+   }
+
+   mTemporaryBreakpoints.clear();
+
+   auto end = std::chrono::steady_clock::now();
+   ReportLocation(return_address, stops, std::chrono::duration<f64, std::micro>(end - start).count());
+
+   sprintf(msg, "Returned rax = 0x%lx", GetRegister(REGISTER_RAX));
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::StepUntil(eStepCondition Condition, u64 Operand, u64 Value, u64 MaxSteps, eStepMode Mode)
+{
+   char        msg[256];
+   u64         steps = 0;
+   bool        met = false;
+   const char* reason = "Step limit reached";
+
+   if (MaxSteps == 0)
+      MaxSteps = (Condition == STEP_UNTIL_COUNT) ? 1 : DEFAULT_STEP_LIMIT;
+
+   if ((Condition == STEP_UNTIL_REGISTER_EQUAL || Condition == STEP_UNTIL_REGISTER_NOT_EQUAL) && Operand >= REGISTER_COUNT)
+   {
+      sprintf(msg, "Unknown register %lu", Operand);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   // a branch trap only shows where control flow goes, registers and memory can change
+   // anywhere inside a block
+   if (Condition != STEP_UNTIL_COUNT && Condition != STEP_UNTIL_OUTSIDE_RANGE)
+      Mode = STEP_MODE_INSTRUCTION;
+
+   if (!mBlockStepSupported)
+      Mode = STEP_MODE_INSTRUCTION;
+
+   // Everything below is one trap and one waitpid per instruction (or per taken branch when
+   // block stepping), plus the one read the condition needs. Nothing is pushed to the
+   // frontend until the loop is over.
+   auto check = [&]() -> bool
+   {
+      u64 rip = 0;
+      u64 value = 0;
+
+      // a block can run into an int3, a user breakpoint or ours at the end of the range
+      if (Mode == STEP_MODE_BLOCK && (mBreakpoints.size() || mTemporaryBreakpoints.size()))
+      {
+         bool user = false;
+
+         rip = Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, rip), nullptr);
+
+         for (size_t i = 0; i < mBreakpoints.size(); i++)
+            user = user || (mBreakpoints[i].Enabled && mBreakpoints[i].Address == rip - 1);
+
+         if (user || FindTemporaryBreakpoint(rip - 1) != -1)
+         {
+            GetSignalInfo();
+
+            if (IsBreakpointTrap())
+            {
+               mRegistersValid = false;
+
+               if (user)
+               {
+                  int bp = CheckBreakpoints();
+
+                  sprintf(msg, "Breakpoint %d hit at 0x%lx", bp + 1, rip - 1);
+                  PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+                  reason = "Stopped at breakpoint";
+                  return true;
+               }
+
+               SetRegister(REGISTER_RIP, rip - 1);
+               rip--;
+            }
+         }
+      }
+
+      switch (Condition)
+      {
+         case STEP_UNTIL_REGISTER_EQUAL:
+         case STEP_UNTIL_REGISTER_NOT_EQUAL:
+         {
+            TRegister registers;
+
+            if (Ptrace(PTRACE_GETREGS, mChildPid, nullptr, &registers.Reg) < 0)
+               return true;
+
+            rip = registers.Reg.rip;
+            met = (registers.RegArray[Operand] == Value) == (Condition == STEP_UNTIL_REGISTER_EQUAL);
+            break;
+         }
+         case STEP_UNTIL_MEMORY_EQUAL:
+         case STEP_UNTIL_MEMORY_NOT_EQUAL:
+            if (ReadMemory(Operand, &value, sizeof(value)) != sizeof(value))
+               return true;
+
+            met = (value == Value) == (Condition == STEP_UNTIL_MEMORY_EQUAL);
+            break;
+         case STEP_UNTIL_OUTSIDE_RANGE:
+            if (rip == 0)
+               rip = Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, rip), nullptr);
+            met = rip < Operand || rip >= Value;
+            break;
+         default:
+            break;
+      }
+
+      if (met)
+         reason = "Condition met";
+
+      // stop in front of a user breakpoint instead of running into its int3
+      if (mBreakpoints.size())
+      {
+         if (rip == 0)
+            rip = Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, rip), nullptr);
+
+         for (size_t i = 0; i < mBreakpoints.size(); i++)
+         {
+            if (mBreakpoints[i].Enabled && mBreakpoints[i].Address == rip)
+            {
+               sprintf(msg, "Breakpoint %lu hit at 0x%lx", i + 1, rip);
+               PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+               mBreakpointHit = i;
+               reason = "Stopped at breakpoint";
+               return true;
+            }
+         }
+      }
+
+      return met;
+   };
+
+   auto start = std::chrono::steady_clock::now();
+   bool stop = false;
+
+   // leaving a user breakpoint is the first step
+   if (mBreakpointHit != -1)
+   {
+      StepOverBreakpoint();
+      steps++;
+
+      if (!IsStoppedByTrap())
+         return;
+
+      stop = check();
+   }
+
+   // falling out of the end of the range is not a branch, a breakpoint there catches it
+   mTemporaryBreakpoints.clear();
+   if (Mode == STEP_MODE_BLOCK && Condition == STEP_UNTIL_OUTSIDE_RANGE && !stop)
+   {
+      AddTemporaryBreakpoint(Value, TEMPORARY_BREAKPOINT_EXIT);
+      InsertTemporaryBreakpoints();
+   }
+
+   while (!stop && steps < MaxSteps)
+   {
+      bool trapped = StepTrap(&Mode);
+      steps++;
+
+      // signals and the end of the target take the normal path
+      if (!trapped)
+      {
+         RemoveTemporaryBreakpoints();
+         mTemporaryBreakpoints.clear();
+         ProcessStop();
+         sprintf(msg, "Stepping interrupted after %lu steps", steps);
+         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         return;
+      }
+
+      stop = check();
+   }
+
+   RemoveTemporaryBreakpoints();
+   mTemporaryBreakpoints.clear();
+
+   auto end = std::chrono::steady_clock::now();
+   f64  elapsed_us = std::chrono::duration<f64, std::micro>(end - start).count();
+   f64  rate = (elapsed_us > 0.0) ? steps * 1000000.0 / elapsed_us : 0.0;
+
+   mStepStats[Mode].Traps += steps;
+   mStepStats[Mode].Seconds += elapsed_us / 1000000.0;
+
+   mRegistersValid = false;
+   mAddressSpace.Invalidate();
+
+   ReportLocation(GetRegister(REGISTER_RIP), steps, elapsed_us);
+
+   if (Mode == STEP_MODE_BLOCK)
+      sprintf(msg, "%s after %lu blocks, %.0f traps/s", reason, steps, rate);
+   else
+      sprintf(msg, "%s after %lu steps, %.0f steps/s", reason, steps, rate);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+// Resumes the target for one trap and waits for it. Block stepping drops to single steps for
+// good when the kernel refuses PTRACE_SINGLEBLOCK, or when a trap right after a plain
+// instruction shows the cpu ignored the branch trap flag (hypervisors often don't pass
+// DEBUGCTL.BTF through). Returns false when the target stopped for anything but a trap, or
+// when the step hit a watchpoint.
+bool CDebugBackend::StepTrap(eStepMode* Mode)
+{
+   const char* failure = nullptr;
+   u64         from = 0;
+
+   if (*Mode == STEP_MODE_BLOCK)
+   {
+      if (!mBlockStepVerified)
+         from = Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, rip), nullptr);
+
+      if (Ptrace(PTRACE_SINGLEBLOCK, mChildPid, nullptr, nullptr) < 0)
+      {
+         failure = strerror(errno);
+         *Mode = STEP_MODE_INSTRUCTION;
+      }
+   }
+
+   if (*Mode == STEP_MODE_INSTRUCTION && PTRACE(PTRACE_SINGLESTEP, mChildPid, nullptr, nullptr) < 0)
+      return false;
+
+   eWaitResult result = WaitStop();
+
+   if (!WIFSTOPPED(mWaitStatus) || WSTOPSIG(mWaitStatus) != SIGTRAP || result == WAIT_WATCH_HIT)
+      return false;
+
+   // after a watch fault the trap is from the single step over the write, it tells nothing
+   if (*Mode == STEP_MODE_BLOCK && from && result == WAIT_STOPPED)
+   {
+      TInstruction        scratch;
+      const TInstruction* inst = DecodeAt(from, &scratch);
+      u64                 to = Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, rip), nullptr);
+
+      // only straight line code tells, a branch traps in both modes
+      if (inst && !(inst->Flags & INSTRUCTION_FLAG_INVALID) && inst->Branch == BRANCH_NONE)
+      {
+         GetSignalInfo();
+
+         if (!IsBreakpointTrap() && to == from + inst->Length)
+         {
+            failure = "the cpu doesn't trap on branches";
+            *Mode = STEP_MODE_INSTRUCTION;
+         }
+         else if (!IsBreakpointTrap())
+            mBlockStepVerified = true;
+      }
+   }
+
+   if (failure)
+   {
+      char msg[256];
+
+      mBlockStepSupported = false;
+      sprintf(msg, "Block stepping is not available (%s), using single steps", failure);
+      PushData(DATA_TYPE_STREAM_WARNING, (u8*)msg, strlen(msg));
+   }
+
+   return true;
+}
+
+void CDebugBackend::TraceBlocks(u64 MaxBlocks)
+{
+   TInstruction     scratch;
+   char             msg[256];
+   std::vector<u64> blocks;
+   eStepMode        mode = mBlockStepSupported ? STEP_MODE_BLOCK : STEP_MODE_INSTRUCTION;
+   u64              traps = 0;
+   const char*      reason = "Block limit reached";
+
+   if (MaxBlocks == 0 || MaxBlocks > MAX_TRACE_BLOCKS)
+      MaxBlocks = MAX_TRACE_BLOCKS;
+
+   blocks.reserve(MaxBlocks);
+   auto start = std::chrono::steady_clock::now();
+
+   if (mBreakpointHit != -1)
+   {
+      StepOverBreakpoint();
+      traps++;
+
+      if (!IsStoppedByTrap())
+         return;
+   }
+
+   u64 pc = Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, rip), nullptr);
+
+   while (blocks.size() < MaxBlocks)
+   {
+      if (!StepTrap(&mode))
+      {
+         ProcessStop();
+         reason = "Tracing interrupted";
+         break;
+      }
+
+      u64 rip = Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, rip), nullptr);
+      int bp = -1;
+
+      traps++;
+
+      // a block that ran into a user breakpoint ends the trace on it
+      if (mode == STEP_MODE_BLOCK)
+      {
+         for (size_t i = 0; i < mBreakpoints.size(); i++)
+         {
+            if (mBreakpoints[i].Enabled && mBreakpoints[i].Address == rip - 1)
+            {
+               GetSignalInfo();
+               if (IsBreakpointTrap())
+               {
+                  mRegistersValid = false;
+                  bp = CheckBreakpoints();
+                  rip--;
+               }
+               break;
+            }
+         }
+      }
+
+      // single steps see every instruction, only the ones that didn't fall through start a block
+      if (bp == -1 && mode == STEP_MODE_INSTRUCTION)
+      {
+         const TInstruction* inst = DecodeAt(pc, &scratch);
+
+         if (!inst || rip != pc + inst->Length)
+            blocks.push_back(rip);
+      }
+      else if (bp == -1)
+         blocks.push_back(rip);
+
+      pc = rip;
+
+      for (size_t i = 0; bp == -1 && i < mBreakpoints.size(); i++)
+      {
+         if (mBreakpoints[i].Enabled && mBreakpoints[i].Address == rip)
+         {
+            mBreakpointHit = i;
+            bp = i;
+         }
+      }
+
+      if (bp != -1)
+      {
+         sprintf(msg, "Breakpoint %d hit at 0x%lx", bp + 1, rip);
+         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         reason = "Stopped at breakpoint";
+         break;
+      }
+   }
+
+   auto end = std::chrono::steady_clock::now();
+   f64  elapsed_us = std::chrono::duration<f64, std::micro>(end - start).count();
+
+   mStepStats[mode].Traps += traps;
+   mStepStats[mode].Seconds += elapsed_us / 1000000.0;
+
+   mRegistersValid = false;
+   mAddressSpace.Invalidate();
+
+   for (size_t i = 0; i < blocks.size(); i++)
+   {
+      u64               offset;
+      const TElfSymbol* symbol = FindSymbol(blocks[i], &offset);
+
+      if (symbol)
+         sprintf(msg, "0x%016lx <%s+0x%lx>", blocks[i], symbol->Name, offset);
+      else
+         sprintf(msg, "0x%016lx", blocks[i]);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+
+   sprintf(msg, "%s, %lu blocks in %lu traps (%s), %.0f traps/s", reason, blocks.size(), traps,
+           (mode == STEP_MODE_BLOCK) ? "block step" : "single step", (elapsed_us > 0.0) ? traps * 1000000.0 / elapsed_us : 0.0);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::ReportStats()
+{
+   const char* names[STEP_MODE_COUNT] = { "single step", "block step" };
+   char        msg[256];
+
+   sprintf(msg, "Block stepping: %s", !mBlockStepSupported ? "not available" : mBlockStepVerified ? "supported" : "not verified yet");
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   for (int i = 0; i < STEP_MODE_COUNT; i++)
+   {
+      const TStepStats& stats = mStepStats[i];
+
+      sprintf(msg, "%-12s %10lu traps %10.3f s %12.0f traps/s", names[i], stats.Traps, stats.Seconds,
+              (stats.Seconds > 0.0) ? stats.Traps / stats.Seconds : 0.0);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+
+   u64 symbols = 0;
+
+   for (size_t i = 0; i < mLibraries.size(); i++)
+      symbols += mLibraries[i].Elf ? 1 : 0;
+
+   sprintf(msg, "Shared libraries: %lu loaded, %lu with symbols read, %lu rendezvous stops", mLibraries.size(), symbols,
+           mRendezvousStops);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   sprintf(msg, "Address space: %lu mappings, maps read %lu times, layout changed %lu times", mAddressSpace.GetMaps().size(),
+           mAddressSpace.GetRefreshes(), mAddressSpace.GetGeneration());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   sprintf(msg, "Watchpoints: %lu faults, %lu missed the watched bytes, %.1f us per fault", mWatchFaults, mWatchMisses,
+           mWatchFaults ? mWatchSeconds * 1e6 / mWatchFaults : 0.0);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   // ptrace requests, most used first
+   u32 order[PTRACE_STATS];
+   u64 requests = 0;
+
+   for (u32 i = 0; i < PTRACE_STATS; i++)
+   {
+      order[i] = i;
+      requests += mStats.Ptrace[i];
+   }
+
+   std::sort(order, order + PTRACE_STATS, [&](u32 A, u32 B) { return mStats.Ptrace[A] > mStats.Ptrace[B]; });
+
+   int length = sprintf(msg, "ptrace: %lu requests", requests);
+
+   for (u32 i = 0; i < PTRACE_STATS && mStats.Ptrace[order[i]]; i++)
+   {
+      const char* name = (order[i] < ArrayCount(PtraceRequests)) ? PtraceRequests[order[i]].Name : "other";
+
+      if (length > 96)
+      {
+         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, length);
+         length = sprintf(msg, "       ");
+      }
+
+      length += sprintf(&msg[length], "%s%s %lu", (length > 7) ? ", " : "", name, mStats.Ptrace[order[i]]);
+   }
+
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, length);
+
+   sprintf(msg, "waitpid: %lu calls", mStats.Waits);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   sprintf(msg, "Target memory: %lu bytes read, %lu bytes written", mStats.BytesRead, mStats.BytesWritten);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   sprintf(msg, "Output: %lu messages, %lu bytes, %lu messages (%lu bytes) dropped", mStats.Messages, mStats.MessageBytes,
+           mStats.DroppedMessages, mStats.DroppedBytes);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   ReportLatency();
+}
+
+u32 CDebugBackend::PtraceStat(int Request)
+{
+   for (u32 i = 0; i < ArrayCount(PtraceRequests); i++)
+   {
+      if (PtraceRequests[i].Request == Request)
+         return i;
+   }
+
+   return ArrayCount(PtraceRequests);
+}
+
+void CDebugBackend::AddLatency(eDebugCommand Command, f64 Us)
+{
+   TLatencyHistogram& histogram = mStats.Commands[Command];
+   u32                bucket = 0;
+
+   while (bucket < LATENCY_BUCKETS - 1 && Us >= (f64)(1ull << bucket))
+      bucket++;
+
+   histogram.Count++;
+   histogram.TotalUs += Us;
+   histogram.MaxUs = std::max(histogram.MaxUs, Us);
+   histogram.Buckets[bucket]++;
+}
+
+// upper end of the bucket the given fraction of the commands fall into
+static u64 GetPercentile(const TLatencyHistogram& Histogram, f64 Fraction)
+{
+   u64 count = 0;
+
+   for (u32 i = 0; i < LATENCY_BUCKETS; i++)
+   {
+      count += Histogram.Buckets[i];
+
+      if (count >= Histogram.Count * Fraction)
+         return 1ull << i;
+   }
+
+   return 1ull << (LATENCY_BUCKETS - 1);
+}
+
+void CDebugBackend::ReportLatency()
+{
+   char msg[512];
+
+   sprintf(msg, "Command latency, from SetCommand until processed:");
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   for (u32 i = 0; i < DEBUG_CMD_COUNT; i++)
+   {
+      const TLatencyHistogram& histogram = mStats.Commands[i];
+
+      if (!histogram.Count)
+         continue;
+
+      sprintf(msg, "  %-20s %6lu  mean %10.1f us  max %10.1f us  p50 < %lu us  p99 < %lu us", DebugCommandStr[i], histogram.Count,
+              histogram.TotalUs / histogram.Count, histogram.MaxUs, GetPercentile(histogram, 0.5), GetPercentile(histogram, 0.99));
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+      // the buckets that have anything in them, by their upper end
+      int length = sprintf(msg, "   ");
+
+      for (u32 b = 0; b < LATENCY_BUCKETS && length < (int)sizeof(msg) - 1; b++)
+      {
+         if (histogram.Buckets[b])
+            length += snprintf(&msg[length], sizeof(msg) - length, " <%lu us: %lu", (u64)1 << b, histogram.Buckets[b]);
+      }
+      length = std::min(length, (int)sizeof(msg) - 1);
+
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, length);
+   }
+}
+
+// the same counters as ReportStats as JSON, to compare between runs and versions
+void CDebugBackend::DumpStats(const char* Filename)
+{
+   const char* modes[STEP_MODE_COUNT] = { "single_step", "block_step" };
+   char        msg[512];
+   FILE*       file = fopen(Filename, "w");
+
+   if (!file)
+   {
+      snprintf(msg, sizeof(msg), "Failed to create %s: %s", Filename, strerror(errno));
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   fprintf(file, "{\n  \"ptrace\": {");
+   for (u32 i = 0; i <= ArrayCount(PtraceRequests); i++)
+      fprintf(file, "%s\"%s\": %lu", i ? ", " : "", (i < ArrayCount(PtraceRequests)) ? PtraceRequests[i].Name : "other", mStats.Ptrace[i]);
+   fprintf(file, "},\n");
+
+   fprintf(file, "  \"waitpid\": %lu,\n", mStats.Waits);
+   fprintf(file, "  \"memory\": {\"bytes_read\": %lu, \"bytes_written\": %lu},\n", mStats.BytesRead, mStats.BytesWritten);
+   fprintf(file, "  \"output\": {\"messages\": %lu, \"bytes\": %lu, \"dropped_messages\": %lu, \"dropped_bytes\": %lu},\n",
+           mStats.Messages, mStats.MessageBytes, mStats.DroppedMessages, mStats.DroppedBytes);
+
+   fprintf(file, "  \"stepping\": {");
+   for (u32 i = 0; i < STEP_MODE_COUNT; i++)
+      fprintf(file, "%s\"%s\": {\"traps\": %lu, \"seconds\": %.6f}", i ? ", " : "", modes[i], mStepStats[i].Traps, mStepStats[i].Seconds);
+   fprintf(file, "},\n");
+
+   fprintf(file, "  \"rendezvous_stops\": %lu,\n", mRendezvousStops);
+   fprintf(file, "  \"address_space\": {\"refreshes\": %lu, \"generation\": %lu},\n", mAddressSpace.GetRefreshes(),
+           mAddressSpace.GetGeneration());
+   fprintf(file, "  \"watchpoints\": {\"faults\": %lu, \"misses\": %lu, \"seconds\": %.6f},\n", mWatchFaults, mWatchMisses,
+           mWatchSeconds);
+
+   // bucket i counts the commands under 2^i us, see TLatencyHistogram
+   fprintf(file, "  \"commands\": {");
+   for (u32 i = 0, first = 1; i < DEBUG_CMD_COUNT; i++)
+   {
+      const TLatencyHistogram& histogram = mStats.Commands[i];
+
+      if (!histogram.Count)
+         continue;
+
+      fprintf(file, "%s\n    \"%s\": {\"count\": %lu, \"total_us\": %.1f, \"max_us\": %.1f, \"buckets\": [", first ? "" : ",",
+              DebugCommandStr[i], histogram.Count, histogram.TotalUs, histogram.MaxUs);
+      for (u32 b = 0; b < LATENCY_BUCKETS; b++)
+         fprintf(file, "%s%lu", b ? ", " : "", histogram.Buckets[b]);
+      fprintf(file, "]}");
+
+      first = 0;
+   }
+   fprintf(file, "\n  }\n}\n");
+
+   if (fclose(file) != 0)
+   {
+      snprintf(msg, sizeof(msg), "Failed to write %s: %s", Filename, strerror(errno));
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   snprintf(msg, sizeof(msg), "Stats written to %s", Filename);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::Record(const char* Filename, u64 MaxSteps)
+{
+   CTraceWriter writer;
+   TRegister    registers;
+   char         msg[256];
+   u64          steps = 0;
+   const char*  reason = "Step limit reached";
+
+   if (MaxSteps == 0)
+      MaxSteps = DEFAULT_STEP_LIMIT;
+
+   if (!GetRegisters(&registers))
+   {
+      sprintf(msg, "Failed to read registers");
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   if (!writer.Open(Filename))
+   {
+      sprintf(msg, "Failed to create %s: %s", Filename, strerror(errno));
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   // the replay cache may be holding the file that is about to be replaced
+   if (mTraceFilename == Filename)
+   {
+      mTraceReader.Close();
+      mTraceFilename.clear();
+   }
+
+   auto start = std::chrono::steady_clock::now();
+
+   // instruction 0 is where the recording starts, each step adds the state after it
+   writer.Add(&registers);
+
+   while (steps < MaxSteps)
+   {
+      bool watched = false;
+
+      if (mBreakpointHit != -1)
+      {
+         StepOverBreakpoint();
+
+         if (!IsStoppedByTrap())
+         {
+            reason = "Recording interrupted";
+            break;
+         }
+      }
+      else
+      {
+         PTRACE(PTRACE_SINGLESTEP, mChildPid, nullptr, nullptr);
+         watched = (WaitStop() == WAIT_WATCH_HIT);
+
+         if (!WIFSTOPPED(mWaitStatus) || WSTOPSIG(mWaitStatus) != SIGTRAP)
+         {
+            ProcessStop();
+            reason = "Recording interrupted";
+            break;
+         }
+      }
+
+      steps++;
+
+      if (Ptrace(PTRACE_GETREGS, mChildPid, nullptr, &registers.Reg) < 0)
+         break;
+
+      writer.Add(&registers);
+
+      // stop in front of a user breakpoint, like step until does
+      for (size_t i = 0; i < mBreakpoints.size(); i++)
+      {
+         if (mBreakpoints[i].Enabled && mBreakpoints[i].Address == registers.Reg.rip)
+         {
+            sprintf(msg, "Breakpoint %lu hit at 0x%llx", i + 1, registers.Reg.rip);
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+            mBreakpointHit = i;
+            reason = "Stopped at breakpoint";
+            break;
+         }
+      }
+
+      // the write is done, the state after it is the last one recorded
+      if (watched)
+      {
+         reason = "Stopped at watchpoint";
+         break;
+      }
+
+      if (mBreakpointHit != -1)
+         break;
+   }
+
+   bool written = writer.Close();
+
+   auto end = std::chrono::steady_clock::now();
+   f64  elapsed_us = std::chrono::duration<f64, std::micro>(end - start).count();
+
+   mStepStats[STEP_MODE_INSTRUCTION].Traps += steps;
+   mStepStats[STEP_MODE_INSTRUCTION].Seconds += elapsed_us / 1000000.0;
+
+   mRegistersValid = false;
+   mAddressSpace.Invalidate();
+
+   if (!written)
+   {
+      sprintf(msg, "Failed to write %s", Filename);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+   }
+
+   sprintf(msg, "%s, recorded %lu instructions to %s, %lu bytes (%.2f bytes/instruction), %.0f steps/s", reason,
+           writer.GetInstructions(), Filename, writer.GetBytes(), (f64)writer.GetBytes() / writer.GetInstructions(),
+           (elapsed_us > 0.0) ? steps * 1000000.0 / elapsed_us : 0.0);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::Replay(const char* Filename, u64 Index)
+{
+   TRegister registers;
+   char      msg[256];
+
+   if (mTraceFilename != Filename || !mTraceReader.IsOpen())
+   {
+      mTraceFilename.clear();
+
+      if (!mTraceReader.Open(Filename))
+      {
+         sprintf(msg, "%s is not a trace file", Filename);
+         PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         return;
+      }
+
+      mTraceFilename = Filename;
+   }
+
+   if (!mTraceReader.Seek(Index, &registers))
+   {
+      sprintf(msg, "Instruction %lu is not in %s, it has %lu", Index, Filename, mTraceReader.GetInstructions());
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   PushData(DATA_TYPE_REGISTERS, (u8*)&registers, sizeof(TRegister));
+
+   u64               rip = registers.Reg.rip;
+   u64               offset;
+   const TElfSymbol* symbol = FindSymbol(rip, &offset);
+
+   if (symbol)
+      sprintf(msg, "Instruction %lu of %lu at 0x%lx <%s+0x%lx>", Index, mTraceReader.GetInstructions(), rip, symbol->Name, offset);
+   else
+      sprintf(msg, "Instruction %lu of %lu at 0x%lx", Index, mTraceReader.GetInstructions(), rip);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::ReportLocation(u64 Address, u64 Stops, f64 ElapsedUs)
+{
+   char              msg[256];
+   TLineInfo         line;
+   u64               offset;
+   const TElfSymbol* symbol = FindSymbol(Address, &offset);
+
+   if (mLineTable.FindLine(Address - mLoadBias, &line))
+      sprintf(msg, "%s:%u at 0x%lx (%lu stops, %.1f us)", line.File, line.Line, Address, Stops, ElapsedUs);
+   else if (symbol)
+      sprintf(msg, "0x%lx in %s+0x%lx (%lu stops, %.1f us)", Address, symbol->Name, offset, Stops, ElapsedUs);
+   else
+      sprintf(msg, "0x%lx (%lu stops, %.1f us)", Address, Stops, ElapsedUs);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::SetCommand(TDebugCommand Command)
+{
+   mMutex.lock();
+   mCommand = Command;
+   mCommandStart = std::chrono::steady_clock::now();
+   mMutex.unlock();
+
+   // both end the backend thread, the thread takes mMutex to push its output so it can't be
+   // held while joining
+   if (Command.Command == DEBUG_CMD_QUIT || Command.Command == DEBUG_CMD_ATTACH)
+      mRunning = false;
+
+   mWakeMutex.lock();
+   mWakePending = true;
+   mWakeMutex.unlock();
+   mWake.notify_one();
+
+   if (Command.Command == DEBUG_CMD_QUIT)
+   {
+      if (mThread.joinable())
+         mThread.join();
+
+      mMutex.lock();
+      mCommand.Command = DEBUG_CMD_PROCESSED;
+      mMutex.unlock();
+   }
+   else if (Command.Command == DEBUG_CMD_ATTACH)
+   {
+      if (mThread.joinable())
+         mThread.join();
+      Attach(Command.Data.Pid.Value);
+      // {
+      //    char msg[256];
+      //    sprintf(msg, "Could not attach to %d, starting debug on target %s", mCommand.Data.Pid.Value, mTarget.c_str());
+      //    PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      //    Run(mTarget.c_str());
+      // }
+
+      mMutex.lock();
+      mCommand.Command = DEBUG_CMD_PROCESSED;
+      mMutex.unlock();
+   }
+}
+
+bool CDebugBackend::WaitCommand(u32 Milliseconds)
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+
+   return mProcessed.wait_for(lock, std::chrono::milliseconds(Milliseconds),
+                              [this] { return mCommand.Command == DEBUG_CMD_PROCESSED; });
+}
+
+void CDebugBackend::HandleCommand()
+{
+   char          msg[256];
+   eDebugCommand command = mCommand.Command;
+
+   switch (mCommand.Command)
+   {
+      case DEBUG_CMD_CONTINUE:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            Continue();
+         break;
+      case DEBUG_CMD_RUN:
+         if (mTarget.length() == 0)
+         {
+            sprintf(msg, "No Target is defined");
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         else if (mTargetRunning)
+         {
+            sprintf(msg, "Target is already running, pid %d", mChildPid);
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+         {
+            if (WIFEXITED(mWaitStatus) || mChildPid == 0)
+            {
+               StartTarget();
+            }
+
+            // StartTarget() reported why there is no process
+            if (mChildPid > 0)
+            {
+               mTargetRunning = true;
+               Continue();
+            }
+         }
+         break;
+      case DEBUG_CMD_STEP_SINGLE:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            StepSingle();
+         break;
+      case DEBUG_CMD_NEXT_INSTRUCTION:
+      case DEBUG_CMD_FINISH:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else if (mCommand.Command == DEBUG_CMD_FINISH)
+            Finish();
+         else
+            NextInstruction();
+         break;
+      case DEBUG_CMD_STEP_UNTIL:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            StepUntil((eStepCondition)mCommand.Data.StepUntil.Condition, mCommand.Data.StepUntil.Operand,
+                      mCommand.Data.StepUntil.Value, mCommand.Data.StepUntil.MaxSteps, (eStepMode)mCommand.Data.StepUntil.Mode);
+         break;
+      case DEBUG_CMD_TRACE_BLOCKS:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            TraceBlocks(mCommand.Data.Trace.MaxBlocks);
+         break;
+      case DEBUG_CMD_STATS:
+         if (mCommand.Data.String.String)
+            DumpStats((char*)mCommand.Data.String.String);
+         else
+            ReportStats();
+         delete [] mCommand.Data.String.String;
+         break;
+      case DEBUG_CMD_RECORD:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            Record((char*)mCommand.Data.TraceFile.Filename, mCommand.Data.TraceFile.Count);
+         delete [] mCommand.Data.TraceFile.Filename;
+         break;
+      case DEBUG_CMD_REPLAY:
+         Replay((char*)mCommand.Data.TraceFile.Filename, mCommand.Data.TraceFile.Count);
+         delete [] mCommand.Data.TraceFile.Filename;
+         break;
+      case DEBUG_CMD_STEP_OVER:
+      case DEBUG_CMD_STEP_INTO:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            StepLine(mCommand.Command == DEBUG_CMD_STEP_INTO);
+         break;
+      case DEBUG_CMD_LIST_BREAKPOINTS:
+         ListBreakpoints();
+         break;
+      case DEBUG_CMD_SET_BREAKPOINT:
+         AddBreakpoint(mCommand.Data.BpAddr.Address);
+         break;
+      case DEBUG_CMD_DELETE_BREAKPOINT:
+         DeleteBreakpoint(mCommand.Data.BpIdx.Index);
+         break;
+      case DEBUG_CMD_ENABLE_BREAKPOINT:
+         EnableBreakpoint(mCommand.Data.BpIdx.Index);
+         break;
+      case DEBUG_CMD_DISABLE_BREAKPOINT:
+         DisableBreakpoint(mCommand.Data.BpIdx.Index);
+         break;
+      case DEBUG_CMD_REGISTER_READ:
+      {
+         sprintf(msg, "Register %s contents: 0x%x", RegisterStr[mCommand.Data.Reg.Index], GetRegister((eRegister)mCommand.Data.Reg.Index));
+         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         break;
+      }
+      case DEBUG_CMD_REGISTER_READ_ALL:
+      {
+         TRegister registers;
+
+         if (GetRegisters(&registers))
+         {
+            PushData(DATA_TYPE_REGISTERS, (u8*)&registers, sizeof(TRegister));
+         }
+         else
+         {
+            sprintf(msg, "Failed to read registers");
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         break;
+      }
+      case DEBUG_CMD_REGISTER_WRITE:
+      {
+         // if writing to instruction pointer, clear breakpoint hit index
+         if (mCommand.Data.Reg.Index == REGISTER_RIP)
+            mBreakpointHit = -1;
+
+         SetRegister((eRegister)mCommand.Data.Reg.Index, mCommand.Data.Reg.Value);
+         sprintf(msg, "Wrote Register %s contents: 0x%x", RegisterStr[mCommand.Data.Reg.Index], mCommand.Data.Reg.Value);
+         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         break;
+      }
+      case DEBUG_CMD_DATA_READ:
+      {
+         u64 address = mCommand.Data.Read.Address;
+         u64 size = (mCommand.Data.Read.Bytes < MAX_DATA) ? mCommand.Data.Read.Bytes : MAX_DATA;
+         u8 data[MAX_DATA + sizeof(u64)];
+
+         // put address in first 8 bytes of data buffer going back to front end
+         *(u64*)data = address;
+
+         u64 bytes = ReadMemory(address, &data[sizeof(u64)], size);
+
+         if (bytes < size)
+         {
+            // the map tells a bad address apart from a read that failed
+            if (!mCore.IsOpen() && mAddressSpace.IsValid() && !mAddressSpace.Find(address + bytes))
+               sprintf(msg, "Failed to read data, 0x%lx is not mapped", address + bytes);
+            else
+               sprintf(msg, "Failed to read data at 0x%lx", address + bytes);
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         else
+         {
+            PushData(DATA_TYPE_DATA, (u8*)data, size + sizeof(u64));
+         }
+         break;
+      }
+      case DEBUG_CMD_BACKTRACE:
+         if (mChildPid == 0 && !mCore.IsOpen())
+         {
+            sprintf(msg, "Target has not been started");
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         else
+            Backtrace((eUnwindMode)mCommand.Data.Backtrace.Mode, mCommand.Data.Backtrace.MaxFrames);
+         break;
+      case DEBUG_CMD_DISASSEMBLE:
+         if (mChildPid == 0 && !mCore.IsOpen())
+         {
+            sprintf(msg, "Target has not been started");
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         else
+            Disassemble(mCommand.Data.Disassemble.Address, mCommand.Data.Disassemble.Count);
+         break;
+      case DEBUG_CMD_GET_TARGET:
+         if (mTarget.length())
+         {
+            char target_pid[100] = {};
+
+            if (mChildPid)
+            {
+               sprintf(target_pid, " (pid %d%s)", mChildPid, mTargetRunning ? " running" : "");
+            }
+
+            sprintf(msg, "Target: %s%s", mTarget.c_str(), target_pid);
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+            for (size_t i = 0; i < mLaunch.Arguments.size(); i++)
+            {
+               snprintf(msg, sizeof(msg), "  argv[%lu]: %s", i + 1, mLaunch.Arguments[i].c_str());
+               PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+            }
+            for (size_t i = 0; i < mLaunch.Environment.size(); i++)
+            {
+               snprintf(msg, sizeof(msg), "  env: %s", mLaunch.Environment[i].c_str());
+               PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+            }
+            if (mLaunch.WorkingDirectory.length())
+            {
+               snprintf(msg, sizeof(msg), "  cwd: %s", mLaunch.WorkingDirectory.c_str());
+               PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+            }
+            if (mLaunch.Input.length())
+            {
+               snprintf(msg, sizeof(msg), "  stdin: %s", mLaunch.Input.c_str());
+               PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+            }
+            if (mCore.IsOpen())
+            {
+               snprintf(msg, sizeof(msg), "  core: %s (pid %d, signal %d)", mLaunch.Core.c_str(), mCore.GetPid(), mCore.GetSignal());
+               PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+            }
+         }
+         else
+         {
+            sprintf(msg, "No Target is defined");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         //PushData(DATA_TYPE_DATA, (u8*)mTarget.c_str(), mTarget.length() + sizeof(u64));
+         break;
+      case DEBUG_CMD_SET_TARGET:
+         if (mCommand.Data.String.String)
+         {
+            mTarget = (char*)mCommand.Data.String.String;
+            mLaunch = mCommand.Data.String.Launch ? *mCommand.Data.String.Launch : TLaunchSpec();
+            delete mCommand.Data.String.Launch;
+
+            if (mChildPid)
+               StopTarget();
+
+            DropStandby();
+
+            mBreakpoints.clear();
+            while (mCheckpoints.size())
+               DeleteCheckpoint(mCheckpoints.size() - 1);
+            mCore.Close();
+            VerifyTarget();
+
+            if (mLaunch.Core.length())
+               OpenCore(mLaunch.Core.c_str());
+            else
+               StartTarget();
+            delete [] mCommand.Data.String.String;
+            sprintf(msg, "Target is now: %s", mTarget.c_str());
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         break;
+      case DEBUG_CMD_CHECKPOINT:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            CreateCheckpoint();
+         break;
+      case DEBUG_CMD_RESTORE_CHECKPOINT:
+         RestoreCheckpoint(mCommand.Data.Checkpoint.Index);
+         break;
+      case DEBUG_CMD_DELETE_CHECKPOINT:
+         DeleteCheckpoint(mCommand.Data.Checkpoint.Index);
+         break;
+      case DEBUG_CMD_LIST_CHECKPOINTS:
+         ListCheckpoints();
+         break;
+      case DEBUG_CMD_LIST_LIBRARIES:
+         ListLibraries();
+         break;
+      case DEBUG_CMD_SNAPSHOT:
+      case DEBUG_CMD_DIFF:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else if (mCommand.Command == DEBUG_CMD_SNAPSHOT)
+            TakeSnapshot();
+         else
+            DiffSnapshot();
+         break;
+      case DEBUG_CMD_FIND:
+         if (mChildPid == 0 && !mCore.IsOpen())
+         {
+            sprintf(msg, "Target has not been started");
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         else
+            Find(mCommand.Data.Find.Pattern, mCommand.Data.Find.Size, mCommand.Data.Find.Alignment);
+         delete [] mCommand.Data.Find.Pattern;
+         break;
+      case DEBUG_CMD_SET_WATCHPOINT:
+      case DEBUG_CMD_DELETE_WATCHPOINT:
+      case DEBUG_CMD_LIST_WATCHPOINTS:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else if (mCommand.Command == DEBUG_CMD_SET_WATCHPOINT)
+            AddWatchpoint(mCommand.Data.Watch.Address, mCommand.Data.Watch.Size);
+         else if (mCommand.Command == DEBUG_CMD_DELETE_WATCHPOINT)
+            DeleteWatchpoint(mCommand.Data.BpIdx.Index);
+         else
+            ListWatchpoints();
+         break;
+      case DEBUG_CMD_CALL:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            CallFunction((char*)mCommand.Data.String.String);
+         delete [] mCommand.Data.String.String;
+         break;
+      case DEBUG_CMD_PROFILE:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            Profile(mCommand.Data.Profile.Milliseconds, mCommand.Data.Profile.Hz, (char*)mCommand.Data.Profile.Filename);
+         delete [] mCommand.Data.Profile.Filename;
+         break;
+      case DEBUG_CMD_GENERATE_CORE:
+         if (!mTargetRunning)
+         {
+            sprintf(msg, "Target is not running");
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         }
+         else
+            GenerateCore((char*)mCommand.Data.String.String);
+         delete [] mCommand.Data.String.String;
+         break;
+      case DEBUG_CMD_START:
+         if (mChildPid)
+         {
+            sprintf(msg, "Target has already been started, pid %d", mChildPid);
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         else
+         {
+            StartTarget();
+         }
+         break;
+      case DEBUG_CMD_STOP:
+         if (mChildPid == 0)
+         {
+            sprintf(msg, "Target has not been started");
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         }
+         else
+         {
+            StopTarget();
+         }
+         break;
+      default:
+         break;
+   }
+
+   mMutex.lock();
+   mCommand.Command = DEBUG_CMD_PROCESSED;
+
+   // the command the backend starts out with never came through SetCommand
+   if (command != DEBUG_CMD_PROCESSED && command != DEBUG_CMD_UNKNOWN)
+      AddLatency(command, std::chrono::duration<f64, std::micro>(std::chrono::steady_clock::now() - mCommandStart).count());
+   mMutex.unlock();
+   mProcessed.notify_all();
+}
+
+void CDebugBackend::GetSignalInfo()
+{
+   char       msg[256];
+   siginfo_t& info = mSignalInfo;
+
+   info = {};
+   PTRACE(PTRACE_GETSIGINFO, mChildPid, nullptr, &info);
+
+   assert(info.si_signo >= 0 && info.si_signo < NSIG);
+
+   // not really sure what do with this info?
+   //sprintf(msg, "got signal %s (%d) from %d code %d", strsignal(info.si_signo), info.si_signo, mChildPid, info.si_code);
+   //PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::Wait()
+{
+   // a write to a watched page, the instruction is done either way before the stop is reported
+   WaitStop();
+
+   ProcessStop();
+}
+
+// Waits for the target after it was resumed, continued or stepped. A write to a watched page
+// stops it with SIGSEGV before the instruction ran, StepWatchFault() finishes the instruction
+// and reports a hit, so every caller sees the target after the write. A stop right after a
+// system call that changed the layout invalidates the address space.
+eWaitResult CDebugBackend::WaitStop()
+{
+   Waitpid(mChildPid, &mWaitStatus, 0);
+   mRegistersValid = false;
+
+   // a step over a system call traps on its way out with orig_rax still holding the number,
+   // an exec reports its SIGTRAP there as well
+   if (WIFSTOPPED(mWaitStatus) && WSTOPSIG(mWaitStatus) == SIGTRAP &&
+       CAddressSpace::ChangesLayout(Ptrace(PTRACE_PEEKUSER, mChildPid, offsetof(user_regs_struct, orig_rax), nullptr)))
+      mAddressSpace.Invalidate();
+
+   if (!WIFSTOPPED(mWaitStatus) || WSTOPSIG(mWaitStatus) != SIGSEGV || mWatchedPages.empty())
+      return WAIT_STOPPED;
+
+   GetSignalInfo();
+
+   if (!IsWatchFault())
+      return WAIT_STOPPED;
+
+   return StepWatchFault() ? WAIT_WATCH_HIT : WAIT_WATCH_MISS;
+}
+
+void CDebugBackend::ProcessStop()
+{
+   char msg[256];
+
+   // the target ran, the cached register snapshot is stale
+   mRegistersValid = false;
+
+   if (WIFEXITED(mWaitStatus))
+   {
+      mTargetRunning = false;
+
+      TargetOutput();
+
+      sprintf(msg, "Target execution exited cleanly");
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+      InitializeTargetOutput();
+
+      // start a new instance
+      StartTarget();
+      return;
+   }
+   else if (WIFSTOPPED(mWaitStatus))
+   {
+      // get some info about the signal that caused the stop
+      GetSignalInfo();
+
+      // check breakpoints, only an int3 can have hit one (a single step can end right
+      // after a one byte instruction that has a breakpoint on it)
+      int bp = IsBreakpointTrap() ? CheckBreakpoints() : -1;
+      if (bp != -1)
+      {
+         sprintf(msg, "Breakpoint %d hit at 0x%x", bp + 1, mBreakpoints[bp].Address);
+         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+      }
+   }
+}
+
+bool CDebugBackend::IsBreakpointTrap() const
+{
+   return WIFSTOPPED(mWaitStatus) && WSTOPSIG(mWaitStatus) == SIGTRAP && mSignalInfo.si_code == SI_KERNEL;
+}
+
+// Starts the target with vfork, so launching doesn't get slower with the debugger's own
+// memory footprint (GL context, output buffer). Everything exec needs is built up front and
+// every descriptor the debugger opens is O_CLOEXEC, the target only inherits stdin, stdout
+// and stderr. Returns the pid, which stops itself at its first instruction, 0 when the
+// target couldn't be started (already reported) or -1 when no process could be created.
+pid_t CDebugBackend::LaunchTarget()
+{
+   std::vector<char*> arguments;
+   std::vector<char*> environment;
+   volatile int       failure = 0; // written by the child, it shares our memory until it execs
+   char               msg[256];
+   volatile int       input_fd = -1;
+
+   arguments.push_back((char*)mTarget.c_str());
+   for (size_t i = 0; i < mLaunch.Arguments.size(); i++)
+      arguments.push_back((char*)mLaunch.Arguments[i].c_str());
+   arguments.push_back(nullptr);
+
+   for (char** env = environ; *env; env++)
+   {
+      bool replaced = false;
+
+      for (size_t i = 0; i < mLaunch.Environment.size() && !replaced; i++)
+      {
+         size_t length = mLaunch.Environment[i].find('=');
+
+         replaced = (length != std::string::npos && strncmp(*env, mLaunch.Environment[i].c_str(), length + 1) == 0);
+      }
+
+      if (!replaced)
+         environment.push_back(*env);
+   }
+   for (size_t i = 0; i < mLaunch.Environment.size(); i++)
+      environment.push_back((char*)mLaunch.Environment[i].c_str());
+   environment.push_back(nullptr);
+
+   if (mLaunch.Input.length())
+   {
+      input_fd = open(mLaunch.Input.c_str(), O_RDONLY | O_CLOEXEC);
+
+      if (input_fd == -1)
+      {
+         sprintf(msg, "Couldn't open %s for input: %s", mLaunch.Input.c_str(), strerror(errno));
+         PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         return 0;
+      }
+   }
+
+   // appending keeps the output of every instance at the end of the file, even after the
+   // debugger truncated it for the next one
+   volatile int output_fd = open(TargetOutputStr, O_WRONLY | O_APPEND | O_CLOEXEC);
+
+   // the child reads these after vfork, they must not live in registers it can clobber
+   const char* volatile  directory = mLaunch.WorkingDirectory.length() ? mLaunch.WorkingDirectory.c_str() : nullptr;
+   char* const* volatile argv = arguments.data();
+   char* const* volatile envp = environment.data();
+
+   pid_t pid = vfork();
+
+   if (pid == 0)
+   {
+      // the child runs on our stack until it execs, so only plain system calls here: no
+      // function calls into the debugger, no allocations, no locks. The raw ptrace, the
+      // counting wrapper would write to mStats in our memory.
+      personality(ADDR_NO_RANDOMIZE);
+
+      if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0 ||
+          (directory && chdir(directory) < 0) ||
+          (input_fd != -1 && dup2(input_fd, 0) < 0) ||
+          (output_fd != -1 && dup2(output_fd, 1) < 0))
+      {
+         failure = errno;
+      }
+      else
+      {
+         execve(argv[0], argv, envp);
+         failure = errno;
+      }
+
+      // the exec failed, this must never get back into the debugger
+      _exit(127);
+   }
+
+   if (input_fd != -1)
+      close(input_fd);
+   if (output_fd != -1)
+      close(output_fd);
+
+   if (pid > 0 && failure)
+   {
+      int status;
+
+      Waitpid(pid, &status, 0);
+
+      sprintf(msg, "Couldn't start %s: %s", mTarget.c_str(), strerror(failure));
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return 0;
+   }
+
+   return pid;
+}
+
+// Starts the next instance of the target ahead of time. It execs and stops at its first
+// instruction on its own while the current one is debugged, StartTarget() only has to wait
+// for a stop that usually happened long ago.
+void CDebugBackend::SpawnStandby()
+{
+   if (mStandbyPid == 0 && mTarget.length())
+   {
+      mStandbyPid = LaunchTarget();
+
+      if (mStandbyPid < 0)
+         mStandbyPid = 0;
+   }
+}
+
+void CDebugBackend::DropStandby()
+{
+   int status;
+
+   if (mStandbyPid > 0)
+   {
+      kill(mStandbyPid, SIGKILL);
+      Waitpid(mStandbyPid, &status, 0);
+   }
+
+   mStandbyPid = 0;
+}
+
+void CDebugBackend::StartTarget()
+{
+   char msg[256];
+
+   mBreakpointHit = -1;
+
+   // running the target leaves the core behind, like starting it fresh
+   if (mCore.IsOpen())
+   {
+      mCore.Close();
+      mLaunch.Core.clear();
+   }
+
+   if (!mTargetRunning && mTarget.length())
+   {
+      auto start = std::chrono::steady_clock::now();
+      bool standby = false;
+
+      if (mStandbyPid)
+      {
+         mChildPid = mStandbyPid;
+         mStandbyPid = 0;
+
+         // a standby that couldn't exec is gone, launch the slow way to report it
+         Waitpid(mChildPid, &mWaitStatus, 0);
+         standby = WIFSTOPPED(mWaitStatus);
+      }
+
+      if (!standby)
+      {
+         mChildPid = LaunchTarget();
+
+         if (mChildPid == 0)
+            return;
+
+         if (mChildPid < 0)
+         {
+            char msg[256];
+            sprintf(msg, "Error forking child process %s (%d)", strerror(errno), errno);
+            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+            mRunning = false;
+            return;
+         }
+
+         // Wait for child to stop on its first instruction
+         Waitpid(mChildPid, &mWaitStatus, 0);
+      }
+
+      ProcessStop();
+
+      auto end = std::chrono::steady_clock::now();
+
+      sprintf(msg, "Debugging started on %s, pid %d (%s %.1f us)", mTarget.c_str(), mChildPid,
+              standby ? "standby ready in" : "launch to first stop", std::chrono::duration<f64, std::micro>(end - start).count());
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+      PushData(DATA_TYPE_PID, (u8*)&mChildPid, sizeof(mChildPid));
+
+      LoadTargetInfo();
+
+      mOutputFd = open(TargetOutputStr, O_RDONLY | O_CLOEXEC);
+
+      //PTRACE(PTRACE_SETOPTIONS, mChildPid, nullptr, PTRACE_O_TRACEEXIT);
+
+      SpawnStandby();
+   }
+
+   if (mBreakpoints.size() > 0)
+   {
+      // set all breakpoints on new instance
+      size_t num_breakpoints = mBreakpoints.size();
+      for (size_t i = 0; i < num_breakpoints; i++)
+      {
+         AddBreakpoint(mBreakpoints[i].Address);
+         if (!mBreakpoints[i].Enabled)
+         {
+            size_t new_bp_idx = mBreakpoints.size();
+            DisableBreakpoint(new_bp_idx);
+         }
+      }
+
+      // delete old breakpoints in reverse order
+      for (size_t i = num_breakpoints; i > 0; i--)
+      {
+         mBreakpoints.erase(mBreakpoints.begin() + (i - 1));
+      }
+   }
+}
+
+void CDebugBackend::AttachTarget()
+{
+   char msg[256];
+
+   mBreakpointHit = -1;
+
+   if (!mTargetRunning && mTarget.length())
+   {
+      PTRACE(PTRACE_ATTACH, mChildPid, nullptr, nullptr);
+
+      sprintf(msg, "Debugging attached to %s, pid %d", mTarget.c_str(), mChildPid);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+      PushData(DATA_TYPE_PID, (u8*)&mChildPid, sizeof(mChildPid));
+
+      // Wait for child to stop on its first instruction
+      Wait();
+
+      LoadTargetInfo();
+
+      mOutputFd = open(TargetOutputStr, O_RDONLY | O_CLOEXEC);
+      mTargetRunning = true;
+
+      //PTRACE(PTRACE_SETOPTIONS, mChildPid, nullptr, PTRACE_O_TRACEEXIT);
+   }
+
+   if (mBreakpoints.size() > 0)
+   {
+      // set all breakpoints on new instance
+      size_t num_breakpoints = mBreakpoints.size();
+      for (size_t i = 0; i < num_breakpoints; i++)
+      {
+         AddBreakpoint(mBreakpoints[i].Address);
+         if (!mBreakpoints[i].Enabled)
+         {
+            size_t new_bp_idx = mBreakpoints.size();
+            DisableBreakpoint(new_bp_idx);
+         }
+      }
+
+      // delete old breakpoints in reverse order
+      for (size_t i = num_breakpoints; i > 0; i--)
+      {
+         mBreakpoints.erase(mBreakpoints.begin() + (i - 1));
+      }
+   }
+}
+
+void CDebugBackend::StopTarget()
+{
+   if (PTRACE(PTRACE_KILL, mChildPid, nullptr, nullptr) < 0)
+   {
+      return;
+   }
+
+   mWaitStatus = 0;
+   mChildPid = 0;
+   mTargetRunning = false;
+   mRegistersValid = false;
+}
+
+// Makes Pid clone itself by planting a syscall instruction at its rip. PTRACE_O_TRACEFORK has
+// the copy start out stopped and traced by us, CLONE_PARENT makes it a sibling of Pid so the
+// debugger (the parent of the original target) reaps it. Pid is put back exactly as it was,
+// the copy gets the same registers and its own copy of the syscall patch is undone, so it is
+// a duplicate that hasn't run a single instruction. Returns 0 on failure.
+pid_t CDebugBackend::InjectFork(pid_t Pid)
+{
+   user_regs_struct saved;
+   s64              child = 0;
+   int              status = 0;
+
+   if (Ptrace(PTRACE_GETREGS, Pid, nullptr, &saved) < 0)
+      return 0;
+
+   errno = 0;
+   long word = Ptrace(PTRACE_PEEKTEXT, Pid, saved.rip, nullptr);
+   if (errno)
+      return 0;
+
+   // same stack, copied
+   if (Ptrace(PTRACE_SETOPTIONS, Pid, nullptr, PTRACE_O_TRACEFORK) < 0 ||
+       !InjectSyscall(Pid, SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, &child) || child < 0)
+      child = 0;
+
+   Ptrace(PTRACE_SETOPTIONS, Pid, nullptr, 0);
+
+   if (child > 0)
+   {
+      // the copy comes up with a SIGSTOP, resuming it later without a signal discards that
+      Waitpid(child, &status, __WALL);
+
+      Ptrace(PTRACE_SETOPTIONS, child, nullptr, 0);
+      Ptrace(PTRACE_POKETEXT, child, saved.rip, word);
+      Ptrace(PTRACE_SETREGS, child, nullptr, &saved);
+   }
+
+   return child;
+}
+
+void CDebugBackend::CreateCheckpoint()
+{
+   char msg[256];
+
+   auto  start = std::chrono::steady_clock::now();
+   pid_t pid = InjectFork(mChildPid);
+
+   if (pid <= 0)
+   {
+      sprintf(msg, "Failed to create a checkpoint of pid %d", mChildPid);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   // the copy is kept without int3 patches, breakpoints can change before it's restored
+   for (size_t i = 0; i < mBreakpoints.size(); i++)
+   {
+      if (!mBreakpoints[i].Enabled)
+         continue;
+
+      u64 data = Ptrace(PTRACE_PEEKTEXT, pid, mBreakpoints[i].Address, nullptr);
+      Ptrace(PTRACE_POKETEXT, pid, mBreakpoints[i].Address, (data & ~0xff) | mBreakpoints[i].SavedData);
+   }
+
+   // and with its watched pages writable again, for the same reason
+   ProtectPages(pid, 0, ~0ull, false);
+
+   TCheckpoint checkpoint = { pid, GetRegister(REGISTER_RIP) };
+   mCheckpoints.push_back(checkpoint);
+
+   auto end = std::chrono::steady_clock::now();
+
+   sprintf(msg, "Checkpoint %lu at 0x%lx, pid %d (%.1f us)", mCheckpoints.size(), checkpoint.Rip, pid,
+           std::chrono::duration<f64, std::micro>(end - start).count());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::RestoreCheckpoint(u64 Index)
+{
+   char msg[256];
+   int  status;
+
+   if (Index >= mCheckpoints.size())
+   {
+      sprintf(msg, "No checkpoint %lu", Index + 1);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   auto  start = std::chrono::steady_clock::now();
+   pid_t pid = InjectFork(mCheckpoints[Index].Pid);
+
+   if (pid <= 0)
+   {
+      sprintf(msg, "Failed to restore checkpoint %lu", Index + 1);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   // the current target is thrown away, its checkpoints are siblings and live on
+   if (mChildPid > 0)
+   {
+      kill(mChildPid, SIGKILL);
+      Waitpid(mChildPid, &status, __WALL);
+   }
+
+   mChildPid = pid;
+   mWaitStatus = 0x7f | (SIGSTOP << 8); // stopped, like waitpid reported for the copy
+   mTargetRunning = true;
+   mRegistersValid = false;
+   mAddressSpace.Invalidate();
+   mBreakpointHit = -1;
+   mTemporaryBreakpoints.clear();
+   mInstructionCache.Clear();
+
+   u64 rip = GetRegister(REGISTER_RIP);
+
+   for (size_t i = 0; i < mBreakpoints.size(); i++)
+   {
+      if (!mBreakpoints[i].Enabled)
+         continue;
+
+      u64 data = GetData(mBreakpoints[i].Address);
+
+      mBreakpoints[i].SavedData = data;
+      SetData(mBreakpoints[i].Address, (data & ~0xff) | SW_INTERRUPT_3);
+
+      if (mBreakpoints[i].Address == rip)
+         mBreakpointHit = i;
+   }
+
+   ReapplyWatchpoints();
+
+   auto end = std::chrono::steady_clock::now();
+
+   sprintf(msg, "Restored checkpoint %lu at 0x%lx, pid %d (%.1f us)", Index + 1, rip, pid,
+           std::chrono::duration<f64, std::micro>(end - start).count());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   PushData(DATA_TYPE_PID, (u8*)&mChildPid, sizeof(mChildPid));
+}
+
+void CDebugBackend::DeleteCheckpoint(u64 Index)
+{
+   int status;
+
+   if (Index < mCheckpoints.size())
+   {
+      kill(mCheckpoints[Index].Pid, SIGKILL);
+      Waitpid(mCheckpoints[Index].Pid, &status, __WALL);
+      mCheckpoints.erase(mCheckpoints.begin() + Index);
+   }
+}
+
+void CDebugBackend::ListCheckpoints()
+{
+   char msg[256];
+
+   sprintf(msg, "Number of checkpoints: %lu", mCheckpoints.size());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   for (size_t i = 0; i < mCheckpoints.size(); i++)
+   {
+      u64               offset;
+      const TElfSymbol* symbol = FindSymbol(mCheckpoints[i].Rip, &offset);
+
+      if (symbol)
+         sprintf(msg, "  Checkpoint %4lu: 0x%lx <%s+0x%lx> pid %d", i + 1, mCheckpoints[i].Rip, symbol->Name,
+                 offset, mCheckpoints[i].Pid);
+      else
+         sprintf(msg, "  Checkpoint %4lu: 0x%lx pid %d", i + 1, mCheckpoints[i].Rip, mCheckpoints[i].Pid);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+}
+
+void CDebugBackend::GenerateCore(const char* Filename)
+{
+   CCoreWriter         writer;
+   TCoreStats          stats;
+   TRegister           registers;
+   user_fpregs_struct  fp_registers;
+   user_fpregs_struct* fp = &fp_registers;
+   char                filename[64];
+   char                msg[256];
+
+   if (!Filename)
+   {
+      sprintf(filename, "core.%d", mChildPid);
+      Filename = filename;
+   }
+
+   if (!GetRegisters(&registers))
+   {
+      sprintf(msg, "Failed to read registers");
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   if (Ptrace(PTRACE_GETFPREGS, mChildPid, nullptr, &fp_registers) < 0)
+      fp = nullptr;
+
+   auto start = std::chrono::steady_clock::now();
+
+   // memory goes through ReadCode so the core has the original bytes under our breakpoints
+   bool result = writer.Write(Filename, mChildPid, WIFSTOPPED(mWaitStatus) ? WSTOPSIG(mWaitStatus) : SIGSTOP,
+                              &registers, fp, ReadCodeCallback, this, &stats);
+
+   f64 seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+
+   if (!result)
+   {
+      sprintf(msg, "Failed to write core file: %s", writer.GetError());
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   sprintf(msg, "Saved core file %.100s: %lu segments, %.1f MB of memory, %.1f MB written, %.3f s, %.0f MB/s",
+           Filename, stats.Segments, stats.MemoryBytes / 1048576.0, stats.WrittenBytes / 1048576.0, seconds,
+           (seconds > 0.0) ? stats.MemoryBytes / 1048576.0 / seconds : 0.0);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::OpenCore(const char* Filename)
+{
+   char msg[256];
+
+   if (!mTarget.length())
+      return;
+
+   if (!mCore.Open(Filename))
+   {
+      snprintf(msg, sizeof(msg), "Couldn't read core file %s", Filename);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      mLaunch.Core.clear();
+      return;
+   }
+
+   LoadTargetInfo();
+
+   u64               rip = mCore.GetRegisters()->Reg.rip;
+   u64               offset;
+   const TElfSymbol* symbol = FindSymbol(rip, &offset);
+
+   snprintf(msg, sizeof(msg), "Core of pid %d (%s), %lu segments", mCore.GetPid(), mCore.GetCommandLine(),
+            mCore.GetSegments().size());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   if (symbol)
+      snprintf(msg, sizeof(msg), "Program stopped with signal %d (%s) at 0x%lx <%s+0x%lx>", mCore.GetSignal(),
+               strsignal(mCore.GetSignal()), rip, symbol->Name, offset);
+   else
+      snprintf(msg, sizeof(msg), "Program stopped with signal %d (%s) at 0x%lx", mCore.GetSignal(),
+               strsignal(mCore.GetSignal()), rip);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   TRegister registers = *mCore.GetRegisters();
+   PushData(DATA_TYPE_REGISTERS, (u8*)&registers, sizeof(TRegister));
+}
+
+void CDebugBackend::Find(const u8* Pattern, u64 Size, u64 Alignment)
+{
+   char msg[256];
+
+   if (Size == 0 || Size > CMemorySearch::MAX_PATTERN)
+   {
+      sprintf(msg, "Search pattern must be 1 to %u bytes", CMemorySearch::MAX_PATTERN);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   std::vector<TSearchRange> ranges;
+
+   mSearchMaps.clear();
+
+   if (mCore.IsOpen())
+   {
+      for (const TCoreSegment& segment : mCore.GetSegments())
+      {
+         if (segment.Flags & ELF_SEGMENT_FLAG_R)
+            mSearchMaps.push_back({ segment.Start, segment.End, 0, MEMORY_MAP_READ, "" });
+      }
+   }
+   else
+   {
+      UpdateAddressSpace();
+
+      for (const TMemoryMap& map : mAddressSpace.GetMaps())
+      {
+         // the kernel's pages can't be read through process_vm_readv
+         if ((map.Flags & MEMORY_MAP_READ) && map.Path != "[vvar]" && map.Path != "[vsyscall]")
+            mSearchMaps.push_back(map);
+      }
+   }
+
+   for (const TMemoryMap& map : mSearchMaps)
+      ranges.push_back({ map.Start, map.End });
+
+   TSearchStats stats;
+
+   mSearch.Search(ranges, Pattern, Size, Alignment, MAX_FIND_MATCHES, ReadSearchCallback, this, FoundCallback, this, &stats);
+
+   f64 mb = stats.Bytes / 1048576.0;
+
+   sprintf(msg, "%s %lu matches in %.1f MB of %lu mappings, %.3f s, %.0f MB/s (%u threads, %s)",
+           stats.Cancelled ? "Search cancelled," : stats.Truncated ? "Search stopped at" : "Found", stats.Matches, mb,
+           mSearchMaps.size(), stats.Seconds, (stats.Seconds > 0.0) ? mb / stats.Seconds : 0.0, stats.Threads,
+           CMemorySearch::GetScanner());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   if (stats.Unreadable)
+   {
+      sprintf(msg, "%lu bytes could not be read", stats.Unreadable);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+
+   mSearchMaps.clear();
+}
+
+void CDebugBackend::FoundCallback(void* Context, u64 Address, u32 Range)
+{
+   CDebugBackend*    backend = (CDebugBackend*)Context;
+   const TMemoryMap& map = backend->mSearchMaps[Range];
+   u64               offset;
+   const TElfSymbol* symbol = backend->FindSymbol(Address, &offset);
+   char              msg[512];
+
+   if (symbol)
+      snprintf(msg, sizeof(msg), "0x%016lx <%s+0x%lx>", Address, symbol->Name, offset);
+   else if (map.Path.length())
+      snprintf(msg, sizeof(msg), "0x%016lx in %s+0x%lx", Address, map.Path.c_str(), Address - map.Start);
+   else
+      snprintf(msg, sizeof(msg), "0x%016lx", Address);
+
+   backend->PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::TakeSnapshot()
+{
+   char msg[256];
+
+   UpdateAddressSpace();
+
+   auto start = std::chrono::steady_clock::now();
+
+   // memory goes through ReadCode so a later diff doesn't see our breakpoints come and go
+   mSnapshot.Take(mChildPid, mAddressSpace.GetMaps(), ReadCodeCallback, this);
+
+   f64 seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+
+   sprintf(msg, "Snapshot of %.1f MB of writable memory, %.1f MB stored, %.3f s, changes tracked with %s",
+           mSnapshot.GetPages() * PAGE_SIZE / 1048576.0, mSnapshot.GetStoredBytes() / 1048576.0, seconds,
+           mSnapshot.HasSoftDirty() ? "soft-dirty bits" : "page hashes");
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::DiffSnapshot()
+{
+   char msg[512];
+
+   if (!mSnapshot.IsValid())
+   {
+      sprintf(msg, "No snapshot, take one with snapshot first");
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   if (mSnapshot.GetPid() != mChildPid)
+   {
+      sprintf(msg, "Snapshot is of pid %d, target is now pid %d", mSnapshot.GetPid(), mChildPid);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   std::vector<TMemoryChange> changes;
+   TSnapshotStats             stats;
+
+   UpdateAddressSpace();
+   mSnapshot.Diff(mAddressSpace.GetMaps(), ReadCodeCallback, this, MAX_DIFF_CHANGES, changes, &stats);
+
+   sprintf(msg, "%lu changes, %lu bytes written in %lu of %lu pages, %lu pages read using %s, %.3f s", stats.Ranges,
+           stats.Bytes, stats.Changed, stats.Pages, stats.Checked, stats.SoftDirty ? "soft-dirty bits" : "page hashes",
+           stats.Seconds);
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   for (const TMemoryChange& change : changes)
+   {
+      const TMemoryMap* map = mAddressSpace.Find(change.Address);
+      int               length;
+
+      if (change.Type == MEMORY_CHANGE_MAPPED)
+         length = sprintf(msg, "  0x%016lx-0x%016lx mapped", change.Address, change.Address + change.Size);
+      else if (change.Type == MEMORY_CHANGE_UNMAPPED)
+         length = sprintf(msg, "  0x%016lx-0x%016lx unmapped", change.Address, change.Address + change.Size);
+      else
+         length = sprintf(msg, "  0x%016lx %lu bytes", change.Address, change.Size);
+
+      // the path is cut short so the values after it always fit
+      if (map && map->Path.length())
+         length += snprintf(&msg[length], sizeof(msg) - length, " in %.200s+0x%lx", map->Path.c_str(), change.Address - map->Start);
+      length = std::min(length, (int)sizeof(msg) - 1);
+
+      // small changes are values, show them
+      if (change.Type == MEMORY_CHANGE_WRITTEN && change.Size <= sizeof(change.Old))
+      {
+         length += snprintf(&msg[length], sizeof(msg) - length, ": ");
+         for (u64 i = 0; i < change.Size && length < (int)sizeof(msg) - 1; i++)
+            length += snprintf(&msg[length], sizeof(msg) - length, "%02x", change.Old[i]);
+         length = std::min(length, (int)sizeof(msg) - 1);
+         length += snprintf(&msg[length], sizeof(msg) - length, " -> ");
+         for (u64 i = 0; i < change.Size && length < (int)sizeof(msg) - 1; i++)
+            length += snprintf(&msg[length], sizeof(msg) - length, "%02x", change.New[i]);
+         length = std::min(length, (int)sizeof(msg) - 1);
+      }
+
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, length);
+   }
+
+   if (stats.Ranges > changes.size())
+   {
+      sprintf(msg, "  ... %lu more", stats.Ranges - changes.size());
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+}
+
+// Runs one system call in Pid by planting a syscall instruction at its rip and puts the
+// instruction and the registers back. Result is the raw return value, a negative errno on
+// failure. A ptrace event the call reports (a fork with PTRACE_O_TRACEFORK) stops the target
+// inside the syscall, one more step finishes it.
+bool CDebugBackend::InjectSyscall(pid_t Pid, u64 Number, u64 Arg0, u64 Arg1, u64 Arg2, s64* Result)
+{
+   user_regs_struct saved;
+   user_regs_struct regs;
+   int              status = 0;
+   bool             result = false;
+
+   if (Ptrace(PTRACE_GETREGS, Pid, nullptr, &saved) < 0)
+      return false;
+
+   errno = 0;
+   long word = Ptrace(PTRACE_PEEKTEXT, Pid, saved.rip, nullptr);
+   if (errno)
+      return false;
+
+   regs = saved;
+   regs.rax = Number;
+   regs.rdi = Arg0;
+   regs.rsi = Arg1;
+   regs.rdx = Arg2;
+   regs.r10 = 0;
+   regs.r8 = 0;
+   regs.orig_rax = -1; // don't let a syscall the target was stopped in get restarted
+
+   if (Ptrace(PTRACE_POKETEXT, Pid, saved.rip, (word & ~0xffffl) | 0x050f) == 0 &&
+       Ptrace(PTRACE_SETREGS, Pid, nullptr, &regs) == 0 &&
+       Ptrace(PTRACE_SINGLESTEP, Pid, nullptr, nullptr) == 0)
+   {
+      Waitpid(Pid, &status, __WALL);
+
+      if (WIFSTOPPED(status) && (status >> 16) != 0)
+      {
+         Ptrace(PTRACE_SINGLESTEP, Pid, nullptr, nullptr);
+         Waitpid(Pid, &status, __WALL);
+      }
+
+      if (WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP && Ptrace(PTRACE_GETREGS, Pid, nullptr, &regs) == 0)
+      {
+         *Result = regs.rax;
+         result = true;
+      }
+   }
+
+   Ptrace(PTRACE_POKETEXT, Pid, saved.rip, word);
+   Ptrace(PTRACE_SETREGS, Pid, nullptr, &saved);
+
+   return result;
+}
+
+// Sets the watched pages between Start and End read-only or back to what they were, one
+// mprotect per run of adjacent pages with the same protection
+bool CDebugBackend::ProtectPages(pid_t Pid, u64 Start, u64 End, bool ReadOnly)
+{
+   bool result = true;
+   auto it = mWatchedPages.lower_bound(Start);
+
+   while (it != mWatchedPages.end() && it->first < End)
+   {
+      u64 first = it->first;
+      u64 last = first + PAGE_SIZE;
+      u32 protection = it->second;
+      s64 status = 0;
+
+      for (++it; it != mWatchedPages.end() && it->first == last && last < End && it->second == protection; ++it)
+         last += PAGE_SIZE;
+
+      if (ReadOnly)
+         protection &= ~PROT_WRITE;
+
+      if (!InjectSyscall(Pid, SYS_mprotect, first, last - first, protection, &status) || status != 0)
+         result = false;
+   }
+
+   return result;
+}
+
+// Makes the pages under Watchpoint read-only, remembering what they were the first time
+bool CDebugBackend::WatchPages(const TWatchpoint& Watchpoint)
+{
+   u64 start = Watchpoint.Address & ~(u64)(PAGE_SIZE - 1);
+   u64 end = (Watchpoint.Address + Watchpoint.Size + PAGE_SIZE - 1) & ~(u64)(PAGE_SIZE - 1);
+
+   std::vector<std::pair<u64, u32>> pages;
+
+   UpdateAddressSpace();
+
+   // pages another watchpoint made read-only already are known, the rest has to be writable
+   for (u64 page = start; page < end; page += PAGE_SIZE)
+   {
+      if (mWatchedPages.count(page))
+         continue;
+
+      const TMemoryMap* map = mAddressSpace.Find(page);
+
+      if (!map || (map->Flags & (MEMORY_MAP_READ | MEMORY_MAP_WRITE)) != (MEMORY_MAP_READ | MEMORY_MAP_WRITE))
+         return false;
+
+      pages.push_back(std::make_pair(page, (map->Flags & MEMORY_MAP_EXEC) ? PROT_READ | PROT_WRITE | PROT_EXEC : PROT_READ | PROT_WRITE));
+   }
+
+   mWatchedPages.insert(pages.begin(), pages.end());
+
+   return ProtectPages(mChildPid, start, end, true);
+}
+
+// Gives back the pages of watchpoint Index that no other watchpoint needs
+void CDebugBackend::UnwatchPages(u64 Index)
+{
+   const TWatchpoint& watchpoint = mWatchpoints[Index];
+   u64                start = watchpoint.Address & ~(u64)(PAGE_SIZE - 1);
+   u64                end = (watchpoint.Address + watchpoint.Size + PAGE_SIZE - 1) & ~(u64)(PAGE_SIZE - 1);
+   u64                run = start;
+
+   for (u64 page = start; page <= end; page += PAGE_SIZE)
+   {
+      bool shared = false;
+
+      for (size_t i = 0; page < end && i < mWatchpoints.size() && !shared; i++)
+      {
+         const TWatchpoint& other = mWatchpoints[i];
+
+         shared = i != Index && other.Enabled && other.Address < page + PAGE_SIZE && other.Address + other.Size > page;
+      }
+
+      // restore the pages up to a shared one or the end in one go
+      if (shared || page == end)
+      {
+         ProtectPages(mChildPid, run, page, false);
+         mWatchedPages.erase(mWatchedPages.lower_bound(run), mWatchedPages.lower_bound(page));
+         run = page + PAGE_SIZE;
+      }
+   }
+}
+
+void CDebugBackend::AddWatchpoint(u64 Address, u64 Size)
+{
+   char        msg[256];
+   TWatchpoint watchpoint = { Address, Size ? Size : sizeof(u64), {}, 0, true };
+
+   watchpoint.Value.resize(watchpoint.Size);
+
+   auto start = std::chrono::steady_clock::now();
+   u64  pages = mWatchedPages.size();
+
+   if (ReadMemory(Address, watchpoint.Value.data(), watchpoint.Size) != watchpoint.Size || !WatchPages(watchpoint))
+   {
+      sprintf(msg, "Can't watch 0x%lx-0x%lx, it isn't all writable memory", Address, Address + watchpoint.Size);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   mWatchpoints.push_back(watchpoint);
+
+   auto end = std::chrono::steady_clock::now();
+
+   sprintf(msg, "Watchpoint %lu at 0x%lx, %lu bytes, %lu pages made read-only (%.1f us)", mWatchpoints.size(), Address,
+           watchpoint.Size, mWatchedPages.size() - pages, std::chrono::duration<f64, std::micro>(end - start).count());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+}
+
+void CDebugBackend::DeleteWatchpoint(u64 Index)
+{
+   char msg[256];
+
+   if (Index >= mWatchpoints.size())
+   {
+      sprintf(msg, "No watchpoint %lu", Index + 1);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   if (mWatchpoints[Index].Enabled)
+      UnwatchPages(Index);
+
+   mWatchpoints.erase(mWatchpoints.begin() + Index);
+}
+
+void CDebugBackend::ListWatchpoints()
+{
+   char msg[256];
+
+   sprintf(msg, "Number of watchpoints: %lu, %lu pages read-only", mWatchpoints.size(), mWatchedPages.size());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   for (size_t i = 0; i < mWatchpoints.size(); i++)
+   {
+      sprintf(msg, "  Watchpoint %4lu: 0x%016lx %lu bytes, %lu hits%s", i + 1, mWatchpoints[i].Address, mWatchpoints[i].Size,
+              mWatchpoints[i].Hits, mWatchpoints[i].Enabled ? "" : ", disabled");
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+}
+
+// Protects the pages again in a new or restored process, the old protections mean nothing there
+void CDebugBackend::ReapplyWatchpoints()
+{
+   char msg[256];
+
+   mWatchedPages.clear();
+
+   for (size_t i = 0; i < mWatchpoints.size(); i++)
+   {
+      TWatchpoint& watchpoint = mWatchpoints[i];
+
+      if (!watchpoint.Enabled)
+         continue;
+
+      if (ReadMemory(watchpoint.Address, watchpoint.Value.data(), watchpoint.Size) != watchpoint.Size || !WatchPages(watchpoint))
+      {
+         watchpoint.Enabled = false;
+
+         sprintf(msg, "Watchpoint %lu disabled, 0x%lx isn't writable memory in pid %d", i + 1, watchpoint.Address, mChildPid);
+         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+      }
+   }
+}
+
+bool CDebugBackend::IsWatchFault() const
+{
+   if (!WIFSTOPPED(mWaitStatus) || WSTOPSIG(mWaitStatus) != SIGSEGV || mSignalInfo.si_code != SEGV_ACCERR)
+      return false;
+
+   return mWatchedPages.count((u64)mSignalInfo.si_addr & ~(u64)(PAGE_SIZE - 1)) != 0;
+}
+
+// The target faulted writing to a watched page. The page is made writable for one step of the
+// faulting instruction and read-only again; a write that crosses into another watched page
+// faults inside the step and opens that one too. Returns true when a watched byte was written,
+// the target is then stopped after the instruction; false means the write only hit
+// neighbouring bytes and the target can go on.
+bool CDebugBackend::StepWatchFault()
+{
+   char             msg[256];
+   std::vector<u64> pages;
+   std::vector<u64> faults;
+   u64              rip = GetRegister(REGISTER_RIP);
+   int              hit = -1;
+
+   auto start = std::chrono::steady_clock::now();
+
+   mWatchFaults++;
+
+   for (;;)
+   {
+      u64 fault = (u64)mSignalInfo.si_addr;
+      u64 page = fault & ~(u64)(PAGE_SIZE - 1);
+
+      ProtectPages(mChildPid, page, page + PAGE_SIZE, false);
+      pages.push_back(page);
+      faults.push_back(fault);
+
+      // a rep prefixed instruction traps after every iteration, it's done once rip moves on
+      do
+      {
+         Ptrace(PTRACE_SINGLESTEP, mChildPid, nullptr, nullptr);
+         Waitpid(mChildPid, &mWaitStatus, 0);
+         mRegistersValid = false;
+      } while (WIFSTOPPED(mWaitStatus) && WSTOPSIG(mWaitStatus) == SIGTRAP && GetRegister(REGISTER_RIP) == rip);
+
+      if (!WIFSTOPPED(mWaitStatus) || WSTOPSIG(mWaitStatus) != SIGSEGV || pages.size() == MAX_WATCH_PAGES)
+         break;
+
+      GetSignalInfo();
+
+      if (!IsWatchFault())
+         break;
+   }
+
+   for (u64 page : pages)
+      ProtectPages(mChildPid, page, page + PAGE_SIZE, true);
+
+   // the target is gone or was stopped by something else, that is what gets reported
+   if (!WIFSTOPPED(mWaitStatus) || WSTOPSIG(mWaitStatus) != SIGTRAP)
+      return true;
+
+   for (size_t i = 0; i < mWatchpoints.size(); i++)
+   {
+      TWatchpoint& watchpoint = mWatchpoints[i];
+
+      if (!watchpoint.Enabled)
+         continue;
+
+      for (u64 page : pages)
+      {
+         u64 first = std::max(watchpoint.Address, page);
+         u64 last = std::min(watchpoint.Address + watchpoint.Size, page + PAGE_SIZE);
+         u8  current[PAGE_SIZE];
+
+         if (first >= last || ReadMemory(first, current, last - first) != last - first)
+            continue;
+
+         u8* value = &watchpoint.Value[first - watchpoint.Address];
+         u64 changed = 0;
+
+         while (changed < last - first && value[changed] == current[changed])
+            changed++;
+
+         // the same value written again still counts when the fault was on a watched byte
+         bool written = changed < last - first;
+
+         for (u64 fault : faults)
+            written |= fault >= first && fault < last;
+
+         if (!written)
+            continue;
+
+         if (hit == -1)
+         {
+            u64               offset;
+            const TElfSymbol* symbol = FindSymbol(rip, &offset);
+            int               length;
+
+            hit = i;
+            watchpoint.Hits++;
+
+            if (symbol)
+               length = snprintf(msg, 128, "Watchpoint %lu hit by 0x%lx <%s+0x%lx>", i + 1, rip, symbol->Name, offset);
+            else
+               length = sprintf(msg, "Watchpoint %lu hit by 0x%lx", i + 1, rip);
+
+            if (changed == last - first)
+               length += sprintf(&msg[length], ", 0x%lx written with the same value", faults[0]);
+            else
+            {
+               u64 bytes = std::min(last - first - changed, (u64)sizeof(u64));
+
+               length += sprintf(&msg[length], ", 0x%lx: ", first + changed);
+               for (u64 b = 0; b < bytes; b++)
+                  length += sprintf(&msg[length], "%02x", value[changed + b]);
+               length += sprintf(&msg[length], " -> ");
+               for (u64 b = 0; b < bytes; b++)
+                  length += sprintf(&msg[length], "%02x", current[changed + b]);
+            }
+
+            PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, length);
+         }
+
+         memcpy(value, current, last - first);
+      }
+   }
+
+   if (hit == -1)
+      mWatchMisses++;
+
+   mWatchSeconds += std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+
+   return hit != -1;
+}
+
+// Calls a function in the stopped target, "name arg ..." or "name(arg, ...)". Arguments are
+// numbers, register names, function names or quoted strings, which are copied onto the stack
+// below the red zone. The return address is the executable's entry point with an int3 on it,
+// code that never runs again once the target started. Registers, including the FPU and SSE
+// state, are put back afterwards whatever the callee did: returned, crashed, hit a breakpoint
+// or didn't return within CALL_TIMEOUT_MS.
+void CDebugBackend::CallFunction(const char* Expression)
+{
+   static const eRegister arg_registers[] = { REGISTER_RDI, REGISTER_RSI, REGISTER_RDX, REGSITER_RCX, REGISTER_R8, REGISTER_R9 };
+   std::vector<std::string> tokens;
+   std::vector<u64>         stack;
+   char                     msg[512];
+   TRegister                saved;
+   user_fpregs_struct       saved_fp;
+   u64                      args[ArrayCount(arg_registers)] = {};
+   u64                      function;
+   int                      status = 0;
+
+   for (const char* p = Expression; *p;)
+   {
+      const char* start = p;
+
+      if (strchr(" (),", *p))
+      {
+         p++;
+         continue;
+      }
+
+      if (*p == '"')
+      {
+         for (p++; *p && *p != '"'; p++)
+            ;
+         if (*p)
+            p++;
+      }
+      else
+      {
+         while (*p && !strchr(" (),", *p))
+            p++;
+      }
+
+      tokens.push_back(std::string(start, p - start));
+   }
+
+   if (tokens.empty() || tokens.size() > ArrayCount(arg_registers) + 1)
+   {
+      sprintf(msg, "A call takes a function and up to %lu arguments", ArrayCount(arg_registers));
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   if (!GetRegisters(&saved) || Ptrace(PTRACE_GETFPREGS, mChildPid, nullptr, &saved_fp) < 0)
+   {
+      sprintf(msg, "Failed to read registers");
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
+
+   // strings go right below the red zone, the return address below them
+   u64 string_bytes = 0;
+
+   for (size_t i = 1; i < tokens.size(); i++)
+   {
+      if (tokens[i][0] == '"')
+         string_bytes += (tokens[i].length() + 7) & ~7ull;
+   }
+
+   u64 sp = ((saved.Reg.rsp - 128 - string_bytes) & ~15ull) - sizeof(u64);
+   u64 strings = sp + sizeof(u64);
+   u64 entry = mElf.GetHeader()->e_entry + mLoadBias;
+
+   stack.push_back(entry);
+
+   for (size_t i = 0; i < tokens.size(); i++)
+   {
+      const char* token = tokens[i].c_str();
+      u64*        value = i ? &args[i - 1] : &function;
+      int         reg = -1;
+      char*       end;
+
+      for (int r = 0; r < REGISTER_COUNT; r++)
+      {
+         if (strcmp(token + (*token == '$'), RegisterStr[r]) == 0)
+            reg = r;
+      }
+
+      if (i && *token == '"')
+      {
+         u64 length = tokens[i].length() - 1 - (tokens[i].back() == '"');
+         u64 words = (length + 8) / 8;
+
+         *value = strings + (stack.size() - 1) * sizeof(u64);
+         stack.resize(stack.size() + words, 0);
+         memcpy(&stack[stack.size() - words], token + 1, length);
+      }
+      else if (reg != -1)
+         *value = saved.RegArray[reg];
+      else if (isdigit(*token) || *token == '-')
+      {
+         *value = (*token == '-') ? strtoll(token, &end, 0) : strtoull(token, &end, 0);
+
+         if (*end)
+            reg = -2;
+      }
+      else if (!FindSymbolAddress(token, value))
+         reg = -2;
+
+      if (reg == -2)
+      {
+         snprintf(msg, sizeof(msg), "Unknown %s %s", i ? "argument" : "function", token);
+         PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+         return;
+      }
+   }
+
+   TRegister regs = saved;
+
+   for (size_t i = 0; i < ArrayCount(arg_registers); i++)
+      regs.RegArray[arg_registers[i]] = args[i];
+
+   regs.Reg.rax = 0;           // no vector registers for a variadic callee
+   regs.Reg.rsp = sp;
+   regs.Reg.rip = function;
+   regs.Reg.orig_rax = -1;     // a syscall the target was stopped in isn't restarted into the call
+   regs.Reg.eflags &= ~0x400;  // direction flag clear on entry
+
+   u64 entry_data = GetData(entry);
+
+   for (size_t i = 0; i < stack.size(); i++)
+      SetData(sp + i * sizeof(u64), stack[i]);
+
+   SetData(entry, (entry_data & ~0xff) | SW_INTERRUPT_3);
+   PTRACE(PTRACE_SETREGS, mChildPid, nullptr, &regs.Reg);
+   mRegistersValid = false;
+
+   // the stop the user is looking at stays the current one
+   int       saved_status = mWaitStatus;
+   siginfo_t saved_info = mSignalInfo;
+   auto      start = std::chrono::steady_clock::now();
+   bool      resume = true;
+   bool      returned = false;
+   bool      timed_out = false;
+   u32       backoff = 1;
+
+   for (;;)
+   {
+      if (resume)
+         Ptrace(PTRACE_CONT, mChildPid, nullptr, nullptr);
+
+      resume = false;
+
+      // polled so a callee that never returns can be stopped
+      if (Waitpid(mChildPid, &status, WNOHANG) == 0)
+      {
+         if (!timed_out && std::chrono::steady_clock::now() - start > std::chrono::milliseconds(CALL_TIMEOUT_MS))
          {
-            StartTarget();
+            kill(mChildPid, SIGSTOP);
+            timed_out = true;
          }
+
+         std::this_thread::sleep_for(std::chrono::microseconds(backoff));
+         backoff = std::min(backoff * 2, 1000u);
+         continue;
+      }
+
+      mRegistersValid = false;
+
+      if (!WIFSTOPPED(status))
          break;
-      case DEBUG_CMD_STOP:
-         if (mChildPid == 0)
-         {
-            sprintf(msg, "Target has not been started");
-            PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
-         }
-         else
+
+      // whatever the callee was doing, the SIGSTOP is the stop to clean up at
+      if (timed_out)
+      {
+         resume = WSTOPSIG(status) != SIGSTOP;
+         if (resume)
+            continue;
+         break;
+      }
+
+      mWaitStatus = status;
+      GetSignalInfo();
+
+      if (WSTOPSIG(status) == SIGSEGV && mWatchedPages.size())
+      {
+         if (IsWatchFault())
          {
-            StopTarget();
+            StepWatchFault();
+            status = mWaitStatus;
+
+            if (!WIFSTOPPED(status))
+               break;
+
+            GetSignalInfo();
          }
+      }
+
+      u64 rip = GetRegister(REGISTER_RIP);
+
+      if (WSTOPSIG(status) == SIGTRAP && rip == entry + 1)
+      {
+         returned = true;
          break;
-      default:
+      }
+
+      // stepped past a watched write, or signals nobody would notice
+      resume = (WSTOPSIG(status) == SIGTRAP && !IsBreakpointTrap()) || WSTOPSIG(status) == SIGCHLD ||
+               WSTOPSIG(status) == SIGWINCH || WSTOPSIG(status) == SIGURG;
+      if (!resume)
          break;
    }
 
-   mMutex.lock();
-   mCommand.Command = DEBUG_CMD_PROCESSED;
-   mMutex.unlock();
-}
+   f64 us = std::chrono::duration<f64, std::micro>(std::chrono::steady_clock::now() - start).count();
 
-void CDebugBackend::GetSignalInfo()
-{
-   char      msg[256];
-   siginfo_t info = {};
-   PTRACE(PTRACE_GETSIGINFO, mChildPid, nullptr, &info);
+   // the callee took the target down with it
+   if (!WIFSTOPPED(status))
+   {
+      snprintf(msg, sizeof(msg), "Target ended during the call to %s", tokens[0].c_str());
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
 
-   assert(info.si_signo >= 0 && info.si_signo < NSIG);
+      mWaitStatus = status;
+      ProcessStop();
+      return;
+   }
 
-   // not really sure what do with this info?
-   //sprintf(msg, "got signal %s (%d) from %d code %d", strsignal(info.si_signo), info.si_signo, mChildPid, info.si_code);
-   //PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-}
+   u64  result = GetRegister(REGISTER_RAX);
+   u64  rip = GetRegister(REGISTER_RIP);
+   bool breakpoint = !timed_out && IsBreakpointTrap();
 
-void CDebugBackend::Wait()
-{
-   char  msg[256];
-   pid_t status;
+   SetData(entry, entry_data);
+   PTRACE(PTRACE_SETREGS, mChildPid, nullptr, &saved.Reg);
+   PTRACE(PTRACE_SETFPREGS, mChildPid, nullptr, &saved_fp);
+   mRegistersValid = false;
+   mWaitStatus = saved_status;
+   mSignalInfo = saved_info;
 
-   // wait for debugee to stop
-   status = waitpid(mChildPid, &mWaitStatus, 0);
+   // it may have mapped memory or loaded libraries
+   mAddressSpace.Invalidate();
 
-   if (WIFEXITED(mWaitStatus))
+   int length = snprintf(msg, sizeof(msg) - 128, "%s(", tokens[0].c_str());
+
+   for (size_t i = 1; i < tokens.size(); i++)
+      length += snprintf(&msg[length], sizeof(msg) - 128 - length, "%s0x%lx", (i > 1) ? ", " : "", args[i - 1]);
+
+   length = std::min(length, (int)sizeof(msg) - 128);
+
+   if (returned)
+      sprintf(&msg[length], ") = 0x%lx (%ld), %.1f us", result, (s64)result, us);
+   else
    {
-      mTargetRunning = false;
+      u64               offset;
+      u64               address = breakpoint ? rip - 1 : rip;
+      const TElfSymbol* symbol = FindSymbol(address, &offset);
+      const char*       reason = timed_out ? "didn't return in time" : breakpoint ? "hit a breakpoint" : strsignal(WSTOPSIG(status));
+
+      length += snprintf(&msg[length], 64, ") %s at 0x%lx", reason, address);
+      if (symbol)
+         length += snprintf(&msg[length], 48, " <%s+0x%lx>", symbol->Name, offset);
+      sprintf(&msg[length], ", registers restored");
+   }
 
-      TargetOutput();
+   PushData(returned ? DATA_TYPE_STREAM_INFO : DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+}
 
-      sprintf(msg, "Target execution exited cleanly");
-      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+// Samples the stacks of all the target's threads Hz times a second. The traced thread is
+// stopped with a SIGSTOP that is never delivered, the other threads are seized for the
+// duration and stopped with PTRACE_INTERRUPT. Each thread is unwound with the frame pointer
+// unwinder and resumed right away, so a sample pauses it for one register read and one stack
+// walk. Breakpoints and watched pages are lifted meanwhile: the seized threads would stop at
+// them with nobody handling it.
+void CDebugBackend::Profile(u64 Milliseconds, u32 Hz, const char* Filename)
+{
+   std::vector<pid_t> threads;
+   std::vector<f64>   pauses;
+   char               msg[512];
+   int                status = 0;
+   int                fault = 0;
+   u64                sampled_threads = 1;
+   bool               exited = false;
+
+   if (Hz == 0 || Hz > MAX_PROFILE_HZ || Milliseconds == 0)
+   {
+      sprintf(msg, "Profile for more than 0 s at 1 to %u Hz", MAX_PROFILE_HZ);
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
+      return;
+   }
 
-      InitializeTargetOutput();
+   if (mBreakpointHit != -1)
+      StepOverBreakpoint();
 
-      // start a new instance
-      StartTarget();
+   if (!mTargetRunning || !WIFSTOPPED(mWaitStatus))
       return;
+
+   for (size_t i = 0; i < mBreakpoints.size(); i++)
+   {
+      if (mBreakpoints[i].Enabled)
+         SetData(mBreakpoints[i].Address, (GetData(mBreakpoints[i].Address) & ~0xff) | mBreakpoints[i].SavedData);
    }
-   else if (WIFSTOPPED(mWaitStatus))
+
+   ProtectPages(mChildPid, 0, ~0ull, false);
+
+   RefreshCodeRanges();
+   mProfile.Clear();
+
+   // the traced thread only, other signals that got there first are delivered and it is waited
+   // on again; a fault is held back and ends the profile, the faulting instruction runs again
+   // after the SIGSTOP is taken
+   auto stop_target = [&]() -> bool
    {
-      // get some info about the signal that caused the stop
-      GetSignalInfo();
+      syscall(SYS_tgkill, mChildPid, mChildPid, SIGSTOP);
 
-      // check breakpoints
-      int bp = CheckBreakpoints();
-      if (bp != -1)
+      for (;;)
       {
-         sprintf(msg, "Breakpoint %d hit at 0x%x", bp + 1, mBreakpoints[bp].Address);
-         PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+         Waitpid(mChildPid, &status, __WALL);
+
+         if (!WIFSTOPPED(status))
+            return false;
+
+         if (WSTOPSIG(status) == SIGSTOP)
+            return true;
+
+         int deliver = ((status >> 16) != 0) ? 0 : WSTOPSIG(status);
+
+         if (deliver == SIGSEGV || deliver == SIGBUS || deliver == SIGILL || deliver == SIGFPE || deliver == SIGABRT)
+         {
+            fault = status;
+            deliver = 0;
+         }
+
+         Ptrace(PTRACE_CONT, mChildPid, nullptr, deliver);
       }
-   }
-}
+   };
 
-void CDebugBackend::RunTarget()
-{
-   if (PTRACE(PTRACE_TRACEME, 0, nullptr, nullptr) < 0)
+   // a seized thread after PTRACE_INTERRUPT, signals that got there first are delivered
+   auto stop_thread = [&](pid_t Tid) -> bool
    {
-      return;
-   }
+      int thread_status;
 
-   int output_fd = open(TargetOutputStr, O_WRONLY);
-   dup2(output_fd, 1);
-   execl(mTarget.c_str(), mTarget.c_str(), nullptr);
-}
+      for (;;)
+      {
+         if (Waitpid(Tid, &thread_status, __WALL) != Tid || !WIFSTOPPED(thread_status))
+            return false;
 
-void CDebugBackend::StartTarget()
-{
-   char msg[256];
+         if ((thread_status >> 16) == PTRACE_EVENT_STOP)
+            return true;
 
-   mBreakpointHit = -1;
+         Ptrace(PTRACE_CONT, Tid, nullptr, WSTOPSIG(thread_status));
+      }
+   };
 
-   if (!mTargetRunning && mTarget.length())
+   FindThreads(threads);
+   sampled_threads += threads.size();
+
+   auto start = std::chrono::steady_clock::now();
+   auto scanned = start;
+
+   Ptrace(PTRACE_CONT, mChildPid, nullptr, nullptr);
+
+   for (u64 tick = 1; !fault; tick++)
    {
-      mChildPid = fork();
+      auto next = start + std::chrono::microseconds(tick * 1000000 / Hz);
+      auto now = std::chrono::steady_clock::now();
 
-      if (mChildPid == 0)
+      // ticks missed while stopping slow threads are dropped, the profile still ends on time
+      if (next < now)
       {
-         personality(ADDR_NO_RANDOMIZE);
-         RunTarget();
+         tick = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count() * Hz / 1000000 + 1;
+         next = start + std::chrono::microseconds(tick * 1000000 / Hz);
       }
-      else if (mChildPid < 0)
+
+      if (next - start >= std::chrono::milliseconds(Milliseconds))
+         break;
+
+      std::this_thread::sleep_until(next);
+
+      // threads started since are picked up once a second, while the target runs
+      if (next - scanned >= std::chrono::seconds(1))
       {
-         char msg[256];
-         sprintf(msg, "Error forking child process %s (%d)", strerror(errno), errno);
-         PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
-         mRunning = false;
-         return;
+         size_t known = threads.size();
+
+         FindThreads(threads);
+         sampled_threads += threads.size() - known;
+         scanned = next;
       }
 
-      sprintf(msg, "Debugging started on %s, pid %d", mTarget.c_str(), mChildPid);
-      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-      PushData(DATA_TYPE_PID, (u8*)&mChildPid, sizeof(mChildPid));
+      auto pause = std::chrono::steady_clock::now();
 
-      // Wait for child to stop on its first instruction
-      Wait();
+      for (pid_t tid : threads)
+         Ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
 
-      mOutputFd = open(TargetOutputStr, O_RDONLY);
+      if (!stop_target())
+      {
+         exited = true;
+         break;
+      }
 
-      //PTRACE(PTRACE_SETOPTIONS, mChildPid, nullptr, PTRACE_O_TRACEEXIT);
-   }
+      SampleThread(mChildPid);
 
-   if (mBreakpoints.size() > 0)
-   {
-      // set all breakpoints on new instance
-      size_t num_breakpoints = mBreakpoints.size();
-      for (size_t i = 0; i < num_breakpoints; i++)
+      if (!fault)
+         Ptrace(PTRACE_CONT, mChildPid, nullptr, nullptr);
+
+      pauses.push_back(std::chrono::duration<f64, std::micro>(std::chrono::steady_clock::now() - pause).count());
+
+      for (size_t i = 0; i < threads.size();)
       {
-         AddBreakpoint(mBreakpoints[i].Address);
-         if (!mBreakpoints[i].Enabled)
+         if (!stop_thread(threads[i]))
          {
-            size_t new_bp_idx = mBreakpoints.size();
-            DisableBreakpoint(new_bp_idx);
+            threads.erase(threads.begin() + i);
+            continue;
          }
-      }
 
-      // delete old breakpoints in reverse order
-      for (size_t i = num_breakpoints; i > 0; i--)
-      {
-         mBreakpoints.erase(mBreakpoints.begin() + (i - 1));
+         SampleThread(threads[i]);
+         Ptrace(PTRACE_CONT, threads[i], nullptr, nullptr);
+
+         pauses.push_back(std::chrono::duration<f64, std::micro>(std::chrono::steady_clock::now() - pause).count());
+         i++;
       }
    }
-}
 
-void CDebugBackend::AttachTarget()
-{
-   char msg[256];
+   f64 seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
 
-   mBreakpointHit = -1;
+   // the traced thread ends up stopped like after any other command, the rest is let go
+   if (!exited && !fault && !stop_target())
+      exited = true;
 
-   if (!mTargetRunning && mTarget.length())
+   for (pid_t tid : threads)
    {
-      PTRACE(PTRACE_ATTACH, mChildPid, nullptr, nullptr);
+      Ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
 
-      sprintf(msg, "Debugging attached to %s, pid %d", mTarget.c_str(), mChildPid);
-      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
-      PushData(DATA_TYPE_PID, (u8*)&mChildPid, sizeof(mChildPid));
+      if (!exited && stop_thread(tid))
+         Ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+   }
 
-      // Wait for child to stop on its first instruction
-      Wait();
+   mWaitStatus = status;
+   mRegistersValid = false;
+   mAddressSpace.Invalidate();
 
-      mOutputFd = open(TargetOutputStr, O_RDONLY);
-      mTargetRunning = true;
+   if (exited)
+   {
+      ProcessStop();
+      return;
+   }
 
-      //PTRACE(PTRACE_SETOPTIONS, mChildPid, nullptr, PTRACE_O_TRACEEXIT);
+   u64 rip = GetRegister(REGISTER_RIP);
+
+   for (size_t i = 0; i < mBreakpoints.size(); i++)
+   {
+      if (!mBreakpoints[i].Enabled)
+         continue;
+
+      SetData(mBreakpoints[i].Address, (GetData(mBreakpoints[i].Address) & ~0xff) | SW_INTERRUPT_3);
+
+      if (mBreakpoints[i].Address == rip)
+         mBreakpointHit = i;
    }
 
-   if (mBreakpoints.size() > 0)
+   ProtectPages(mChildPid, 0, ~0ull, true);
+
+   // libraries loaded while sampling are needed for the names
+   UpdateLibraries();
+   mAddressSpace.Invalidate();
+
+   std::sort(pauses.begin(), pauses.end());
+
+   f64 total = 0.0;
+
+   for (f64 pause : pauses)
+      total += pause;
+
+   sprintf(msg, "Profile: %lu samples of %lu threads in %.2f s at %u Hz, %lu call tree nodes", mProfile.GetSamples(),
+           sampled_threads, seconds, Hz, mProfile.GetNodes());
+   PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+
+   if (pauses.size())
    {
-      // set all breakpoints on new instance
-      size_t num_breakpoints = mBreakpoints.size();
-      for (size_t i = 0; i < num_breakpoints; i++)
-      {
-         AddBreakpoint(mBreakpoints[i].Address);
-         if (!mBreakpoints[i].Enabled)
-         {
-            size_t new_bp_idx = mBreakpoints.size();
-            DisableBreakpoint(new_bp_idx);
-         }
-      }
+      sprintf(msg, "Pause per sample: mean %.1f us, median %.1f us, 99th percentile %.1f us, max %.1f us", total / pauses.size(),
+              pauses[pauses.size() / 2], pauses[pauses.size() * 99 / 100], pauses.back());
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
 
-      // delete old breakpoints in reverse order
-      for (size_t i = num_breakpoints; i > 0; i--)
-      {
-         mBreakpoints.erase(mBreakpoints.begin() + (i - 1));
-      }
+   if (fault)
+   {
+      sprintf(msg, "Profile stopped early, the target got %s", strsignal(WSTOPSIG(fault)));
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+
+   std::vector<TProfileFunction> functions;
+
+   mProfile.GetTop(PROFILE_TOP_FUNCTIONS, SymbolizeCallback, this, functions);
+
+   for (const TProfileFunction& function : functions)
+   {
+      snprintf(msg, sizeof(msg), "  %5.1f%% self %5.1f%% total  %s", function.Self * 100.0 / mProfile.GetSamples(),
+               function.Total * 100.0 / mProfile.GetSamples(), function.Name.c_str());
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+
+   if (Filename && mProfile.WriteCollapsed(Filename, SymbolizeCallback, this))
+   {
+      snprintf(msg, sizeof(msg), "Collapsed stacks written to %s", Filename);
+      PushData(DATA_TYPE_STREAM_INFO, (u8*)msg, strlen(msg));
+   }
+   else if (Filename)
+   {
+      snprintf(msg, sizeof(msg), "Failed to write %s: %s", Filename, strerror(errno));
+      PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
    }
 }
 
-void CDebugBackend::StopTarget()
+// seizes the threads of the target that aren't the traced one and aren't in Threads yet
+void CDebugBackend::FindThreads(std::vector<pid_t>& Threads)
 {
-   if (PTRACE(PTRACE_KILL, mChildPid, nullptr, nullptr) < 0)
+   char filename[64];
+
+   sprintf(filename, "/proc/%d/task", mChildPid);
+
+   DIR* dir = opendir(filename);
+
+   if (!dir)
+      return;
+
+   while (struct dirent* entry = readdir(dir))
    {
+      pid_t tid = atoi(entry->d_name);
+
+      if (tid <= 0 || tid == mChildPid || std::find(Threads.begin(), Threads.end(), tid) != Threads.end())
+         continue;
+
+      if (Ptrace(PTRACE_SEIZE, tid, nullptr, nullptr) == 0)
+         Threads.push_back(tid);
+   }
+
+   closedir(dir);
+}
+
+void CDebugBackend::SampleThread(pid_t Tid)
+{
+   static TFrame frames[MAX_PROFILE_FRAMES];
+   u64           pcs[MAX_PROFILE_FRAMES];
+   TRegister     registers;
+
+   if (Ptrace(PTRACE_GETREGS, Tid, nullptr, &registers.Reg) < 0)
       return;
+
+   int count = mUnwinder.UnwindFramePointer(&registers, frames, MAX_PROFILE_FRAMES);
+
+   // return addresses are after the call, one back is still inside it
+   for (int i = 0; i < count; i++)
+      pcs[i] = frames[i].Pc - (i ? 1 : 0);
+
+   if (count == 0)
+   {
+      pcs[0] = registers.Reg.rip;
+      count = 1;
    }
 
-   mWaitStatus = 0;
-   mChildPid = 0;
-   mTargetRunning = false;
+   mProfile.Add(pcs, count);
+}
+
+bool CDebugBackend::SymbolizeCallback(void* Context, u64 Address, char* Name, u32 Size)
+{
+   CDebugBackend*    backend = (CDebugBackend*)Context;
+   u64               offset;
+   const TElfSymbol* symbol = backend->FindSymbol(Address, &offset);
+
+   if (symbol)
+   {
+      snprintf(Name, Size, "%s", symbol->Name);
+      return true;
+   }
+
+   // no symbol, frames in the same file at least end up together
+   const TMemoryMap* map = backend->mAddressSpace.Find(Address);
+
+   if (!map || !map->Path.length())
+      return false;
+
+   const char* slash = strrchr(map->Path.c_str(), '/');
+
+   snprintf(Name, Size, "[%s]", slash ? slash + 1 : map->Path.c_str());
+   return true;
 }
 
 void CDebugBackend::VerifyTarget()
@@ -695,23 +4508,27 @@ void CDebugBackend::VerifyTarget()
 
    if (mTarget.length())
    {
-      mTargetData = ReadEntireFile(mTarget.c_str());
+      // unwind rules and line tables are cached per executable
+      mUnwinder.Reset();
+      mLineTable.Reset();
 
-      if (mTargetData.Size == 0)
+      if (!mElf.Open(mTarget.c_str()))
       {
          sprintf(msg, "Couldn't read target %s", mTarget.c_str());
          PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
          mTarget = "";
       }
-      else if (!IsFileElf64(mTargetData))
+      else if (!IsFileElf64(mElf.GetImage()))
       {
          sprintf(msg, "Target %s is not a 64-bit ELF executable", mTarget.c_str());
          PushData(DATA_TYPE_STREAM_ERROR, (u8*)msg, strlen(msg));
          mTarget = "";
-         
-         delete [] mTargetData.Data;
-         mTargetData.Data = nullptr;
-         mTargetData.Size = 0;
+
+         mElf.Close();
+      }
+      else
+      {
+         mLineTable.Initialize(&mElf);
       }
    }
 }
@@ -731,8 +4548,15 @@ void CDebugBackend::PushData(eDataType DataType, u8* String, u32 Size)
       memcpy(&mOutputBuffer[mBufferIndex], String, Size);
 
       mBufferIndex += Size;
+      mStats.Messages++;
+      mStats.MessageBytes += Size;
       mMutex.unlock();
    }
+   else
+   {
+      mStats.DroppedMessages++;
+      mStats.DroppedBytes += Size;
+   }
 }
 
 u8* CDebugBackend::PopData()
@@ -787,14 +4611,16 @@ void CDebugBackend::TargetOutput()
 
 void CDebugBackend::InitializeTargetOutput()
 {
-   // create an empty file "TargetOutputStr" to redirect the target output to
-   // TODO: Do this the right way, without system call? use TargetOutputStr
+   // create an empty file "TargetOutputStr" to redirect the target output to, truncated
+   // in place because the standby instance already has it open
 
    if (mOutputFd > 0)
       close(mOutputFd);
    mOutputFd = 0;
-   system("rm -f tmpOutput");
-   system("touch tmpOutput");
+
+   int fd = open(TargetOutputStr, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd != -1)
+      close(fd);
 }
 
 void CDebugBackend::RunDebugger()
@@ -821,16 +4647,25 @@ void CDebugBackend::RunDebugger()
 
       TargetOutput();
 
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      // target output is polled every 10 ms, a new command is picked up right away
+      std::unique_lock<std::mutex> lock(mWakeMutex);
+      mWake.wait_for(lock, std::chrono::milliseconds(10), [this] { return mWakePending; });
+      mWakePending = false;
    }
 
-   // we're done, stop the child process
-   kill(mChildPid, SIGTERM);
+   // we're done, stop the child process (pid 0 would signal our whole process group)
+   if (mChildPid > 0)
+      kill(mChildPid, SIGTERM);
+   DropStandby();
+
+   while (mCheckpoints.size())
+      DeleteCheckpoint(mCheckpoints.size() - 1);
 }
 
-bool CDebugBackend::Run(const char* Filename)
+bool CDebugBackend::Run(const char* Filename, const TLaunchSpec* Launch)
 {
    mTarget = Filename;
+   mLaunch = Launch ? *Launch : TLaunchSpec();
 
    // start thread to run debugger
    if (!mThread.joinable())
@@ -872,6 +4707,11 @@ bool CDebugBackend::Attach(pid_t ProcessId)
    }
 }
 
+bool CDebugBackend::Cancel()
+{
+   return mSearch.Cancel();
+}
+
 void CDebugBackend::Quit()
 {
    TDebugCommand cmd;
@@ -2,11 +2,86 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <string>
+#include <map>
+#include <memory>
 #include <vector>
 #include <thread>
+#include <chrono>
 #include <mutex>
+#include <condition_variable>
 #include "DebugTypes.h"
+#include "ElfFile.h"
+#include "Unwinder.h"
+#include "Decoder.h"
+#include "LineTable.h"
+#include "TraceFile.h"
+#include "CoreFile.h"
+#include "AddressSpace.h"
+#include "MemorySearch.h"
+#include "Snapshot.h"
+#include "Profile.h"
+
+// How the target gets started, everything is optional
+struct TLaunchSpec
+{
+   std::vector<std::string> Arguments;        // argv[1] onwards
+   std::vector<std::string> Environment;      // NAME=value, added to or replacing the debugger's own
+   std::string              WorkingDirectory;
+   std::string              Input;            // file for stdin
+   std::string              Core;             // core file to debug post-mortem instead of starting the target
+};
+
+// Shared object from the dynamic linker's list. Its symbols are only read the first time an
+// address inside it needs a name.
+struct TSharedLibrary
+{
+   u64                       LinkMap; // link_map entry in the target, identifies the library
+   u64                       Bias;    // l_addr
+   u64                       Start;   // range of the PT_LOAD segments, both 0 when unknown
+   u64                       End;
+   std::string               Path;
+   std::unique_ptr<CElfFile> Elf;     // null until a symbol is needed
+   bool                      Failed;  // the file couldn't be opened, don't keep trying
+};
+
+// Write watchpoint done in software: the pages it covers are made read-only in the target and
+// a write to any of them stops it with a SIGSEGV
+struct TWatchpoint
+{
+   u64             Address;
+   u64             Size;
+   std::vector<u8> Value;   // contents as of the last stop, to show what a write changed
+   u64             Hits;
+   bool            Enabled;
+};
+
+// Latencies in log2 buckets of microseconds: bucket 0 is under 1 us, bucket i from 2^(i-1) up
+// to 2^i us, the last one everything longer
+struct TLatencyHistogram
+{
+   u64 Count;
+   f64 TotalUs;
+   f64 MaxUs;
+   u64 Buckets[LATENCY_BUCKETS];
+};
+
+// Where the backend's time and traffic go, shown by stats
+struct TBackendStats
+{
+   u64               Ptrace[PTRACE_STATS];      // per request, see PtraceStat
+   u64               Waits;
+   u64               BytesRead;                 // target memory, live or core
+   u64               BytesWritten;
+   u64               Messages;                  // PushData
+   u64               MessageBytes;
+   u64               DroppedMessages;           // output buffer full
+   u64               DroppedBytes;
+   TLatencyHistogram Commands[DEBUG_CMD_COUNT]; // SetCommand to DEBUG_CMD_PROCESSED
+};
 
 class CDebugBackend
 {
@@ -17,18 +92,51 @@ public:
    void SetCommand(TDebugCommand Command);
    eDebugCommand GetCommand() const { return mCommand.Command; }
 
+   // waits up to Milliseconds for the last command to be processed, returns false on timeout
+   bool WaitCommand(u32 Milliseconds);
+
    bool IsRunning() const { return mRunning; }
-   bool Run(const char* Filename);
+   bool Run(const char* Filename, const TLaunchSpec* Launch = nullptr);
    bool Attach(pid_t ProcessId);
 
    void Quit();
 
+   // stops a running memory search, returns false when there is none
+   bool Cancel();
+
    u8* PopData();
 
 private:
 
+   // all ptrace and waitpid calls of the backend go through these to be counted
+   template <typename A, typename D> long Ptrace(int Request, pid_t Pid, A Addr, D Data)
+   {
+      mStats.Ptrace[PtraceStat(Request)]++;
+      return ptrace((__ptrace_request)Request, Pid, Addr, Data);
+   }
+
+   pid_t Waitpid(pid_t Pid, int* Status, int Options)
+   {
+      mStats.Waits++;
+      return waitpid(Pid, Status, Options);
+   }
+
+   static u32 PtraceStat(int Request);
+   void AddLatency(eDebugCommand Command, f64 Us);
+   void ReportLatency();
+   void DumpStats(const char* Filename);
+
    u64 GetData(u64 Address);
    void SetData(u64 Address, u64 Value);
+   u64 ReadMemory(u64 Address, void* Buffer, u64 Size);
+   u64 ReadCoreMemory(u64 Address, void* Buffer, u64 Size) const;
+   static u64 ReadMemoryCallback(void* Context, u64 Address, void* Buffer, u64 Size);
+   u64 ReadCode(u64 Address, void* Buffer, u64 Size);
+   static u64 ReadCodeCallback(void* Context, u64 Address, void* Buffer, u64 Size);
+   void HideBreakpoints(u64 Address, void* Buffer, u64 Size) const;
+   u64 ReadSearchMemory(u64 Address, void* Buffer, u64 Size) const;
+   static u64 ReadSearchCallback(void* Context, u64 Address, void* Buffer, u64 Size);
+   const TInstruction* DecodeAt(u64 Address, TInstruction* Scratch);
 
    u64 GetRegister(eRegister Register);
    bool GetRegisters(TRegister* Registers);
@@ -41,13 +149,84 @@ private:
    void ListBreakpoints();
    int CheckBreakpoints();
 
+   void Backtrace(eUnwindMode Mode, int MaxFrames);
+   void Disassemble(u64 Address, int Count);
+   void RefreshCodeRanges();
+   const TElfSymbol* FindSymbol(u64 Address, u64* Offset);
+   bool FindSymbolAddress(const char* Name, u64* Address);
+   CElfFile* GetLibraryElf(TSharedLibrary& Library);
+   void FindRendezvous();
+   void UpdateLibraries();
+   void ListLibraries();
+   bool InsertRendezvousBreakpoint();
+   void RemoveRendezvousBreakpoint();
+   void UpdateAddressSpace();
+   void LoadTargetInfo();
+
    void Continue();
+   void Resume();
    void StepSingle();
    void StepOverBreakpoint();
+   void StepLine(bool Into);
+   void NextInstruction();
+   void Finish();
+   void StepUntil(eStepCondition Condition, u64 Operand, u64 Value, u64 MaxSteps, eStepMode Mode);
+   bool StepTrap(eStepMode* Mode);
+   void TraceBlocks(u64 MaxBlocks);
+   void ReportStats();
+   void Record(const char* Filename, u64 MaxSteps);
+   void Replay(const char* Filename, u64 Index);
+   void ReportLocation(u64 Address, u64 Stops, f64 ElapsedUs);
+
+   void AddTemporaryBreakpoint(u64 Address, eTemporaryBreakpoint Type);
+   int FindTemporaryBreakpoint(u64 Address) const;
+   void InsertTemporaryBreakpoints();
+   void RemoveTemporaryBreakpoints();
+   int ContinueToTemporary();
+   void PlanLineStep(const TLineInfo* Line, bool Into, u64 ReturnAddress);
+   u64 GetFrameAddress(u64* ReturnAddress);
+   u64 SkipPrologue(u64 Address);
+   bool IsStoppedByTrap() const;
+
+   pid_t InjectFork(pid_t Pid);
+   void CreateCheckpoint();
+   void RestoreCheckpoint(u64 Index);
+   void DeleteCheckpoint(u64 Index);
+   void ListCheckpoints();
+
+   void GenerateCore(const char* Filename);
+   void OpenCore(const char* Filename);
+
+   void Find(const u8* Pattern, u64 Size, u64 Alignment);
+   static void FoundCallback(void* Context, u64 Address, u32 Range);
+
+   void TakeSnapshot();
+   void DiffSnapshot();
+
+   bool InjectSyscall(pid_t Pid, u64 Number, u64 Arg0, u64 Arg1, u64 Arg2, s64* Result);
+   bool ProtectPages(pid_t Pid, u64 Start, u64 End, bool ReadOnly);
+   bool WatchPages(const TWatchpoint& Watchpoint);
+   void UnwatchPages(u64 Index);
+   void AddWatchpoint(u64 Address, u64 Size);
+   void DeleteWatchpoint(u64 Index);
+   void ListWatchpoints();
+   void ReapplyWatchpoints();
+   bool IsWatchFault() const;
+   bool StepWatchFault();
+   eWaitResult WaitStop();
+
+   void CallFunction(const char* Expression);
+
+   void Profile(u64 Milliseconds, u32 Hz, const char* Filename);
+   void FindThreads(std::vector<pid_t>& Threads);
+   void SampleThread(pid_t Tid);
+   static bool SymbolizeCallback(void* Context, u64 Address, char* Name, u32 Size);
 
    void HandleCommand();
-   void RunTarget();
    void RunDebugger();
+   pid_t LaunchTarget();
+   void SpawnStandby();
+   void DropStandby();
    void StartTarget();
    void AttachTarget();
    void StopTarget();
@@ -56,23 +235,66 @@ private:
    void InitializeTargetOutput();
 
    void GetSignalInfo();
+   bool IsBreakpointTrap() const;
    void Wait();
+   void ProcessStop();
 
    void PushData(eDataType DataType, u8* String, u32 Size);
 
    std::string              mTarget;
+   TLaunchSpec              mLaunch;
    std::thread              mThread;
    std::mutex               mMutex;
+   std::mutex               mWakeMutex;   // separate from mMutex, SetCommand holds that while joining
+   std::condition_variable  mWake;
+   std::condition_variable  mProcessed;   // with mMutex, mCommand became DEBUG_CMD_PROCESSED
    std::vector<TBreakpoint> mBreakpoints;
-   TBuffer                  mTargetData;
+   std::vector<TTemporaryBreakpoint> mTemporaryBreakpoints;
+   std::vector<TCheckpoint> mCheckpoints;
+   CElfFile                 mElf;
+   CUnwinder                mUnwinder;
+   CInstructionCache        mInstructionCache;
+   CLineTable               mLineTable;
+   CTraceReader             mTraceReader;
+   CCoreFile                mCore;
+   CAddressSpace            mAddressSpace;
+   CMemorySearch            mSearch;
+   std::vector<TMemoryMap>  mSearchMaps; // what the running search covers, for reporting matches
+   CSnapshot                mSnapshot;
+   CProfile                 mProfile;
+   std::vector<TWatchpoint> mWatchpoints;
+   std::map<u64, u32>       mWatchedPages; // page -> protection it had, read-only in the target
+   std::vector<TSharedLibrary> mLibraries; // sorted by Start
+   std::string              mTraceFilename;
+   TRegister                mRegisters;
+   siginfo_t                mSignalInfo;
+   TStepStats               mStepStats[STEP_MODE_COUNT];
+   TBackendStats            mStats;
    u8*                      mOutputBuffer;
    u32                      mBufferIndex;
    u32                      mReadIndex;
+   u64                      mLoadBias;
+   u64                      mCodeRangesGeneration; // address space generation the unwinder's code ranges are from
+   u64                      mRendezvousAddress;    // _dl_debug_state, breakpoint while the target runs
+   u64                      mDebugAddress;         // r_debug, 0 until the dynamic linker has set it up
+   u64                      mRendezvousStops;
+   u8                       mRendezvousSavedData;
+   u64                      mWatchFaults;
+   u64                      mWatchMisses;  // faults on watched pages that didn't touch a watched byte
+   f64                      mWatchSeconds;
    pid_t                    mChildPid;
+   pid_t                    mStandbyPid; // next instance of the target, already exec'd
+   pid_t                    mMemoryPid;
    s32                      mBreakpointHit;
    s32                      mWaitStatus;
    int                      mOutputFd;
+   int                      mMemoryFd;
    TDebugCommand            mCommand;
+   std::chrono::steady_clock::time_point mCommandStart; // when SetCommand got mCommand
    bool                     mRunning;
+   bool                     mWakePending; // SetCommand was called, under mWakeMutex
    bool                     mTargetRunning;
+   bool                     mRegistersValid;
+   bool                     mBlockStepSupported; // cleared for good once block stepping is seen not to work
+   bool                     mBlockStepVerified;  // a block step has been seen skipping straight line code
 };
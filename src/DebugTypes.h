@@ -21,6 +21,20 @@ typedef double   f64;
 const u8  SW_INTERRUPT_3 = 0xcc;
 const u32 OUTPUT_BUFFER  = 1024 * 1024;
 const u32 MAX_DATA       = 64;
+const u32 MAX_FRAMES     = 1024;
+const u32 MAX_INSTRUCTIONS = 1024;
+const u64 DEFAULT_STEP_LIMIT = 10 * 1000 * 1000;
+const u32 MAX_TRACE_BLOCKS = 16 * 1024;
+const u32 MAX_LIBRARIES = 64 * 1024;
+const u32 MAX_FIND_MATCHES = 4096;
+const u32 MAX_DIFF_CHANGES = 1024;
+const u32 MAX_WATCH_PAGES = 64;
+const u32 CALL_TIMEOUT_MS = 5000;
+const u32 MAX_PROFILE_HZ = 10000;
+const u32 MAX_PROFILE_FRAMES = 256;
+const u32 PROFILE_TOP_FUNCTIONS = 10;
+const u32 LATENCY_BUCKETS = 32;
+const u32 PTRACE_STATS = 24;
 
 #define ArrayCount(array) sizeof(array)/sizeof(array[0])
 
@@ -54,10 +68,37 @@ enum eDebugCommand
    DEBUG_CMD_STOP,
    DEBUG_CMD_QUIT,
    DEBUG_CMD_ATTACH,
+   DEBUG_CMD_BACKTRACE,
+   DEBUG_CMD_DISASSEMBLE,
+   DEBUG_CMD_NEXT_INSTRUCTION,
+   DEBUG_CMD_FINISH,
+   DEBUG_CMD_STEP_UNTIL,
+   DEBUG_CMD_TRACE_BLOCKS,
+   DEBUG_CMD_STATS,
+   DEBUG_CMD_RECORD,
+   DEBUG_CMD_REPLAY,
+   DEBUG_CMD_CHECKPOINT,
+   DEBUG_CMD_RESTORE_CHECKPOINT,
+   DEBUG_CMD_DELETE_CHECKPOINT,
+   DEBUG_CMD_LIST_CHECKPOINTS,
+   DEBUG_CMD_GENERATE_CORE,
+   DEBUG_CMD_LIST_LIBRARIES,
+   DEBUG_CMD_FIND,
+   DEBUG_CMD_SNAPSHOT,
+   DEBUG_CMD_DIFF,
+   DEBUG_CMD_SET_WATCHPOINT,
+   DEBUG_CMD_DELETE_WATCHPOINT,
+   DEBUG_CMD_LIST_WATCHPOINTS,
+   DEBUG_CMD_CALL,
+   DEBUG_CMD_PROFILE,
    DEBUG_CMD_PROCESSED,
    DEBUG_CMD_COUNT
 };
 
+extern const char* DebugCommandStr[];
+
+struct TLaunchSpec;
+
 struct TDebugCommand
 {
    eDebugCommand Command;
@@ -84,8 +125,10 @@ struct TDebugCommand
       } Read;
       struct TStringData
       {
-         u8* String;
-         u64 Size;
+         u8*          String;
+         u64          Size;
+         TLaunchSpec* Launch; // SET_TARGET only, null for no arguments, deleted by the backend
+                              // GENERATE_CORE has a null String for core.<pid>
       } String;
       struct TIntegerData
       {
@@ -95,10 +138,99 @@ struct TDebugCommand
       {
          int Value;
       } Pid;
+      struct TBacktrace
+      {
+         s64 MaxFrames;
+         u64 Mode;
+      } Backtrace;
+      struct TDisassemble
+      {
+         u64 Address; // 0 disassembles at rip
+         u64 Count;
+      } Disassemble;
+      struct TStepUntil
+      {
+         u64 Condition; // eStepCondition
+         u64 Operand;   // register index, memory address or range start
+         u64 Value;     // value to compare against or range end
+         u64 MaxSteps;  // 0 for DEFAULT_STEP_LIMIT
+         u64 Mode;      // eStepMode
+      } StepUntil;
+      struct TTraceBlocks
+      {
+         u64 MaxBlocks;
+      } Trace;
+      struct TTraceFileData
+      {
+         u8* Filename;
+         u64 Size;
+         u64 Count; // instructions to record, or the instruction to show when replaying
+      } TraceFile;
+      struct TProfileData
+      {
+         u8* Filename; // collapsed stacks, null for none
+         u64 Size;
+         u64 Milliseconds;
+         u64 Hz;
+      } Profile;
+      struct TCheckpointIndex
+      {
+         u64 Index;
+      } Checkpoint;
+      struct TWatchRange
+      {
+         u64 Address;
+         u64 Size;
+      } Watch;
+      struct TFind
+      {
+         u8* Pattern;   // deleted by the backend
+         u64 Size;
+         u64 Alignment; // 1 for bytes and strings, 8 for pointers and other 8 byte values
+      } Find;
 
    } Data;
 };
 
+enum eStepCondition
+{
+   STEP_UNTIL_COUNT,              // just MaxSteps instructions, or blocks when block stepping
+   STEP_UNTIL_REGISTER_EQUAL,
+   STEP_UNTIL_REGISTER_NOT_EQUAL,
+   STEP_UNTIL_MEMORY_EQUAL,       // 64 bit value at the address
+   STEP_UNTIL_MEMORY_NOT_EQUAL,
+   STEP_UNTIL_OUTSIDE_RANGE,      // rip leaves [Operand, Value)
+   STEP_UNTIL_COUNT_CONDITIONS
+};
+
+enum eStepMode
+{
+   STEP_MODE_INSTRUCTION, // PTRACE_SINGLESTEP, one trap per instruction
+   STEP_MODE_BLOCK,       // PTRACE_SINGLEBLOCK, one trap per taken branch
+   STEP_MODE_COUNT
+};
+
+// what the target did after it was resumed, see CDebugBackend::WaitStop()
+enum eWaitResult
+{
+   WAIT_STOPPED,    // stopped or gone, mWaitStatus says why
+   WAIT_WATCH_MISS, // a write to a watched page missed the watched bytes, stopped right after it
+   WAIT_WATCH_HIT   // a watchpoint was hit and reported, stopped right after the write
+};
+
+struct TStepStats
+{
+   u64 Traps;
+   f64 Seconds;
+};
+
+enum eUnwindMode
+{
+   UNWIND_MODE_CFI,           // .eh_frame/.debug_frame, works for any code
+   UNWIND_MODE_FRAME_POINTER, // rbp chain, falls back to CFI where the chain is broken
+   UNWIND_MODE_COUNT
+};
+
 // match x86_64 registers in /usr/include/sys/user.h
 enum eRegister
 {
@@ -156,6 +288,32 @@ struct TBreakpoint
    bool Enabled;
 };
 
+// Frozen copy of the target made by forking it from the inside. It is traced and stopped
+// for as long as it exists and never runs, restoring forks it again and debugs the copy.
+struct TCheckpoint
+{
+   pid_t Pid;
+   u64   Rip;
+};
+
+enum eTemporaryBreakpoint
+{
+   TEMPORARY_BREAKPOINT_EXIT,     // code after the line being stepped, only counts in the stepping frame
+   TEMPORARY_BREAKPOINT_RETURN,   // return address of the stepping frame
+   TEMPORARY_BREAKPOINT_CALL,     // body of a function called from the line (step into)
+   TEMPORARY_BREAKPOINT_INDIRECT  // indirect jump or call, single stepped to see where it goes
+};
+
+// Internal breakpoint used while stepping, never visible to the user. One that lands on a
+// user breakpoint isn't patched in, the user breakpoint traps there already.
+struct TTemporaryBreakpoint
+{
+   u64  Address;
+   u8   SavedData;
+   u8   Type;     // eTemporaryBreakpoint
+   bool Inserted;
+};
+
 enum eDataType
 {
    DATA_TYPE_STREAM_ERROR,
@@ -223,4 +381,134 @@ enum eElfClass
    ELF_CLASS_32BIT,
    ELF_CLASS_64BIT,
    ELF_CLASS_COUNT
-};
\ No newline at end of file
+};
+// ELF Section header types and constants
+
+struct TElfSectionHeader64
+{
+   u32 sh_name;      // Section name (string table index)
+   u32 sh_type;      // Section type
+   u64 sh_flags;     // Section flags
+   u64 sh_addr;      // Section virtual addr at execution
+   u64 sh_offset;    // Section file offset
+   u64 sh_size;      // Section size in bytes
+   u32 sh_link;      // Link to another section
+   u32 sh_info;      // Additional section information
+   u64 sh_addralign; // Section alignment
+   u64 sh_entsize;   // Entry size if section holds table
+};
+
+#define ELF_SECTION_TYPE_NULL     0 // Section header table entry unused
+#define ELF_SECTION_TYPE_PROGBITS 1 // Program data
+#define ELF_SECTION_TYPE_SYMTAB   2 // Symbol table
+#define ELF_SECTION_TYPE_STRTAB   3 // String table
+#define ELF_SECTION_TYPE_NOBITS   8 // Program space with no data (bss)
+#define ELF_SECTION_TYPE_DYNSYM   11 // Dynamic linker symbol table
+
+#define ELF_SECTION_FLAG_ALLOC      (1 << 1)  // Occupies memory during execution
+#define ELF_SECTION_FLAG_EXECINSTR  (1 << 2)  // Executable
+#define ELF_SECTION_FLAG_COMPRESSED (1 << 11) // Section with compressed data
+
+// Header at the start of a SHF_COMPRESSED section
+struct TElfCompressionHeader64
+{
+   u32 ch_type;      // Compression format
+   u32 ch_reserved;
+   u64 ch_size;      // Uncompressed data size
+   u64 ch_addralign; // Uncompressed data alignment
+};
+
+enum eElfCompression
+{
+   ELF_COMPRESS_NONE = 0,
+   ELF_COMPRESS_ZLIB = 1, // ZLIB/DEFLATE algorithm
+   ELF_COMPRESS_ZSTD = 2  // Zstandard algorithm
+};
+
+#define ELF_TYPE_EXEC 2 // Executable file
+#define ELF_TYPE_DYN  3 // Shared object file (and PIE executables)
+#define ELF_TYPE_CORE 4 // Core file
+
+// ELF Program header types and constants
+
+struct TElfProgramHeader64
+{
+   u32 p_type;   // Segment type
+   u32 p_flags;  // Segment flags
+   u64 p_offset; // Segment file offset
+   u64 p_vaddr;  // Segment virtual address
+   u64 p_paddr;  // Segment physical address
+   u64 p_filesz; // Segment size in file
+   u64 p_memsz;  // Segment size in memory
+   u64 p_align;  // Segment alignment
+};
+
+#define ELF_SEGMENT_TYPE_LOAD         1          // Loadable program segment
+#define ELF_SEGMENT_TYPE_DYNAMIC      2          // Dynamic linking information
+#define ELF_SEGMENT_TYPE_INTERP       3          // Program interpreter
+#define ELF_SEGMENT_TYPE_NOTE         4          // Auxiliary information
+#define ELF_SEGMENT_TYPE_GNU_EH_FRAME 0x6474e550 // GCC .eh_frame_hdr segment
+
+#define ELF_SEGMENT_FLAG_X (1 << 0) // Segment is executable
+#define ELF_SEGMENT_FLAG_W (1 << 1) // Segment is writable
+#define ELF_SEGMENT_FLAG_R (1 << 2) // Segment is readable
+
+// ELF Symbol table entry
+
+struct TElfSymbol64
+{
+   u32 st_name;  // Symbol name (string table index)
+   u8  st_info;  // Symbol type and binding
+   u8  st_other; // Symbol visibility
+   u16 st_shndx; // Section index
+   u64 st_value; // Symbol value
+   u64 st_size;  // Symbol size
+};
+
+#define ELF_SYMBOL_TYPE(info) ((info) & 0xf)
+
+#define ELF_SYMBOL_TYPE_FUNC 2 // Symbol is a code object
+
+// Auxiliary vector entries read from /proc/pid/auxv
+#define AUX_TYPE_NULL  0  // End of vector
+#define AUX_TYPE_PHDR  3  // Program headers for program
+#define AUX_TYPE_BASE  7  // Base address of interpreter
+#define AUX_TYPE_ENTRY 9  // Entry point of program
+
+// ELF Dynamic section entry
+
+struct TElfDynamic64
+{
+   s64 d_tag; // Entry type
+   u64 d_val; // Integer value or address
+};
+
+#define ELF_DYNAMIC_NULL  0  // Marks end of dynamic section
+#define ELF_DYNAMIC_DEBUG 21 // Address of the dynamic linker's r_debug, filled in at run time
+
+// struct r_debug from <link.h>, how the dynamic linker tells debuggers about loaded objects
+struct TRendezvous
+{
+   s32 Version;
+   u64 Map;    // first link_map
+   u64 Break;  // _dl_debug_state, called before and after every change to the list
+   s32 State;  // eRendezvousState
+   u64 LdBase; // base address of the dynamic linker
+};
+
+enum eRendezvousState
+{
+   RENDEZVOUS_CONSISTENT, // the list can be read
+   RENDEZVOUS_ADD,        // an object is about to be added
+   RENDEZVOUS_DELETE      // an object is about to be removed
+};
+
+// public part of struct link_map from <link.h>
+struct TLinkMap
+{
+   u64 Address;  // l_addr, load address minus link time address
+   u64 Name;     // absolute path, empty for the executable
+   u64 Dynamic;  // dynamic section
+   u64 Next;
+   u64 Previous;
+};
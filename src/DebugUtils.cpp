@@ -10,7 +10,7 @@ TBuffer ReadEntireFile(const char* Filename)
 {
    TBuffer Result = {};
 
-   FILE* File = fopen(Filename, "rb");
+   FILE* File = fopen(Filename, "rbe");
 
    if (File)
    {
@@ -39,35 +39,39 @@ TBuffer ReadEntireFile(const char* Filename)
 TBuffer ReadEntireProcFile(const char* Filename)
 {
    size_t  bytes_to_read = 128;
-   size_t  index = 0;
    TBuffer Result = {};
 
-   int File = open(Filename, O_RDONLY);
+   int File = open(Filename, O_RDONLY | O_CLOEXEC);
 
    if (File != -1)
    {
       Result.Data = (u8*)malloc(bytes_to_read);
 
-      int bytes = read(File, &Result.Data[index], bytes_to_read);
+      // proc files report a size of 0, read until the end
+      ssize_t bytes;
 
-      while (bytes == bytes_to_read)
+      while (Result.Data && (bytes = read(File, &Result.Data[Result.Size], bytes_to_read)) > 0)
       {
          Result.Size += bytes;
-         Result.Data = (u8*)realloc(Result.Data, Result.Size + bytes_to_read);
-         if (Result.Data == nullptr)
+
+         u8* data = (u8*)realloc(Result.Data, Result.Size + bytes_to_read);
+         if (data == nullptr)
          {
+            free(Result.Data);
+            Result.Data = nullptr;
             Result.Size = 0;
+            close(File);
             return Result;
          }
+         Result.Data = data;
       }
 
-      if (bytes > 0 && bytes != bytes_to_read)
-      {
-         Result.Size += bytes;
-      }
+      // there is always room for a terminator after the data
+      if (Result.Data)
+         Result.Data[Result.Size] = 0;
 
       // strip newline off end
-      if (Result.Data[Result.Size-1] == '\n')
+      if (Result.Size && Result.Data[Result.Size-1] == '\n')
       {
          Result.Data[--Result.Size] = 0;
       }
@@ -78,6 +82,18 @@ TBuffer ReadEntireProcFile(const char* Filename)
    return Result;
 }
 
+bool IsZeroPage(const u8* Page, u32 Size)
+{
+   const u64* words = (const u64*)Page;
+   u64        bits = 0;
+
+   // or everything together instead of branching per word, the loop vectorizes
+   for (u32 i = 0; i < Size / sizeof(u64); i++)
+      bits |= words[i];
+
+   return bits == 0;
+}
+
 bool IsFileElf64(TBuffer Buffer)
 {
    bool          result = false;
@@ -93,4 +109,57 @@ bool IsFileElf64(TBuffer Buffer)
    }
 
    return result;
-}
\ No newline at end of file
+}
+bool ParseProcessMapsLine(const char* Line, TMemoryMap* Map)
+{
+   char perms[8] = {};
+   int  path_offset = 0;
+
+   *Map = {};
+
+   if (sscanf(Line, "%lx-%lx %7s %lx %*x:%*x %*u %n", &Map->Start, &Map->End, perms, &Map->Offset, &path_offset) < 4)
+      return false;
+
+   Map->Flags |= (perms[0] == 'r') ? MEMORY_MAP_READ : 0;
+   Map->Flags |= (perms[1] == 'w') ? MEMORY_MAP_WRITE : 0;
+   Map->Flags |= (perms[2] == 'x') ? MEMORY_MAP_EXEC : 0;
+   Map->Flags |= (perms[3] == 's') ? MEMORY_MAP_SHARED : 0;
+
+   if (path_offset > 0)
+   {
+      Map->Path = &Line[path_offset];
+
+      // strip newline off end
+      if (Map->Path.length() && Map->Path.back() == '\n')
+         Map->Path.pop_back();
+   }
+
+   return true;
+}
+
+bool ReadProcessMaps(pid_t Pid, std::vector<TMemoryMap>& Maps)
+{
+   char filename[64];
+   char line[4096];
+
+   Maps.clear();
+
+   sprintf(filename, "/proc/%d/maps", Pid);
+
+   FILE* file = fopen(filename, "re");
+
+   if (!file)
+      return false;
+
+   while (fgets(line, sizeof(line), file))
+   {
+      TMemoryMap map;
+
+      if (ParseProcessMapsLine(line, &map))
+         Maps.push_back(map);
+   }
+
+   fclose(file);
+
+   return true;
+}
@@ -1,9 +1,29 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
 #include "DebugTypes.h"
 
+#define MEMORY_MAP_READ   (1 << 0)
+#define MEMORY_MAP_WRITE  (1 << 1)
+#define MEMORY_MAP_EXEC   (1 << 2)
+#define MEMORY_MAP_SHARED (1 << 3)
+
+// one line of /proc/pid/maps
+struct TMemoryMap
+{
+   u64         Start;
+   u64         End;
+   u64         Offset;
+   u32         Flags;
+   std::string Path;
+};
+
 TBuffer ReadEntireFile(const char* Filename);
 TBuffer ReadEntireProcFile(const char* Filename);
 
-bool IsFileElf64(TBuffer Buffer);
\ No newline at end of file
+bool IsZeroPage(const u8* Page, u32 Size);
+bool IsFileElf64(TBuffer Buffer);
+bool ParseProcessMapsLine(const char* Line, TMemoryMap* Map);
+bool ReadProcessMaps(pid_t Pid, std::vector<TMemoryMap>& Maps);
@@ -0,0 +1,646 @@
+#include <stdio.h>
+#include <string.h>
+#include "Decoder.h"
+
+// Per opcode properties, one table per opcode map
+#define OP_MODRM    (1 << 0)
+#define OP_INVALID  (1 << 1) // not encodable in 64-bit mode
+#define OP_GROUP3   (1 << 2) // f6/f7, only test (/0 /1) has an immediate
+#define OP_GROUP5   (1 << 3) // ff, /2 /3 are calls and /4 /5 jumps
+#define OP_SYSCALL  (1 << 4)
+
+enum eImmediate
+{
+   IMM_NONE,
+   IMM_8,
+   IMM_16,
+   IMM_Z,     // 16 bits with a 66 prefix, 32 bits otherwise
+   IMM_V,     // like IMM_Z, but 64 bits with REX.W (mov r64, imm64)
+   IMM_REL32, // always 32 bits in 64-bit mode, 66 is ignored
+   IMM_16_8,  // enter
+   IMM_MOFFS  // 64 bit address, 32 bits with a 67 prefix
+};
+
+struct TOpcodeInfo
+{
+   u8 Flags;
+   u8 Immediate;
+   u8 Branch;
+};
+
+struct TOpcodeTable
+{
+   TOpcodeInfo Op[256];
+};
+
+static constexpr TOpcodeTable BuildOneByteTable()
+{
+   TOpcodeTable table = {};
+
+   // the eight classic ALU blocks: op r/m,r  op r,r/m  op al,ib  op eax,iz
+   for (int i = 0; i < 0x40; i += 8)
+   {
+      table.Op[i + 0].Flags = OP_MODRM;
+      table.Op[i + 1].Flags = OP_MODRM;
+      table.Op[i + 2].Flags = OP_MODRM;
+      table.Op[i + 3].Flags = OP_MODRM;
+      table.Op[i + 4].Immediate = IMM_8;
+      table.Op[i + 5].Immediate = IMM_Z;
+   }
+
+   const u8 invalid[] = { 0x06, 0x07, 0x0e, 0x16, 0x17, 0x1e, 0x1f, 0x27, 0x2f, 0x37, 0x3f,
+                          0x60, 0x61, 0x82, 0x9a, 0xce, 0xd4, 0xd5, 0xd6, 0xea };
+   for (u8 op : invalid)
+      table.Op[op].Flags = OP_INVALID;
+
+   table.Op[0x62].Flags = OP_MODRM; // EVEX, handled before the table lookup
+   table.Op[0x63].Flags = OP_MODRM;
+   table.Op[0x68].Immediate = IMM_Z;
+   table.Op[0x69].Flags = OP_MODRM;
+   table.Op[0x69].Immediate = IMM_Z;
+   table.Op[0x6a].Immediate = IMM_8;
+   table.Op[0x6b].Flags = OP_MODRM;
+   table.Op[0x6b].Immediate = IMM_8;
+
+   for (int i = 0x70; i <= 0x7f; i++)
+   {
+      table.Op[i].Immediate = IMM_8;
+      table.Op[i].Branch = BRANCH_CONDITIONAL;
+   }
+
+   for (int i = 0x80; i <= 0x8f; i++)
+      table.Op[i].Flags |= OP_MODRM;
+   table.Op[0x80].Immediate = IMM_8;
+   table.Op[0x81].Immediate = IMM_Z;
+   table.Op[0x83].Immediate = IMM_8;
+
+   for (int i = 0xa0; i <= 0xa3; i++)
+      table.Op[i].Immediate = IMM_MOFFS;
+   table.Op[0xa8].Immediate = IMM_8;
+   table.Op[0xa9].Immediate = IMM_Z;
+
+   for (int i = 0xb0; i <= 0xb7; i++)
+      table.Op[i].Immediate = IMM_8;
+   for (int i = 0xb8; i <= 0xbf; i++)
+      table.Op[i].Immediate = IMM_V;
+
+   table.Op[0xc0] = { OP_MODRM, IMM_8, BRANCH_NONE };
+   table.Op[0xc1] = { OP_MODRM, IMM_8, BRANCH_NONE };
+   table.Op[0xc2] = { 0, IMM_16, BRANCH_RETURN };
+   table.Op[0xc3] = { 0, IMM_NONE, BRANCH_RETURN };
+   table.Op[0xc4] = { OP_MODRM, IMM_NONE, BRANCH_NONE }; // VEX3, handled before the table lookup
+   table.Op[0xc5] = { OP_MODRM, IMM_NONE, BRANCH_NONE }; // VEX2, handled before the table lookup
+   table.Op[0xc6] = { OP_MODRM, IMM_8, BRANCH_NONE };
+   table.Op[0xc7] = { OP_MODRM, IMM_Z, BRANCH_NONE };
+   table.Op[0xc8] = { 0, IMM_16_8, BRANCH_NONE };
+   table.Op[0xca] = { 0, IMM_16, BRANCH_RETURN };
+   table.Op[0xcb] = { 0, IMM_NONE, BRANCH_RETURN };
+   table.Op[0xcc] = { 0, IMM_NONE, BRANCH_TRAP };
+   table.Op[0xcd] = { 0, IMM_8, BRANCH_TRAP };
+   table.Op[0xcf] = { 0, IMM_NONE, BRANCH_RETURN };
+
+   for (int i = 0xd0; i <= 0xd3; i++)
+      table.Op[i].Flags = OP_MODRM;
+
+   // x87
+   for (int i = 0xd8; i <= 0xdf; i++)
+      table.Op[i].Flags = OP_MODRM;
+
+   for (int i = 0xe0; i <= 0xe3; i++)
+      table.Op[i] = { 0, IMM_8, BRANCH_CONDITIONAL };
+   for (int i = 0xe4; i <= 0xe7; i++)
+      table.Op[i].Immediate = IMM_8;
+
+   table.Op[0xe8] = { 0, IMM_REL32, BRANCH_CALL };
+   table.Op[0xe9] = { 0, IMM_REL32, BRANCH_JUMP };
+   table.Op[0xeb] = { 0, IMM_8, BRANCH_JUMP };
+   table.Op[0xf1] = { 0, IMM_NONE, BRANCH_TRAP };
+   table.Op[0xf4] = { 0, IMM_NONE, BRANCH_TRAP };
+   table.Op[0xf6] = { OP_MODRM | OP_GROUP3, IMM_8, BRANCH_NONE };
+   table.Op[0xf7] = { OP_MODRM | OP_GROUP3, IMM_Z, BRANCH_NONE };
+   table.Op[0xfe] = { OP_MODRM, IMM_NONE, BRANCH_NONE };
+   table.Op[0xff] = { OP_MODRM | OP_GROUP5, IMM_NONE, BRANCH_NONE };
+
+   return table;
+}
+
+static constexpr TOpcodeTable Build0FTable()
+{
+   TOpcodeTable table = {};
+
+   // almost everything in the two byte map takes a ModRM byte
+   for (int i = 0; i < 256; i++)
+      table.Op[i].Flags = OP_MODRM;
+
+   const u8 no_modrm[] = { 0x05, 0x06, 0x07, 0x08, 0x09, 0x0b, 0x0e, 0x30, 0x31, 0x32, 0x33, 0x34,
+                           0x35, 0x37, 0x77, 0xa0, 0xa1, 0xa2, 0xa8, 0xa9, 0xaa };
+   for (u8 op : no_modrm)
+      table.Op[op].Flags = 0;
+
+   const u8 invalid[] = { 0x04, 0x0a, 0x0c, 0x24, 0x25, 0x26, 0x27, 0x36, 0x39, 0x3b, 0x3c, 0x3d,
+                          0x3e, 0x3f, 0x7a, 0x7b, 0xa6, 0xa7 };
+   for (u8 op : invalid)
+      table.Op[op].Flags = OP_INVALID;
+
+   table.Op[0x05] = { OP_SYSCALL, IMM_NONE, BRANCH_TRAP }; // syscall
+   table.Op[0x07] = { 0, IMM_NONE, BRANCH_RETURN };        // sysret
+   table.Op[0x0b] = { 0, IMM_NONE, BRANCH_TRAP };          // ud2
+   table.Op[0x34] = { OP_SYSCALL, IMM_NONE, BRANCH_TRAP }; // sysenter
+   table.Op[0x35] = { 0, IMM_NONE, BRANCH_RETURN };        // sysexit
+
+   for (int i = 0x70; i <= 0x73; i++)
+      table.Op[i].Immediate = IMM_8;
+
+   for (int i = 0x80; i <= 0x8f; i++)
+      table.Op[i] = { 0, IMM_REL32, BRANCH_CONDITIONAL };
+
+   // c8-cf bswap
+   for (int i = 0xc8; i <= 0xcf; i++)
+      table.Op[i].Flags = 0;
+
+   const u8 imm8[] = { 0xa4, 0xac, 0xba, 0xc2, 0xc4, 0xc5, 0xc6 };
+   for (u8 op : imm8)
+      table.Op[op].Immediate = IMM_8;
+
+   return table;
+}
+
+static constexpr TOpcodeTable BuildModRMTable(u8 Immediate)
+{
+   TOpcodeTable table = {};
+
+   for (int i = 0; i < 256; i++)
+      table.Op[i] = { OP_MODRM, Immediate, BRANCH_NONE };
+
+   return table;
+}
+
+static constexpr TOpcodeTable OpcodeTables[OPCODE_MAP_COUNT] =
+{
+   BuildOneByteTable(),
+   Build0FTable(),
+   BuildModRMTable(IMM_NONE), // 0f 38
+   BuildModRMTable(IMM_8),    // 0f 3a
+   BuildModRMTable(IMM_8),    // 0f 0f (3DNow!), the opcode is the trailing byte
+   BuildModRMTable(IMM_8),    // XOP map 8
+   BuildModRMTable(IMM_NONE), // XOP map 9
+   BuildModRMTable(IMM_Z),    // XOP map a (32 bit immediate)
+   BuildModRMTable(IMM_NONE), // EVEX map 5
+   BuildModRMTable(IMM_NONE)  // EVEX map 6
+};
+
+static const char* OneByteMnemonics[256] =
+{
+   "add", "add", "add", "add", "add", "add", nullptr, nullptr,              // 00
+   "or", "or", "or", "or", "or", "or", nullptr, nullptr,                    // 08
+   "adc", "adc", "adc", "adc", "adc", "adc", nullptr, nullptr,              // 10
+   "sbb", "sbb", "sbb", "sbb", "sbb", "sbb", nullptr, nullptr,              // 18
+   "and", "and", "and", "and", "and", "and", nullptr, nullptr,              // 20
+   "sub", "sub", "sub", "sub", "sub", "sub", nullptr, nullptr,              // 28
+   "xor", "xor", "xor", "xor", "xor", "xor", nullptr, nullptr,              // 30
+   "cmp", "cmp", "cmp", "cmp", "cmp", "cmp", nullptr, nullptr,              // 38
+   nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,  // 40 (rex)
+   nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,  // 48 (rex)
+   "push", "push", "push", "push", "push", "push", "push", "push",          // 50
+   "pop", "pop", "pop", "pop", "pop", "pop", "pop", "pop",                  // 58
+   nullptr, nullptr, nullptr, "movsxd", nullptr, nullptr, nullptr, nullptr, // 60
+   "push", "imul", "push", "imul", "insb", "insd", "outsb", "outsd",        // 68
+   "jo", "jno", "jb", "jae", "je", "jne", "jbe", "ja",                      // 70
+   "js", "jns", "jp", "jnp", "jl", "jge", "jle", "jg",                      // 78
+   nullptr, nullptr, nullptr, nullptr, "test", "test", "xchg", "xchg",      // 80 (group 1)
+   "mov", "mov", "mov", "mov", "mov", "lea", "mov", "pop",                  // 88
+   "nop", "xchg", "xchg", "xchg", "xchg", "xchg", "xchg", "xchg",           // 90
+   "cdqe", "cqo", nullptr, "fwait", "pushf", "popf", "sahf", "lahf",        // 98
+   "mov", "mov", "mov", "mov", "movsb", "movsd", "cmpsb", "cmpsd",          // a0
+   "test", "test", "stosb", "stosd", "lodsb", "lodsd", "scasb", "scasd",    // a8
+   "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",                  // b0
+   "mov", "mov", "mov", "mov", "mov", "mov", "mov", "mov",                  // b8
+   nullptr, nullptr, "ret", "ret", nullptr, nullptr, "mov", "mov",          // c0 (group 2)
+   "enter", "leave", "retf", "retf", "int3", "int", nullptr, "iret",        // c8
+   nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "xlat",   // d0 (group 2)
+   "fpu", "fpu", "fpu", "fpu", "fpu", "fpu", "fpu", "fpu",                  // d8
+   "loopne", "loope", "loop", "jrcxz", "in", "in", "out", "out",            // e0
+   "call", "jmp", nullptr, "jmp", "in", "in", "out", "out",                 // e8
+   nullptr, "int1", nullptr, nullptr, "hlt", "cmc", nullptr, nullptr,       // f0 (group 3)
+   "clc", "stc", "cli", "sti", "cld", "std", nullptr, nullptr               // f8 (group 4, 5)
+};
+
+static const char* Group1Mnemonics[8] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+static const char* Group2Mnemonics[8] = { "rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar" };
+static const char* Group3Mnemonics[8] = { "test", "test", "not", "neg", "mul", "imul", "div", "idiv" };
+static const char* EncodingNames[] = { "legacy", "vex", "evex", "xop" };
+
+static const char* Group5Mnemonics[8] = { "inc", "dec", "call", "callf", "jmp", "jmpf", "push", nullptr };
+
+static const char* TwoByteMnemonics[256] =
+{
+   "grp6", "grp7", "lar", "lsl", nullptr, "syscall", "clts", "sysret",                         // 00
+   "invd", "wbinvd", nullptr, "ud2", nullptr, "prefetch", "femms", nullptr,                    // 08
+   "movups", "movups", "movlps", "movlps", "unpcklps", "unpckhps", "movhps", "movhps",         // 10
+   "prefetch", "nop", "nop", "nop", "nop", "nop", "nop", "nop",                                // 18
+   "mov", "mov", "mov", "mov", nullptr, nullptr, nullptr, nullptr,                             // 20
+   "movaps", "movaps", "cvtpi2ps", "movntps", "cvttps2pi", "cvtps2pi", "ucomiss", "comiss",    // 28
+   "wrmsr", "rdtsc", "rdmsr", "rdpmc", "sysenter", "sysexit", nullptr, "getsec",               // 30
+   nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,                     // 38
+   "cmovo", "cmovno", "cmovb", "cmovae", "cmove", "cmovne", "cmovbe", "cmova",                 // 40
+   "cmovs", "cmovns", "cmovp", "cmovnp", "cmovl", "cmovge", "cmovle", "cmovg",                 // 48
+   "movmskps", "sqrtps", "rsqrtps", "rcpps", "andps", "andnps", "orps", "xorps",               // 50
+   "addps", "mulps", "cvtps2pd", "cvtdq2ps", "subps", "minps", "divps", "maxps",               // 58
+   "punpcklbw", "punpcklwd", "punpckldq", "packsswb", "pcmpgtb", "pcmpgtw", "pcmpgtd", "packuswb", // 60
+   "punpckhbw", "punpckhwd", "punpckhdq", "packssdw", "punpcklqdq", "punpckhqdq", "movd", "movdqa", // 68
+   "pshufd", "psrlw", "psrld", "psrlq", "pcmpeqb", "pcmpeqw", "pcmpeqd", "emms",               // 70
+   "vmread", "vmwrite", nullptr, nullptr, "haddpd", "hsubpd", "movd", "movdqa",                // 78
+   "jo", "jno", "jb", "jae", "je", "jne", "jbe", "ja",                                         // 80
+   "js", "jns", "jp", "jnp", "jl", "jge", "jle", "jg",                                         // 88
+   "seto", "setno", "setb", "setae", "sete", "setne", "setbe", "seta",                         // 90
+   "sets", "setns", "setp", "setnp", "setl", "setge", "setle", "setg",                         // 98
+   "push", "pop", "cpuid", "bt", "shld", "shld", nullptr, nullptr,                             // a0
+   "push", "pop", "rsm", "bts", "shrd", "shrd", "grp15", "imul",                               // a8
+   "cmpxchg", "cmpxchg", "lss", "btr", "lfs", "lgs", "movzx", "movzx",                         // b0
+   "popcnt", "ud1", "bt", "btc", "bsf", "bsr", "movsx", "movsx",                               // b8
+   "xadd", "xadd", "cmpps", "movnti", "pinsrw", "pextrw", "shufps", "grp9",                    // c0
+   "bswap", "bswap", "bswap", "bswap", "bswap", "bswap", "bswap", "bswap",                     // c8
+   "addsubpd", "psrlw", "psrld", "psrlq", "paddq", "pmullw", "movq", "pmovmskb",               // d0
+   "psubusb", "psubusw", "pminub", "pand", "paddusb", "paddusw", "pmaxub", "pandn",            // d8
+   "pavgb", "psraw", "psrad", "pavgw", "pmulhuw", "pmulhw", "cvttpd2dq", "movntq",             // e0
+   "psubsb", "psubsw", "pminsw", "por", "paddsb", "paddsw", "pmaxsw", "pxor",                  // e8
+   "lddqu", "psllw", "pslld", "psllq", "pmuludq", "pmaddwd", "psadbw", "maskmovq",             // f0
+   "psubb", "psubw", "psubd", "psubq", "paddb", "paddw", "paddd", "ud0"                        // f8
+};
+
+static bool Invalid(const u8* Code, u32 Size, TInstruction* Inst)
+{
+   // skip a single byte, that is the best resynchronisation there is without more context
+   Inst->Flags |= INSTRUCTION_FLAG_INVALID;
+   Inst->Length = 1;
+   Inst->Branch = BRANCH_NONE;
+   Inst->Bytes[0] = Size ? Code[0] : 0;
+   return false;
+}
+
+bool CDecoder::Decode(const u8* Code, u32 Size, u64 Address, TInstruction* Inst)
+{
+   const u8* p = Code;
+   const u8* end = Code + ((Size < MAX_INSTRUCTION_LENGTH) ? Size : MAX_INSTRUCTION_LENGTH);
+   bool      truncated = false;
+   u8        vex_w = 0;
+
+   auto next = [&]() -> u8
+   {
+      if (p >= end)
+      {
+         truncated = true;
+         return 0;
+      }
+      return *p++;
+   };
+
+   memset(Inst, 0, sizeof(TInstruction));
+   Inst->Address = Address;
+
+   // legacy prefixes in any order, a REX only counts when it is the last byte before the opcode
+   for (bool prefix = true; prefix && p < end; )
+   {
+      u8 byte = *p;
+
+      switch (byte)
+      {
+         case 0xf0: Inst->Flags |= INSTRUCTION_FLAG_LOCK; break;
+         case 0xf2: Inst->Flags |= INSTRUCTION_FLAG_REPNE; break;
+         case 0xf3: Inst->Flags |= INSTRUCTION_FLAG_REP; break;
+         case 0x66: Inst->Flags |= INSTRUCTION_FLAG_OPSIZE; break;
+         case 0x67: Inst->Flags |= INSTRUCTION_FLAG_ADDRSIZE; break;
+         case 0x2e: case 0x36: case 0x3e: case 0x26: case 0x64: case 0x65: break;
+         default: prefix = ((byte & 0xf0) == 0x40); break;
+      }
+
+      if (prefix)
+      {
+         Inst->Rex = ((byte & 0xf0) == 0x40) ? byte : 0;
+         p++;
+      }
+   }
+
+   u8 opcode = next();
+   u8 map = OPCODE_MAP_ONE_BYTE;
+
+   if (opcode == 0x0f)
+   {
+      opcode = next();
+      map = OPCODE_MAP_0F;
+
+      if (opcode == 0x38)
+      {
+         map = OPCODE_MAP_0F38;
+         opcode = next();
+      }
+      else if (opcode == 0x3a)
+      {
+         map = OPCODE_MAP_0F3A;
+         opcode = next();
+      }
+      else if (opcode == 0x0f)
+      {
+         map = OPCODE_MAP_3DNOW;
+      }
+   }
+   else if (opcode == 0xc5)
+   {
+      // two byte VEX: R vvvv L pp, implied 0f map
+      Inst->Encoding = ENCODING_VEX;
+      next();
+      map = OPCODE_MAP_0F;
+      opcode = next();
+   }
+   else if (opcode == 0xc4 || (opcode == 0x8f && p < end && (*p & 0x1f) >= 8))
+   {
+      // three byte VEX / XOP: RXB mmmmm, W vvvv L pp
+      bool xop = (opcode == 0x8f);
+      u8   select = next() & 0x1f;
+
+      vex_w = next() >> 7;
+      opcode = next();
+
+      if (xop)
+      {
+         Inst->Encoding = ENCODING_XOP;
+         map = (select == 8) ? OPCODE_MAP_XOP8 : (select == 9) ? OPCODE_MAP_XOP9 : (select == 10) ? OPCODE_MAP_XOPA : OPCODE_MAP_COUNT;
+      }
+      else
+      {
+         Inst->Encoding = ENCODING_VEX;
+         map = (select == 1) ? OPCODE_MAP_0F : (select == 2) ? OPCODE_MAP_0F38 : (select == 3) ? OPCODE_MAP_0F3A : OPCODE_MAP_COUNT;
+      }
+   }
+   else if (opcode == 0x62)
+   {
+      // EVEX: RXBR'0mmm, Wvvvv1pp, zL'Lbv'aaa
+      u8 select = next() & 0x07;
+
+      Inst->Encoding = ENCODING_EVEX;
+      vex_w = next() >> 7;
+      next();
+      opcode = next();
+
+      switch (select)
+      {
+         case 1: map = OPCODE_MAP_0F; break;
+         case 2: map = OPCODE_MAP_0F38; break;
+         case 3: map = OPCODE_MAP_0F3A; break;
+         case 5: map = OPCODE_MAP_EVEX5; break;
+         case 6: map = OPCODE_MAP_EVEX6; break;
+         default: map = OPCODE_MAP_COUNT; break;
+      }
+   }
+
+   if (vex_w || (Inst->Rex & 0x08))
+      Inst->Flags |= INSTRUCTION_FLAG_REX_W;
+
+   if (truncated || map == OPCODE_MAP_COUNT)
+      return Invalid(Code, Size, Inst);
+
+   TOpcodeInfo info = OpcodeTables[map].Op[opcode];
+
+   // vector encodings have a ModRM byte (except vzeroupper/vzeroall) and never branch
+   if (Inst->Encoding != ENCODING_LEGACY)
+   {
+      info.Flags = (map == OPCODE_MAP_0F && opcode == 0x77) ? 0 : OP_MODRM;
+      info.Branch = BRANCH_NONE;
+   }
+
+   Inst->Map = map;
+   Inst->Opcode = opcode;
+   Inst->Branch = info.Branch;
+
+   if (info.Flags & OP_SYSCALL)
+      Inst->Flags |= INSTRUCTION_FLAG_SYSCALL;
+
+   if (info.Flags & OP_MODRM)
+   {
+      u8 modrm = next();
+      u8 mod = modrm >> 6;
+      u8 rm = modrm & 7;
+
+      Inst->Flags |= INSTRUCTION_FLAG_MODRM;
+      Inst->ModRM = modrm;
+
+      if (mod != 3)
+      {
+         u8 disp_size = (mod == 1) ? 1 : (mod == 2) ? 4 : 0;
+
+         if (rm == 4)
+         {
+            u8 sib = next();
+
+            Inst->Flags |= INSTRUCTION_FLAG_SIB;
+
+            if ((sib & 7) == 5 && mod == 0)
+               disp_size = 4;
+         }
+         else if (rm == 5 && mod == 0)
+         {
+            disp_size = 4;
+            Inst->Flags |= INSTRUCTION_FLAG_RIP_RELATIVE;
+         }
+
+         if (disp_size == 1)
+         {
+            Inst->Displacement = (s8)next();
+         }
+         else if (disp_size == 4)
+         {
+            u32 disp = next();
+            disp |= (u32)next() << 8;
+            disp |= (u32)next() << 16;
+            disp |= (u32)next() << 24;
+            Inst->Displacement = (s32)disp;
+         }
+      }
+
+      u8 reg = (modrm >> 3) & 7;
+
+      if ((info.Flags & OP_GROUP3) && reg > 1)
+         info.Immediate = IMM_NONE;
+
+      if (info.Flags & OP_GROUP5)
+      {
+         if (reg == 2 || reg == 3)
+            Inst->Branch = BRANCH_CALL_INDIRECT;
+         else if (reg == 4 || reg == 5)
+            Inst->Branch = BRANCH_JUMP_INDIRECT;
+      }
+   }
+
+   u32 imm_size = 0;
+   u32 imm2_size = 0;
+
+   switch (info.Immediate)
+   {
+      case IMM_8:     imm_size = 1; break;
+      case IMM_16:    imm_size = 2; break;
+      case IMM_Z:     imm_size = (Inst->Flags & INSTRUCTION_FLAG_OPSIZE) ? 2 : 4; break;
+      case IMM_V:     imm_size = (Inst->Flags & INSTRUCTION_FLAG_REX_W) ? 8 : (Inst->Flags & INSTRUCTION_FLAG_OPSIZE) ? 2 : 4; break;
+      case IMM_REL32: imm_size = 4; break;
+      case IMM_16_8:  imm_size = 2; imm2_size = 1; break;
+      case IMM_MOFFS: imm_size = (Inst->Flags & INSTRUCTION_FLAG_ADDRSIZE) ? 4 : 8; break;
+      default: break;
+   }
+
+   // VEX/EVEX instructions in the 0f map only keep the imm8 forms (cmpps, shufps, ...)
+   if (Inst->Encoding != ENCODING_LEGACY && map == OPCODE_MAP_0F && info.Immediate != IMM_8)
+      imm_size = 0;
+
+   if (imm_size)
+   {
+      u64 value = 0;
+
+      for (u32 i = 0; i < imm_size; i++)
+         value |= (u64)next() << (i * 8);
+
+      // sign extend to 64 bits
+      if (imm_size < 8)
+      {
+         u32 shift = 64 - (imm_size * 8);
+         value = (u64)((s64)(value << shift) >> shift);
+      }
+
+      Inst->Immediate = (s64)value;
+
+      for (u32 i = 0; i < imm2_size; i++)
+         next();
+   }
+
+   // 3DNow! puts the real opcode after the operands
+   if (map == OPCODE_MAP_3DNOW)
+      Inst->Opcode = (u8)Inst->Immediate;
+
+   if (truncated)
+      return Invalid(Code, Size, Inst);
+
+   Inst->Length = p - Code;
+   memcpy(Inst->Bytes, Code, Inst->Length);
+
+   if (Inst->Branch == BRANCH_JUMP || Inst->Branch == BRANCH_CONDITIONAL || Inst->Branch == BRANCH_CALL)
+   {
+      Inst->Target = Address + Inst->Length + Inst->Immediate;
+   }
+   else if (Inst->Flags & INSTRUCTION_FLAG_RIP_RELATIVE)
+   {
+      Inst->Target = Address + Inst->Length + Inst->Displacement;
+   }
+
+   if (info.Flags & OP_INVALID)
+   {
+      Inst->Flags |= INSTRUCTION_FLAG_INVALID;
+      return false;
+   }
+
+   return true;
+}
+
+void CDecoder::GetMnemonic(const TInstruction* Inst, char* Buffer, u32 Size)
+{
+   const char* name = nullptr;
+   u8          reg = (Inst->ModRM >> 3) & 7;
+
+   if (Inst->Flags & INSTRUCTION_FLAG_INVALID)
+   {
+      snprintf(Buffer, Size, "(bad)");
+      return;
+   }
+
+   if (Inst->Map == OPCODE_MAP_ONE_BYTE)
+   {
+      switch (Inst->Opcode)
+      {
+         case 0x80: case 0x81: case 0x83:
+            name = Group1Mnemonics[reg];
+            break;
+         case 0xc0: case 0xc1: case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+            name = Group2Mnemonics[reg];
+            break;
+         case 0xf6: case 0xf7:
+            name = Group3Mnemonics[reg];
+            break;
+         case 0xfe:
+            name = (reg == 0) ? "inc" : (reg == 1) ? "dec" : nullptr;
+            break;
+         case 0xff:
+            name = Group5Mnemonics[reg];
+            break;
+         case 0x90:
+            name = (Inst->Flags & INSTRUCTION_FLAG_REP) ? "pause" : (Inst->Rex & 1) ? "xchg" : "nop";
+            break;
+         default:
+            name = OneByteMnemonics[Inst->Opcode];
+            break;
+      }
+   }
+   else if (Inst->Map == OPCODE_MAP_0F)
+   {
+      if (Inst->Opcode == 0x1e && (Inst->Flags & INSTRUCTION_FLAG_REP) && Inst->ModRM == 0xfa)
+         name = "endbr64";
+      else
+         name = TwoByteMnemonics[Inst->Opcode];
+   }
+
+   if (name && Inst->Encoding == ENCODING_LEGACY)
+      snprintf(Buffer, Size, "%s", name);
+   else if (name)
+      snprintf(Buffer, Size, "v%s", name);
+   else
+      snprintf(Buffer, Size, "(%s map %d op %02x)", EncodingNames[Inst->Encoding], Inst->Map, Inst->Opcode);
+}
+
+CInstructionCache::CInstructionCache()
+   : mInstructions(),
+     mHits(0),
+     mMisses(0)
+{
+   mInstructions.reserve(4096);
+}
+
+const TInstruction* CInstructionCache::Find(u64 Address) const
+{
+   auto it = mInstructions.find(Address);
+
+   if (it == mInstructions.end())
+   {
+      mMisses++;
+      return nullptr;
+   }
+
+   mHits++;
+   return &it->second;
+}
+
+const TInstruction* CInstructionCache::Insert(const TInstruction* Inst)
+{
+   // a simple bound, the cache refills quickly from whatever is being looked at
+   if (mInstructions.size() >= MAX_ENTRIES)
+      mInstructions.clear();
+
+   return &(mInstructions[Inst->Address] = *Inst);
+}
+
+void CInstructionCache::Invalidate(u64 Address, u64 Size)
+{
+   if (mInstructions.size() == 0)
+      return;
+
+   // any instruction starting up to 14 bytes before the write can overlap it
+   u64 start = (Address > MAX_INSTRUCTION_LENGTH - 1) ? Address - (MAX_INSTRUCTION_LENGTH - 1) : 0;
+
+   for (u64 address = start; address < Address + Size; address++)
+   {
+      auto it = mInstructions.find(address);
+
+      if (it != mInstructions.end() && address + it->second.Length > Address)
+         mInstructions.erase(it);
+   }
+}
+
+void CInstructionCache::Clear()
+{
+   mInstructions.clear();
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <unordered_map>
+#include "DebugTypes.h"
+
+const u32 MAX_INSTRUCTION_LENGTH = 15;
+
+enum eOpcodeMap
+{
+   OPCODE_MAP_ONE_BYTE,
+   OPCODE_MAP_0F,
+   OPCODE_MAP_0F38,
+   OPCODE_MAP_0F3A,
+   OPCODE_MAP_3DNOW,
+   OPCODE_MAP_XOP8,
+   OPCODE_MAP_XOP9,
+   OPCODE_MAP_XOPA,
+   OPCODE_MAP_EVEX5, // AVX512-FP16
+   OPCODE_MAP_EVEX6,
+   OPCODE_MAP_COUNT
+};
+
+enum eBranchType
+{
+   BRANCH_NONE,
+   BRANCH_JUMP,          // jmp rel8/rel32
+   BRANCH_CONDITIONAL,   // jcc, loop, jrcxz
+   BRANCH_CALL,          // call rel32
+   BRANCH_RETURN,        // ret, retf, iret
+   BRANCH_JUMP_INDIRECT, // jmp r/m
+   BRANCH_CALL_INDIRECT, // call r/m
+   BRANCH_TRAP           // int3, int n, syscall, ud2, hlt
+};
+
+enum eEncoding
+{
+   ENCODING_LEGACY,
+   ENCODING_VEX,
+   ENCODING_EVEX,
+   ENCODING_XOP
+};
+
+#define INSTRUCTION_FLAG_MODRM        (1 << 0)
+#define INSTRUCTION_FLAG_SIB          (1 << 1)
+#define INSTRUCTION_FLAG_RIP_RELATIVE (1 << 2)
+#define INSTRUCTION_FLAG_LOCK         (1 << 3)
+#define INSTRUCTION_FLAG_REP          (1 << 4) // f3
+#define INSTRUCTION_FLAG_REPNE        (1 << 5) // f2
+#define INSTRUCTION_FLAG_OPSIZE       (1 << 6) // 66
+#define INSTRUCTION_FLAG_ADDRSIZE     (1 << 7) // 67
+#define INSTRUCTION_FLAG_REX_W        (1 << 8)
+#define INSTRUCTION_FLAG_SYSCALL      (1 << 9)
+#define INSTRUCTION_FLAG_INVALID      (1 << 10)
+
+struct TInstruction
+{
+   u64 Address;
+   u64 Target;       // branch target for direct branches, rip relative address otherwise
+   s64 Immediate;
+   s32 Displacement;
+   u16 Flags;        // INSTRUCTION_FLAG_*
+   u8  Length;
+   u8  Map;          // eOpcodeMap
+   u8  Opcode;
+   u8  ModRM;
+   u8  Rex;
+   u8  Encoding;     // eEncoding
+   u8  Branch;       // eBranchType
+   u8  Bytes[MAX_INSTRUCTION_LENGTH];
+};
+
+// Length and control flow decoder for x86_64 machine code. Everything that depends on the
+// opcode (ModRM present, immediate size, branch type) comes out of per-map tables that are
+// built at compile time, so decoding is a few table lookups per instruction. It knows
+// prefixes, REX, VEX, EVEX and XOP; mnemonics are only provided for the common opcodes.
+class CDecoder
+{
+public:
+
+   // returns false if the bytes are not a valid instruction, Inst->Length is still set
+   // to a best guess (at least 1) so callers can always make progress
+   static bool Decode(const u8* Code, u32 Size, u64 Address, TInstruction* Inst);
+
+   // writes the mnemonic, vector instructions without a name get their map and opcode
+   static void GetMnemonic(const TInstruction* Inst, char* Buffer, u32 Size);
+
+   static bool IsCall(const TInstruction* Inst) { return Inst->Branch == BRANCH_CALL || Inst->Branch == BRANCH_CALL_INDIRECT; }
+   static bool IsReturn(const TInstruction* Inst) { return Inst->Branch == BRANCH_RETURN; }
+};
+
+// Decoded instructions keyed by address. The backend invalidates the range of every write
+// to target memory, and decodes from memory with breakpoint bytes already put back, so an
+// int3 patch never ends up in here.
+class CInstructionCache
+{
+public:
+
+   static constexpr u32 MAX_ENTRIES = 256 * 1024;
+
+   CInstructionCache();
+
+   const TInstruction* Find(u64 Address) const;
+   const TInstruction* Insert(const TInstruction* Inst);
+   void Invalidate(u64 Address, u64 Size);
+   void Clear();
+
+   u64 GetHits() const { return mHits; }
+   u64 GetMisses() const { return mMisses; }
+   size_t GetSize() const { return mInstructions.size(); }
+
+private:
+
+   std::unordered_map<u64, TInstruction> mInstructions;
+   mutable u64                           mHits;
+   mutable u64                           mMisses;
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include "DebugTypes.h"
+
+// DWARF register numbers for x86_64 (System V ABI, figure 3.36)
+enum eDwarfRegister
+{
+   DWARF_REG_RAX,
+   DWARF_REG_RDX,
+   DWARF_REG_RCX,
+   DWARF_REG_RBX,
+   DWARF_REG_RSI,
+   DWARF_REG_RDI,
+   DWARF_REG_RBP,
+   DWARF_REG_RSP,
+   DWARF_REG_R8,
+   DWARF_REG_R9,
+   DWARF_REG_R10,
+   DWARF_REG_R11,
+   DWARF_REG_R12,
+   DWARF_REG_R13,
+   DWARF_REG_R14,
+   DWARF_REG_R15,
+   DWARF_REG_RA,    // return address (rip)
+   DWARF_REG_COUNT
+};
+
+// maps a DWARF register number to its slot in TRegister
+const eRegister DwarfToRegister[DWARF_REG_COUNT] =
+{
+   REGISTER_RAX,
+   REGISTER_RDX,
+   REGSITER_RCX,
+   REGISTER_RBX,
+   REGISTER_RSI,
+   REGISTER_RDI,
+   REGISTER_RBP,
+   REGISTER_RSP,
+   REGISTER_R8,
+   REGISTER_R9,
+   REGISTER_R10,
+   REGISTER_R11,
+   REGISTER_R12,
+   REGISTER_R13,
+   REGISTER_R14,
+   REGISTER_R15,
+   REGISTER_RIP
+};
+
+// Call frame instructions (DWARF 5, section 6.4.2)
+enum eDwarfCfa
+{
+   DW_CFA_nop                = 0x00,
+   DW_CFA_set_loc            = 0x01,
+   DW_CFA_advance_loc1       = 0x02,
+   DW_CFA_advance_loc2       = 0x03,
+   DW_CFA_advance_loc4       = 0x04,
+   DW_CFA_offset_extended    = 0x05,
+   DW_CFA_restore_extended   = 0x06,
+   DW_CFA_undefined          = 0x07,
+   DW_CFA_same_value         = 0x08,
+   DW_CFA_register           = 0x09,
+   DW_CFA_remember_state     = 0x0a,
+   DW_CFA_restore_state      = 0x0b,
+   DW_CFA_def_cfa            = 0x0c,
+   DW_CFA_def_cfa_register   = 0x0d,
+   DW_CFA_def_cfa_offset     = 0x0e,
+   DW_CFA_def_cfa_expression = 0x0f,
+   DW_CFA_expression         = 0x10,
+   DW_CFA_offset_extended_sf = 0x11,
+   DW_CFA_def_cfa_sf         = 0x12,
+   DW_CFA_def_cfa_offset_sf  = 0x13,
+   DW_CFA_val_offset         = 0x14,
+   DW_CFA_val_offset_sf      = 0x15,
+   DW_CFA_val_expression     = 0x16,
+   DW_CFA_GNU_args_size      = 0x2e,
+   DW_CFA_advance_loc        = 0x40, // high 2 bits, delta in low 6 bits
+   DW_CFA_offset             = 0x80, // high 2 bits, register in low 6 bits
+   DW_CFA_restore            = 0xc0  // high 2 bits, register in low 6 bits
+};
+
+// Pointer encodings used in .eh_frame (LSB core specification)
+enum eDwarfPointerEncoding
+{
+   DW_EH_PE_absptr   = 0x00,
+   DW_EH_PE_uleb128  = 0x01,
+   DW_EH_PE_udata2   = 0x02,
+   DW_EH_PE_udata4   = 0x03,
+   DW_EH_PE_udata8   = 0x04,
+   DW_EH_PE_sleb128  = 0x09,
+   DW_EH_PE_sdata2   = 0x0a,
+   DW_EH_PE_sdata4   = 0x0b,
+   DW_EH_PE_sdata8   = 0x0c,
+   DW_EH_PE_pcrel    = 0x10,
+   DW_EH_PE_textrel  = 0x20,
+   DW_EH_PE_datarel  = 0x30,
+   DW_EH_PE_funcrel  = 0x40,
+   DW_EH_PE_aligned  = 0x50,
+   DW_EH_PE_indirect = 0x80,
+   DW_EH_PE_omit     = 0xff
+};
+
+// Bounds checked reader over a block of DWARF data. Reads past the end return zero and
+// set Overrun, so parsers can check once at the end of a record instead of at every field.
+struct TDwarfReader
+{
+   const u8* Data;
+   const u8* End;
+   bool      Overrun;
+
+   TDwarfReader(const u8* Start, const u8* Finish) : Data(Start), End(Finish), Overrun(false) {}
+
+   bool AtEnd() const { return Data >= End; }
+   u64 Remaining() const { return (Data < End) ? End - Data : 0; }
+
+   void Skip(u64 Bytes)
+   {
+      if (Bytes > Remaining())
+      {
+         Overrun = true;
+         Data = End;
+      }
+      else
+      {
+         Data += Bytes;
+      }
+   }
+
+   template <typename T>
+   T Read()
+   {
+      T result = 0;
+
+      if (sizeof(T) > Remaining())
+      {
+         Overrun = true;
+         Data = End;
+         return result;
+      }
+
+      __builtin_memcpy(&result, Data, sizeof(T));
+      Data += sizeof(T);
+      return result;
+   }
+
+   u8 ReadU8() { return Read<u8>(); }
+   u16 ReadU16() { return Read<u16>(); }
+   u32 ReadU32() { return Read<u32>(); }
+   u64 ReadU64() { return Read<u64>(); }
+
+   u64 ReadULEB128()
+   {
+      u64 result = 0;
+      u32 shift = 0;
+
+      while (Data < End)
+      {
+         u8 byte = *Data++;
+
+         if (shift < 64)
+            result |= (u64)(byte & 0x7f) << shift;
+         shift += 7;
+
+         if ((byte & 0x80) == 0)
+            return result;
+      }
+
+      Overrun = true;
+      return result;
+   }
+
+   s64 ReadSLEB128()
+   {
+      s64 result = 0;
+      u32 shift = 0;
+      u8  byte = 0;
+
+      while (Data < End)
+      {
+         byte = *Data++;
+
+         if (shift < 64)
+            result |= (s64)(byte & 0x7f) << shift;
+         shift += 7;
+
+         if ((byte & 0x80) == 0)
+         {
+            // sign extend
+            if (shift < 64 && (byte & 0x40))
+               result |= -((s64)1 << shift);
+            return result;
+         }
+      }
+
+      Overrun = true;
+      return result;
+   }
+
+   const char* ReadString()
+   {
+      const char* result = (const char*)Data;
+
+      while (Data < End && *Data)
+         Data++;
+
+      if (Data >= End)
+      {
+         Overrun = true;
+         return "";
+      }
+
+      Data++;
+      return result;
+   }
+};
+
+// Line number program opcodes (DWARF 5, section 6.2.5)
+enum eDwarfLineOpcode
+{
+   DW_LNS_copy               = 0x01,
+   DW_LNS_advance_pc         = 0x02,
+   DW_LNS_advance_line       = 0x03,
+   DW_LNS_set_file           = 0x04,
+   DW_LNS_set_column         = 0x05,
+   DW_LNS_negate_stmt        = 0x06,
+   DW_LNS_set_basic_block    = 0x07,
+   DW_LNS_const_add_pc       = 0x08,
+   DW_LNS_fixed_advance_pc   = 0x09,
+   DW_LNS_set_prologue_end   = 0x0a,
+   DW_LNS_set_epilogue_begin = 0x0b,
+   DW_LNS_set_isa            = 0x0c
+};
+
+enum eDwarfLineExtendedOpcode
+{
+   DW_LNE_end_sequence      = 0x01,
+   DW_LNE_set_address       = 0x02,
+   DW_LNE_define_file       = 0x03,
+   DW_LNE_set_discriminator = 0x04
+};
+
+// Content types of the DWARF 5 directory and file name tables
+enum eDwarfLineContent
+{
+   DW_LNCT_path            = 0x1,
+   DW_LNCT_directory_index = 0x2,
+   DW_LNCT_timestamp       = 0x3,
+   DW_LNCT_size            = 0x4,
+   DW_LNCT_MD5             = 0x5
+};
+
+// Attribute forms (DWARF 5, section 7.5.6)
+enum eDwarfForm
+{
+   DW_FORM_addr           = 0x01,
+   DW_FORM_block2         = 0x03,
+   DW_FORM_block4         = 0x04,
+   DW_FORM_data2          = 0x05,
+   DW_FORM_data4          = 0x06,
+   DW_FORM_data8          = 0x07,
+   DW_FORM_string         = 0x08,
+   DW_FORM_block          = 0x09,
+   DW_FORM_block1         = 0x0a,
+   DW_FORM_data1          = 0x0b,
+   DW_FORM_flag           = 0x0c,
+   DW_FORM_sdata          = 0x0d,
+   DW_FORM_strp           = 0x0e,
+   DW_FORM_udata          = 0x0f,
+   DW_FORM_ref_addr       = 0x10,
+   DW_FORM_ref1           = 0x11,
+   DW_FORM_ref2           = 0x12,
+   DW_FORM_ref4           = 0x13,
+   DW_FORM_ref8           = 0x14,
+   DW_FORM_ref_udata      = 0x15,
+   DW_FORM_indirect       = 0x16,
+   DW_FORM_sec_offset     = 0x17,
+   DW_FORM_exprloc        = 0x18,
+   DW_FORM_flag_present   = 0x19,
+   DW_FORM_strx           = 0x1a,
+   DW_FORM_addrx          = 0x1b,
+   DW_FORM_ref_sup4       = 0x1c,
+   DW_FORM_strp_sup       = 0x1d,
+   DW_FORM_data16         = 0x1e,
+   DW_FORM_line_strp      = 0x1f,
+   DW_FORM_ref_sig8       = 0x20,
+   DW_FORM_implicit_const = 0x21,
+   DW_FORM_loclistx       = 0x22,
+   DW_FORM_rnglistx       = 0x23,
+   DW_FORM_ref_sup8       = 0x24,
+   DW_FORM_strx1          = 0x25,
+   DW_FORM_strx2          = 0x26,
+   DW_FORM_strx3          = 0x27,
+   DW_FORM_strx4          = 0x28,
+   DW_FORM_addrx1         = 0x29,
+   DW_FORM_addrx2         = 0x2a,
+   DW_FORM_addrx3         = 0x2b,
+   DW_FORM_addrx4         = 0x2c,
+   DW_FORM_GNU_addr_index = 0x1f01,
+   DW_FORM_GNU_str_index  = 0x1f02,
+   DW_FORM_GNU_ref_alt    = 0x1f20,
+   DW_FORM_GNU_strp_alt   = 0x1f21
+};
+
+// Attributes, only the ones the debugger looks for
+enum eDwarfAttribute
+{
+   DW_AT_stmt_list = 0x10
+};
+
+// Unit types of a DWARF 5 unit header
+enum eDwarfUnitType
+{
+   DW_UT_compile       = 0x01,
+   DW_UT_type          = 0x02,
+   DW_UT_partial       = 0x03,
+   DW_UT_skeleton      = 0x04,
+   DW_UT_split_compile = 0x05,
+   DW_UT_split_type    = 0x06
+};
@@ -0,0 +1,651 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <algorithm>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "ElfFile.h"
+
+CElfFile::CElfFile()
+   : mFilename(),
+     mImage{},
+     mSections(),
+     mSymbols(),
+     mSymbolsLoaded(false),
+     mCache(),
+     mChunkedSections(),
+     mCacheBudget(DEFAULT_CACHE_BUDGET),
+     mCachedBytes(0),
+     mUseCounter(0)
+{
+}
+
+CElfFile::~CElfFile()
+{
+   Close();
+}
+
+bool CElfFile::Open(const char* Filename)
+{
+   struct stat stat_buf;
+
+   Close();
+
+   int fd = open(Filename, O_RDONLY | O_CLOEXEC);
+
+   if (fd == -1)
+      return false;
+
+   if (fstat(fd, &stat_buf) == -1 || stat_buf.st_size == 0)
+   {
+      close(fd);
+      return false;
+   }
+
+   // map the file instead of reading it, only the pages we touch get loaded
+   void* image = mmap(nullptr, stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (image == MAP_FAILED)
+      return false;
+
+   mFilename = Filename;
+   mImage.Data = (u8*)image;
+   mImage.Size = stat_buf.st_size;
+
+   if (mImage.Size >= sizeof(TElfHeader64) &&
+       memcmp(mImage.Data, ELF_MAGIC, ELF_MAGIC_SIZE) == 0 &&
+       mImage.Data[ELF_CLASS] == ELF_CLASS_64BIT)
+   {
+      ParseSections();
+   }
+
+   return true;
+}
+
+void CElfFile::Close()
+{
+   for (size_t i = 0; i < mCache.size(); i++)
+   {
+      delete [] mCache[i].Data;
+   }
+   mCache.clear();
+
+   FreeChunkedSections();
+   mCachedBytes = 0;
+
+   mSections.clear();
+   mSymbols.clear();
+   mSymbolsLoaded = false;
+
+   if (mImage.Data)
+   {
+      munmap(mImage.Data, mImage.Size);
+   }
+
+   mImage.Data = nullptr;
+   mImage.Size = 0;
+   mFilename = "";
+}
+
+const TElfSection* CElfFile::FindSection(const char* Name) const
+{
+   for (size_t i = 0; i < mSections.size(); i++)
+   {
+      if (mSections[i].Name == Name)
+         return &mSections[i];
+   }
+
+   return nullptr;
+}
+
+const TElfProgramHeader64* CElfFile::GetProgramHeaders(u32* Count) const
+{
+   const TElfHeader64* header = GetHeader();
+
+   *Count = 0;
+
+   if (!IsOpen() || header->e_phoff == 0 || header->e_phentsize != sizeof(TElfProgramHeader64))
+      return nullptr;
+
+   if (header->e_phoff + (header->e_phnum * sizeof(TElfProgramHeader64)) > mImage.Size)
+      return nullptr;
+
+   *Count = header->e_phnum;
+   return (const TElfProgramHeader64*)&mImage.Data[header->e_phoff];
+}
+
+const TElfSymbol* CElfFile::FindSymbol(u64 Address)
+{
+   LoadSymbols();
+
+   // find the last symbol starting at or before the address
+   size_t low = 0;
+   size_t high = mSymbols.size();
+
+   while (low < high)
+   {
+      size_t mid = (low + high) / 2;
+
+      if (mSymbols[mid].Address <= Address)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   if (low == 0)
+      return nullptr;
+
+   const TElfSymbol* symbol = &mSymbols[low - 1];
+
+   if (symbol->Size)
+      return (Address < symbol->Address + symbol->Size) ? symbol : nullptr;
+
+   // symbols without a size (hand written assembly) cover everything up to the next one,
+   // as long as that stays inside the code section the symbol is in
+   for (size_t i = 0; i < mSections.size(); i++)
+   {
+      const TElfSection* section = &mSections[i];
+
+      if ((section->Flags & ELF_SECTION_FLAG_EXECINSTR) &&
+          symbol->Address >= section->Address && Address < section->Address + section->Size)
+      {
+         return symbol;
+      }
+   }
+
+   return nullptr;
+}
+
+const TElfSymbol* CElfFile::FindSymbol(const char* Name)
+{
+   LoadSymbols();
+
+   for (size_t i = 0; i < mSymbols.size(); i++)
+   {
+      if (strcmp(mSymbols[i].Name, Name) == 0)
+         return &mSymbols[i];
+   }
+
+   return nullptr;
+}
+
+TBuffer CElfFile::GetSection(const char* Name)
+{
+   return GetSection(FindSection(Name));
+}
+
+TBuffer CElfFile::GetSection(const TElfSection* Section)
+{
+   TBuffer result = {};
+
+   if (!Section || Section->Type == ELF_SECTION_TYPE_NOBITS)
+      return result;
+
+   if (Section->Compression == ELF_COMPRESS_NONE)
+   {
+      result.Data = &mImage.Data[Section->Offset];
+      result.Size = Section->Size;
+   }
+   else
+   {
+      // callers asking for a whole section get it whole, even if it is large
+      result.Data = (u8*)DecompressWhole(Section, &result.Size);
+   }
+
+   return result;
+}
+
+bool CElfFile::ReadSection(const TElfSection* Section, u64 Offset, void* Buffer, u64 Size)
+{
+   if (!Section || Section->Type == ELF_SECTION_TYPE_NOBITS)
+      return false;
+
+   if (Offset > Section->Size || Size > Section->Size - Offset)
+      return false;
+
+   if (Section->Compression == ELF_COMPRESS_NONE)
+   {
+      memcpy(Buffer, &mImage.Data[Section->Offset + Offset], Size);
+      return true;
+   }
+
+   if (Section->Size <= WHOLE_SECTION_LIMIT || Section->Compression != ELF_COMPRESS_ZLIB)
+   {
+      u64       size;
+      const u8* data = DecompressWhole(Section, &size);
+
+      if (!data)
+         return false;
+
+      memcpy(Buffer, &data[Offset], Size);
+      return true;
+   }
+
+   // large zlib section, only inflate the chunks covering the range
+   u8* dst = (u8*)Buffer;
+
+   while (Size > 0)
+   {
+      u32       chunk = Offset / CHUNK_SIZE;
+      u64       chunk_offset = Offset % CHUNK_SIZE;
+      u64       chunk_size;
+      const u8* data = DecompressChunk(Section, chunk, &chunk_size);
+
+      if (!data || chunk_offset >= chunk_size)
+         return false;
+
+      u64 bytes = chunk_size - chunk_offset;
+      if (bytes > Size)
+         bytes = Size;
+
+      memcpy(dst, &data[chunk_offset], bytes);
+
+      dst += bytes;
+      Offset += bytes;
+      Size -= bytes;
+   }
+
+   return true;
+}
+
+void CElfFile::SetCacheBudget(u64 Bytes)
+{
+   mCacheBudget = Bytes;
+   EvictCache(0);
+}
+
+bool CElfFile::ParseSections()
+{
+   const TElfHeader64* header = GetHeader();
+
+   if (header->e_shoff == 0 || header->e_shentsize != sizeof(TElfSectionHeader64))
+      return false;
+
+   if (header->e_shoff + sizeof(TElfSectionHeader64) > mImage.Size)
+      return false;
+
+   const TElfSectionHeader64* section_headers = (const TElfSectionHeader64*)&mImage.Data[header->e_shoff];
+
+   // with extended section numbering the real counts are stored in section header 0
+   u64 num_sections = header->e_shnum ? header->e_shnum : section_headers[0].sh_size;
+   u32 string_index = (header->e_shstrndx != 0xffff) ? header->e_shstrndx : section_headers[0].sh_link;
+
+   if (header->e_shoff + (num_sections * sizeof(TElfSectionHeader64)) > mImage.Size || string_index >= num_sections)
+      return false;
+
+   const TElfSectionHeader64* strings = &section_headers[string_index];
+
+   if (strings->sh_offset + strings->sh_size > mImage.Size)
+      return false;
+
+   mSections.reserve(num_sections);
+
+   for (u64 i = 0; i < num_sections; i++)
+   {
+      const TElfSectionHeader64* sh = &section_headers[i];
+      TElfSection                section = {};
+
+      if (sh->sh_name < strings->sh_size)
+      {
+         const char* name = (const char*)&mImage.Data[strings->sh_offset + sh->sh_name];
+         section.Name.assign(name, strnlen(name, strings->sh_size - sh->sh_name));
+      }
+
+      section.Index = i;
+      section.Type = sh->sh_type;
+      section.Link = sh->sh_link;
+      section.Flags = sh->sh_flags;
+      section.Address = sh->sh_addr;
+      section.Offset = sh->sh_offset;
+      section.FileSize = sh->sh_size;
+      section.Size = sh->sh_size;
+      section.Compression = ELF_COMPRESS_NONE;
+
+      if (sh->sh_type != ELF_SECTION_TYPE_NOBITS && sh->sh_offset + sh->sh_size > mImage.Size)
+      {
+         // truncated file, don't hand out pointers past the end of the image
+         section.Type = ELF_SECTION_TYPE_NOBITS;
+      }
+      else if ((sh->sh_flags & ELF_SECTION_FLAG_COMPRESSED) && sh->sh_size >= sizeof(TElfCompressionHeader64))
+      {
+         const TElfCompressionHeader64* chdr = (const TElfCompressionHeader64*)&mImage.Data[sh->sh_offset];
+
+         section.Offset += sizeof(TElfCompressionHeader64);
+         section.FileSize -= sizeof(TElfCompressionHeader64);
+         section.Size = chdr->ch_size;
+         section.Compression = chdr->ch_type;
+      }
+
+      mSections.push_back(section);
+   }
+
+   return true;
+}
+
+void CElfFile::LoadSymbols()
+{
+   if (mSymbolsLoaded)
+      return;
+
+   mSymbolsLoaded = true;
+
+   const TElfSection* symbols = FindSection(".symtab");
+
+   if (!symbols)
+      symbols = FindSection(".dynsym");
+
+   if (symbols)
+      LoadSymbols(symbols);
+
+   std::sort(mSymbols.begin(), mSymbols.end(), [](const TElfSymbol& A, const TElfSymbol& B) { return A.Address < B.Address; });
+}
+
+void CElfFile::LoadSymbols(const TElfSection* Symbols)
+{
+   if (Symbols->Compression != ELF_COMPRESS_NONE || Symbols->Type == ELF_SECTION_TYPE_NOBITS)
+      return;
+
+   // names point straight into the mapped string table, so it can't be compressed either
+   if (Symbols->Link >= mSections.size() || mSections[Symbols->Link].Compression != ELF_COMPRESS_NONE ||
+       mSections[Symbols->Link].Type == ELF_SECTION_TYPE_NOBITS)
+      return;
+
+   const TElfSymbol64* entries = (const TElfSymbol64*)&mImage.Data[Symbols->Offset];
+   u64                 num_entries = Symbols->Size / sizeof(TElfSymbol64);
+   const TElfSection*  strings = &mSections[Symbols->Link];
+
+   mSymbols.reserve(num_entries);
+
+   for (u64 i = 0; i < num_entries; i++)
+   {
+      if (ELF_SYMBOL_TYPE(entries[i].st_info) != ELF_SYMBOL_TYPE_FUNC || entries[i].st_value == 0 ||
+          entries[i].st_name >= strings->Size)
+         continue;
+
+      TElfSymbol symbol;
+      symbol.Address = entries[i].st_value;
+      symbol.Size = entries[i].st_size;
+      symbol.Name = (const char*)&mImage.Data[strings->Offset + entries[i].st_name];
+
+      mSymbols.push_back(symbol);
+   }
+}
+
+const u8* CElfFile::GetCachedData(u32 Section, u32 Chunk, u64* Size)
+{
+   for (size_t i = 0; i < mCache.size(); i++)
+   {
+      if (mCache[i].Section == Section && mCache[i].Chunk == Chunk)
+      {
+         mCache[i].LastUse = ++mUseCounter;
+         *Size = mCache[i].Size;
+         return mCache[i].Data;
+      }
+   }
+
+   return nullptr;
+}
+
+u8* CElfFile::AddCacheEntry(u32 Section, u32 Chunk, u64 Size)
+{
+   TCacheEntry entry;
+
+   EvictCache(Size);
+
+   entry.Section = Section;
+   entry.Chunk = Chunk;
+   entry.Data = new u8[Size];
+   entry.Size = Size;
+   entry.LastUse = ++mUseCounter;
+
+   mCache.push_back(entry);
+   mCachedBytes += Size;
+
+   return entry.Data;
+}
+
+void CElfFile::EvictCache(u64 BytesNeeded)
+{
+   // drop least recently used buffers and checkpoints until the new one fits the budget
+   while (mCachedBytes + BytesNeeded > mCacheBudget)
+   {
+      size_t       lru = mCache.size();
+      TCheckpoint* checkpoint = nullptr;
+      u64          oldest = ~0ull;
+
+      for (size_t i = 0; i < mCache.size(); i++)
+      {
+         if (mCache[i].LastUse < oldest)
+         {
+            lru = i;
+            oldest = mCache[i].LastUse;
+         }
+      }
+
+      for (size_t i = 0; i < mChunkedSections.size(); i++)
+      {
+         for (size_t j = 0; j < mChunkedSections[i].Checkpoints.size(); j++)
+         {
+            TCheckpoint* current = &mChunkedSections[i].Checkpoints[j];
+
+            if (current->Stream && current->LastUse < oldest)
+            {
+               checkpoint = current;
+               oldest = current->LastUse;
+            }
+         }
+      }
+
+      if (checkpoint)
+      {
+         DropCheckpoint(checkpoint);
+      }
+      else if (lru < mCache.size())
+      {
+         mCachedBytes -= mCache[lru].Size;
+         delete [] mCache[lru].Data;
+         mCache.erase(mCache.begin() + lru);
+      }
+      else
+      {
+         break;
+      }
+   }
+}
+
+const u8* CElfFile::DecompressWhole(const TElfSection* Section, u64* Size)
+{
+   const u8* cached = GetCachedData(Section->Index, WHOLE_SECTION, Size);
+
+   if (cached)
+      return cached;
+
+   const u8* src = &mImage.Data[Section->Offset];
+   u8*       dst = nullptr;
+   bool      status = false;
+
+   if (Section->Compression == ELF_COMPRESS_ZLIB)
+   {
+      uLongf dst_size = Section->Size;
+
+      dst = AddCacheEntry(Section->Index, WHOLE_SECTION, Section->Size);
+      status = (uncompress(dst, &dst_size, src, Section->FileSize) == Z_OK && dst_size == Section->Size);
+   }
+#ifdef HAVE_ZSTD
+   else if (Section->Compression == ELF_COMPRESS_ZSTD)
+   {
+      dst = AddCacheEntry(Section->Index, WHOLE_SECTION, Section->Size);
+      size_t dst_size = ZSTD_decompress(dst, Section->Size, src, Section->FileSize);
+      status = (!ZSTD_isError(dst_size) && dst_size == Section->Size);
+   }
+#endif
+
+   if (!status)
+   {
+      if (dst)
+      {
+         // drop the entry we just added, it holds garbage
+         mCachedBytes -= mCache.back().Size;
+         delete [] mCache.back().Data;
+         mCache.pop_back();
+      }
+      *Size = 0;
+      return nullptr;
+   }
+
+   *Size = Section->Size;
+   return dst;
+}
+
+CElfFile::TChunkedSection* CElfFile::GetChunkedSection(const TElfSection* Section)
+{
+   for (size_t i = 0; i < mChunkedSections.size(); i++)
+   {
+      if (mChunkedSections[i].Section == Section->Index)
+         return &mChunkedSections[i];
+   }
+
+   TChunkedSection chunked;
+   chunked.Section = Section->Index;
+   chunked.Checkpoints.resize((Section->Size + CHUNK_SIZE - 1) / CHUNK_SIZE, TCheckpoint{nullptr, 0});
+
+   mChunkedSections.push_back(chunked);
+
+   return &mChunkedSections.back();
+}
+
+const u8* CElfFile::DecompressChunk(const TElfSection* Section, u32 Chunk, u64* Size)
+{
+   const u8* cached = GetCachedData(Section->Index, Chunk, Size);
+
+   if (cached)
+      return cached;
+
+   TChunkedSection* chunked = GetChunkedSection(Section);
+
+   if (Chunk >= chunked->Checkpoints.size())
+      return nullptr;
+
+   // resume from the closest saved inflate state at or before the chunk, the start of the
+   // stream doesn't need one
+   u32 start = Chunk;
+   while (start > 0 && !chunked->Checkpoints[start].Stream)
+      start--;
+
+   z_stream stream{};
+   int      init_status;
+
+   if (start > 0)
+   {
+      chunked->Checkpoints[start].LastUse = ++mUseCounter;
+      init_status = inflateCopy(&stream, (z_stream*)chunked->Checkpoints[start].Stream);
+   }
+   else
+   {
+      stream.next_in = (Bytef*)&mImage.Data[Section->Offset];
+      stream.avail_in = Section->FileSize;
+      init_status = inflateInit(&stream);
+   }
+
+   if (init_status != Z_OK)
+      return nullptr;
+
+   // the requested chunk only goes into the cache at the end, saving the checkpoint after it
+   // may evict buffers
+   std::vector<u8> scratch(CHUNK_SIZE);
+   u64             chunk_size = 0;
+   bool            status = true;
+
+   for (u32 i = start; i <= Chunk && status; i++)
+   {
+      chunk_size = Section->Size - ((u64)i * CHUNK_SIZE);
+      if (chunk_size > CHUNK_SIZE)
+         chunk_size = CHUNK_SIZE;
+
+      stream.next_out = scratch.data();
+      stream.avail_out = chunk_size;
+
+      while (stream.avail_out > 0)
+      {
+         int z_status = inflate(&stream, Z_NO_FLUSH);
+
+         if (z_status == Z_STREAM_END)
+            break;
+
+         if (z_status != Z_OK)
+         {
+            status = false;
+            break;
+         }
+      }
+
+      status = status && (stream.avail_out == 0);
+
+      // remember where the next chunk starts so it never has to be regenerated from scratch
+      if (status && i + 1 < chunked->Checkpoints.size() && !chunked->Checkpoints[i + 1].Stream)
+         SaveCheckpoint(&chunked->Checkpoints[i + 1], &stream);
+   }
+
+   inflateEnd(&stream);
+
+   if (!status)
+      return nullptr;
+
+   u8* dst = AddCacheEntry(Section->Index, Chunk, chunk_size);
+   memcpy(dst, scratch.data(), chunk_size);
+
+   *Size = chunk_size;
+   return dst;
+}
+
+void CElfFile::SaveCheckpoint(TCheckpoint* Checkpoint, void* Stream)
+{
+   // with a budget too small for it the chunks are inflated from an earlier checkpoint again
+   EvictCache(CHECKPOINT_SIZE);
+
+   if (mCachedBytes + CHECKPOINT_SIZE > mCacheBudget)
+      return;
+
+   z_stream* copy = new z_stream{};
+
+   if (inflateCopy(copy, (z_stream*)Stream) != Z_OK)
+   {
+      delete copy;
+      return;
+   }
+
+   Checkpoint->Stream = copy;
+   Checkpoint->LastUse = ++mUseCounter;
+   mCachedBytes += CHECKPOINT_SIZE;
+}
+
+void CElfFile::DropCheckpoint(TCheckpoint* Checkpoint)
+{
+   z_stream* stream = (z_stream*)Checkpoint->Stream;
+
+   inflateEnd(stream);
+   delete stream;
+
+   Checkpoint->Stream = nullptr;
+   mCachedBytes -= CHECKPOINT_SIZE;
+}
+
+void CElfFile::FreeChunkedSections()
+{
+   for (size_t i = 0; i < mChunkedSections.size(); i++)
+   {
+      for (size_t j = 0; j < mChunkedSections[i].Checkpoints.size(); j++)
+      {
+         if (mChunkedSections[i].Checkpoints[j].Stream)
+            DropCheckpoint(&mChunkedSections[i].Checkpoints[j]);
+      }
+   }
+
+   mChunkedSections.clear();
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "DebugTypes.h"
+
+struct TElfSection
+{
+   std::string Name;
+   u32         Index;
+   u32         Type;
+   u32         Link;
+   u64         Flags;
+   u64         Address;
+   u64         Offset;      // file offset of the section data (after the compression header)
+   u64         FileSize;    // bytes in the file (compressed size for SHF_COMPRESSED)
+   u64         Size;        // uncompressed size in bytes
+   u32         Compression; // eElfCompression
+};
+
+struct TElfSymbol
+{
+   u64         Address;
+   u64         Size;
+   const char* Name;
+};
+
+// Read-only view of an ELF file on disk. The file is mapped rather than read, so only the
+// pages actually touched are ever brought in. Sections flagged SHF_COMPRESSED are
+// decompressed transparently on first use:
+//   - small sections are inflated whole into a cached buffer
+//   - large sections are inflated in fixed size chunks, with the inflate state saved at
+//     every chunk boundary so any chunk can be regenerated later without starting over
+// All decompressed data lives in one cache with an LRU byte budget, so a session that only
+// touches a few compilation units never holds the full uncompressed debug info in memory.
+//
+// Pointers returned by GetSection() are only valid until the next call into CElfFile,
+// since that call may evict the buffer they point into. Callers that need to keep data
+// around should parse it into their own structures (or use ReadSection to copy it out).
+class CElfFile
+{
+public:
+
+   static constexpr u64 CHUNK_SIZE           = 1024 * 1024;
+   static constexpr u64 WHOLE_SECTION_LIMIT  = 8 * CHUNK_SIZE;
+   static constexpr u64 DEFAULT_CACHE_BUDGET = 64 * CHUNK_SIZE;
+
+   CElfFile();
+   ~CElfFile();
+
+   bool Open(const char* Filename);
+   void Close();
+
+   bool IsOpen() const { return mImage.Size > 0; }
+   TBuffer GetImage() const { return mImage; }
+   const std::string& GetFilename() const { return mFilename; }
+
+   const TElfHeader64* GetHeader() const { return (const TElfHeader64*)mImage.Data; }
+   const std::vector<TElfSection>& GetSections() const { return mSections; }
+   const TElfSection* FindSection(const char* Name) const;
+
+   const TElfProgramHeader64* GetProgramHeaders(u32* Count) const;
+   bool IsPositionIndependent() const { return IsOpen() && GetHeader()->e_type == ELF_TYPE_DYN; }
+
+   // function symbols from .symtab (or .dynsym when stripped), loaded on first use,
+   // addresses are link-time addresses
+   const TElfSymbol* FindSymbol(u64 Address);
+   const TElfSymbol* FindSymbol(const char* Name);
+
+   // returns the (decompressed) contents of a whole section, Data is nullptr on failure
+   TBuffer GetSection(const char* Name);
+   TBuffer GetSection(const TElfSection* Section);
+
+   // copies Size bytes starting at Offset of the uncompressed section into Buffer,
+   // only decompressing the chunks covering the range
+   bool ReadSection(const TElfSection* Section, u64 Offset, void* Buffer, u64 Size);
+
+   void SetCacheBudget(u64 Bytes);
+   u64 GetCacheBudget() const { return mCacheBudget; }
+   u64 GetCachedBytes() const { return mCachedBytes; }
+
+private:
+
+   struct TCacheEntry
+   {
+      u32 Section;
+      u32 Chunk;   // chunk index, or WHOLE_SECTION
+      u8* Data;
+      u64 Size;
+      u64 LastUse;
+   };
+
+   // inflate state saved at the start of a chunk of a large zlib section, charged to the
+   // cache budget and evicted with the buffers
+   struct TCheckpoint
+   {
+      void* Stream;  // z_stream*, null until the chunk boundary has been reached or once evicted
+      u64   LastUse;
+   };
+
+   struct TChunkedSection
+   {
+      u32                      Section;
+      std::vector<TCheckpoint> Checkpoints; // one per chunk, the first one is never saved
+   };
+
+   static constexpr u32 WHOLE_SECTION   = 0xffffffff;
+   static constexpr u64 CHECKPOINT_SIZE = 40 * 1024; // z_stream, zlib's inflate state and its 32 KB window
+
+   bool ParseSections();
+   void LoadSymbols();
+   void LoadSymbols(const TElfSection* Symbols);
+
+   const u8* GetCachedData(u32 Section, u32 Chunk, u64* Size);
+   u8* AddCacheEntry(u32 Section, u32 Chunk, u64 Size);
+   void EvictCache(u64 BytesNeeded);
+
+   const u8* DecompressWhole(const TElfSection* Section, u64* Size);
+   const u8* DecompressChunk(const TElfSection* Section, u32 Chunk, u64* Size);
+   TChunkedSection* GetChunkedSection(const TElfSection* Section);
+   void SaveCheckpoint(TCheckpoint* Checkpoint, void* Stream);
+   void DropCheckpoint(TCheckpoint* Checkpoint);
+   void FreeChunkedSections();
+
+   std::string                  mFilename;
+   TBuffer                      mImage;
+   std::vector<TElfSection>     mSections;
+   std::vector<TElfSymbol>      mSymbols;
+   bool                         mSymbolsLoaded;
+   std::vector<TCacheEntry>     mCache;
+   std::vector<TChunkedSection> mChunkedSections;
+   u64                          mCacheBudget;
+   u64                          mCachedBytes;
+   u64                          mUseCounter;
+};
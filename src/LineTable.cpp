@@ -0,0 +1,821 @@
+#include <string.h>
+#include <algorithm>
+#include "LineTable.h"
+
+CLineTable::CLineTable()
+   : mElf(nullptr),
+     mLoaded(false),
+     mLine(nullptr),
+     mLineStrings(nullptr),
+     mStrings(nullptr),
+     mUnits(),
+     mRanges(),
+     mFiles(),
+     mLineStringCache(),
+     mStringCache()
+{
+}
+
+CLineTable::~CLineTable()
+{
+}
+
+void CLineTable::Initialize(CElfFile* Elf)
+{
+   Reset();
+   mElf = Elf;
+}
+
+void CLineTable::Reset()
+{
+   mElf = nullptr;
+   mLoaded = false;
+   mLine = nullptr;
+   mLineStrings = nullptr;
+   mStrings = nullptr;
+   mUnits.clear();
+   mUnits.shrink_to_fit();
+   mRanges.clear();
+   mRanges.shrink_to_fit();
+   mFiles.clear();
+   mLineStringCache.clear();
+   mStringCache.clear();
+}
+
+u64 CLineTable::GetRowCount() const
+{
+   u64 count = 0;
+
+   for (const TUnit& unit : mUnits)
+      count += unit.Rows.size();
+
+   return count;
+}
+
+bool CLineTable::FindLine(u64 Address, TLineInfo* Info)
+{
+   const std::vector<TLineRow>* unit_rows = FindRows(Address);
+
+   if (!unit_rows)
+      return false;
+
+   const std::vector<TLineRow>& rows = *unit_rows;
+
+   auto it = std::upper_bound(rows.begin(), rows.end(), Address,
+                              [](u64 Value, const TLineRow& Row) { return Value < Row.Address; });
+
+   if (it == rows.begin())
+      return false;
+
+   size_t index = (it - rows.begin()) - 1;
+
+   // every sequence is closed by an end row, so a valid row always has a successor
+   if ((rows[index].Flags & LINE_ROW_FLAG_END_SEQUENCE) || index + 1 >= rows.size())
+      return false;
+
+   if (!Info)
+      return true;
+
+   const TLineRow& row = rows[index];
+   size_t          start = index;
+   size_t          end = index + 1;
+
+   // consecutive rows for the same line (different columns) are one block of code
+   while (start > 0 && !(rows[start - 1].Flags & LINE_ROW_FLAG_END_SEQUENCE) &&
+          rows[start - 1].Line == row.Line && rows[start - 1].File == row.File)
+      start--;
+
+   while (end + 1 < rows.size() && !(rows[end].Flags & LINE_ROW_FLAG_END_SEQUENCE) &&
+          rows[end].Line == row.Line && rows[end].File == row.File)
+      end++;
+
+   Info->Start = rows[start].Address;
+   Info->End = rows[end].Address;
+   Info->RowAddress = row.Address;
+   Info->File = mFiles[row.File].c_str();
+   Info->Line = row.Line;
+   return true;
+}
+
+u64 CLineTable::FindPrologueEnd(u64 Start, u64 End)
+{
+   const std::vector<TLineRow>* unit_rows = FindRows(Start);
+
+   if (!unit_rows)
+      return Start;
+
+   const std::vector<TLineRow>& rows = *unit_rows;
+
+   auto it = std::lower_bound(rows.begin(), rows.end(), Start,
+                              [](const TLineRow& Row, u64 Value) { return Row.Address < Value; });
+
+   if (it == rows.end() || it->Address != Start)
+      return Start;
+
+   size_t first = it - rows.begin();
+
+   // clang marks the end of the prologue explicitly
+   for (size_t i = first; i < rows.size() && rows[i].Address < End; i++)
+   {
+      if (rows[i].Flags & LINE_ROW_FLAG_PROLOGUE_END)
+         return rows[i].Address;
+   }
+
+   // several lines at the entry point is optimized code that starts with the body
+   if (first + 1 >= rows.size() || rows[first + 1].Address == Start)
+      return Start;
+
+   // otherwise the prologue is the code generated for the line with the opening brace
+   for (size_t i = first + 1; i < rows.size() && rows[i].Address < End; i++)
+   {
+      if (rows[i].Flags & LINE_ROW_FLAG_END_SEQUENCE)
+         break;
+
+      if (rows[i].Line != rows[first].Line)
+         return rows[i].Address;
+   }
+
+   return Start;
+}
+
+void CLineTable::Load()
+{
+   mLoaded = true;
+
+   if (!mElf || !mElf->IsOpen())
+      return;
+
+   mLine = mElf->FindSection(".debug_line");
+   mLineStrings = mElf->FindSection(".debug_line_str");
+   mStrings = mElf->FindSection(".debug_str");
+
+   if (!mLine)
+      return;
+
+   // file 0 is what rows without a usable file index point at
+   mFiles.push_back("??");
+
+   if (!IndexAranges())
+      IndexSequences();
+
+   std::sort(mRanges.begin(), mRanges.end(), [](const TUnitRange& A, const TUnitRange& B) { return A.Start < B.Start; });
+}
+
+// The compilation units of .debug_aranges with the code they cover. Which line number program
+// belongs to a unit is only looked up once an address in it is, by FindRows().
+bool CLineTable::IndexAranges()
+{
+   const TElfSection* aranges = mElf->FindSection(".debug_aranges");
+   std::map<u64, u32> units;
+   std::vector<u8>    data;
+
+   if (!aranges || !mElf->FindSection(".debug_info") || !mElf->FindSection(".debug_abbrev"))
+      return false;
+
+   for (u64 offset = 0; offset < aranges->Size; offset += data.size())
+   {
+      if (!ReadUnit(aranges, offset, data))
+         break;
+
+      TDwarfReader reader(data.data(), data.data() + data.size());
+      bool         dwarf64 = (reader.ReadU32() == 0xffffffff);
+
+      if (dwarf64)
+         reader.ReadU64();
+
+      u16 version = reader.ReadU16();
+      u64 info_offset = dwarf64 ? reader.ReadU64() : reader.ReadU32();
+      u8  address_size = reader.ReadU8();
+      u8  segment_size = reader.ReadU8();
+
+      if (reader.Overrun || version != 2 || (address_size != 4 && address_size != 8) || segment_size != 0)
+         continue;
+
+      // the tuples are aligned to their size, counted from the start of the set
+      u64 tuple_size = 2 * address_size;
+      reader.Skip((tuple_size - (reader.Data - data.data()) % tuple_size) % tuple_size);
+
+      auto found = units.find(info_offset);
+      u32  index;
+
+      if (found == units.end())
+      {
+         index = mUnits.size();
+         units[info_offset] = index;
+         mUnits.push_back({ info_offset, NO_OFFSET, false, {} });
+      }
+      else
+         index = found->second;
+
+      for (;;)
+      {
+         u64 start = (address_size == 8) ? reader.ReadU64() : reader.ReadU32();
+         u64 length = (address_size == 8) ? reader.ReadU64() : reader.ReadU32();
+
+         if (reader.Overrun || (start == 0 && length == 0))
+            break;
+
+         // ranges at address 0 belong to functions the linker threw away
+         if (start != 0 && length != 0)
+            mRanges.push_back({ start, start + length, index });
+      }
+   }
+
+   if (mRanges.empty())
+   {
+      mUnits.clear();
+      return false;
+   }
+
+   return true;
+}
+
+// Without .debug_aranges every line number program is run once, only the address range of
+// each sequence is kept.
+void CLineTable::IndexSequences()
+{
+   std::vector<u8>       data;
+   std::vector<TLineRow> rows;
+
+   for (u64 offset = 0; offset < mLine->Size; offset += data.size())
+   {
+      if (!ReadUnit(mLine, offset, data))
+         break;
+
+      TDwarfReader reader(data.data(), data.data() + data.size());
+
+      rows.clear();
+      if (!ParseUnit(reader, rows, false))
+         break;
+
+      u32    index = mUnits.size();
+      size_t first = 0;
+
+      mUnits.push_back({ NO_OFFSET, offset, false, {} });
+
+      // the rows are still in program order, every sequence ends with its end row
+      for (size_t i = 0; i < rows.size(); i++)
+      {
+         if (!(rows[i].Flags & LINE_ROW_FLAG_END_SEQUENCE))
+            continue;
+
+         if (rows[i].Address > rows[first].Address)
+            mRanges.push_back({ rows[first].Address, rows[i].Address, index });
+         first = i + 1;
+      }
+   }
+}
+
+// Copies the unit at Offset, its length field included, into Data
+bool CLineTable::ReadUnit(const TElfSection* Section, u64 Offset, std::vector<u8>& Data)
+{
+   u32 length32 = 0;
+   u64 length64 = 0;
+   u64 header = 4;
+
+   if (!mElf->ReadSection(Section, Offset, &length32, sizeof(length32)))
+      return false;
+
+   if (length32 == 0xffffffff)
+   {
+      if (!mElf->ReadSection(Section, Offset + 4, &length64, sizeof(length64)))
+         return false;
+      header = 12;
+   }
+   else
+   {
+      length64 = length32;
+   }
+
+   if (length64 > Section->Size - Offset - header)
+      return false;
+
+   Data.resize(header + length64);
+   return mElf->ReadSection(Section, Offset, Data.data(), Data.size());
+}
+
+static bool SkipForm(TDwarfReader& Reader, u64 Form, u8 AddressSize, bool Dwarf64, u16 Version)
+{
+   u64 offset_size = Dwarf64 ? 8 : 4;
+
+   switch (Form)
+   {
+      case DW_FORM_flag_present:
+      case DW_FORM_implicit_const: break;
+      case DW_FORM_addr:           Reader.Skip(AddressSize); break;
+      case DW_FORM_data1:
+      case DW_FORM_ref1:
+      case DW_FORM_flag:
+      case DW_FORM_strx1:
+      case DW_FORM_addrx1:         Reader.Skip(1); break;
+      case DW_FORM_data2:
+      case DW_FORM_ref2:
+      case DW_FORM_strx2:
+      case DW_FORM_addrx2:         Reader.Skip(2); break;
+      case DW_FORM_strx3:
+      case DW_FORM_addrx3:         Reader.Skip(3); break;
+      case DW_FORM_data4:
+      case DW_FORM_ref4:
+      case DW_FORM_ref_sup4:
+      case DW_FORM_strx4:
+      case DW_FORM_addrx4:         Reader.Skip(4); break;
+      case DW_FORM_data8:
+      case DW_FORM_ref8:
+      case DW_FORM_ref_sig8:
+      case DW_FORM_ref_sup8:       Reader.Skip(8); break;
+      case DW_FORM_data16:         Reader.Skip(16); break;
+      case DW_FORM_sdata:          Reader.ReadSLEB128(); break;
+      case DW_FORM_udata:
+      case DW_FORM_ref_udata:
+      case DW_FORM_strx:
+      case DW_FORM_addrx:
+      case DW_FORM_loclistx:
+      case DW_FORM_rnglistx:
+      case DW_FORM_GNU_addr_index:
+      case DW_FORM_GNU_str_index:  Reader.ReadULEB128(); break;
+      case DW_FORM_strp:
+      case DW_FORM_line_strp:
+      case DW_FORM_sec_offset:
+      case DW_FORM_strp_sup:
+      case DW_FORM_GNU_ref_alt:
+      case DW_FORM_GNU_strp_alt:   Reader.Skip(offset_size); break;
+      case DW_FORM_ref_addr:       Reader.Skip((Version == 2) ? AddressSize : offset_size); break;
+      case DW_FORM_string:         Reader.ReadString(); break;
+      case DW_FORM_block1:         Reader.Skip(Reader.ReadU8()); break;
+      case DW_FORM_block2:         Reader.Skip(Reader.ReadU16()); break;
+      case DW_FORM_block4:         Reader.Skip(Reader.ReadU32()); break;
+      case DW_FORM_block:
+      case DW_FORM_exprloc:        Reader.Skip(Reader.ReadULEB128()); break;
+      default:
+         return false;
+   }
+
+   return !Reader.Overrun;
+}
+
+// DW_AT_stmt_list of the compilation unit at InfoOffset. Only the start of the unit and of its
+// abbreviations are read, the unit's own entry comes first in both.
+bool CLineTable::FindLineOffset(u64 InfoOffset, u64* LineOffset)
+{
+   const TElfSection* info = mElf->FindSection(".debug_info");
+   const TElfSection* abbreviations = mElf->FindSection(".debug_abbrev");
+   u32                length32 = 0;
+   u64                length64 = 0;
+   u64                header = 4;
+
+   if (!info || !abbreviations || !mElf->ReadSection(info, InfoOffset, &length32, sizeof(length32)))
+      return false;
+
+   if (length32 == 0xffffffff)
+   {
+      if (!mElf->ReadSection(info, InfoOffset + 4, &length64, sizeof(length64)))
+         return false;
+      header = 12;
+   }
+   else
+   {
+      length64 = length32;
+   }
+
+   if (length64 > info->Size - InfoOffset - header)
+      return false;
+
+   std::vector<u8> entry(std::min(length64, READ_WINDOW));
+
+   if (!mElf->ReadSection(info, InfoOffset + header, entry.data(), entry.size()))
+      return false;
+
+   TDwarfReader reader(entry.data(), entry.data() + entry.size());
+   bool         dwarf64 = (header == 12);
+   u16          version = reader.ReadU16();
+   u64          abbreviation_offset;
+   u8           address_size;
+
+   if (version < 2 || version > 5)
+      return false;
+
+   if (version >= 5)
+   {
+      u8 type = reader.ReadU8();
+
+      address_size = reader.ReadU8();
+      abbreviation_offset = dwarf64 ? reader.ReadU64() : reader.ReadU32();
+
+      if (type == DW_UT_skeleton || type == DW_UT_split_compile)
+         reader.Skip(8); // dwo_id
+      else if (type != DW_UT_compile && type != DW_UT_partial)
+         return false;
+   }
+   else
+   {
+      abbreviation_offset = dwarf64 ? reader.ReadU64() : reader.ReadU32();
+      address_size = reader.ReadU8();
+   }
+
+   u64 code = reader.ReadULEB128();
+
+   if (reader.Overrun || code == 0 || abbreviation_offset >= abbreviations->Size)
+      return false;
+
+   std::vector<u8> table(std::min(abbreviations->Size - abbreviation_offset, READ_WINDOW));
+
+   if (!mElf->ReadSection(abbreviations, abbreviation_offset, table.data(), table.size()))
+      return false;
+
+   TDwarfReader abbreviation(table.data(), table.data() + table.size());
+
+   for (;;)
+   {
+      u64 abbreviation_code = abbreviation.ReadULEB128();
+
+      if (abbreviation.Overrun || abbreviation_code == 0)
+         return false;
+
+      abbreviation.ReadULEB128(); // tag
+      abbreviation.ReadU8();      // has children
+
+      if (abbreviation_code == code)
+         break;
+
+      for (;;)
+      {
+         u64 attribute = abbreviation.ReadULEB128();
+         u64 form = abbreviation.ReadULEB128();
+
+         if (form == DW_FORM_implicit_const)
+            abbreviation.ReadSLEB128();
+
+         if (abbreviation.Overrun)
+            return false;
+
+         if (attribute == 0 && form == 0)
+            break;
+      }
+   }
+
+   for (;;)
+   {
+      u64 attribute = abbreviation.ReadULEB128();
+      u64 form = abbreviation.ReadULEB128();
+
+      if (form == DW_FORM_implicit_const)
+         abbreviation.ReadSLEB128();
+
+      if (abbreviation.Overrun || (attribute == 0 && form == 0))
+         return false;
+
+      while (form == DW_FORM_indirect && !reader.Overrun)
+         form = reader.ReadULEB128();
+
+      if (attribute == DW_AT_stmt_list)
+      {
+         switch (form)
+         {
+            case DW_FORM_data4:      *LineOffset = reader.ReadU32(); break;
+            case DW_FORM_data8:      *LineOffset = reader.ReadU64(); break;
+            case DW_FORM_sec_offset: *LineOffset = dwarf64 ? reader.ReadU64() : reader.ReadU32(); break;
+            default:
+               return false;
+         }
+
+         return !reader.Overrun;
+      }
+
+      if (!SkipForm(reader, form, address_size, dwarf64, version))
+         return false;
+   }
+}
+
+// rows of the unit covering Address, decoded on first use
+const std::vector<TLineRow>* CLineTable::FindRows(u64 Address)
+{
+   if (!mLoaded)
+      Load();
+
+   auto it = std::upper_bound(mRanges.begin(), mRanges.end(), Address,
+                              [](u64 Value, const TUnitRange& Range) { return Value < Range.Start; });
+
+   if (it == mRanges.begin() || Address >= (it - 1)->End)
+      return nullptr;
+
+   TUnit& unit = mUnits[(it - 1)->Unit];
+
+   if (!unit.Parsed)
+   {
+      std::vector<u8> data;
+
+      unit.Parsed = true;
+
+      if ((unit.LineOffset != NO_OFFSET || FindLineOffset(unit.InfoOffset, &unit.LineOffset)) &&
+          ReadUnit(mLine, unit.LineOffset, data))
+      {
+         TDwarfReader reader(data.data(), data.data() + data.size());
+
+         ParseUnit(reader, unit.Rows, true);
+      }
+
+      // end rows sort before a sequence starting at the same address, so lookups find the start
+      std::stable_sort(unit.Rows.begin(), unit.Rows.end(), [](const TLineRow& A, const TLineRow& B)
+      {
+         if (A.Address != B.Address)
+            return A.Address < B.Address;
+         return (A.Flags & LINE_ROW_FLAG_END_SEQUENCE) > (B.Flags & LINE_ROW_FLAG_END_SEQUENCE);
+      });
+
+      unit.Rows.shrink_to_fit();
+   }
+
+   return &unit.Rows;
+}
+
+// Reads the string at Offset in .debug_line_str or .debug_str a piece at a time, strings
+// that were needed once stay cached
+const char* CLineTable::GetString(const TElfSection* Section, u64 Offset)
+{
+   if (!Section)
+      return "??";
+
+   std::map<u64, std::string>& cache = (Section == mLineStrings) ? mLineStringCache : mStringCache;
+   auto                        found = cache.find(Offset);
+
+   if (found != cache.end())
+      return found->second.c_str();
+
+   std::string string;
+   char        piece[64];
+
+   for (u64 position = Offset; position < Section->Size; position += sizeof(piece))
+   {
+      u64 size = std::min((u64)sizeof(piece), Section->Size - position);
+
+      if (!mElf->ReadSection(Section, position, piece, size))
+         return "??";
+
+      const char* end = (const char*)memchr(piece, 0, size);
+
+      if (end)
+      {
+         string.append(piece, end - piece);
+         return cache.emplace(Offset, string).first->second.c_str();
+      }
+
+      string.append(piece, size);
+   }
+
+   return "??";
+}
+
+bool CLineTable::ReadEntryFormat(TDwarfReader& Reader, bool Dwarf64, std::vector<std::string>& Names, std::vector<u64>& Directories)
+{
+   u8  format_count = Reader.ReadU8();
+   u64 formats[32][2];
+
+   if (format_count > 32)
+      return false;
+
+   for (u32 i = 0; i < format_count; i++)
+   {
+      formats[i][0] = Reader.ReadULEB128();
+      formats[i][1] = Reader.ReadULEB128();
+   }
+
+   u64 count = Reader.ReadULEB128();
+
+   for (u64 entry = 0; entry < count && !Reader.Overrun; entry++)
+   {
+      const char* name = "??";
+      u64         directory = 0;
+
+      for (u32 i = 0; i < format_count; i++)
+      {
+         const char* string = nullptr;
+         u64         value = 0;
+
+         switch (formats[i][1])
+         {
+            case DW_FORM_string:    string = Reader.ReadString(); break;
+            case DW_FORM_line_strp: string = GetString(mLineStrings, Dwarf64 ? Reader.ReadU64() : Reader.ReadU32()); break;
+            case DW_FORM_strp:      string = GetString(mStrings, Dwarf64 ? Reader.ReadU64() : Reader.ReadU32()); break;
+            case DW_FORM_udata:     value = Reader.ReadULEB128(); break;
+            case DW_FORM_sdata:     value = Reader.ReadSLEB128(); break;
+            case DW_FORM_data1:     value = Reader.ReadU8(); break;
+            case DW_FORM_data2:     value = Reader.ReadU16(); break;
+            case DW_FORM_data4:     value = Reader.ReadU32(); break;
+            case DW_FORM_data8:     value = Reader.ReadU64(); break;
+            case DW_FORM_data16:    Reader.Skip(16); break;
+            case DW_FORM_block:     Reader.Skip(Reader.ReadULEB128()); break;
+            case DW_FORM_block1:    Reader.Skip(Reader.ReadU8()); break;
+            case DW_FORM_block2:    Reader.Skip(Reader.ReadU16()); break;
+            case DW_FORM_block4:    Reader.Skip(Reader.ReadU32()); break;
+            default:
+               // no way to know the size of the entry, give up on this unit
+               return false;
+         }
+
+         if (formats[i][0] == DW_LNCT_path && string)
+            name = string;
+         else if (formats[i][0] == DW_LNCT_directory_index)
+            directory = value;
+      }
+
+      Names.push_back(name);
+      Directories.push_back(directory);
+   }
+
+   return !Reader.Overrun;
+}
+
+// Rows of one line number program in program order. Without Files the file tables are skipped
+// and every row points at file 0.
+bool CLineTable::ParseUnit(TDwarfReader& Reader, std::vector<TLineRow>& Rows, bool Files)
+{
+   u64  unit_length = Reader.ReadU32();
+   bool dwarf64 = false;
+
+   if (unit_length == 0xffffffff)
+   {
+      unit_length = Reader.ReadU64();
+      dwarf64 = true;
+   }
+
+   if (Reader.Overrun || unit_length > Reader.Remaining())
+      return false;
+
+   TDwarfReader unit(Reader.Data, Reader.Data + unit_length);
+   Reader.Skip(unit_length);
+
+   u16 version = unit.ReadU16();
+
+   // unknown versions are skipped, the next unit may still be fine
+   if (version < 2 || version > 5)
+      return true;
+
+   if (version >= 5)
+   {
+      unit.ReadU8(); // address_size
+      unit.ReadU8(); // segment_selector_size
+   }
+
+   u64       header_length = dwarf64 ? unit.ReadU64() : unit.ReadU32();
+   const u8* program = unit.Data + header_length;
+
+   u8 min_instruction_length = unit.ReadU8();
+   if (version >= 4)
+      unit.ReadU8(); // maximum_operations_per_instruction, only for VLIW
+   u8 default_is_stmt = unit.ReadU8();
+   s8 line_base = (s8)unit.ReadU8();
+   u8 line_range = unit.ReadU8();
+   u8 opcode_base = unit.ReadU8();
+   u8 opcode_lengths[256] = {};
+
+   for (u32 i = 1; i < opcode_base; i++)
+      opcode_lengths[i] = unit.ReadU8();
+
+   std::vector<std::string> directories;
+   std::vector<std::string> names;
+   std::vector<u64>         directory_index;
+   std::vector<u32>         files;
+
+   if (Files && version >= 5)
+   {
+      std::vector<u64> unused;
+
+      if (!ReadEntryFormat(unit, dwarf64, directories, unused) ||
+          !ReadEntryFormat(unit, dwarf64, names, directory_index))
+         return true;
+   }
+   else if (Files)
+   {
+      // directory 0 is the compilation directory and file 0 doesn't exist before DWARF 5
+      directories.push_back("");
+      names.push_back("??");
+      directory_index.push_back(0);
+
+      for (const char* dir = unit.ReadString(); *dir; dir = unit.ReadString())
+         directories.push_back(dir);
+
+      for (const char* name = unit.ReadString(); *name; name = unit.ReadString())
+      {
+         names.push_back(name);
+         directory_index.push_back(unit.ReadULEB128());
+         unit.ReadULEB128(); // modification time
+         unit.ReadULEB128(); // length
+      }
+   }
+
+   if (unit.Overrun || line_range == 0 || program > unit.End)
+      return true;
+
+   for (size_t i = 0; i < names.size(); i++)
+   {
+      const std::string& dir = (directory_index[i] < directories.size()) ? directories[directory_index[i]] : "";
+
+      if (names[i][0] == '/' || dir.empty())
+         mFiles.push_back(names[i]);
+      else
+         mFiles.push_back(dir + "/" + names[i]);
+
+      files.push_back(mFiles.size() - 1);
+   }
+
+   unit.Data = program;
+
+   u64    address = 0;
+   u64    file = 1;
+   u32    line = 1;
+   bool   is_stmt = default_is_stmt;
+   u32    flags = 0;
+   size_t sequence_start = Rows.size();
+
+   auto emit_row = [&](u32 RowFlags)
+   {
+      if (is_stmt || (RowFlags & LINE_ROW_FLAG_END_SEQUENCE))
+         Rows.push_back({ address, (file < files.size()) ? files[file] : 0, line, RowFlags | flags });
+      flags = 0;
+   };
+
+   while (!unit.AtEnd())
+   {
+      u8 opcode = unit.ReadU8();
+
+      if (opcode >= opcode_base)
+      {
+         u8 adjusted = opcode - opcode_base;
+
+         address += (adjusted / line_range) * min_instruction_length;
+         line += line_base + (adjusted % line_range);
+         emit_row(0);
+         continue;
+      }
+
+      switch (opcode)
+      {
+         case 0:
+         {
+            u64       length = unit.ReadULEB128();
+            const u8* next = unit.Data + length;
+
+            if (length == 0 || length > unit.Remaining())
+               return true;
+
+            switch (unit.ReadU8())
+            {
+               case DW_LNE_end_sequence:
+                  emit_row(LINE_ROW_FLAG_END_SEQUENCE);
+
+                  // sequences at address 0 belong to functions the linker threw away
+                  if (Rows[sequence_start].Address == 0)
+                     Rows.resize(sequence_start);
+
+                  sequence_start = Rows.size();
+                  address = 0;
+                  file = 1;
+                  line = 1;
+                  is_stmt = default_is_stmt;
+                  break;
+               case DW_LNE_set_address:
+                  address = (length == 9) ? unit.ReadU64() : unit.ReadU32();
+                  break;
+               default:
+                  break;
+            }
+
+            unit.Data = next;
+            break;
+         }
+         case DW_LNS_copy:
+            emit_row(0);
+            break;
+         case DW_LNS_advance_pc:
+            address += unit.ReadULEB128() * min_instruction_length;
+            break;
+         case DW_LNS_advance_line:
+            line += unit.ReadSLEB128();
+            break;
+         case DW_LNS_set_file:
+            file = unit.ReadULEB128();
+            break;
+         case DW_LNS_negate_stmt:
+            is_stmt = !is_stmt;
+            break;
+         case DW_LNS_const_add_pc:
+            address += ((255 - opcode_base) / line_range) * min_instruction_length;
+            break;
+         case DW_LNS_fixed_advance_pc:
+            address += unit.ReadU16();
+            break;
+         case DW_LNS_set_prologue_end:
+            flags |= LINE_ROW_FLAG_PROLOGUE_END;
+            break;
+         default:
+            // DW_LNS_set_column, DW_LNS_set_isa and anything newer: skip the operands
+            for (u32 i = 0; i < opcode_lengths[opcode]; i++)
+               unit.ReadULEB128();
+            break;
+      }
+   }
+
+   // a unit that ends in the middle of a sequence has no usable end for its last row
+   Rows.resize(sequence_start);
+   return true;
+}
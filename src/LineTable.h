@@ -0,0 +1,100 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "DebugTypes.h"
+#include "Dwarf.h"
+#include "ElfFile.h"
+
+#define LINE_ROW_FLAG_END_SEQUENCE (1 << 0)
+#define LINE_ROW_FLAG_PROLOGUE_END (1 << 1)
+
+struct TLineRow
+{
+   u64 Address; // link-time
+   u32 File;    // index into the file table of CLineTable
+   u32 Line;
+   u32 Flags;   // LINE_ROW_FLAG_*
+};
+
+// A source line and the contiguous block of code generated for it. A line can own several
+// such blocks (loop conditions, inlined code), each one is looked up separately.
+struct TLineInfo
+{
+   u64         Start; // link-time, [Start, End)
+   u64         End;
+   u64         RowAddress; // start of the row containing the address that was looked up
+   const char* File;
+   u32         Line;
+};
+
+// Address to line mapping from .debug_line (DWARF 2 to 5). Only statement rows are kept,
+// so every address resolves to the line a debugger should report for it. A unit is decoded
+// the first time a lookup lands in it, into one array sorted by address; lookups are a binary
+// search in it. Which unit covers an address comes from .debug_aranges, or without it from
+// one pass over the line programs that keeps only the address range of each sequence. File
+// names are read from the string sections one at a time, so a session that only touches a
+// few units never has a large compressed section inflated as a whole.
+class CLineTable
+{
+public:
+
+   CLineTable();
+   ~CLineTable();
+
+   void Initialize(CElfFile* Elf);
+   void Reset();
+
+   // Address is link-time, Info can be null to only check for line information
+   bool FindLine(u64 Address, TLineInfo* Info);
+
+   // first address of the function body, Start if the function has no separate prologue
+   u64 FindPrologueEnd(u64 Start, u64 End);
+
+   // rows of the units decoded so far
+   u64 GetRowCount() const;
+
+private:
+
+   static constexpr u64 NO_OFFSET   = ~0ull;
+   static constexpr u64 READ_WINDOW = 4096; // bytes read for a unit's first entry or abbreviations
+
+   struct TUnit
+   {
+      u64                   InfoOffset; // compilation unit in .debug_info, NO_OFFSET if unknown
+      u64                   LineOffset; // line number program, NO_OFFSET until looked up
+      bool                  Parsed;
+      std::vector<TLineRow> Rows;
+   };
+
+   // [Start, End) link-time addresses covered by a unit
+   struct TUnitRange
+   {
+      u64 Start;
+      u64 End;
+      u32 Unit;
+   };
+
+   void Load();
+   bool IndexAranges();
+   void IndexSequences();
+   bool ReadUnit(const TElfSection* Section, u64 Offset, std::vector<u8>& Data);
+   bool FindLineOffset(u64 InfoOffset, u64* LineOffset);
+   const std::vector<TLineRow>* FindRows(u64 Address);
+
+   bool ParseUnit(TDwarfReader& Reader, std::vector<TLineRow>& Rows, bool Files);
+   bool ReadEntryFormat(TDwarfReader& Reader, bool Dwarf64, std::vector<std::string>& Names, std::vector<u64>& Directories);
+   const char* GetString(const TElfSection* Section, u64 Offset);
+
+   CElfFile*                  mElf;
+   bool                       mLoaded;
+   const TElfSection*         mLine;
+   const TElfSection*         mLineStrings;
+   const TElfSection*         mStrings;
+   std::vector<TUnit>         mUnits;
+   std::vector<TUnitRange>    mRanges;  // sorted by Start
+   std::vector<std::string>   mFiles;
+   std::map<u64, std::string> mLineStringCache; // by offset, only strings that were needed
+   std::map<u64, std::string> mStringCache;
+};
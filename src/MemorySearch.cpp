@@ -0,0 +1,386 @@
+#include <string.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <immintrin.h>
+#include "MemorySearch.h"
+
+// Scanners append the offset of every position in Data[0, Size) where the pattern starts, Size
+// includes the pattern bytes of the last position
+
+typedef void (*TScanFunc)(const u8* Data, u64 Size, const u8* Pattern, u32 PatternSize, std::vector<u64>& Offsets);
+
+static void ScanBytesScalar(const u8* Data, u64 Size, const u8* Pattern, u32 PatternSize, std::vector<u64>& Offsets)
+{
+   const u8* end = Data + Size - PatternSize + 1;
+
+   for (const u8* p = Data; p < end; p++)
+   {
+      if (*p == Pattern[0] && memcmp(p, Pattern, PatternSize) == 0)
+         Offsets.push_back(p - Data);
+   }
+}
+
+static void ScanBytesSSE2(const u8* Data, u64 Size, const u8* Pattern, u32 PatternSize, std::vector<u64>& Offsets)
+{
+   u64     positions = Size - PatternSize + 1;
+   __m128i first = _mm_set1_epi8(Pattern[0]);
+   __m128i last = _mm_set1_epi8(Pattern[PatternSize - 1]);
+   u64     i = 0;
+
+   for (; i + 16 <= positions; i += 16)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i*)(Data + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(Data + i + PatternSize - 1));
+      u32     mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+      while (mask)
+      {
+         u32 bit = __builtin_ctz(mask);
+
+         if (PatternSize <= 2 || memcmp(Data + i + bit + 1, Pattern + 1, PatternSize - 2) == 0)
+            Offsets.push_back(i + bit);
+
+         mask &= mask - 1;
+      }
+   }
+
+   if (i < positions)
+   {
+      u64 start = Offsets.size();
+
+      ScanBytesScalar(Data + i, Size - i, Pattern, PatternSize, Offsets);
+
+      for (u64 j = start; j < Offsets.size(); j++)
+         Offsets[j] += i;
+   }
+}
+
+__attribute__((target("avx2")))
+static void ScanBytesAVX2(const u8* Data, u64 Size, const u8* Pattern, u32 PatternSize, std::vector<u64>& Offsets)
+{
+   u64     positions = Size - PatternSize + 1;
+   __m256i first = _mm256_set1_epi8(Pattern[0]);
+   __m256i last = _mm256_set1_epi8(Pattern[PatternSize - 1]);
+   u64     i = 0;
+
+   for (; i + 32 <= positions; i += 32)
+   {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(Data + i));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(Data + i + PatternSize - 1));
+      u32     mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+      while (mask)
+      {
+         u32 bit = __builtin_ctz(mask);
+
+         if (PatternSize <= 2 || memcmp(Data + i + bit + 1, Pattern + 1, PatternSize - 2) == 0)
+            Offsets.push_back(i + bit);
+
+         mask &= mask - 1;
+      }
+   }
+
+   if (i < positions)
+   {
+      u64 start = Offsets.size();
+
+      ScanBytesSSE2(Data + i, Size - i, Pattern, PatternSize, Offsets);
+
+      for (u64 j = start; j < Offsets.size(); j++)
+         Offsets[j] += i;
+   }
+}
+
+// aligned 8 byte values, Data is 8 byte aligned relative to the target address
+
+static void ScanValuesScalar(const u8* Data, u64 Size, const u8* Pattern, std::vector<u64>& Offsets)
+{
+   u64 value;
+
+   memcpy(&value, Pattern, sizeof(value));
+
+   for (u64 i = 0; i + sizeof(u64) <= Size; i += sizeof(u64))
+   {
+      if (*(const u64*)(Data + i) == value)
+         Offsets.push_back(i);
+   }
+}
+
+static void ScanValuesSSE2(const u8* Data, u64 Size, const u8* Pattern, u32, std::vector<u64>& Offsets)
+{
+   u64     value;
+   u64     i = 0;
+
+   memcpy(&value, Pattern, sizeof(value));
+
+   __m128i pattern = _mm_set1_epi64x(value);
+
+   // SSE2 has no 64 bit compare, a word matches when both of its 32 bit halves do
+   for (; i + 64 <= Size; i += 64)
+   {
+      __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(Data + i)), pattern);
+      __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(Data + i + 16)), pattern);
+      __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(Data + i + 32)), pattern);
+      __m128i d = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(Data + i + 48)), pattern);
+
+      // nothing in the 64 bytes has even a matching half most of the time
+      if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) == 0)
+         continue;
+
+      u64 mask = (u64)_mm_movemask_epi8(a) | ((u64)_mm_movemask_epi8(b) << 16) |
+                 ((u64)_mm_movemask_epi8(c) << 32) | ((u64)_mm_movemask_epi8(d) << 48);
+
+      for (u32 word = 0; word < 8; word++)
+      {
+         if (((mask >> (word * 8)) & 0xff) == 0xff)
+            Offsets.push_back(i + word * sizeof(u64));
+      }
+   }
+
+   if (i < Size)
+   {
+      u64 start = Offsets.size();
+
+      ScanValuesScalar(Data + i, Size - i, Pattern, Offsets);
+
+      for (u64 j = start; j < Offsets.size(); j++)
+         Offsets[j] += i;
+   }
+}
+
+__attribute__((target("avx2")))
+static void ScanValuesAVX2(const u8* Data, u64 Size, const u8* Pattern, u32 PatternSize, std::vector<u64>& Offsets)
+{
+   u64     value;
+   u64     i = 0;
+
+   memcpy(&value, Pattern, sizeof(value));
+
+   __m256i pattern = _mm256_set1_epi64x(value);
+
+   for (; i + 128 <= Size; i += 128)
+   {
+      __m256i a = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(Data + i)), pattern);
+      __m256i b = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(Data + i + 32)), pattern);
+      __m256i c = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(Data + i + 64)), pattern);
+      __m256i d = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(Data + i + 96)), pattern);
+
+      if (_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)),
+                             _mm256_set1_epi8(-1)))
+         continue;
+
+      u32 mask = _mm256_movemask_pd(_mm256_castsi256_pd(a)) | (_mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4) |
+                 (_mm256_movemask_pd(_mm256_castsi256_pd(c)) << 8) | (_mm256_movemask_pd(_mm256_castsi256_pd(d)) << 12);
+
+      while (mask)
+      {
+         Offsets.push_back(i + __builtin_ctz(mask) * sizeof(u64));
+         mask &= mask - 1;
+      }
+   }
+
+   if (i < Size)
+   {
+      u64 start = Offsets.size();
+
+      ScanValuesSSE2(Data + i, Size - i, Pattern, PatternSize, Offsets);
+
+      for (u64 j = start; j < Offsets.size(); j++)
+         Offsets[j] += i;
+   }
+}
+
+static bool HasAVX2()
+{
+   static bool avx2 = __builtin_cpu_supports("avx2");
+
+   return avx2;
+}
+
+CMemorySearch::CMemorySearch()
+   : mChunks(),
+     mMatches(),
+     mMutex(),
+     mCondition(),
+     mNext(0),
+     mBytes(0),
+     mUnreadable(0),
+     mCancel(false),
+     mRunning(false),
+     mFinished(0),
+     mPattern(nullptr),
+     mSize(0),
+     mAlignment(1),
+     mRead(nullptr),
+     mReadContext(nullptr)
+{
+}
+
+const char* CMemorySearch::GetScanner()
+{
+   return HasAVX2() ? "avx2" : "sse2";
+}
+
+bool CMemorySearch::Cancel()
+{
+   if (!mRunning)
+      return false;
+
+   mCancel = true;
+   mCondition.notify_all();
+
+   return true;
+}
+
+bool CMemorySearch::Search(const std::vector<TSearchRange>& Ranges, const u8* Pattern, u32 Size, u32 Alignment,
+                           u64 MaxMatches, TReadMemoryFunc Read, void* ReadContext, TSearchFoundFunc Found,
+                           void* FoundContext, TSearchStats* Stats)
+{
+   auto start = std::chrono::steady_clock::now();
+
+   memset(Stats, 0, sizeof(*Stats));
+
+   if (Size == 0 || Size > MAX_PATTERN || Alignment == 0 || (Alignment & (Alignment - 1)))
+      return false;
+
+   mChunks.clear();
+   mMatches.clear();
+   mNext = 0;
+   mBytes = 0;
+   mUnreadable = 0;
+   mCancel = false;
+   mFinished = 0;
+   mPattern = Pattern;
+   mSize = Size;
+   mAlignment = Alignment;
+   mRead = Read;
+   mReadContext = ReadContext;
+
+   for (u32 i = 0; i < Ranges.size(); i++)
+   {
+      // chunks start aligned, the value scanners rely on it
+      u64 first = (Ranges[i].Start + Alignment - 1) & ~(u64)(Alignment - 1);
+
+      for (u64 address = first; address < Ranges[i].End; address += CHUNK_SIZE)
+      {
+         u64 size = (Ranges[i].End - address < CHUNK_SIZE) ? Ranges[i].End - address : CHUNK_SIZE;
+
+         mChunks.push_back({ address, size, Ranges[i].End, i });
+      }
+   }
+
+   u32 threads = std::thread::hardware_concurrency();
+
+   threads = (threads == 0) ? 1 : (threads > MAX_THREADS) ? MAX_THREADS : threads;
+   threads = (threads > mChunks.size()) ? mChunks.size() : threads;
+
+   std::vector<std::thread> workers;
+
+   mRunning = true;
+
+   for (u32 i = 0; i < threads; i++)
+      workers.push_back(std::thread(&CMemorySearch::Worker, this));
+
+   // hand out matches as they come in until every worker is done
+   std::vector<TMatch> matches;
+   bool                done = (threads == 0);
+
+   while (!done || matches.size())
+   {
+      for (const TMatch& match : matches)
+      {
+         if (Stats->Matches == MaxMatches)
+         {
+            Stats->Truncated = true;
+            mCancel = true;
+            break;
+         }
+
+         Found(FoundContext, match.Address, match.Range);
+         Stats->Matches++;
+      }
+
+      matches.clear();
+
+      std::unique_lock<std::mutex> lock(mMutex);
+
+      if (mMatches.empty() && mFinished < threads)
+         mCondition.wait_for(lock, std::chrono::milliseconds(10));
+
+      matches.swap(mMatches);
+      done = (mFinished == threads);
+   }
+
+   for (std::thread& worker : workers)
+      worker.join();
+
+   mRunning = false;
+
+   Stats->Bytes = mBytes;
+   Stats->Unreadable = mUnreadable;
+   Stats->Threads = threads;
+   Stats->Cancelled = mCancel && !Stats->Truncated;
+   Stats->Seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+
+   return true;
+}
+
+void CMemorySearch::Worker()
+{
+   TScanFunc scan;
+
+   if (mSize == sizeof(u64) && mAlignment == sizeof(u64))
+      scan = HasAVX2() ? ScanValuesAVX2 : ScanValuesSSE2;
+   else
+      scan = HasAVX2() ? ScanBytesAVX2 : ScanBytesSSE2;
+
+   u8*              buffer = (u8*)aligned_alloc(64, CHUNK_SIZE + MAX_PATTERN);
+   std::vector<u64> offsets;
+   std::vector<u64> found;
+
+   for (u64 index = mNext++; buffer && index < mChunks.size() && !mCancel; index = mNext++)
+   {
+      const TChunk& chunk = mChunks[index];
+      u64           size = chunk.Size + mSize - 1;
+
+      // the pattern may start in the last bytes of the chunk and end in the next one
+      size = (chunk.End - chunk.Address < size) ? chunk.End - chunk.Address : size;
+
+      u64 bytes = mRead(mReadContext, chunk.Address, buffer, size);
+
+      mBytes += (bytes < chunk.Size) ? bytes : chunk.Size;
+      mUnreadable += (bytes < chunk.Size) ? chunk.Size - bytes : 0;
+
+      if (bytes < mSize)
+         continue;
+
+      offsets.clear();
+      scan(buffer, bytes, mPattern, mSize, offsets);
+
+      found.clear();
+
+      for (u64 offset : offsets)
+      {
+         if (offset < chunk.Size && (chunk.Address + offset) % mAlignment == 0)
+            found.push_back(chunk.Address + offset);
+      }
+
+      if (found.size())
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+
+         for (u64 address : found)
+            mMatches.push_back({ address, chunk.Range });
+
+         mCondition.notify_one();
+      }
+   }
+
+   free(buffer);
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mFinished++;
+   mCondition.notify_one();
+}
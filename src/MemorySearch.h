@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "DebugTypes.h"
+#include "Unwinder.h"
+
+// Pattern search over ranges of target memory. The ranges are cut into CHUNK_SIZE pieces that
+// a pool of worker threads takes in address order; each worker reads a chunk plus the pattern
+// size - 1 bytes after it into its own buffer, so matches across chunk boundaries are found
+// once, and scans it with the widest compare the CPU has:
+//
+//   bytes   the first and last pattern byte are compared 32 (AVX2) or 16 (SSE2) positions at
+//           a time, only positions where both match get a full compare
+//   values  8 byte patterns at 8 byte alignment compare whole aligned words, 4 (AVX2) or
+//           2 (SSE2) per instruction
+//
+// Matches are handed to the calling thread as they come in, which is the only thread that sees
+// them. Memory is read through a callback that the workers call concurrently.
+
+struct TSearchRange
+{
+   u64 Start;
+   u64 End;
+};
+
+struct TSearchStats
+{
+   u64  Bytes;      // bytes scanned
+   u64  Unreadable; // bytes in the ranges that couldn't be read
+   u64  Matches;
+   f64  Seconds;
+   u32  Threads;
+   bool Cancelled;
+   bool Truncated;  // stopped at MaxMatches
+};
+
+typedef void (*TSearchFoundFunc)(void* Context, u64 Address, u32 Range);
+
+class CMemorySearch
+{
+public:
+
+   static constexpr u64 CHUNK_SIZE = 4 * 1024 * 1024;
+   static constexpr u32 MAX_THREADS = 16;
+   static constexpr u32 MAX_PATTERN = 256;
+
+   CMemorySearch();
+
+   // Alignment 1 finds the pattern anywhere, a larger power of two only at addresses that are
+   // a multiple of it. Read has to be safe to call from several threads at once.
+   bool Search(const std::vector<TSearchRange>& Ranges, const u8* Pattern, u32 Size, u32 Alignment, u64 MaxMatches,
+               TReadMemoryFunc Read, void* ReadContext, TSearchFoundFunc Found, void* FoundContext, TSearchStats* Stats);
+
+   // from any thread, returns false when no search is running
+   bool Cancel();
+
+   // name of the scanner the CPU supports
+   static const char* GetScanner();
+
+private:
+
+   struct TChunk
+   {
+      u64 Address;
+      u64 Size;
+      u64 End;   // end of the range, how far the pattern may reach past the chunk
+      u32 Range;
+   };
+
+   struct TMatch
+   {
+      u64 Address;
+      u32 Range;
+   };
+
+   void Worker();
+
+   std::vector<TChunk>     mChunks;
+   std::vector<TMatch>     mMatches; // found but not handed out yet
+   std::mutex              mMutex;
+   std::condition_variable mCondition;
+   std::atomic<u64>        mNext;
+   std::atomic<u64>        mBytes;
+   std::atomic<u64>        mUnreadable;
+   std::atomic<bool>       mCancel;
+   std::atomic<bool>       mRunning;
+   u32                     mFinished; // workers done, under mMutex
+   const u8*               mPattern;
+   u32                     mSize;
+   u32                     mAlignment;
+   TReadMemoryFunc         mRead;
+   void*                   mReadContext;
+};
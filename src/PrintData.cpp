@@ -1,121 +1,191 @@
-
 #include "PrintData.h"
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include <ctype.h>
+#include <array>
+#include <memory>
+#include <immintrin.h>
 
-char* CPrintData::mDataString = nullptr;
-int   CPrintData::mDataLength = 0;
+thread_local std::vector<char> CPrintData::mDataString;
+thread_local char              CPrintData::mTimeString[32];
 
-const char* CPrintData::GetDataAsString(char* Data, int Length, const char* NewLine, unsigned long Address)
+static const char HexDigits[] = "0123456789abcdef";
+
+// two hex digits for every byte value
+static const char* GetHexPairs()
 {
-   const char* newline = "\n";
+   static const std::array<char, 512> pairs = []
+   {
+      std::array<char, 512> result;
+
+      for (int i = 0; i < 256; i++)
+      {
+         result[i * 2] = HexDigits[i >> 4];
+         result[i * 2 + 1] = HexDigits[i & 0xf];
+      }
+      return result;
+   }();
+
+   return pairs.data();
+}
+
+// at least 8 digits, like %08lx
+static char* WriteAddress(char* Out, unsigned long Address)
+{
+   int digits = 8;
+
+   while (digits < 16 && (Address >> (digits * 4)) != 0)
+      digits++;
+
+   for (int i = digits - 1; i >= 0; i--)
+      *Out++ = HexDigits[(Address >> (i * 4)) & 0xf];
+   *Out++ = ':';
+
+   return Out;
+}
 
-   if (NewLine)
-      newline = NewLine;
+// Count bytes of a line, the rest of it padded so the text column lines up; missing bytes show
+// as '.' there
+static char* WriteLine(char* Out, const uint8_t* Data, int Count)
+{
+   const char* pairs = GetHexPairs();
 
-   // format data received
-   if (Length > 0)
+   for (int i = 0; i < CPrintData::BYTES_PER_LINE; i++)
    {
-      char element[BYTES_PER_LINE+3] = { 0 };
+      // a space before every byte, two halfway through the line
+      if (i % (CPrintData::BYTES_PER_LINE / 2) == 0)
+         *Out++ = ' ';
+      *Out++ = ' ';
 
-      // allocate string long enough to hold data
-      int length_required = ((Length + 8) / 8) * CHARS_PER_LINE;
+      if (i < Count)
+         memcpy(Out, &pairs[Data[i] * 2], 2);
+      else
+         memcpy(Out, "  ", 2);
+      Out += 2;
+   }
 
-      if (!mDataString)
-      {
-         mDataString = new char[length_required];
-         mDataLength = length_required;
-      }
-      else if (mDataString && length_required > mDataLength)
-      {
-         delete [] mDataString;
-         mDataString = new char[length_required];
-         mDataLength = length_required;
-      }
+   memcpy(Out, "   |", 4);
+   Out += 4;
 
-      memset(mDataString, 0, mDataLength);
+   for (int i = 0; i < CPrintData::BYTES_PER_LINE; i++)
+   {
+      // replace non-printable characters with '.'
+      *Out++ = (i < Count && Data[i] >= 32 && Data[i] < 127) ? Data[i] : '.';
+   }
+   *Out++ = '|';
 
-      for (int i = 0; i < Length; i++)
-      {
-         if (i % BYTES_PER_LINE == 0)
-         {
-            if (i != 0)
-            {
-               // print data as string
-               strcat(mDataString, "   |");
-               memcpy(element, &Data[i-BYTES_PER_LINE], BYTES_PER_LINE);
-               for (int j = 0; j < BYTES_PER_LINE; j++)
-               {
-                  // replace non-printable characters with '.'
-                  if ((element[j] >= 0 && element[j] <= 31) || element[j] >= 127 || element[j] < 0)
-                     element[j] = '.';
-               }
-               strcat(mDataString, element);
-               strcat(mDataString, "|");
-               strcat(mDataString, newline);
-               memset(element, 0, sizeof(element));
-            }
-            sprintf(element, "%08x:", Address + i);
-            strcat(mDataString, element);
-            memset(element, 0, sizeof(element));
-         }
-
-         if (i % (BYTES_PER_LINE / 2) == 0)
-         {
-            // add a space after halfway through the bytes on a line
-            strcat(mDataString, " ");
-         }
-         // add a space every byte
-         strcat(mDataString, " ");
-
-         // print data
-         sprintf(element, "%02x", (unsigned char)Data[i]);
-         strcat(mDataString, element);
-         memset(element, 0, sizeof(element));
-      }
+   return Out;
+}
+
+// A full line, same output as WriteLine. The digits of each half line are spread out over
+// its 25 characters by two shuffles, lanes with a negative index get a space. The stores
+// overlap and run up to 7 bytes past the hex column, the text column after it overwrites them.
+__attribute__((target("ssse3")))
+static char* WriteLineSsse3(char* Out, const uint8_t* Data)
+{
+   const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+   const __m128i nibble = _mm_set1_epi8(0x0f);
+   const __m128i spread0 = _mm_setr_epi8(-1, -1, 0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9);
+   const __m128i spread1 = _mm_setr_epi8(-1, 10, 11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1);
+   const __m128i spaces0 = _mm_and_si128(_mm_cmplt_epi8(spread0, _mm_setzero_si128()), _mm_set1_epi8(' '));
+   const __m128i spaces1 = _mm_and_si128(_mm_cmplt_epi8(spread1, _mm_setzero_si128()), _mm_set1_epi8(' '));
+
+   __m128i bytes = _mm_loadu_si128((const __m128i*)Data);
+   __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+   __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, nibble));
+   __m128i first = _mm_unpacklo_epi8(high, low);
+   __m128i second = _mm_unpackhi_epi8(high, low);
+
+   _mm_storeu_si128((__m128i*)&Out[0], _mm_or_si128(_mm_shuffle_epi8(first, spread0), spaces0));
+   _mm_storeu_si128((__m128i*)&Out[16], _mm_or_si128(_mm_shuffle_epi8(first, spread1), spaces1));
+   _mm_storeu_si128((__m128i*)&Out[25], _mm_or_si128(_mm_shuffle_epi8(second, spread0), spaces0));
+   _mm_storeu_si128((__m128i*)&Out[41], _mm_or_si128(_mm_shuffle_epi8(second, spread1), spaces1));
+
+   // printable is 32 to 126, the signed compare leaves out 128 and up
+   __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(31)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(127)));
+   __m128i text = _mm_or_si128(_mm_and_si128(printable, bytes), _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+
+   memcpy(&Out[50], "   |", 4);
+   _mm_storeu_si128((__m128i*)&Out[54], text);
+   Out[70] = '|';
+
+   return Out + 71;
+}
 
-      if (Length % BYTES_PER_LINE != 0)
+size_t CPrintData::GetFormattedSize(size_t Length, const char* NewLine)
+{
+   size_t lines = (Length + BYTES_PER_LINE - 1) / BYTES_PER_LINE;
+
+   return lines * (MAX_LINE_LENGTH + strlen(NewLine ? NewLine : "\n")) + 1;
+}
+
+size_t CPrintData::FormatData(char* Buffer, const uint8_t* Data, size_t Length, const char* NewLine, unsigned long Address)
+{
+   static const bool ssse3 = __builtin_cpu_supports("ssse3");
+   const char*       newline = NewLine ? NewLine : "\n";
+   size_t            newline_length = strlen(newline);
+   char*             out = Buffer;
+
+   for (size_t i = 0; i < Length; i += BYTES_PER_LINE)
+   {
+      if (i != 0)
       {
-         // pad with spaces and print data as string
-         for (int j = 0; j < ((BYTES_PER_LINE - (Length % BYTES_PER_LINE)) * 3); j++)
-            strcat(mDataString, " ");
-         
-         if (Length % BYTES_PER_LINE <= 8)
-            strcat(mDataString, " ");
-
-         strcat(mDataString, "   |");
-         memcpy(element, &Data[Length-(Length % BYTES_PER_LINE)], Length % BYTES_PER_LINE);
-         for (int j = 0; j < BYTES_PER_LINE; j++)
-         {
-            // replace non-printable characters with '.'
-            if ((element[j] >= 0 && element[j] <= 31) || element[j] >= 127 || element[j] < 0)
-               element[j] = '.';
-         }
-         strcat(mDataString, element);
-         strcat(mDataString, "|");
-         memset(element, 0, sizeof(element));
+         memcpy(out, newline, newline_length);
+         out += newline_length;
       }
+
+      out = WriteAddress(out, Address + i);
+
+      if (Length - i < BYTES_PER_LINE)
+         out = WriteLine(out, &Data[i], Length - i);
+      else if (ssse3)
+         out = WriteLineSsse3(out, &Data[i]);
       else
+         out = WriteLine(out, &Data[i], BYTES_PER_LINE);
+   }
+
+   *out = 0;
+   return out - Buffer;
+}
+
+bool CPrintData::WriteData(FILE* File, const uint8_t* Data, size_t Length, const char* NewLine, unsigned long Address)
+{
+   const char*             newline = NewLine ? NewLine : "\n";
+   size_t                  newline_length = strlen(newline);
+   size_t                  chunk = (size_t)WRITE_LINES * BYTES_PER_LINE;
+   std::unique_ptr<char[]> buffer(new char[newline_length + GetFormattedSize(chunk, newline)]);
+
+   for (size_t i = 0; i < Length; i += chunk)
+   {
+      char* out = buffer.get();
+
+      // the newline between this chunk and the last one
+      if (i != 0)
       {
-         // print data as string
-         strcat(mDataString, "   |");
-         memcpy(element, &Data[Length-BYTES_PER_LINE], BYTES_PER_LINE);
-         for (int j = 0; j < BYTES_PER_LINE; j++)
-         {
-            // replace non-printable characters with '.'
-            if ((element[j] >= 0 && element[j] <= 31) || element[j] >= 127 || element[j] < 0)
-               element[j] = '.';
-         }
-         strcat(mDataString, element);
-         strcat(mDataString, "|");
-         memset(element, 0, sizeof(element));
+         memcpy(out, newline, newline_length);
+         out += newline_length;
       }
+
+      out += FormatData(out, &Data[i], (Length - i < chunk) ? Length - i : chunk, newline, Address + i);
+
+      if (fwrite(buffer.get(), 1, out - buffer.get(), File) != (size_t)(out - buffer.get()))
+         return false;
    }
 
-   return mDataString;
+   return true;
+}
+
+const char* CPrintData::GetDataAsString(char* Data, int Length, const char* NewLine, unsigned long Address)
+{
+   if (Length <= 0)
+      return "";
+
+   mDataString.resize(GetFormattedSize(Length, NewLine));
+   FormatData(mDataString.data(), (const uint8_t*)Data, Length, NewLine, Address);
+
+   return mDataString.data();
 }
 
 const char* CPrintData::GetTimeAsString()
@@ -123,22 +193,10 @@ const char* CPrintData::GetTimeAsString()
    struct timeval tv;
    struct tm*     tm;
 
-   if (!mDataString)
-   {
-      mDataString = new char[20];
-      mDataLength = 20;
-   }
-   else if (mDataString && 20 > mDataLength)
-   {
-      delete [] mDataString;
-      mDataString = new char[20];
-      mDataLength = 20;
-   }
-
    gettimeofday(&tv, NULL);
    tm = localtime(&tv.tv_sec);
 
-   sprintf(mDataString, "%02d:%02d:%02d.%06ld - ", tm->tm_hour, tm->tm_min, tm->tm_sec, tv.tv_usec);
+   sprintf(mTimeString, "%02d:%02d:%02d.%06ld - ", tm->tm_hour, tm->tm_min, tm->tm_sec, tv.tv_usec);
 
-   return mDataString;
+   return mTimeString;
 }
@@ -1,22 +1,42 @@
-
 #pragma once
 
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+
+// Hex dumps, 16 bytes per line:
+//
+//   7ffd1000:  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 00 00   |Hello, world!...|
+//
+// Lines are formatted straight into the caller's buffer in one pass, full lines with SSSE3
+// shuffles when the CPU has them. Dumps of any size can be streamed to a file through a
+// fixed size buffer with WriteData.
 class CPrintData
 {
 public:
 
-   static constexpr int BYTES_PER_LINE = 16;
-   static constexpr int CHARS_PER_LINE = 80;
+   static constexpr int BYTES_PER_LINE  = 16;
+   static constexpr int MAX_LINE_LENGTH = 88;    // without the newline, with a 16 digit address
+   static constexpr int WRITE_LINES     = 4096;  // lines WriteData formats at a time
 
    CPrintData() {}
    ~CPrintData() = default;
 
+   // buffer size FormatData needs for Length bytes, including the terminating zero
+   static size_t GetFormattedSize(size_t Length, const char* NewLine = nullptr);
+
+   // NewLine goes between lines, not after the last one; returns the characters written
+   static size_t FormatData(char* Buffer, const uint8_t* Data, size_t Length, const char* NewLine = nullptr, unsigned long Address = 0);
+   static bool WriteData(FILE* File, const uint8_t* Data, size_t Length, const char* NewLine = nullptr, unsigned long Address = 0);
+
+   // formatted into a buffer per thread, valid until the thread's next call
    static const char* GetDataAsString(char* Data, int Length, const char* NewLine = nullptr, unsigned long Address = 0);
    static const char* GetTimeAsString();
 
 private:
 
-   static char* mDataString;
-   static int   mDataLength;
+   static thread_local std::vector<char> mDataString;
+   static thread_local char              mTimeString[32];
 
 };
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include "Profile.h"
+
+CProfile::CProfile()
+   : mNodes(),
+     mIndex(),
+     mSamples(0)
+{
+   Clear();
+}
+
+void CProfile::Clear()
+{
+   mNodes.clear();
+   mIndex.clear();
+   mSamples = 0;
+
+   mNodes.push_back({ 0, 0, 0, 0 });
+}
+
+void CProfile::Add(const u64* Pcs, u32 Count)
+{
+   u32 node = 0;
+
+   mSamples++;
+   mNodes[0].Total++;
+
+   for (u32 i = Count; i > 0; i--)
+   {
+      TNodeKey key = { Pcs[i - 1], node };
+      auto     it = mIndex.find(key);
+
+      if (it == mIndex.end())
+      {
+         mNodes.push_back({ key.Pc, node, 0, 0 });
+         it = mIndex.insert(std::make_pair(key, (u32)mNodes.size() - 1)).first;
+      }
+
+      node = it->second;
+      mNodes[node].Total++;
+   }
+
+   mNodes[node].Self++;
+}
+
+void CProfile::Symbolize(TSymbolizeFunc Symbolize, void* Context, std::vector<std::string>& Names) const
+{
+   std::unordered_map<u64, std::string> cache;
+   char                                 name[256];
+
+   Names.resize(mNodes.size());
+
+   for (size_t i = 1; i < mNodes.size(); i++)
+   {
+      auto it = cache.find(mNodes[i].Pc);
+
+      if (it == cache.end())
+      {
+         if (!Symbolize(Context, mNodes[i].Pc, name, sizeof(name)))
+            snprintf(name, sizeof(name), "0x%lx", mNodes[i].Pc);
+
+         it = cache.insert(std::make_pair(mNodes[i].Pc, std::string(name))).first;
+      }
+
+      Names[i] = it->second;
+   }
+}
+
+bool CProfile::WriteCollapsed(const char* Filename, TSymbolizeFunc Symbolize, void* Context) const
+{
+   std::vector<std::string>   names;
+   std::vector<std::string>   stacks(mNodes.size());
+   std::map<std::string, u64> lines;
+
+   FILE* file = fopen(Filename, "w");
+
+   if (!file)
+      return false;
+
+   this->Symbolize(Symbolize, Context, names);
+
+   // parents come first, so every node's stack is its parent's plus one name
+   for (size_t i = 1; i < mNodes.size(); i++)
+   {
+      const TNode& node = mNodes[i];
+
+      stacks[i] = node.Parent ? stacks[node.Parent] + ";" + names[i] : names[i];
+
+      if (node.Self)
+         lines[stacks[i]] += node.Self;
+   }
+
+   for (const auto& line : lines)
+      fprintf(file, "%s %lu\n", line.first.c_str(), line.second);
+
+   return fclose(file) == 0;
+}
+
+void CProfile::GetTop(u32 Max, TSymbolizeFunc Symbolize, void* Context, std::vector<TProfileFunction>& Functions) const
+{
+   std::vector<std::string>                          names;
+   std::unordered_map<std::string, TProfileFunction> functions;
+   std::vector<const std::string*>                   seen;
+
+   this->Symbolize(Symbolize, Context, names);
+
+   for (size_t i = 1; i < mNodes.size(); i++)
+   {
+      if (!mNodes[i].Self)
+         continue;
+
+      functions[names[i]].Self += mNodes[i].Self;
+
+      // a recursive function is on the stack more than once but only counts once per sample
+      seen.clear();
+
+      for (u32 node = i; node; node = mNodes[node].Parent)
+      {
+         if (std::find_if(seen.begin(), seen.end(), [&](const std::string* name) { return *name == names[node]; }) != seen.end())
+            continue;
+
+         seen.push_back(&names[node]);
+         functions[names[node]].Total += mNodes[i].Self;
+      }
+   }
+
+   Functions.clear();
+
+   for (auto& function : functions)
+   {
+      function.second.Name = function.first;
+      Functions.push_back(function.second);
+   }
+
+   std::sort(Functions.begin(), Functions.end(),
+             [](const TProfileFunction& A, const TProfileFunction& B) { return A.Self > B.Self || (A.Self == B.Self && A.Total > B.Total); });
+
+   if (Functions.size() > Max)
+      Functions.resize(Max);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DebugTypes.h"
+
+// Call tree built from sampled stacks. A node is a pc under a parent node and every
+// (parent, pc) pair is hash-consed to one node, so adding a stack is one lookup per frame and
+// stacks with a common outer part share its nodes. Total counts the samples that passed
+// through a node, Self the samples whose innermost frame it was.
+//
+// Nodes are per pc rather than per function, names only come in when the tree is exported:
+// stacks that symbolize to the same functions become one line of collapsed stacks, the
+// "outer;...;inner count" text flamegraph.pl and the usual flame graph viewers read.
+
+// writes the name for Address into Name, returns false when there is none
+typedef bool (*TSymbolizeFunc)(void* Context, u64 Address, char* Name, u32 Size);
+
+struct TProfileFunction
+{
+   std::string Name;
+   u64         Self;
+   u64         Total; // samples with the function anywhere on the stack, counted once each
+};
+
+class CProfile
+{
+public:
+
+   CProfile();
+
+   void Clear();
+
+   // Pcs innermost frame first, the way the unwinder returns them
+   void Add(const u64* Pcs, u32 Count);
+
+   u64 GetSamples() const { return mSamples; }
+   u64 GetNodes() const { return mNodes.size() - 1; }
+
+   bool WriteCollapsed(const char* Filename, TSymbolizeFunc Symbolize, void* Context) const;
+
+   // functions with the most self samples first, at most Max of them
+   void GetTop(u32 Max, TSymbolizeFunc Symbolize, void* Context, std::vector<TProfileFunction>& Functions) const;
+
+private:
+
+   struct TNode
+   {
+      u64 Pc;
+      u32 Parent;
+      u64 Self;
+      u64 Total;
+   };
+
+   struct TNodeKey
+   {
+      u64 Pc;
+      u32 Parent;
+
+      bool operator==(const TNodeKey& Other) const { return Pc == Other.Pc && Parent == Other.Parent; }
+   };
+
+   struct TNodeHash
+   {
+      size_t operator()(const TNodeKey& Key) const { return (Key.Pc ^ ((u64)Key.Parent << 40)) * 0x9e3779b97f4a7c15; }
+   };
+
+   // names of every node's pc, indexed like mNodes
+   void Symbolize(TSymbolizeFunc Symbolize, void* Context, std::vector<std::string>& Names) const;
+
+   std::vector<TNode>                           mNodes; // 0 is the root, parents come before children
+   std::unordered_map<TNodeKey, u32, TNodeHash> mIndex;
+   u64                                          mSamples;
+};
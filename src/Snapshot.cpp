@@ -0,0 +1,414 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <chrono>
+#include <algorithm>
+#include "Snapshot.h"
+
+#define PAGEMAP_SOFT_DIRTY (1ull << 55)
+#define PAGEMAP_BATCH      (64 * 1024) // pagemap entries read at once
+
+static const u64 PAGES_PER_BLOCK = CSnapshot::BLOCK_SIZE / PAGE_SIZE;
+
+// four independent lanes of xor and multiply by an odd constant, both steps are reversible so
+// a change to one word always changes the hash
+static u64 HashPage(const u8* Page)
+{
+   const u64* words = (const u64*)Page;
+   u64        a = 0x9e3779b97f4a7c15;
+   u64        b = 0xbf58476d1ce4e5b9;
+   u64        c = 0x94d049bb133111eb;
+   u64        d = 0xff51afd7ed558ccd;
+
+   for (u32 i = 0; i < PAGE_SIZE / sizeof(u64); i += 4)
+   {
+      a = (a ^ words[i]) * 0xc4ceb9fe1a85ec53;
+      b = (b ^ words[i + 1]) * 0xc4ceb9fe1a85ec53;
+      c = (c ^ words[i + 2]) * 0xc4ceb9fe1a85ec53;
+      d = (d ^ words[i + 3]) * 0xc4ceb9fe1a85ec53;
+   }
+
+   return a ^ ((b << 16) | (b >> 48)) ^ ((c << 32) | (c >> 32)) ^ ((d << 48) | (d >> 16));
+}
+
+static const u8 ZeroPage[PAGE_SIZE] = {};
+
+CSnapshot::CSnapshot()
+   : mRegions(),
+     mBlocks(),
+     mChanges(nullptr),
+     mStats(nullptr),
+     mOpen{},
+     mMaxChanges(0),
+     mStoredPages(0),
+     mPid(0),
+     mPagemapFd(-1),
+     mSoftDirty(false)
+{
+}
+
+CSnapshot::~CSnapshot()
+{
+   Clear();
+}
+
+void CSnapshot::Clear()
+{
+   if (mPagemapFd != -1)
+      close(mPagemapFd);
+
+   mRegions.clear();
+   mBlocks.clear();
+   mStoredPages = 0;
+   mPid = 0;
+   mPagemapFd = -1;
+   mSoftDirty = false;
+}
+
+u64 CSnapshot::GetPages() const
+{
+   u64 pages = 0;
+
+   for (const TRegion& region : mRegions)
+      pages += region.Slots.size();
+
+   return pages;
+}
+
+const u8* CSnapshot::GetPage(u32 Slot) const
+{
+   if (Slot == ZERO_PAGE)
+      return ZeroPage;
+
+   return &mBlocks[Slot / PAGES_PER_BLOCK][(Slot % PAGES_PER_BLOCK) * PAGE_SIZE];
+}
+
+u32 CSnapshot::StorePage(const u8* Page)
+{
+   if (mStoredPages % PAGES_PER_BLOCK == 0)
+      mBlocks.push_back(std::unique_ptr<u8[]>(new u8[BLOCK_SIZE]));
+
+   memcpy(&mBlocks.back()[(mStoredPages % PAGES_PER_BLOCK) * PAGE_SIZE], Page, PAGE_SIZE);
+
+   return mStoredPages++;
+}
+
+bool CSnapshot::ReadSoftDirty(u64 Start, u64 Pages, std::vector<u64>& Entries)
+{
+   Entries.resize(Pages);
+
+   ssize_t bytes = pread(mPagemapFd, Entries.data(), Pages * sizeof(u64), (Start / PAGE_SIZE) * sizeof(u64));
+
+   return bytes == (ssize_t)(Pages * sizeof(u64));
+}
+
+// pages start out soft-dirty when they are first touched, a kernel that tracks the bit shows
+// it somewhere in any process that ran at all
+bool CSnapshot::FindSoftDirty(const std::vector<TRegion>& Regions)
+{
+   std::vector<u64> entries;
+
+   for (const TRegion& region : Regions)
+   {
+      for (u64 address = region.Start; address < region.End; address += PAGEMAP_BATCH * PAGE_SIZE)
+      {
+         u64 pages = std::min<u64>((region.End - address) / PAGE_SIZE, PAGEMAP_BATCH);
+
+         if (!ReadSoftDirty(address, pages, entries))
+            return false;
+
+         for (u64 entry : entries)
+         {
+            if (entry & PAGEMAP_SOFT_DIRTY)
+               return true;
+         }
+      }
+   }
+
+   return false;
+}
+
+bool CSnapshot::Take(pid_t Pid, const std::vector<TMemoryMap>& Maps, TReadMemoryFunc Read, void* Context)
+{
+   char filename[64];
+
+   Clear();
+
+   mPid = Pid;
+
+   std::vector<TRegion> regions;
+
+   // read-only and shared memory can change too, but not through the target's own stores
+   for (const TMemoryMap& map : Maps)
+   {
+      if ((map.Flags & (MEMORY_MAP_READ | MEMORY_MAP_WRITE)) == (MEMORY_MAP_READ | MEMORY_MAP_WRITE) &&
+          !(map.Flags & MEMORY_MAP_SHARED))
+         regions.push_back({ map.Start, map.End, {}, {} });
+   }
+
+   sprintf(filename, "/proc/%d/pagemap", Pid);
+   mPagemapFd = open(filename, O_RDONLY | O_CLOEXEC);
+
+   std::unique_ptr<u8[]> buffer(new u8[BLOCK_SIZE]);
+
+   for (TRegion& region : regions)
+   {
+      region.Slots.reserve((region.End - region.Start) / PAGE_SIZE);
+      region.Hashes.reserve((region.End - region.Start) / PAGE_SIZE);
+
+      for (u64 address = region.Start; address < region.End; address += BLOCK_SIZE)
+      {
+         u64 size = std::min(region.End - address, BLOCK_SIZE);
+         u64 pages = Read(Context, address, buffer.get(), size) / PAGE_SIZE;
+
+         for (u64 i = 0; i < pages; i++)
+         {
+            const u8* page = &buffer[i * PAGE_SIZE];
+            bool      zero = IsZeroPage(page, PAGE_SIZE);
+
+            region.Slots.push_back(zero ? ZERO_PAGE : StorePage(page));
+            region.Hashes.push_back(HashPage(page));
+         }
+
+         // whatever couldn't be read isn't part of the snapshot
+         if (pages * PAGE_SIZE < size)
+         {
+            region.End = address + pages * PAGE_SIZE;
+            break;
+         }
+      }
+   }
+
+   regions.erase(std::remove_if(regions.begin(), regions.end(), [](const TRegion& region) { return region.Start == region.End; }),
+                 regions.end());
+
+   mSoftDirty = mPagemapFd != -1 && FindSoftDirty(regions);
+
+   if (mSoftDirty)
+   {
+      sprintf(filename, "/proc/%d/clear_refs", Pid);
+
+      int fd = open(filename, O_WRONLY | O_CLOEXEC);
+
+      mSoftDirty = fd != -1 && write(fd, "4", 1) == 1;
+
+      if (fd != -1)
+         close(fd);
+   }
+
+   mRegions = std::move(regions);
+
+   return true;
+}
+
+void CSnapshot::CloseChange()
+{
+   if (mOpen.Size == 0)
+      return;
+
+   mStats->Ranges++;
+   mStats->Bytes += mOpen.Size;
+
+   if (mChanges->size() < mMaxChanges)
+      mChanges->push_back(mOpen);
+
+   mOpen.Size = 0;
+}
+
+void CSnapshot::AddChange(u64 Address, u64 Size, eMemoryChange Type)
+{
+   CloseChange();
+
+   mStats->Ranges++;
+
+   if (mChanges->size() < mMaxChanges)
+      mChanges->push_back({ Address, Size, Type, {}, {} });
+}
+
+void CSnapshot::ComparePage(u64 Address, const u8* Old, const u8* New)
+{
+   for (u64 i = 0; i < PAGE_SIZE; )
+   {
+      // most of a changed page is usually the same, skip it a word at a time
+      if (mOpen.Size == 0 && (i & 7) == 0 && *(const u64*)(Old + i) == *(const u64*)(New + i))
+      {
+         i += 8;
+         continue;
+      }
+
+      if (Old[i] != New[i])
+      {
+         // a range only carries over from the previous page when that page was right before
+         if (mOpen.Size && mOpen.Address + mOpen.Size != Address + i)
+            CloseChange();
+
+         if (mOpen.Size == 0)
+         {
+            mOpen.Address = Address + i;
+            mOpen.Type = MEMORY_CHANGE_WRITTEN;
+         }
+
+         if (mOpen.Size < sizeof(mOpen.Old))
+         {
+            mOpen.Old[mOpen.Size] = Old[i];
+            mOpen.New[mOpen.Size] = New[i];
+         }
+
+         mOpen.Size++;
+      }
+      else
+      {
+         CloseChange();
+      }
+
+      i++;
+   }
+}
+
+void CSnapshot::DiffPages(const TRegion& Region, u64 Start, u64 Pages, u8* Buffer, TReadMemoryFunc Read, void* Context)
+{
+   while (Pages)
+   {
+      u64 count = std::min(Pages, PAGES_PER_BLOCK);
+      u64 read = Read(Context, Start, Buffer, count * PAGE_SIZE) / PAGE_SIZE;
+
+      for (u64 i = 0; i < read; i++)
+      {
+         u64 index = (Start - Region.Start) / PAGE_SIZE + i;
+
+         mStats->Checked++;
+
+         if (HashPage(&Buffer[i * PAGE_SIZE]) == Region.Hashes[index])
+            continue;
+
+         mStats->Changed++;
+         ComparePage(Start + i * PAGE_SIZE, GetPage(Region.Slots[index]), &Buffer[i * PAGE_SIZE]);
+      }
+
+      if (read < count)
+      {
+         AddChange(Start + read * PAGE_SIZE, (Pages - read) * PAGE_SIZE, MEMORY_CHANGE_UNMAPPED);
+         return;
+      }
+
+      Start += count * PAGE_SIZE;
+      Pages -= count;
+   }
+}
+
+bool CSnapshot::Diff(const std::vector<TMemoryMap>& Maps, TReadMemoryFunc Read, void* Context, u64 MaxChanges,
+                     std::vector<TMemoryChange>& Changes, TSnapshotStats* Stats)
+{
+   auto start = std::chrono::steady_clock::now();
+
+   memset(Stats, 0, sizeof(*Stats));
+   Changes.clear();
+
+   if (!IsValid())
+      return false;
+
+   mChanges = &Changes;
+   mStats = Stats;
+   mMaxChanges = MaxChanges;
+   mOpen.Size = 0;
+
+   Stats->Pages = GetPages();
+   Stats->SoftDirty = mSoftDirty;
+
+   std::vector<TMemoryMap> maps;
+
+   for (const TMemoryMap& map : Maps)
+   {
+      if ((map.Flags & (MEMORY_MAP_READ | MEMORY_MAP_WRITE)) == (MEMORY_MAP_READ | MEMORY_MAP_WRITE) &&
+          !(map.Flags & MEMORY_MAP_SHARED))
+         maps.push_back(map);
+   }
+
+   // writable memory that wasn't there when the snapshot was taken
+   for (const TMemoryMap& map : maps)
+   {
+      u64 address = map.Start;
+
+      for (const TRegion& region : mRegions)
+      {
+         if (region.End <= address || region.Start >= map.End)
+            continue;
+
+         if (region.Start > address)
+            AddChange(address, region.Start - address, MEMORY_CHANGE_MAPPED);
+
+         address = region.End;
+      }
+
+      if (address < map.End)
+         AddChange(address, map.End - address, MEMORY_CHANGE_MAPPED);
+   }
+
+   std::unique_ptr<u8[]> buffer(new u8[BLOCK_SIZE]);
+   std::vector<u64>      entries;
+
+   for (const TRegion& region : mRegions)
+   {
+      u64 address = region.Start;
+
+      for (const TMemoryMap& map : maps)
+      {
+         u64 start = std::max(map.Start, region.Start);
+         u64 end = std::min(map.End, region.End);
+
+         if (start >= end)
+            continue;
+
+         if (start > address)
+            AddChange(address, start - address, MEMORY_CHANGE_UNMAPPED);
+
+         address = end;
+
+         if (!mSoftDirty)
+         {
+            DiffPages(region, start, (end - start) / PAGE_SIZE, buffer.get(), Read, Context);
+            continue;
+         }
+
+         // only runs of pages the target wrote to are read
+         for (u64 batch = start; batch < end; batch += PAGEMAP_BATCH * PAGE_SIZE)
+         {
+            u64 pages = std::min<u64>((end - batch) / PAGE_SIZE, PAGEMAP_BATCH);
+
+            if (!ReadSoftDirty(batch, pages, entries))
+            {
+               DiffPages(region, batch, pages, buffer.get(), Read, Context);
+               continue;
+            }
+
+            for (u64 i = 0; i < pages; )
+            {
+               if (!(entries[i] & PAGEMAP_SOFT_DIRTY))
+               {
+                  i++;
+                  continue;
+               }
+
+               u64 run = i;
+
+               while (run < pages && (entries[run] & PAGEMAP_SOFT_DIRTY))
+                  run++;
+
+               DiffPages(region, batch + i * PAGE_SIZE, run - i, buffer.get(), Read, Context);
+               i = run;
+            }
+         }
+      }
+
+      if (address < region.End)
+         AddChange(address, region.End - address, MEMORY_CHANGE_UNMAPPED);
+   }
+
+   CloseChange();
+
+   std::sort(Changes.begin(), Changes.end(), [](const TMemoryChange& a, const TMemoryChange& b) { return a.Address < b.Address; });
+
+   Stats->Seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+
+   return true;
+}
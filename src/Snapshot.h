@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "DebugTypes.h"
+#include "DebugUtils.h"
+#include "Unwinder.h"
+
+// Copy of the target's writable memory to compare against later. Pages are stored once in
+// BLOCK_SIZE blocks, pages that are all zero aren't stored at all, and every page keeps a hash
+// of its contents.
+//
+// Taking a snapshot clears the soft-dirty bits through /proc/pid/clear_refs, so the kernel
+// marks every page the target writes from then on. A diff reads those bits from
+// /proc/pid/pagemap and compares only the marked pages. Kernels built without soft-dirty
+// accept the clear but never set a bit; that is caught when no page at all shows the bit
+// before clearing, and the diff hashes every page instead and compares only the pages whose
+// hash changed. Either way, the stored copy is only read for pages that changed.
+
+enum eMemoryChange
+{
+   MEMORY_CHANGE_WRITTEN,  // bytes that differ from the snapshot
+   MEMORY_CHANGE_MAPPED,   // writable memory the snapshot doesn't have
+   MEMORY_CHANGE_UNMAPPED, // snapshot memory that is gone
+};
+
+struct TMemoryChange
+{
+   u64           Address;
+   u64           Size;
+   eMemoryChange Type;
+   u8            Old[8];  // first bytes of a written range, up to Size
+   u8            New[8];
+};
+
+struct TSnapshotStats
+{
+   u64  Pages;        // pages in the snapshot
+   u64  Checked;      // pages read from the target
+   u64  Changed;      // pages with at least one byte changed
+   u64  Ranges;       // changes found, more than were returned when over the limit
+   u64  Bytes;        // bytes written
+   f64  Seconds;
+   bool SoftDirty;
+};
+
+class CSnapshot
+{
+public:
+
+   static constexpr u64 BLOCK_SIZE = 4 * 1024 * 1024;
+   static constexpr u32 ZERO_PAGE = 0xffffffff;
+
+   CSnapshot();
+   ~CSnapshot();
+
+   // Maps are the target's current mappings, only the private writable ones are copied
+   bool Take(pid_t Pid, const std::vector<TMemoryMap>& Maps, TReadMemoryFunc Read, void* Context);
+   bool Diff(const std::vector<TMemoryMap>& Maps, TReadMemoryFunc Read, void* Context, u64 MaxChanges,
+             std::vector<TMemoryChange>& Changes, TSnapshotStats* Stats);
+   void Clear();
+
+   bool IsValid() const { return mPid != 0; }
+   pid_t GetPid() const { return mPid; }
+   bool HasSoftDirty() const { return mSoftDirty; }
+   u64 GetPages() const;
+   u64 GetStoredBytes() const { return mStoredPages * PAGE_SIZE; }
+
+private:
+
+   struct TRegion
+   {
+      u64              Start;
+      u64              End;
+      std::vector<u32> Slots;  // stored page per page, ZERO_PAGE when all zero
+      std::vector<u64> Hashes;
+   };
+
+   const u8* GetPage(u32 Slot) const;
+   u32 StorePage(const u8* Page);
+   bool ReadSoftDirty(u64 Start, u64 Pages, std::vector<u64>& Entries);
+   bool FindSoftDirty(const std::vector<TRegion>& Regions);
+   void DiffPages(const TRegion& Region, u64 Start, u64 Pages, u8* Buffer, TReadMemoryFunc Read, void* Context);
+   void ComparePage(u64 Address, const u8* Old, const u8* New);
+   void AddChange(u64 Address, u64 Size, eMemoryChange Type);
+   void CloseChange();
+
+   std::vector<TRegion>               mRegions;
+   std::vector<std::unique_ptr<u8[]>> mBlocks;
+   std::vector<TMemoryChange>*        mChanges;     // output of the running diff
+   TSnapshotStats*                    mStats;
+   TMemoryChange                      mOpen;        // written range still growing, Size 0 when none
+   u64                                mMaxChanges;
+   u64                                mStoredPages;
+   pid_t                              mPid;
+   int                                mPagemapFd;
+   bool                               mSoftDirty;
+};
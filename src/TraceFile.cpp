@@ -0,0 +1,480 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "TraceFile.h"
+
+// Bit order of the changed register mask, registers that change all the time come first so
+// the mask of a typical instruction fits in one varint byte. rip is always stored.
+static const u8 TraceRegisterOrder[] =
+{
+   REGISTER_RAX, REGSITER_RCX, REGISTER_RDX, REGISTER_RSI, REGISTER_RDI, REGISTER_RSP, REGISTER_EFLAGS,
+   REGISTER_R8, REGISTER_R9, REGISTER_R10, REGISTER_R11, REGISTER_RBX, REGISTER_RBP, REGISTER_R12,
+   REGISTER_R13, REGISTER_R14, REGISTER_R15, REGISTER_ORIG_RAX, REGISTER_FS_BASE, REGISTER_GS_BASE,
+   REGISTER_CS, REGISTER_SS, REGISTER_DS, REGISTER_ES, REGISTER_FS, REGISTER_GS
+};
+
+static_assert(ArrayCount(TraceRegisterOrder) == REGISTER_COUNT - 1, "every register but rip needs a mask bit");
+
+static inline u8* PutVarint(u8* Out, u64 Value)
+{
+   while (Value >= 0x80)
+   {
+      *Out++ = (u8)Value | 0x80;
+      Value >>= 7;
+   }
+   *Out++ = (u8)Value;
+
+   return Out;
+}
+
+static inline const u8* GetVarint(const u8* In, const u8* End, u64* Value)
+{
+   u64 result = 0;
+
+   for (u32 shift = 0; In < End && shift < 64; shift += 7)
+   {
+      u8 byte = *In++;
+
+      result |= (u64)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+      {
+         *Value = result;
+         return In;
+      }
+   }
+
+   return nullptr;
+}
+
+// differences are signed and mostly small, zigzag keeps small negative values short
+static inline u64 ZigZag(u64 Delta) { return (Delta << 1) ^ (u64)((s64)Delta >> 63); }
+static inline u64 UnZigZag(u64 Value) { return (Value >> 1) ^ (0 - (Value & 1)); }
+
+// decodes one delta record in place, returns the position of the next record or null when
+// the record is truncated
+static const u8* DecodeDelta(const u8* In, const u8* End, TRegister* Registers)
+{
+   u64 mask;
+   u64 value;
+
+   if (!(In = GetVarint(In, End, &mask)) || !(In = GetVarint(In, End, &value)))
+      return nullptr;
+
+   Registers->RegArray[REGISTER_RIP] += UnZigZag(value);
+
+   for (u32 bit = 0; mask; bit++, mask >>= 1)
+   {
+      if (!(mask & 1))
+         continue;
+
+      if (bit >= ArrayCount(TraceRegisterOrder) || !(In = GetVarint(In, End, &value)))
+         return nullptr;
+
+      Registers->RegArray[TraceRegisterOrder[bit]] += UnZigZag(value);
+   }
+
+   return In;
+}
+
+CTraceWriter::CTraceWriter()
+   : mThread(),
+     mMutex(),
+     mSignal(),
+     mKeyframes(),
+     mPrevious{},
+     mBuffers{},
+     mPending(nullptr),
+     mPendingSize(0),
+     mActive(0),
+     mUsed(0),
+     mBytes(0),
+     mInstructions(0),
+     mFd(-1),
+     mQuit(false),
+     mFailed(false)
+{
+}
+
+CTraceWriter::~CTraceWriter()
+{
+   Close();
+}
+
+bool CTraceWriter::Open(const char* Filename)
+{
+   TTraceHeader header = {};
+
+   Close();
+
+   mFd = open(Filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (mFd < 0)
+      return false;
+
+   memcpy(header.Magic, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+   header.Version = TRACE_VERSION;
+   header.KeyframeInterval = KEYFRAME_INTERVAL;
+   header.RegisterCount = REGISTER_COUNT;
+
+   if (write(mFd, &header, sizeof(header)) != sizeof(header))
+   {
+      close(mFd);
+      mFd = -1;
+      return false;
+   }
+
+   mBuffers[0] = new u8[BUFFER_SIZE];
+   mBuffers[1] = new u8[BUFFER_SIZE];
+   mPending = nullptr;
+   mPendingSize = 0;
+   mActive = 0;
+   mUsed = 0;
+   mBytes = 0;
+   mInstructions = 0;
+   mQuit = false;
+   mFailed = false;
+   mKeyframes.clear();
+
+   mThread = std::thread(&CTraceWriter::WriteBuffers, this);
+
+   return true;
+}
+
+void CTraceWriter::Add(const TRegister* Registers)
+{
+   if (mFd < 0)
+      return;
+
+   if (mUsed + MAX_RECORD > BUFFER_SIZE)
+      SwapBuffers();
+
+   u8* out = mBuffers[mActive] + mUsed;
+
+   if (mInstructions % KEYFRAME_INTERVAL == 0)
+   {
+      mKeyframes.push_back(sizeof(TTraceHeader) + mBytes + mUsed);
+      memcpy(out, Registers, sizeof(TRegister));
+      out += sizeof(TRegister);
+   }
+   else
+   {
+      u64 deltas[REGISTER_COUNT];
+      u64 mask = 0;
+
+      for (u32 bit = 0; bit < ArrayCount(TraceRegisterOrder); bit++)
+      {
+         u8 reg = TraceRegisterOrder[bit];
+
+         deltas[bit] = Registers->RegArray[reg] - mPrevious.RegArray[reg];
+         if (deltas[bit])
+            mask |= 1ull << bit;
+      }
+
+      out = PutVarint(out, mask);
+      out = PutVarint(out, ZigZag(Registers->RegArray[REGISTER_RIP] - mPrevious.RegArray[REGISTER_RIP]));
+
+      for (u32 bit = 0; mask; bit++, mask >>= 1)
+      {
+         if (mask & 1)
+            out = PutVarint(out, ZigZag(deltas[bit]));
+      }
+   }
+
+   mUsed = out - mBuffers[mActive];
+   mPrevious = *Registers;
+   mInstructions++;
+}
+
+bool CTraceWriter::Close()
+{
+   TTraceFooter footer = {};
+   bool         result;
+
+   if (mFd < 0)
+      return false;
+
+   SwapBuffers();
+
+   mMutex.lock();
+   mQuit = true;
+   mMutex.unlock();
+   mSignal.notify_all();
+   mThread.join();
+
+   footer.Instructions = mInstructions;
+   footer.Keyframes = mKeyframes.size();
+   footer.IndexOffset = sizeof(TTraceHeader) + mBytes;
+   memcpy(footer.Magic, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+
+   ssize_t index_size = mKeyframes.size() * sizeof(u64);
+
+   result = !mFailed && write(mFd, mKeyframes.data(), index_size) == index_size &&
+            write(mFd, &footer, sizeof(footer)) == sizeof(footer);
+
+   close(mFd);
+   mFd = -1;
+
+   delete [] mBuffers[0];
+   delete [] mBuffers[1];
+   mBuffers[0] = nullptr;
+   mBuffers[1] = nullptr;
+
+   return result;
+}
+
+void CTraceWriter::SwapBuffers()
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+
+   // the writer thread still has the other buffer, only happens when the disk is slower
+   // than the target
+   mSignal.wait(lock, [this] { return mPendingSize == 0; });
+
+   if (mUsed == 0)
+      return;
+
+   mPending = mBuffers[mActive];
+   mPendingSize = mUsed;
+   mBytes += mUsed;
+   mActive ^= 1;
+   mUsed = 0;
+
+   lock.unlock();
+   mSignal.notify_all();
+}
+
+void CTraceWriter::WriteBuffers()
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+
+   for (;;)
+   {
+      mSignal.wait(lock, [this] { return mPendingSize != 0 || mQuit; });
+
+      if (mPendingSize == 0)
+         break;
+
+      const u8* data = mPending;
+      u32       size = mPendingSize;
+
+      lock.unlock();
+
+      while (size)
+      {
+         ssize_t written = write(mFd, data, size);
+
+         if (written <= 0)
+         {
+            mFailed = true;
+            break;
+         }
+
+         data += written;
+         size -= written;
+      }
+
+      lock.lock();
+      mPendingSize = 0;
+      mSignal.notify_all();
+   }
+}
+
+CTraceReader::CTraceReader()
+   : mData(nullptr),
+     mSize(0),
+     mEnd(0),
+     mInstructions(0),
+     mKeyframeInterval(0),
+     mKeyframes(),
+     mCurrent{},
+     mIndex(0),
+     mPosition(0)
+{
+}
+
+CTraceReader::~CTraceReader()
+{
+   Close();
+}
+
+bool CTraceReader::Open(const char* Filename)
+{
+   struct stat  info;
+   TTraceHeader header;
+
+   Close();
+
+   int fd = open(Filename, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return false;
+
+   if (fstat(fd, &info) < 0 || (u64)info.st_size < sizeof(TTraceHeader))
+   {
+      close(fd);
+      return false;
+   }
+
+   void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (data == MAP_FAILED)
+      return false;
+
+   mData = (const u8*)data;
+   mSize = info.st_size;
+
+   memcpy(&header, mData, sizeof(header));
+   if (memcmp(header.Magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0 || header.Version != TRACE_VERSION ||
+       header.RegisterCount != REGISTER_COUNT || header.KeyframeInterval == 0)
+   {
+      Close();
+      return false;
+   }
+
+   mKeyframeInterval = header.KeyframeInterval;
+
+   if (ReadIndex())
+      return true;
+
+   // the recording never got closed or its index is broken, everything up to the last whole
+   // record is usable
+   if (!BuildIndex(mSize))
+   {
+      Close();
+      return false;
+   }
+
+   return true;
+}
+
+void CTraceReader::Close()
+{
+   if (mData)
+      munmap((void*)mData, mSize);
+
+   mData = nullptr;
+   mSize = 0;
+   mEnd = 0;
+   mInstructions = 0;
+   mKeyframes.clear();
+   mIndex = 0;
+   mPosition = 0;
+}
+
+// the index of a closed recording, only used when every keyframe it points at lies within the
+// records
+bool CTraceReader::ReadIndex()
+{
+   TTraceFooter footer;
+
+   if (mSize < sizeof(TTraceHeader) + sizeof(TTraceFooter))
+      return false;
+
+   memcpy(&footer, mData + mSize - sizeof(footer), sizeof(footer));
+
+   if (memcmp(footer.Magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0 || footer.IndexOffset < sizeof(TTraceHeader) ||
+       footer.IndexOffset > mSize || footer.Keyframes > (mSize - footer.IndexOffset) / sizeof(u64) ||
+       footer.IndexOffset + footer.Keyframes * sizeof(u64) + sizeof(footer) != mSize)
+      return false;
+
+   // one keyframe starts every interval, Seek() indexes them by instruction
+   if (footer.Keyframes != (footer.Instructions + mKeyframeInterval - 1) / mKeyframeInterval ||
+       footer.Instructions > footer.Keyframes * mKeyframeInterval)
+      return false;
+
+   // a corrupt offset may not be aligned
+   mKeyframes.resize(footer.Keyframes);
+   memcpy(mKeyframes.data(), mData + footer.IndexOffset, footer.Keyframes * sizeof(u64));
+
+   for (size_t i = 0; i < mKeyframes.size(); i++)
+   {
+      if (mKeyframes[i] < sizeof(TTraceHeader) || mKeyframes[i] > footer.IndexOffset ||
+          footer.IndexOffset - mKeyframes[i] < sizeof(TRegister))
+      {
+         mKeyframes.clear();
+         return false;
+      }
+   }
+
+   mInstructions = footer.Instructions;
+   mEnd = footer.IndexOffset;
+
+   return true;
+}
+
+bool CTraceReader::BuildIndex(u64 End)
+{
+   const u8* in = mData + sizeof(TTraceHeader);
+   const u8* end = mData + End;
+   TRegister registers = {};
+
+   mKeyframes.clear();
+   mInstructions = 0;
+
+   for (;;)
+   {
+      const u8* next;
+
+      if (mInstructions % mKeyframeInterval == 0)
+      {
+         next = (end - in >= (s64)sizeof(TRegister)) ? in + sizeof(TRegister) : nullptr;
+         if (next)
+            mKeyframes.push_back(in - mData);
+      }
+      else
+         next = DecodeDelta(in, end, &registers);
+
+      if (!next)
+         break;
+
+      in = next;
+      mInstructions++;
+   }
+
+   mEnd = in - mData;
+
+   return mInstructions > 0;
+}
+
+bool CTraceReader::Seek(u64 Index, TRegister* Registers)
+{
+   if (!mData || Index >= mInstructions)
+      return false;
+
+   // keep decoding forward when the instruction is ahead of us in the same keyframe
+   if (mPosition == 0 || Index < mIndex || Index / mKeyframeInterval != mIndex / mKeyframeInterval)
+   {
+      u64 keyframe = Index / mKeyframeInterval;
+
+      memcpy(&mCurrent, mData + mKeyframes[keyframe], sizeof(TRegister));
+      mIndex = keyframe * mKeyframeInterval;
+      mPosition = mKeyframes[keyframe] + sizeof(TRegister);
+   }
+
+   while (mIndex < Index)
+   {
+      const u8* next = DecodeDelta(mData + mPosition, mData + mEnd, &mCurrent);
+
+      if (!next)
+      {
+         mPosition = 0;
+         return false;
+      }
+
+      mPosition = next - mData;
+      mIndex++;
+   }
+
+   *Registers = mCurrent;
+
+   return true;
+}
+
+bool CTraceReader::Next(TRegister* Registers)
+{
+   if (mPosition == 0)
+      return Seek(0, Registers);
+
+   return Seek(mIndex + 1, Registers);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "DebugTypes.h"
+
+// Instruction trace file, one record per executed instruction:
+//
+//   TTraceHeader
+//   record 0, 1, 2, ...
+//   keyframe index, one u64 file offset per keyframe
+//   TTraceFooter
+//
+// Record N is a keyframe (the whole TRegister) when N is a multiple of KeyframeInterval, every
+// other record is a delta against the one before it: a varint bitmask of the registers that
+// changed, the rip difference, then the difference of each changed register, all as zigzag
+// varints. Straight line code comes out at 3 to 6 bytes per instruction. The index and footer
+// are only written when the recording is closed, a reader rebuilds the index from the
+// keyframes when they are missing.
+
+#define TRACE_MAGIC      "DBGTRACE"
+#define TRACE_MAGIC_SIZE 8
+
+const u32 TRACE_VERSION = 1;
+
+struct TTraceHeader
+{
+   char Magic[TRACE_MAGIC_SIZE];
+   u32  Version;
+   u32  KeyframeInterval;
+   u32  RegisterCount; // REGISTER_COUNT of the recorder
+   u32  Reserved;
+};
+
+struct TTraceFooter
+{
+   u64  Instructions;
+   u64  Keyframes;
+   u64  IndexOffset; // file offset of the keyframe index
+   char Magic[TRACE_MAGIC_SIZE];
+};
+
+// Encodes register snapshots into one of two buffers, a full buffer is handed to a writer
+// thread while the other one is filled, so the stepping loop never waits on the disk unless
+// the disk can't keep up.
+class CTraceWriter
+{
+public:
+
+   static constexpr u32 BUFFER_SIZE = 1024 * 1024;
+   static constexpr u32 KEYFRAME_INTERVAL = 4096;
+   static constexpr u32 MAX_RECORD = 512; // worst case delta record is 4 + 10 * REGISTER_COUNT bytes
+
+   CTraceWriter();
+   ~CTraceWriter();
+
+   bool Open(const char* Filename);
+   void Add(const TRegister* Registers);
+   bool Close();
+
+   u64 GetInstructions() const { return mInstructions; }
+   u64 GetBytes() const { return sizeof(TTraceHeader) + mBytes + mUsed; }
+
+private:
+
+   void SwapBuffers();
+   void WriteBuffers();
+
+   std::thread             mThread;
+   std::mutex              mMutex;
+   std::condition_variable mSignal;
+   std::vector<u64>        mKeyframes;
+   TRegister               mPrevious;
+   u8*                     mBuffers[2];
+   u8*                     mPending;
+   u32                     mPendingSize;
+   u32                     mActive;
+   u32                     mUsed;
+   u64                     mBytes;        // bytes handed to the writer thread, header not included
+   u64                     mInstructions;
+   int                     mFd;
+   bool                    mQuit;
+   bool                    mFailed;
+};
+
+// Random access to a trace file. The file is mapped, seeking goes to the keyframe at or
+// before the instruction and decodes forward from there, so it costs at most
+// KeyframeInterval - 1 delta records.
+class CTraceReader
+{
+public:
+
+   CTraceReader();
+   ~CTraceReader();
+
+   bool Open(const char* Filename);
+   void Close();
+
+   bool IsOpen() const { return mData != nullptr; }
+   u64 GetInstructions() const { return mInstructions; }
+
+   // registers as they were before instruction Index executed
+   bool Seek(u64 Index, TRegister* Registers);
+   bool Next(TRegister* Registers);
+
+private:
+
+   bool ReadIndex();
+   bool BuildIndex(u64 End);
+
+   const u8*        mData;
+   u64              mSize;
+   u64              mEnd;      // end of the records
+   u64              mInstructions;
+   u32              mKeyframeInterval;
+   std::vector<u64> mKeyframes;
+   TRegister        mCurrent;
+   u64              mIndex;    // instruction mCurrent belongs to
+   u64              mPosition; // next record
+};
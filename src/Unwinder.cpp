@@ -0,0 +1,719 @@
+#include <string.h>
+#include <algorithm>
+#include "Unwinder.h"
+
+CUnwinder::CUnwinder()
+   : mElf(nullptr),
+     mLoadBias(0),
+     mIndexBuilt(false),
+     mDebugFrame(false),
+     mFrameSection(nullptr),
+     mFdes(),
+     mRules(),
+     mReadMemory(nullptr),
+     mReadContext(nullptr),
+     mStackBase(0),
+     mStackSize(0)
+{
+}
+
+CUnwinder::~CUnwinder()
+{
+}
+
+void CUnwinder::Initialize(CElfFile* Elf, u64 LoadBias)
+{
+   // rules are kept in link-time addresses, so a new load bias doesn't invalidate them
+   if (Elf != mElf)
+      Reset();
+
+   mElf = Elf;
+   mLoadBias = LoadBias;
+}
+
+void CUnwinder::Reset()
+{
+   mIndexBuilt = false;
+   mDebugFrame = false;
+   mFrameSection = nullptr;
+   mFdes.clear();
+   mRules.clear();
+   mStackSize = 0;
+}
+
+void CUnwinder::SetMemoryReader(TReadMemoryFunc Func, void* Context)
+{
+   mReadMemory = Func;
+   mReadContext = Context;
+}
+
+int CUnwinder::Unwind(const TRegister* Registers, TFrame* Frames, int MaxFrames)
+{
+   u64  regs[DWARF_REG_COUNT];
+   u32  valid = (1 << DWARF_REG_COUNT) - 1;
+   bool signal_frame = false;
+   int  count = 0;
+
+   for (int i = 0; i < DWARF_REG_COUNT; i++)
+      regs[i] = Registers->RegArray[DwarfToRegister[i]];
+
+   // the target has run since the last unwind, nothing in the window can be trusted
+   mStackSize = 0;
+
+   while (count < MaxFrames)
+   {
+      TFrame* frame = &Frames[count++];
+
+      frame->Pc = regs[DWARF_REG_RA];
+      frame->Sp = regs[DWARF_REG_RSP];
+
+      if (!StepFrame(regs, &valid, (count == 1) || signal_frame, frame, &signal_frame))
+         break;
+   }
+
+   return count;
+}
+
+int CUnwinder::UnwindFramePointer(const TRegister* Registers, TFrame* Frames, int MaxFrames)
+{
+   u64  regs[DWARF_REG_COUNT];
+   u32  valid = (1 << DWARF_REG_COUNT) - 1;
+   bool signal_frame = false;
+   int  count = 0;
+
+   for (int i = 0; i < DWARF_REG_COUNT; i++)
+      regs[i] = Registers->RegArray[DwarfToRegister[i]];
+
+   mStackSize = 0;
+
+   while (count < MaxFrames)
+   {
+      TFrame* frame = &Frames[count++];
+      u64     fp = regs[DWARF_REG_RBP];
+      u64     saved_fp;
+      u64     return_address;
+
+      frame->Pc = regs[DWARF_REG_RA];
+      frame->Sp = regs[DWARF_REG_RSP];
+      frame->Cfa = 0;
+
+      // The innermost frame can be stopped anywhere, including in a prologue before rbp
+      // is pushed, so only trust the chain there when there is no CFI to say otherwise.
+      // Every other frame is stopped at a call, where the frame is fully set up.
+      bool chain_valid = (count > 1 || !FindRule(frame->Pc, nullptr)) && !signal_frame;
+
+      chain_valid = chain_valid && (valid & (1 << DWARF_REG_RBP)) && (fp & 7) == 0 && fp >= frame->Sp &&
+                    ReadStack(fp, &saved_fp) && ReadStack(fp + 8, &return_address) && IsCode(return_address) &&
+                    (saved_fp == 0 || saved_fp > fp);
+
+      if (chain_valid)
+      {
+         frame->Cfa = fp + 16;
+         frame->Type = FRAME_TYPE_FRAME_POINTER;
+
+         // only rbp, rsp and the return address are known past this point
+         regs[DWARF_REG_RBP] = saved_fp;
+         regs[DWARF_REG_RSP] = fp + 16;
+         regs[DWARF_REG_RA] = return_address;
+         valid = (1 << DWARF_REG_RBP) | (1 << DWARF_REG_RSP) | (1 << DWARF_REG_RA);
+
+         if (saved_fp == 0)
+         {
+            // the outermost frame clears rbp, so its caller is the last frame
+            if (count < MaxFrames)
+            {
+               Frames[count].Pc = return_address;
+               Frames[count].Sp = fp + 16;
+               Frames[count].Cfa = 0;
+               Frames[count].Type = FRAME_TYPE_LAST;
+               count++;
+            }
+            break;
+         }
+
+         signal_frame = false;
+      }
+      else if (!StepFrame(regs, &valid, (count == 1) || signal_frame, frame, &signal_frame) || !IsCode(regs[DWARF_REG_RA]))
+      {
+         break;
+      }
+   }
+
+   return count;
+}
+
+bool CUnwinder::IsCode(u64 Address) const
+{
+   // without any ranges there is nothing to check against
+   if (mCodeRanges.size() == 0)
+      return Address != 0;
+
+   auto range = std::upper_bound(mCodeRanges.begin(), mCodeRanges.end(), Address, [](u64 Value, const TCodeRange& Range) { return Value < Range.Start; });
+
+   if (range == mCodeRanges.begin())
+      return false;
+
+   --range;
+
+   return Address < range->End;
+}
+
+bool CUnwinder::StepFrame(u64* Registers, u32* Valid, bool SignalFrame, TFrame* Frame, bool* CallerSignalFrame)
+{
+   TUnwindRule rule;
+   u64         pc = Registers[DWARF_REG_RA];
+
+   Frame->Cfa = 0;
+   Frame->Type = FRAME_TYPE_LAST;
+
+   // a return address points after the call, which may be past the end of the caller's FDE
+   u64 lookup_pc = SignalFrame ? pc : pc - 1;
+
+   if (!FindRule(lookup_pc, &rule) || rule.CfaRegister >= DWARF_REG_COUNT || !(*Valid & (1 << rule.CfaRegister)))
+      return false;
+
+   u64 cfa = Registers[rule.CfaRegister] + rule.CfaOffset;
+   u64 caller[DWARF_REG_COUNT];
+   u32 caller_valid = 0;
+
+   for (int i = 0; i < DWARF_REG_COUNT; i++)
+   {
+      const TUnwindRegisterRule* reg = &rule.Registers[i];
+
+      switch (reg->Type)
+      {
+         case UNWIND_RULE_SAME_VALUE:
+            caller[i] = Registers[i];
+            caller_valid |= (*Valid & (1 << i));
+            break;
+         case UNWIND_RULE_OFFSET:
+            if (ReadStack(cfa + reg->Offset, &caller[i]))
+               caller_valid |= (1 << i);
+            break;
+         case UNWIND_RULE_VAL_OFFSET:
+            caller[i] = cfa + reg->Offset;
+            caller_valid |= (1 << i);
+            break;
+         case UNWIND_RULE_REGISTER:
+            if (reg->Register < DWARF_REG_COUNT)
+            {
+               caller[i] = Registers[reg->Register];
+               caller_valid |= (*Valid & (1 << reg->Register));
+            }
+            break;
+         default:
+            break;
+      }
+   }
+
+   // the caller's stack pointer is the CFA by definition
+   caller[DWARF_REG_RSP] = cfa;
+   caller_valid |= (1 << DWARF_REG_RSP);
+
+   if (!(caller_valid & (1 << DWARF_REG_RA)) || caller[DWARF_REG_RA] == 0)
+      return false;
+
+   // the stack has to move towards the base, otherwise we are going around in circles
+   if (!rule.SignalFrame && cfa <= Registers[DWARF_REG_RSP])
+      return false;
+
+   Frame->Cfa = cfa;
+   Frame->Type = FRAME_TYPE_CFI;
+
+   memcpy(Registers, caller, sizeof(caller));
+   *Valid = caller_valid;
+   *CallerSignalFrame = rule.SignalFrame;
+
+   return true;
+}
+
+bool CUnwinder::FindRule(u64 Pc, TUnwindRule* Rule)
+{
+   u64 pc = Pc - mLoadBias;
+
+   if (!mElf)
+      return false;
+
+   // rows that were already compiled
+   auto it = mRules.upper_bound(pc);
+   if (it != mRules.begin())
+   {
+      --it;
+      if (pc >= it->second.Start && pc < it->second.End)
+      {
+         if (Rule)
+            *Rule = it->second;
+         return true;
+      }
+   }
+
+   if (!mIndexBuilt)
+      BuildIndex();
+
+   auto fde = std::upper_bound(mFdes.begin(), mFdes.end(), pc, [](u64 Value, const TFdeEntry& Entry) { return Value < Entry.Start; });
+
+   if (fde == mFdes.begin())
+      return false;
+
+   --fde;
+
+   TUnwindRule rule;
+
+   if (pc >= fde->End || !CompileRule(&(*fde), pc, &rule))
+      return false;
+
+   mRules[rule.Start] = rule;
+
+   if (Rule)
+      *Rule = rule;
+
+   return true;
+}
+
+void CUnwinder::BuildIndex()
+{
+   mIndexBuilt = true;
+
+   mFrameSection = mElf->FindSection(".eh_frame");
+   mDebugFrame = false;
+
+   if (!mFrameSection || mFrameSection->Size == 0 || mFrameSection->Type == ELF_SECTION_TYPE_NOBITS)
+   {
+      mFrameSection = mElf->FindSection(".debug_frame");
+      mDebugFrame = true;
+   }
+
+   TBuffer section = mElf->GetSection(mFrameSection);
+
+   if (!section.Data)
+      return;
+
+   TDwarfReader reader(section.Data, section.Data + section.Size);
+
+   while (!reader.AtEnd())
+   {
+      u64 offset = reader.Data - section.Data;
+      u64 length = reader.ReadU32();
+      u32 id_size = 4;
+
+      if (length == 0)
+      {
+         // .eh_frame is terminated by a zero length entry
+         if (!mDebugFrame)
+            break;
+         continue;
+      }
+
+      if (length == 0xffffffff)
+      {
+         length = reader.ReadU64();
+         id_size = 8;
+      }
+
+      if (reader.Overrun || length > reader.Remaining())
+         break;
+
+      const u8*    record_end = reader.Data + length;
+      const u8*    id_position = reader.Data;
+      TDwarfReader record(reader.Data, record_end);
+      u64          id = (id_size == 4) ? record.ReadU32() : record.ReadU64();
+      bool         is_cie = mDebugFrame ? (id == ((id_size == 4) ? 0xffffffff : 0xffffffffffffffff)) : (id == 0);
+
+      reader.Data = record_end;
+
+      if (is_cie)
+         continue;
+
+      u64      cie_offset = mDebugFrame ? id : (id_position - section.Data) - id;
+      TCieInfo cie;
+
+      if (!ParseCie(section.Data, section.Size, cie_offset, &cie))
+         continue;
+
+      TFdeEntry entry;
+      entry.Start = ReadEncodedPointer(record, cie.PointerEncoding, mFrameSection->Address, section.Data);
+      entry.End = entry.Start + ReadEncodedPointer(record, cie.PointerEncoding & 0x0f, mFrameSection->Address, section.Data);
+      entry.Offset = offset;
+
+      if (!record.Overrun && entry.End > entry.Start)
+         mFdes.push_back(entry);
+   }
+
+   std::sort(mFdes.begin(), mFdes.end(), [](const TFdeEntry& A, const TFdeEntry& B) { return A.Start < B.Start; });
+}
+
+bool CUnwinder::ParseCie(const u8* Section, u64 Size, u64 Offset, TCieInfo* Cie)
+{
+   if (Offset >= Size)
+      return false;
+
+   TDwarfReader reader(&Section[Offset], &Section[Size]);
+   u64          length = reader.ReadU32();
+   u32          id_size = 4;
+
+   if (length == 0xffffffff)
+   {
+      length = reader.ReadU64();
+      id_size = 8;
+   }
+
+   if (reader.Overrun || length > reader.Remaining())
+      return false;
+
+   reader.End = reader.Data + length;
+   reader.Skip(id_size);
+
+   u8          version = reader.ReadU8();
+   const char* augmentation = reader.ReadString();
+
+   if (version >= 4)
+   {
+      // address_size and segment_selector_size, only present in .debug_frame v4+
+      reader.Skip(2);
+   }
+
+   Cie->CodeAlign = reader.ReadULEB128();
+   Cie->DataAlign = reader.ReadSLEB128();
+   Cie->ReturnRegister = (version == 1) ? reader.ReadU8() : reader.ReadULEB128();
+   Cie->PointerEncoding = mDebugFrame ? DW_EH_PE_udata8 : DW_EH_PE_absptr;
+   Cie->SignalFrame = false;
+   Cie->HasAugmentationData = (augmentation[0] == 'z');
+
+   if (augmentation[0] == 'z')
+   {
+      u64       augmentation_length = reader.ReadULEB128();
+      const u8* augmentation_end = reader.Data + augmentation_length;
+
+      for (const char* c = &augmentation[1]; *c && !reader.Overrun; c++)
+      {
+         switch (*c)
+         {
+            case 'R':
+               Cie->PointerEncoding = reader.ReadU8();
+               break;
+            case 'P':
+            {
+               // personality routine, not needed for unwinding
+               u8 encoding = reader.ReadU8();
+               ReadEncodedPointer(reader, encoding & ~DW_EH_PE_indirect, 0, Section);
+               break;
+            }
+            case 'L':
+               reader.ReadU8();
+               break;
+            case 'S':
+               Cie->SignalFrame = true;
+               break;
+            default:
+               break;
+         }
+      }
+
+      reader.Data = augmentation_end;
+   }
+   else if (augmentation[0] != 0)
+   {
+      // without a 'z' there is no way to skip an augmentation we don't understand
+      return false;
+   }
+
+   Cie->Instructions = reader.Data;
+   Cie->InstructionsEnd = reader.End;
+
+   return !reader.Overrun && reader.Data <= reader.End;
+}
+
+u64 CUnwinder::ReadEncodedPointer(TDwarfReader& Reader, u8 Encoding, u64 SectionAddress, const u8* Section)
+{
+   u64 position = SectionAddress + (Reader.Data - Section);
+   u64 result = 0;
+
+   if (Encoding == DW_EH_PE_omit)
+      return 0;
+
+   switch (Encoding & 0x0f)
+   {
+      case DW_EH_PE_absptr:  result = Reader.ReadU64(); break;
+      case DW_EH_PE_uleb128: result = Reader.ReadULEB128(); break;
+      case DW_EH_PE_udata2:  result = Reader.ReadU16(); break;
+      case DW_EH_PE_udata4:  result = Reader.ReadU32(); break;
+      case DW_EH_PE_udata8:  result = Reader.ReadU64(); break;
+      case DW_EH_PE_sleb128: result = Reader.ReadSLEB128(); break;
+      case DW_EH_PE_sdata2:  result = (s16)Reader.ReadU16(); break;
+      case DW_EH_PE_sdata4:  result = (s32)Reader.ReadU32(); break;
+      case DW_EH_PE_sdata8:  result = Reader.ReadU64(); break;
+      default:
+         Reader.Overrun = true;
+         return 0;
+   }
+
+   // only pc relative pointers show up in practice for .eh_frame on x86_64
+   if ((Encoding & 0x70) == DW_EH_PE_pcrel)
+      result += position;
+
+   return result;
+}
+
+bool CUnwinder::CompileRule(const TFdeEntry* Fde, u64 Pc, TUnwindRule* Rule)
+{
+   TBuffer section = mElf->GetSection(mFrameSection);
+
+   if (!section.Data)
+      return false;
+
+   TDwarfReader reader(&section.Data[Fde->Offset], section.Data + section.Size);
+   u64          length = reader.ReadU32();
+   u32          id_size = 4;
+
+   if (length == 0xffffffff)
+   {
+      length = reader.ReadU64();
+      id_size = 8;
+   }
+
+   if (reader.Overrun || length > reader.Remaining())
+      return false;
+
+   reader.End = reader.Data + length;
+
+   const u8* id_position = reader.Data;
+   u64       id = (id_size == 4) ? reader.ReadU32() : reader.ReadU64();
+   u64       cie_offset = mDebugFrame ? id : (id_position - section.Data) - id;
+   TCieInfo  cie;
+
+   if (!ParseCie(section.Data, section.Size, cie_offset, &cie))
+      return false;
+
+   // skip pc_begin and pc_range, we already have them from the index
+   ReadEncodedPointer(reader, cie.PointerEncoding, mFrameSection->Address, section.Data);
+   ReadEncodedPointer(reader, cie.PointerEncoding & 0x0f, mFrameSection->Address, section.Data);
+
+   if (cie.HasAugmentationData)
+   {
+      u64 augmentation_length = reader.ReadULEB128();
+      reader.Skip(augmentation_length);
+   }
+
+   if (reader.Overrun)
+      return false;
+
+   // the initial row is the CIE's instructions run before any location advance
+   TUnwindRule  initial = {};
+   TDwarfReader cie_reader(cie.Instructions, cie.InstructionsEnd);
+   u64          location = Fde->Start;
+   u64          row_end = Fde->End;
+
+   initial.CfaRegister = 0xff;
+   initial.SignalFrame = cie.SignalFrame;
+
+   if (!RunInstructions(&cie, section.Data, cie_reader, nullptr, ~0ull, &location, &initial, &row_end))
+      return false;
+
+   *Rule = initial;
+   Rule->Start = Fde->Start;
+   location = Fde->Start;
+   row_end = Fde->End;
+
+   if (!RunInstructions(&cie, section.Data, reader, &initial, Pc, &location, Rule, &row_end))
+      return false;
+
+   Rule->End = row_end;
+
+   return Rule->CfaRegister < DWARF_REG_COUNT;
+}
+
+bool CUnwinder::RunInstructions(const TCieInfo* Cie, const u8* Section, TDwarfReader& Reader, const TUnwindRule* Initial,
+                                u64 Pc, u64* Location, TUnwindRule* Row, u64* RowEnd)
+{
+   std::vector<TUnwindRule> state_stack;
+
+   while (!Reader.AtEnd() && !Reader.Overrun)
+   {
+      u8  opcode = Reader.ReadU8();
+      u8  operand = opcode & 0x3f;
+      u64 advance = 0;
+      u64 reg;
+
+      switch (opcode & 0xc0)
+      {
+         case DW_CFA_advance_loc:
+            advance = operand * Cie->CodeAlign;
+            break;
+         case DW_CFA_offset:
+            if (operand < DWARF_REG_COUNT)
+            {
+               Row->Registers[operand].Type = UNWIND_RULE_OFFSET;
+               Row->Registers[operand].Offset = Reader.ReadULEB128() * Cie->DataAlign;
+            }
+            else
+            {
+               Reader.ReadULEB128();
+            }
+            break;
+         case DW_CFA_restore:
+            if (operand < DWARF_REG_COUNT)
+            {
+               if (Initial)
+                  Row->Registers[operand] = Initial->Registers[operand];
+               else
+                  Row->Registers[operand].Type = UNWIND_RULE_SAME_VALUE;
+            }
+            break;
+         default:
+         {
+            switch (opcode)
+            {
+               case DW_CFA_nop:
+                  break;
+               case DW_CFA_set_loc:
+               {
+                  u64 location = ReadEncodedPointer(Reader, Cie->PointerEncoding, mFrameSection->Address, Section);
+                  if (location > *Location)
+                     advance = location - *Location;
+                  break;
+               }
+               case DW_CFA_advance_loc1:
+                  advance = Reader.ReadU8() * Cie->CodeAlign;
+                  break;
+               case DW_CFA_advance_loc2:
+                  advance = Reader.ReadU16() * Cie->CodeAlign;
+                  break;
+               case DW_CFA_advance_loc4:
+                  advance = Reader.ReadU32() * Cie->CodeAlign;
+                  break;
+               case DW_CFA_offset_extended:
+               case DW_CFA_offset_extended_sf:
+               case DW_CFA_val_offset:
+               case DW_CFA_val_offset_sf:
+               {
+                  reg = Reader.ReadULEB128();
+                  s64 offset = (opcode == DW_CFA_offset_extended || opcode == DW_CFA_val_offset) ?
+                               (s64)Reader.ReadULEB128() : Reader.ReadSLEB128();
+
+                  if (reg < DWARF_REG_COUNT)
+                  {
+                     bool is_val = (opcode == DW_CFA_val_offset || opcode == DW_CFA_val_offset_sf);
+                     Row->Registers[reg].Type = is_val ? UNWIND_RULE_VAL_OFFSET : UNWIND_RULE_OFFSET;
+                     Row->Registers[reg].Offset = offset * Cie->DataAlign;
+                  }
+                  break;
+               }
+               case DW_CFA_restore_extended:
+                  reg = Reader.ReadULEB128();
+                  if (reg < DWARF_REG_COUNT)
+                  {
+                     if (Initial)
+                        Row->Registers[reg] = Initial->Registers[reg];
+                     else
+                        Row->Registers[reg].Type = UNWIND_RULE_SAME_VALUE;
+                  }
+                  break;
+               case DW_CFA_undefined:
+                  reg = Reader.ReadULEB128();
+                  if (reg < DWARF_REG_COUNT)
+                     Row->Registers[reg].Type = UNWIND_RULE_UNDEFINED;
+                  break;
+               case DW_CFA_same_value:
+                  reg = Reader.ReadULEB128();
+                  if (reg < DWARF_REG_COUNT)
+                     Row->Registers[reg].Type = UNWIND_RULE_SAME_VALUE;
+                  break;
+               case DW_CFA_register:
+               {
+                  reg = Reader.ReadULEB128();
+                  u64 other = Reader.ReadULEB128();
+                  if (reg < DWARF_REG_COUNT)
+                  {
+                     Row->Registers[reg].Type = UNWIND_RULE_REGISTER;
+                     Row->Registers[reg].Register = other;
+                  }
+                  break;
+               }
+               case DW_CFA_remember_state:
+                  state_stack.push_back(*Row);
+                  break;
+               case DW_CFA_restore_state:
+                  if (state_stack.size())
+                  {
+                     // the location is not part of the saved state
+                     u64 start = Row->Start;
+                     *Row = state_stack.back();
+                     Row->Start = start;
+                     state_stack.pop_back();
+                  }
+                  break;
+               case DW_CFA_def_cfa:
+                  Row->CfaRegister = Reader.ReadULEB128();
+                  Row->CfaOffset = Reader.ReadULEB128();
+                  break;
+               case DW_CFA_def_cfa_sf:
+                  Row->CfaRegister = Reader.ReadULEB128();
+                  Row->CfaOffset = Reader.ReadSLEB128() * Cie->DataAlign;
+                  break;
+               case DW_CFA_def_cfa_register:
+                  Row->CfaRegister = Reader.ReadULEB128();
+                  break;
+               case DW_CFA_def_cfa_offset:
+                  Row->CfaOffset = Reader.ReadULEB128();
+                  break;
+               case DW_CFA_def_cfa_offset_sf:
+                  Row->CfaOffset = Reader.ReadSLEB128() * Cie->DataAlign;
+                  break;
+               case DW_CFA_def_cfa_expression:
+                  // expressions need a DWARF stack machine, mark the CFA as unusable
+                  Reader.Skip(Reader.ReadULEB128());
+                  Row->CfaRegister = 0xff;
+                  break;
+               case DW_CFA_expression:
+               case DW_CFA_val_expression:
+                  reg = Reader.ReadULEB128();
+                  Reader.Skip(Reader.ReadULEB128());
+                  if (reg < DWARF_REG_COUNT)
+                     Row->Registers[reg].Type = UNWIND_RULE_UNDEFINED;
+                  break;
+               case DW_CFA_GNU_args_size:
+                  Reader.ReadULEB128();
+                  break;
+               default:
+                  // unknown opcode, the operand length is unknown so we can't go on
+                  return false;
+            }
+            break;
+         }
+      }
+
+      if (advance)
+      {
+         if (*Location + advance > Pc)
+         {
+            // the row we have covers Pc, it ends where the next one starts
+            *RowEnd = *Location + advance;
+            return true;
+         }
+
+         *Location += advance;
+         Row->Start = *Location;
+      }
+   }
+
+   return !Reader.Overrun;
+}
+
+bool CUnwinder::ReadStack(u64 Address, u64* Value)
+{
+   if (Address < mStackBase || Address + sizeof(u64) > mStackBase + mStackSize)
+   {
+      if (!mReadMemory)
+         return false;
+
+      // callers are further up the stack, so start the window at the requested slot
+      mStackBase = Address & ~7ull;
+      mStackSize = mReadMemory(mReadContext, mStackBase, mStack, STACK_WINDOW);
+
+      if (Address + sizeof(u64) > mStackBase + mStackSize)
+         return false;
+   }
+
+   memcpy(Value, &mStack[Address - mStackBase], sizeof(u64));
+   return true;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include "DebugTypes.h"
+#include "Dwarf.h"
+#include "ElfFile.h"
+
+// reads Size bytes of target memory at Address into Buffer, returns the number of bytes read
+typedef u64 (*TReadMemoryFunc)(void* Context, u64 Address, void* Buffer, u64 Size);
+
+enum eUnwindRuleType
+{
+   UNWIND_RULE_SAME_VALUE, // register is unchanged (default for registers without a rule)
+   UNWIND_RULE_UNDEFINED,  // register can't be recovered in the caller
+   UNWIND_RULE_OFFSET,     // saved at CFA + Offset
+   UNWIND_RULE_VAL_OFFSET, // value is CFA + Offset
+   UNWIND_RULE_REGISTER    // saved in another register
+};
+
+struct TUnwindRegisterRule
+{
+   u8  Type;     // eUnwindRuleType
+   u8  Register; // DWARF register for UNWIND_RULE_REGISTER
+   s32 Offset;
+};
+
+// One row of the CFI table compiled down to what is needed to step a frame. Start and End
+// are link-time addresses, the row applies to every pc in [Start, End).
+struct TUnwindRule
+{
+   u64                 Start;
+   u64                 End;
+   s32                 CfaOffset;
+   u8                  CfaRegister;
+   bool                SignalFrame;
+   TUnwindRegisterRule Registers[DWARF_REG_COUNT];
+};
+
+enum eFrameType
+{
+   FRAME_TYPE_CFI,           // caller found by interpreting the CFI for this frame
+   FRAME_TYPE_FRAME_POINTER, // caller found by following the saved rbp
+   FRAME_TYPE_LAST           // no way to find a caller
+};
+
+struct TFrame
+{
+   u64 Pc;
+   u64 Sp;
+   u64 Cfa;  // canonical frame address, or 0 when it is not known
+   u8  Type; // eFrameType, how the caller of this frame was found
+};
+
+// a range of executable memory in the target, used to sanity check return addresses
+struct TCodeRange
+{
+   u64 Start;
+   u64 End;
+};
+
+// Stack unwinder driven by the call frame information in .eh_frame (or .debug_frame when
+// there is no .eh_frame). The FDE for a pc is only interpreted the first time that pc
+// range is seen, after that the compiled TUnwindRule comes out of a cache keyed by the
+// row's address range. Stack memory is read through a window of STACK_WINDOW bytes, so
+// frames close to each other share one read of the target instead of one ptrace per slot.
+//
+// UnwindFramePointer() is the fast path for code built with -fno-omit-frame-pointer: it
+// follows the rbp chain through the same stack window, only checking each return address
+// against the code ranges of the target, and drops to CFI just for the frames where the
+// chain is broken.
+class CUnwinder
+{
+public:
+
+   static constexpr u32 STACK_WINDOW = 16 * 1024;
+
+   CUnwinder();
+   ~CUnwinder();
+
+   void Initialize(CElfFile* Elf, u64 LoadBias);
+   void Reset();
+
+   void SetMemoryReader(TReadMemoryFunc Func, void* Context);
+
+   // walks the stack starting from Registers, returns the number of frames written
+   int Unwind(const TRegister* Registers, TFrame* Frames, int MaxFrames);
+   int UnwindFramePointer(const TRegister* Registers, TFrame* Frames, int MaxFrames);
+
+   // sorted, non overlapping executable ranges of the target (runtime addresses)
+   void SetCodeRanges(const std::vector<TCodeRange>& Ranges) { mCodeRanges = Ranges; }
+   bool IsCode(u64 Address) const;
+
+   // Pc is a runtime address, the rule returned uses link-time addresses,
+   // Rule can be null to only check whether there is CFI for Pc
+   bool FindRule(u64 Pc, TUnwindRule* Rule);
+
+   u64 GetCachedRules() const { return mRules.size(); }
+
+private:
+
+   struct TFdeEntry
+   {
+      u64 Start;  // link-time
+      u64 End;
+      u64 Offset; // offset of the FDE in its section
+   };
+
+   struct TCieInfo
+   {
+      u64       CodeAlign;
+      s64       DataAlign;
+      u64       ReturnRegister;
+      u8        PointerEncoding;
+      bool      SignalFrame;
+      bool      HasAugmentationData;
+      const u8* Instructions;
+      const u8* InstructionsEnd;
+   };
+
+   void BuildIndex();
+   bool ParseCie(const u8* Section, u64 Size, u64 Offset, TCieInfo* Cie);
+   u64 ReadEncodedPointer(TDwarfReader& Reader, u8 Encoding, u64 SectionAddress, const u8* Section);
+   bool CompileRule(const TFdeEntry* Fde, u64 Pc, TUnwindRule* Rule);
+   bool RunInstructions(const TCieInfo* Cie, const u8* Section, TDwarfReader& Reader, const TUnwindRule* Initial,
+                        u64 Pc, u64* Location, TUnwindRule* Row, u64* RowEnd);
+
+   bool StepFrame(u64* Registers, u32* Valid, bool SignalFrame, TFrame* Frame, bool* CallerSignalFrame);
+   bool ReadStack(u64 Address, u64* Value);
+
+   CElfFile*                    mElf;
+   u64                          mLoadBias;
+   bool                         mIndexBuilt;
+   bool                         mDebugFrame;   // index was built from .debug_frame
+   const TElfSection*           mFrameSection;
+   std::vector<TFdeEntry>       mFdes;
+   std::map<u64, TUnwindRule>   mRules;        // keyed by Start
+   std::vector<TCodeRange>      mCodeRanges;
+   TReadMemoryFunc              mReadMemory;
+   void*                        mReadContext;
+   u64                          mStackBase;
+   u64                          mStackSize;
+   u8                           mStack[STACK_WINDOW];
+};
@@ -0,0 +1,465 @@
+// Debugger benchmarks: drives the backend through SetCommand the way the frontends do, against
+// the synthetic targets in bench/targets, and writes the results as JSON (to stdout, or to a
+// file when one is given). Every target is built without PIE so symbol addresses from the ELF
+// file can be used as breakpoints directly.
+//
+//    startup          Run to the first processed command, the target stopped at its entry
+//    breakpoint       continue to a breakpoint in a tight loop, round trip per hit
+//    step             single steps and block steps per second
+//    restart          stop the target and run a new instance to the breakpoint
+//    memory           pattern search and snapshot over HEAP_MB of heap
+//    symbols          symbol table load, lookups by address and by name over 65536 functions
+//    profile          sampling profile of 33 spinning threads, samples per second and pause
+//    output           target output received per second from a target flooding stdout
+//
+//    make bench && ./bench/debugger_bench [json file]
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <sys/personality.h>
+#include <errno.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <assert.h>
+
+#include "../DebugTypes.h"
+
+#include "../PrintData.cpp"
+#include "../ElfFile.cpp"
+#include "../Unwinder.cpp"
+#include "../Decoder.cpp"
+#include "../LineTable.cpp"
+#include "../TraceFile.cpp"
+#include "../CoreFile.cpp"
+#include "../AddressSpace.cpp"
+#include "../MemorySearch.cpp"
+#include "../Snapshot.cpp"
+#include "../Profile.cpp"
+#include "../DebugBackend.cpp"
+#include "../DebugUtils.cpp"
+
+const char* TARGET_DIR         = "bench/targets/";
+const int   STARTUP_RUNS       = 5;
+const int   BREAKPOINT_HITS    = 500;
+const u64   SINGLE_STEPS       = 100000;
+const u64   BLOCK_STEPS        = 20000;
+const int   RESTARTS           = 5;
+const u64   HEAP_MB            = 256;   // bench/targets/heap.cpp allocates this much
+const int   ADDRESS_LOOKUPS    = 1000000;
+const int   NAME_LOOKUPS       = 200;
+const u64   PROFILE_MS         = 1000;
+const u64   PROFILE_HZ         = 1000;
+const int   OUTPUT_IDLE_MS     = 500;   // output is done when nothing came in for this long
+const int   OUTPUT_TIMEOUT_MS  = 60000;
+
+typedef std::chrono::steady_clock TClock;
+
+struct TReply
+{
+   std::vector<std::string> Messages;     // info, warning and error streams
+   u64                      OutputLines;  // target output
+   u64                      OutputBytes;
+   TClock::time_point       LastOutput;
+};
+
+static f64 GetMicroseconds(TClock::time_point Start)
+{
+   return std::chrono::duration<f64, std::micro>(TClock::now() - Start).count();
+}
+
+static void Drain(CDebugBackend& Debugger, TReply& Reply)
+{
+   u8* data;
+
+   while ((data = Debugger.PopData()))
+   {
+      TBufferHeader* header = (TBufferHeader*)data;
+      const char*    str = (const char*)&data[sizeof(TBufferHeader)];
+
+      if (header->DataType == DATA_TYPE_STREAM_TARGET_OUTPUT)
+      {
+         Reply.OutputLines++;
+         Reply.OutputBytes += header->Size;
+         Reply.LastOutput = TClock::now();
+      }
+      else if (header->DataType <= DATA_TYPE_STREAM_DEBUG)
+      {
+         Reply.Messages.push_back(std::string(str, header->Size));
+      }
+   }
+}
+
+static void WaitProcessed(CDebugBackend& Debugger, TReply& Reply)
+{
+   // yield rather than sleep, a sleep would end up in every round trip
+   while (Debugger.GetCommand() != DEBUG_CMD_PROCESSED)
+      std::this_thread::yield();
+
+   Drain(Debugger, Reply);
+}
+
+// returns the microseconds from SetCommand to DEBUG_CMD_PROCESSED
+static f64 Send(CDebugBackend& Debugger, const TDebugCommand& Command, TReply* Reply = nullptr)
+{
+   TReply             reply = {};
+   TClock::time_point start = TClock::now();
+
+   Debugger.SetCommand(Command);
+   while (Debugger.GetCommand() != DEBUG_CMD_PROCESSED)
+      std::this_thread::yield();
+
+   f64 us = GetMicroseconds(start);
+
+   Drain(Debugger, Reply ? *Reply : reply);
+   return us;
+}
+
+static f64 Send(CDebugBackend& Debugger, eDebugCommand Type, TReply* Reply = nullptr)
+{
+   TDebugCommand command = {};
+
+   command.Command = Type;
+   return Send(Debugger, command, Reply);
+}
+
+// first message containing Key, empty when there is none
+static const char* FindMessage(const TReply& Reply, const char* Key)
+{
+   for (size_t i = 0; i < Reply.Messages.size(); i++)
+   {
+      const char* found = strstr(Reply.Messages[i].c_str(), Key);
+
+      if (found)
+         return found;
+   }
+
+   return "";
+}
+
+static CDebugBackend* StartBackend(const char* Target, f64* StartupUs)
+{
+   CDebugBackend*     debugger = new CDebugBackend();
+   TReply             reply = {};
+   TClock::time_point start = TClock::now();
+
+   debugger->Run(Target);
+   WaitProcessed(*debugger, reply);
+
+   if (StartupUs)
+      *StartupUs = GetMicroseconds(start);
+   return debugger;
+}
+
+static void StopBackend(CDebugBackend* Debugger)
+{
+   Send(*Debugger, DEBUG_CMD_QUIT);
+   delete Debugger;
+}
+
+static u64 GetSymbolAddress(const char* Target, const char* Name)
+{
+   CElfFile          elf;
+   const TElfSymbol* symbol = elf.Open(Target) ? elf.FindSymbol(Name) : nullptr;
+
+   if (!symbol)
+   {
+      fprintf(stderr, "No symbol %s in %s, run make bench to build the targets\n", Name, Target);
+      exit(1);
+   }
+
+   return symbol->Address;
+}
+
+// runs the target to the first call of Function and leaves the breakpoint there
+static void RunTo(CDebugBackend& Debugger, const char* Target, const char* Function)
+{
+   TDebugCommand command = {};
+
+   command.Command = DEBUG_CMD_SET_BREAKPOINT;
+   command.Data.BpAddr.Address = GetSymbolAddress(Target, Function);
+   Send(Debugger, command);
+   Send(Debugger, DEBUG_CMD_RUN);
+}
+
+struct TSummary
+{
+   f64 Mean;
+   f64 Median;
+   f64 P99;
+   f64 Max;
+};
+
+static TSummary Summarize(std::vector<f64> Values)
+{
+   TSummary result = {};
+
+   if (Values.empty())
+      return result;
+
+   std::sort(Values.begin(), Values.end());
+   for (size_t i = 0; i < Values.size(); i++)
+      result.Mean += Values[i];
+   result.Mean /= Values.size();
+   result.Median = Values[Values.size() / 2];
+   result.P99 = Values[std::min(Values.size() - 1, (size_t)(Values.size() * 0.99))];
+   result.Max = Values.back();
+   return result;
+}
+
+static void PrintSummary(FILE* File, const char* Name, const TSummary& Summary, const char* Separator)
+{
+   fprintf(File, "  \"%s\": {\"mean\": %.1f, \"median\": %.1f, \"p99\": %.1f, \"max\": %.1f}%s\n", Name, Summary.Mean,
+           Summary.Median, Summary.P99, Summary.Max, Separator);
+}
+
+static void BenchLoop(FILE* File)
+{
+   std::string      target = std::string(TARGET_DIR) + "loop";
+   std::vector<f64> startup;
+   CDebugBackend*   debugger = nullptr;
+
+   for (int i = 0; i < STARTUP_RUNS; i++)
+   {
+      f64 us = 0.0;
+
+      if (debugger)
+         StopBackend(debugger);
+      debugger = StartBackend(target.c_str(), &us);
+      startup.push_back(us / 1000.0);
+   }
+   PrintSummary(File, "startup_ms", Summarize(startup), ",");
+
+   // breakpoint round trips
+   std::vector<f64> hits;
+
+   RunTo(*debugger, target.c_str(), "tick");
+   for (int i = 0; i < BREAKPOINT_HITS; i++)
+      hits.push_back(Send(*debugger, DEBUG_CMD_CONTINUE));
+   PrintSummary(File, "breakpoint_roundtrip_us", Summarize(hits), ",");
+
+   // restarts, kill the target and run a new instance to the breakpoint again
+   std::vector<f64> restart;
+
+   for (int i = 0; i < RESTARTS; i++)
+   {
+      f64 us = Send(*debugger, DEBUG_CMD_STOP);
+
+      us += Send(*debugger, DEBUG_CMD_RUN);
+      restart.push_back(us / 1000.0);
+   }
+   PrintSummary(File, "restart_ms", Summarize(restart), ",");
+
+   TDebugCommand command = {};
+
+   command.Command = DEBUG_CMD_DELETE_BREAKPOINT;
+   command.Data.BpIdx.Index = 0;
+   Send(*debugger, command);
+
+   // stepping, the loop never leaves so every step counts
+   command = {};
+   command.Command = DEBUG_CMD_STEP_UNTIL;
+   command.Data.StepUntil.Condition = STEP_UNTIL_COUNT;
+   command.Data.StepUntil.MaxSteps = SINGLE_STEPS;
+   command.Data.StepUntil.Mode = STEP_MODE_INSTRUCTION;
+   f64 single_us = Send(*debugger, command);
+
+   TReply reply = {};
+
+   command.Data.StepUntil.MaxSteps = BLOCK_STEPS;
+   command.Data.StepUntil.Mode = STEP_MODE_BLOCK;
+   f64 block_us = Send(*debugger, command, &reply);
+
+   fprintf(File, "  \"single_steps_per_s\": %.0f,\n", SINGLE_STEPS / single_us * 1e6);
+   if (*FindMessage(reply, "not available"))
+      fprintf(File, "  \"block_steps_per_s\": null,\n");
+   else
+      fprintf(File, "  \"block_steps_per_s\": %.0f,\n", BLOCK_STEPS / block_us * 1e6);
+
+   StopBackend(debugger);
+}
+
+static void BenchMemory(FILE* File)
+{
+   std::string    target = std::string(TARGET_DIR) + "heap";
+   CDebugBackend* debugger = StartBackend(target.c_str(), nullptr);
+   TReply         reply = {};
+   const char*    pattern = "not in the heap!";
+   f64            mb = 0.0;
+
+   RunTo(*debugger, target.c_str(), "tick");
+
+   TDebugCommand command = {};
+
+   command.Command = DEBUG_CMD_FIND;
+   command.Data.Find.Size = strlen(pattern);
+   command.Data.Find.Pattern = new u8[command.Data.Find.Size];
+   command.Data.Find.Alignment = 1;
+   memcpy(command.Data.Find.Pattern, pattern, command.Data.Find.Size);
+
+   f64 find_us = Send(*debugger, command, &reply);
+
+   sscanf(FindMessage(reply, " matches in "), " matches in %lf MB", &mb);
+   fprintf(File, "  \"search_mb\": %.1f,\n", mb);
+   fprintf(File, "  \"search_mb_per_s\": %.0f,\n", mb / find_us * 1e6);
+
+   reply = {};
+   mb = 0.0;
+   f64 snapshot_us = Send(*debugger, DEBUG_CMD_SNAPSHOT, &reply);
+
+   sscanf(FindMessage(reply, "Snapshot of "), "Snapshot of %lf MB", &mb);
+   fprintf(File, "  \"snapshot_mb\": %.1f,\n", mb);
+   fprintf(File, "  \"snapshot_mb_per_s\": %.0f,\n", mb / snapshot_us * 1e6);
+
+   StopBackend(debugger);
+}
+
+static void BenchSymbols(FILE* File)
+{
+   std::string        target = std::string(TARGET_DIR) + "symbols";
+   CElfFile           elf;
+   TClock::time_point start = TClock::now();
+
+   if (!elf.Open(target.c_str()))
+   {
+      fprintf(stderr, "Couldn't read %s\n", target.c_str());
+      exit(1);
+   }
+
+   // the first lookup loads the table
+   const TElfSymbol*  first = elf.FindSymbol("f0000");
+   const TElfSymbol*  last = elf.FindSymbol("fffff");
+   f64                load_us = GetMicroseconds(start);
+
+   if (!first || !last)
+   {
+      fprintf(stderr, "No f0000 and fffff in %s\n", target.c_str());
+      exit(1);
+   }
+
+   std::mt19937_64 random(1);
+   u64             low = std::min(first->Address, last->Address);
+   u64             high = std::max(first->Address, last->Address);
+   u64             found = 0;
+
+   start = TClock::now();
+   for (int i = 0; i < ADDRESS_LOOKUPS; i++)
+      found += elf.FindSymbol(low + random() % (high - low)) != nullptr;
+   f64 address_us = GetMicroseconds(start);
+
+   char name[16];
+
+   start = TClock::now();
+   for (int i = 0; i < NAME_LOOKUPS; i++)
+   {
+      sprintf(name, "f%04lx", (u64)(random() % 0x10000));
+      found += elf.FindSymbol(name) != nullptr;
+   }
+   f64 name_us = GetMicroseconds(start);
+
+   fprintf(File, "  \"symbol_load_ms\": %.2f,\n", load_us / 1000.0);
+   fprintf(File, "  \"symbol_address_lookups_per_s\": %.0f,\n", ADDRESS_LOOKUPS / address_us * 1e6);
+   fprintf(File, "  \"symbol_name_lookups_per_s\": %.0f,\n", NAME_LOOKUPS / name_us * 1e6);
+   fprintf(File, "  \"symbol_lookups_found\": %lu,\n", found);
+
+   // and the whole startup with that table
+   f64 startup_us = 0.0;
+
+   StopBackend(StartBackend(target.c_str(), &startup_us));
+   fprintf(File, "  \"symbols_startup_ms\": %.2f,\n", startup_us / 1000.0);
+}
+
+static void BenchProfile(FILE* File)
+{
+   std::string    target = std::string(TARGET_DIR) + "threads";
+   CDebugBackend* debugger = StartBackend(target.c_str(), nullptr);
+   TReply         reply = {};
+   u64            samples = 0;
+   u64            threads = 0;
+   f64            seconds = 0.0;
+   f64            mean = 0.0;
+   f64            median = 0.0;
+   f64            p99 = 0.0;
+   f64            max = 0.0;
+
+   // ready is called once every thread has been created
+   RunTo(*debugger, target.c_str(), "ready");
+
+   TDebugCommand command = {};
+
+   command.Command = DEBUG_CMD_PROFILE;
+   command.Data.Profile.Milliseconds = PROFILE_MS;
+   command.Data.Profile.Hz = PROFILE_HZ;
+   Send(*debugger, command, &reply);
+
+   sscanf(FindMessage(reply, "Profile: "), "Profile: %lu samples of %lu threads in %lf s", &samples, &threads, &seconds);
+   sscanf(FindMessage(reply, "Pause per sample: "), "Pause per sample: mean %lf us, median %lf us, 99th percentile %lf us, max %lf us",
+          &mean, &median, &p99, &max);
+
+   fprintf(File, "  \"profile_threads\": %lu,\n", threads);
+   fprintf(File, "  \"profile_samples_per_s\": %.0f,\n", seconds > 0.0 ? samples / seconds : 0.0);
+   fprintf(File, "  \"profile_pause_us\": {\"mean\": %.1f, \"median\": %.1f, \"p99\": %.1f, \"max\": %.1f},\n", mean, median, p99, max);
+
+   StopBackend(debugger);
+}
+
+static void BenchOutput(FILE* File)
+{
+   std::string    target = std::string(TARGET_DIR) + "flood";
+   CDebugBackend* debugger = StartBackend(target.c_str(), nullptr);
+   TReply         reply = {};
+
+   // the breakpoint is reached once all the output has been written
+   RunTo(*debugger, target.c_str(), "tick");
+
+   TClock::time_point start = TClock::now();
+
+   reply.LastOutput = start;
+   while (GetMicroseconds(reply.LastOutput) < OUTPUT_IDLE_MS * 1000.0 && GetMicroseconds(start) < OUTPUT_TIMEOUT_MS * 1000.0)
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      Drain(*debugger, reply);
+   }
+
+   f64 us = std::chrono::duration<f64, std::micro>(reply.LastOutput - start).count();
+
+   fprintf(File, "  \"output_lines\": %lu,\n", reply.OutputLines);
+   fprintf(File, "  \"output_bytes\": %lu,\n", reply.OutputBytes);
+   fprintf(File, "  \"output_kb_per_s\": %.0f\n", us > 0.0 ? reply.OutputBytes / 1024.0 / us * 1e6 : 0.0);
+
+   StopBackend(debugger);
+}
+
+int main(int argc, char** argv)
+{
+   FILE* file = (argc > 1) ? fopen(argv[1], "w") : stdout;
+
+   if (!file)
+   {
+      fprintf(stderr, "Couldn't write %s\n", argv[1]);
+      return 1;
+   }
+
+   fprintf(file, "{\n");
+   BenchLoop(file);
+   BenchMemory(file);
+   BenchSymbols(file);
+   BenchProfile(file);
+   BenchOutput(file);
+   fprintf(file, "}\n");
+
+   if (file != stdout)
+      fclose(file);
+   return 0;
+}
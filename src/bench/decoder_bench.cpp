@@ -0,0 +1,76 @@
+// Decoder throughput: decodes the .text section of an executable (this one by default)
+// until at least MIN_BYTES have gone through, then reports the rate.
+//
+//    make bench_decoder && ./bench/decoder_bench [executable]
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "../DebugTypes.h"
+#include "../ElfFile.cpp"
+#include "../Decoder.cpp"
+
+const u64 MIN_BYTES = 1024 * 1024;
+const int PASSES    = 20;
+
+int main(int argc, char** argv)
+{
+   const char* filename = (argc > 1) ? argv[1] : "/proc/self/exe";
+   CElfFile    elf;
+
+   if (!elf.Open(filename))
+   {
+      printf("Couldn't read %s\n", filename);
+      return 1;
+   }
+
+   const TElfSection* text = elf.FindSection(".text");
+   TBuffer            code = text ? elf.GetSection(text) : TBuffer{};
+
+   if (!code.Data || code.Size == 0)
+   {
+      printf("No .text section in %s\n", filename);
+      return 1;
+   }
+
+   // keep a copy, section pointers are only valid until the next CElfFile call
+   std::vector<u8> buffer(code.Data, code.Data + code.Size);
+   f64             best_us = 0.0;
+   u64             bytes = 0;
+   u64             instructions = 0;
+   u64             invalid = 0;
+
+   for (int pass = 0; pass < PASSES; pass++)
+   {
+      TInstruction inst;
+
+      bytes = 0;
+      instructions = 0;
+      invalid = 0;
+
+      auto start = std::chrono::steady_clock::now();
+      while (bytes < MIN_BYTES)
+      {
+         for (u64 offset = 0; offset < buffer.size(); offset += inst.Length)
+         {
+            if (!CDecoder::Decode(&buffer[offset], buffer.size() - offset, text->Address + offset, &inst))
+               invalid++;
+            instructions++;
+         }
+         bytes += buffer.size();
+      }
+      auto end = std::chrono::steady_clock::now();
+
+      f64 elapsed_us = std::chrono::duration<f64, std::micro>(end - start).count();
+      if (pass == 0 || elapsed_us < best_us)
+         best_us = elapsed_us;
+   }
+
+   printf("%s: .text %lu bytes\n", filename, buffer.size());
+   printf("decoded %lu bytes, %lu instructions (%lu invalid) in %.1f us (best of %d)\n", bytes, instructions, invalid, best_us, PASSES);
+   printf("%.1f MB/s, %.1f M instructions/s, %.2f ms per MB\n", bytes / best_us, instructions / best_us,
+          best_us / 1000.0 / ((f64)bytes / (1024 * 1024)));
+
+   return 0;
+}
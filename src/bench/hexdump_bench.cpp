@@ -0,0 +1,206 @@
+// Hex dump throughput: the formatter in PrintData.cpp against the strcat and sprintf one it
+// replaced (kept below as the reference), at growing sizes, then a 100 MB dump streamed to a
+// temporary file. Checks first that both produce the same text.
+//
+//    make bench_hexdump && ./bench/hexdump_bench
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "../PrintData.cpp"
+
+const int    LEGACY_BYTES_PER_LINE = 16;
+const int    LEGACY_CHARS_PER_LINE = 80;
+const size_t STREAM_BYTES          = 100 * 1024 * 1024;
+const double MIN_SECONDS           = 0.25;
+
+static char* gLegacyString = nullptr;
+static int   gLegacyLength = 0;
+
+static const char* LegacyDataAsString(char* Data, int Length, const char* NewLine, unsigned long Address)
+{
+   const char* newline = "\n";
+
+   if (NewLine)
+      newline = NewLine;
+
+   // format data received
+   if (Length > 0)
+   {
+      char element[LEGACY_BYTES_PER_LINE+3] = { 0 };
+
+      // allocate string long enough to hold data
+      int length_required = ((Length + 8) / 8) * LEGACY_CHARS_PER_LINE;
+
+      if (!gLegacyString)
+      {
+         gLegacyString = new char[length_required];
+         gLegacyLength = length_required;
+      }
+      else if (gLegacyString && length_required > gLegacyLength)
+      {
+         delete [] gLegacyString;
+         gLegacyString = new char[length_required];
+         gLegacyLength = length_required;
+      }
+
+      memset(gLegacyString, 0, gLegacyLength);
+
+      for (int i = 0; i < Length; i++)
+      {
+         if (i % LEGACY_BYTES_PER_LINE == 0)
+         {
+            if (i != 0)
+            {
+               // print data as string
+               strcat(gLegacyString, "   |");
+               memcpy(element, &Data[i-LEGACY_BYTES_PER_LINE], LEGACY_BYTES_PER_LINE);
+               for (int j = 0; j < LEGACY_BYTES_PER_LINE; j++)
+               {
+                  // replace non-printable characters with '.'
+                  if ((element[j] >= 0 && element[j] <= 31) || element[j] >= 127 || element[j] < 0)
+                     element[j] = '.';
+               }
+               strcat(gLegacyString, element);
+               strcat(gLegacyString, "|");
+               strcat(gLegacyString, newline);
+               memset(element, 0, sizeof(element));
+            }
+            sprintf(element, "%08x:", (unsigned)(Address + i));
+            strcat(gLegacyString, element);
+            memset(element, 0, sizeof(element));
+         }
+
+         if (i % (LEGACY_BYTES_PER_LINE / 2) == 0)
+         {
+            // add a space after halfway through the bytes on a line
+            strcat(gLegacyString, " ");
+         }
+         // add a space every byte
+         strcat(gLegacyString, " ");
+
+         // print data
+         sprintf(element, "%02x", (unsigned char)Data[i]);
+         strcat(gLegacyString, element);
+         memset(element, 0, sizeof(element));
+      }
+
+      if (Length % LEGACY_BYTES_PER_LINE != 0)
+      {
+         // pad with spaces and print data as string
+         for (int j = 0; j < ((LEGACY_BYTES_PER_LINE - (Length % LEGACY_BYTES_PER_LINE)) * 3); j++)
+            strcat(gLegacyString, " ");
+         
+         if (Length % LEGACY_BYTES_PER_LINE <= 8)
+            strcat(gLegacyString, " ");
+
+         strcat(gLegacyString, "   |");
+         memcpy(element, &Data[Length-(Length % LEGACY_BYTES_PER_LINE)], Length % LEGACY_BYTES_PER_LINE);
+         for (int j = 0; j < LEGACY_BYTES_PER_LINE; j++)
+         {
+            // replace non-printable characters with '.'
+            if ((element[j] >= 0 && element[j] <= 31) || element[j] >= 127 || element[j] < 0)
+               element[j] = '.';
+         }
+         strcat(gLegacyString, element);
+         strcat(gLegacyString, "|");
+         memset(element, 0, sizeof(element));
+      }
+      else
+      {
+         // print data as string
+         strcat(gLegacyString, "   |");
+         memcpy(element, &Data[Length-LEGACY_BYTES_PER_LINE], LEGACY_BYTES_PER_LINE);
+         for (int j = 0; j < LEGACY_BYTES_PER_LINE; j++)
+         {
+            // replace non-printable characters with '.'
+            if ((element[j] >= 0 && element[j] <= 31) || element[j] >= 127 || element[j] < 0)
+               element[j] = '.';
+         }
+         strcat(gLegacyString, element);
+         strcat(gLegacyString, "|");
+         memset(element, 0, sizeof(element));
+      }
+   }
+
+   return gLegacyString;
+}
+
+typedef std::chrono::steady_clock TClock;
+
+// runs Format until MIN_SECONDS have gone by, returns MB/s of input
+template <typename F>
+static double Measure(size_t Bytes, F Format)
+{
+   TClock::time_point start = TClock::now();
+   double             seconds = 0.0;
+   size_t             runs = 0;
+
+   do
+   {
+      Format();
+      runs++;
+      seconds = std::chrono::duration<double>(TClock::now() - start).count();
+   } while (seconds < MIN_SECONDS);
+
+   return Bytes * runs / seconds / (1024.0 * 1024.0);
+}
+
+int main()
+{
+   std::vector<uint8_t> data(STREAM_BYTES);
+   std::mt19937         random(1);
+
+   // mostly printable with some of everything else
+   for (size_t i = 0; i < data.size(); i++)
+      data[i] = (random() % 4) ? 32 + random() % 95 : random() % 256;
+
+   for (int length = 0; length <= 100; length++)
+   {
+      std::string legacy = length ? LegacyDataAsString((char*)data.data(), length, "\r\n", 0x7ff0 + length) : "";
+
+      if (legacy != CPrintData::GetDataAsString((char*)data.data(), length, "\r\n", 0x7ff0 + length))
+      {
+         printf("Output differs from the old formatter at %d bytes\n", length);
+         return 1;
+      }
+   }
+
+   printf("%10s %14s %14s\n", "bytes", "old MB/s", "new MB/s");
+   for (size_t size = 4096; size <= 16 * 1024 * 1024; size *= 4)
+   {
+      double after = Measure(size, [&] { CPrintData::GetDataAsString((char*)data.data(), size, "\n", 0x400000); });
+
+      // the old one is quadratic, past 64 KB it takes minutes
+      if (size <= 65536)
+      {
+         double before = Measure(size, [&] { LegacyDataAsString((char*)data.data(), size, "\n", 0x400000); });
+
+         printf("%10lu %14.1f %14.1f\n", size, before, after);
+      }
+      else
+      {
+         printf("%10lu %14s %14.1f\n", size, "-", after);
+      }
+   }
+
+   FILE*              file = tmpfile();
+   TClock::time_point start = TClock::now();
+
+   if (!file || !CPrintData::WriteData(file, data.data(), data.size(), "\n", 0x7f0000000000ul) || fflush(file) != 0)
+   {
+      printf("Couldn't write the dump to a temporary file\n");
+      return 1;
+   }
+
+   double seconds = std::chrono::duration<double>(TClock::now() - start).count();
+
+   printf("%lu MB streamed to a file in %.2f s, %.1f MB/s, %ld bytes of text\n", STREAM_BYTES / (1024 * 1024), seconds,
+          STREAM_BYTES / seconds / (1024.0 * 1024.0), ftell(file));
+   fclose(file);
+
+   return 0;
+}
@@ -0,0 +1,23 @@
+// Writes LINES lines to stdout as fast as it can, then calls tick forever, for target output
+// throughput.
+
+#include <stdio.h>
+
+const int LINES = 20000;
+
+volatile unsigned long counter = 0;
+
+extern "C" __attribute__((noinline)) void tick()
+{
+   counter++;
+}
+
+int main()
+{
+   for (int i = 0; i < LINES; i++)
+      printf("flood line %d\n", i);
+   fflush(stdout);
+
+   for (;;)
+      tick();
+}
@@ -0,0 +1,25 @@
+// HEAP_MB of heap filled with a repeating pattern, then a call to tick, for memory search and
+// snapshot throughput.
+
+#include <stdlib.h>
+
+const unsigned long HEAP_MB = 256;
+
+volatile unsigned long counter = 0;
+
+extern "C" __attribute__((noinline)) void tick()
+{
+   counter++;
+}
+
+int main()
+{
+   unsigned long  words = HEAP_MB * 1024 * 1024 / sizeof(unsigned long);
+   unsigned long* heap = (unsigned long*)malloc(words * sizeof(unsigned long));
+
+   for (unsigned long i = 0; i < words; i++)
+      heap[i] = i * 0x9e3779b97f4a7c15ull;
+
+   for (;;)
+      tick();
+}
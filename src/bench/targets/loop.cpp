@@ -0,0 +1,19 @@
+// Tight loop around a function that doesn't get inlined, the target for breakpoint round trips,
+// stepping, restarts and startup.
+
+volatile unsigned long counter = 0;
+
+extern "C" __attribute__((noinline)) void tick()
+{
+   counter++;
+}
+
+int main()
+{
+   for (;;)
+   {
+      for (int i = 0; i < 16; i++)
+         counter += i;
+      tick();
+   }
+}
@@ -0,0 +1,17 @@
+// 65536 small functions, f0000 to fffff, for symbol table loading and lookups.
+
+#define F1(n)    extern "C" __attribute__((noinline)) int f##n(int x) { return x + 0x##n; }
+#define F16(n)   F1(n##0) F1(n##1) F1(n##2) F1(n##3) F1(n##4) F1(n##5) F1(n##6) F1(n##7) \
+                 F1(n##8) F1(n##9) F1(n##a) F1(n##b) F1(n##c) F1(n##d) F1(n##e) F1(n##f)
+#define F256(n)  F16(n##0) F16(n##1) F16(n##2) F16(n##3) F16(n##4) F16(n##5) F16(n##6) F16(n##7) \
+                 F16(n##8) F16(n##9) F16(n##a) F16(n##b) F16(n##c) F16(n##d) F16(n##e) F16(n##f)
+#define F4096(n) F256(n##0) F256(n##1) F256(n##2) F256(n##3) F256(n##4) F256(n##5) F256(n##6) F256(n##7) \
+                 F256(n##8) F256(n##9) F256(n##a) F256(n##b) F256(n##c) F256(n##d) F256(n##e) F256(n##f)
+
+F4096(0) F4096(1) F4096(2) F4096(3) F4096(4) F4096(5) F4096(6) F4096(7)
+F4096(8) F4096(9) F4096(a) F4096(b) F4096(c) F4096(d) F4096(e) F4096(f)
+
+int main()
+{
+   return f0000(0);
+}
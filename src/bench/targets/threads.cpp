@@ -0,0 +1,42 @@
+// THREADS threads and the main thread spinning a few calls deep, for the sampling profiler.
+// ready is called once all of them have been created.
+
+#include <thread>
+#include <vector>
+
+const int THREADS = 32;
+
+volatile unsigned long counter = 0;
+
+extern "C" __attribute__((noinline)) void leaf()
+{
+   for (int i = 0; i < 1000; i++)
+      counter += i;
+}
+
+extern "C" __attribute__((noinline)) void middle()
+{
+   leaf();
+}
+
+extern "C" __attribute__((noinline)) void spin()
+{
+   for (;;)
+      middle();
+}
+
+extern "C" __attribute__((noinline)) void ready()
+{
+   counter++;
+}
+
+int main()
+{
+   std::vector<std::thread> threads;
+
+   for (int i = 0; i < THREADS; i++)
+      threads.emplace_back(spin);
+
+   ready();
+   spin();
+}
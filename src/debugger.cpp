@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <sys/ptrace.h>
 #include <sys/user.h>
@@ -19,46 +20,47 @@
 #include "DebugTypes.h"
 
 #include "PrintData.cpp"
+#include "ElfFile.cpp"
+#include "Unwinder.cpp"
+#include "Decoder.cpp"
+#include "LineTable.cpp"
+#include "TraceFile.cpp"
+#include "CoreFile.cpp"
+#include "AddressSpace.cpp"
+#include "MemorySearch.cpp"
+#include "Snapshot.cpp"
+#include "Profile.cpp"
 #include "DebugBackend.cpp"
 #include "InputHandler.cpp"
 #include "DebugUtils.cpp"
 
-TDebugCommand GetCommand(CInputHandler& Input)
+// turns one command line into a command for the backend, Line is split up in place
+TDebugCommand ParseCommand(char* Line)
 {
-   char               input[CInputHandler::MAX_LINE] = {};
    std::vector<char*> strings;
    TDebugCommand      result = {};
 
-   Input.GetInput(input);
-
-   if (input[0] == CInputHandler::KEY_CTRL_C)
-   {
-      result.Command = DEBUG_CMD_INTERRUPT;
-      result.Data.Integer.Value = -1; // Ctrl-C interrupt
-      return result;
-   }
-
    // trim newline
-   int length = strlen(input);
-   if (input[length-1] == '\n')
+   int length = strlen(Line);
+   if (length > 0 && Line[length-1] == '\n')
    {
-      input[length-1] = 0;
+      Line[length-1] = 0;
       length--;
    }
 
    // split strings
    bool push_string = false;
-   strings.push_back(input);
+   strings.push_back(Line);
    for (int i = 0; i < length; i++)
    {
-      if (input[i] == ' ')
+      if (Line[i] == ' ')
       {
          push_string = true;
-         input[i] = 0;
+         Line[i] = 0;
       }
       else if (push_string)
       {
-         strings.push_back(&input[i]);
+         strings.push_back(&Line[i]);
          push_string = false;
       }
    }
@@ -81,6 +83,352 @@ TDebugCommand GetCommand(CInputHandler& Input)
    else if (strcmp(strings[0], "s") == 0 || strcmp(strings[0], "step") == 0)
    {
       result.Command = DEBUG_CMD_STEP_SINGLE;
+
+      if (strings.size() == 2 && strcmp(strings[1], "over") == 0)
+         result.Command = DEBUG_CMD_STEP_OVER;
+      else if (strings.size() == 2 && strcmp(strings[1], "into") == 0)
+         result.Command = DEBUG_CMD_STEP_INTO;
+      else if (strings.size() == 2 && strtoll(strings[1], 0, 10) > 0)
+      {
+         result.Command = DEBUG_CMD_STEP_UNTIL;
+         result.Data.StepUntil.Condition = STEP_UNTIL_COUNT;
+         result.Data.StepUntil.MaxSteps = strtoll(strings[1], 0, 10);
+      }
+      else if (strings.size() <= 3 && strings.size() >= 2 && strcmp(strings[1], "block") == 0)
+      {
+         result.Command = DEBUG_CMD_STEP_UNTIL;
+         result.Data.StepUntil.Condition = STEP_UNTIL_COUNT;
+         result.Data.StepUntil.Mode = STEP_MODE_BLOCK;
+         result.Data.StepUntil.MaxSteps = (strings.size() == 3) ? strtoll(strings[2], 0, 10) : 1;
+      }
+      else if (strings.size() >= 5 && strcmp(strings[1], "until") == 0)
+      {
+         size_t arg = 3;
+         bool   valid = true;
+
+         result.Command = DEBUG_CMD_STEP_UNTIL;
+         result.Data.StepUntil.MaxSteps = 0;
+
+         if (strcmp(strings[2], "outside") == 0)
+         {
+            result.Data.StepUntil.Condition = STEP_UNTIL_OUTSIDE_RANGE;
+            result.Data.StepUntil.Mode = STEP_MODE_BLOCK;
+            result.Data.StepUntil.Operand = strtoll(strings[arg++], 0, 16);
+            result.Data.StepUntil.Value = strtoll(strings[arg++], 0, 16);
+         }
+         else
+         {
+            bool      memory = (strcmp(strings[2], "mem") == 0);
+            eRegister register_name = REGISTER_COUNT;
+
+            for (int i = 0; i < REGISTER_COUNT; i++)
+            {
+               if (strcmp(strings[2], RegisterStr[i]) == 0)
+               {
+                  register_name = (eRegister)i;
+               }
+            }
+
+            result.Data.StepUntil.Operand = memory ? (u64)strtoll(strings[arg++], 0, 16) : (u64)register_name;
+            valid = (memory || register_name != REGISTER_COUNT) && arg + 1 < strings.size();
+
+            if (valid)
+            {
+               bool equal = (strcmp(strings[arg], "==") == 0);
+
+               valid = equal || strcmp(strings[arg], "!=") == 0;
+
+               if (memory)
+                  result.Data.StepUntil.Condition = equal ? STEP_UNTIL_MEMORY_EQUAL : STEP_UNTIL_MEMORY_NOT_EQUAL;
+               else
+                  result.Data.StepUntil.Condition = equal ? STEP_UNTIL_REGISTER_EQUAL : STEP_UNTIL_REGISTER_NOT_EQUAL;
+
+               result.Data.StepUntil.Value = strtoll(strings[arg + 1], 0, 16);
+               arg += 2;
+            }
+         }
+
+         if (valid && arg < strings.size())
+            result.Data.StepUntil.MaxSteps = strtoll(strings[arg++], 0, 10);
+
+         if (!valid || arg != strings.size())
+            result.Command = DEBUG_CMD_UNKNOWN;
+      }
+      else if (strings.size() != 1)
+      {
+         result.Command = DEBUG_CMD_UNKNOWN;
+      }
+
+      if (result.Command == DEBUG_CMD_UNKNOWN)
+      {
+         printf("Invalid cmd:\r\n");
+         printf("  step [over|into]\r\n");
+         printf("  step [count]\r\n");
+         printf("  step block [count]\r\n");
+         printf("  step until [register] [==|!=] [value] [limit]\r\n");
+         printf("  step until mem [address] [==|!=] [value]\r\n");
+         printf("  step until outside [start] [end] [limit]\r\n");
+      }
+
+      return result;
+   }
+   else if (strcmp(strings[0], "n") == 0 || strcmp(strings[0], "next") == 0)
+   {
+      result.Command = DEBUG_CMD_STEP_OVER;
+      return result;
+   }
+   else if (strcmp(strings[0], "ni") == 0 || strcmp(strings[0], "nexti") == 0)
+   {
+      result.Command = DEBUG_CMD_NEXT_INSTRUCTION;
+      return result;
+   }
+   else if (strcmp(strings[0], "finish") == 0)
+   {
+      result.Command = DEBUG_CMD_FINISH;
+      return result;
+   }
+   else if (strcmp(strings[0], "trace") == 0)
+   {
+      if (strings.size() > 2)
+      {
+         printf("Invalid cmd: trace [blocks]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = DEBUG_CMD_TRACE_BLOCKS;
+      result.Data.Trace.MaxBlocks = (strings.size() > 1) ? strtoll(strings[1], 0, 10) : 32;
+      return result;
+   }
+   else if (strcmp(strings[0], "record") == 0 || strcmp(strings[0], "replay") == 0)
+   {
+      bool record = (strcmp(strings[0], "record") == 0);
+
+      if (strings.size() < 2 || strings.size() > 3)
+      {
+         printf("Invalid cmd:\r\n");
+         printf("  record [file] [limit]\r\n");
+         printf("  replay [file] [instruction]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = record ? DEBUG_CMD_RECORD : DEBUG_CMD_REPLAY;
+      result.Data.TraceFile.Size = strlen(strings[1]) + 1;
+      result.Data.TraceFile.Filename = new u8[result.Data.TraceFile.Size];
+      result.Data.TraceFile.Count = (strings.size() > 2) ? strtoll(strings[2], 0, 10) : 0;
+      memcpy(result.Data.TraceFile.Filename, strings[1], result.Data.TraceFile.Size);
+      return result;
+   }
+   else if (strcmp(strings[0], "checkpoint") == 0)
+   {
+      if (strings.size() == 1)
+         result.Command = DEBUG_CMD_CHECKPOINT;
+      else if (strings.size() == 2 && strcmp(strings[1], "list") == 0)
+         result.Command = DEBUG_CMD_LIST_CHECKPOINTS;
+      else if (strings.size() == 3 && strcmp(strings[1], "delete") == 0)
+      {
+         result.Command = DEBUG_CMD_DELETE_CHECKPOINT;
+         result.Data.Checkpoint.Index = strtoll(strings[2], 0, 10) - 1;
+      }
+      else
+      {
+         printf("Invalid cmd:\r\n");
+         printf("  checkpoint\r\n");
+         printf("  checkpoint list\r\n");
+         printf("  checkpoint delete [checkpoint]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+      }
+
+      return result;
+   }
+   else if (strcmp(strings[0], "restore") == 0)
+   {
+      if (strings.size() != 2)
+      {
+         printf("Invalid cmd: restore [checkpoint]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = DEBUG_CMD_RESTORE_CHECKPOINT;
+      result.Data.Checkpoint.Index = strtoll(strings[1], 0, 10) - 1;
+      return result;
+   }
+   else if (strcmp(strings[0], "gcore") == 0)
+   {
+      if (strings.size() > 2)
+      {
+         printf("Invalid cmd: gcore [file]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = DEBUG_CMD_GENERATE_CORE;
+      if (strings.size() > 1)
+      {
+         result.Data.String.Size = strlen(strings[1]) + 1;
+         result.Data.String.String = new u8[result.Data.String.Size];
+         memcpy(result.Data.String.String, strings[1], result.Data.String.Size);
+      }
+      return result;
+   }
+   else if (strcmp(strings[0], "profile") == 0)
+   {
+      if (strings.size() < 3 || strings.size() > 4)
+      {
+         printf("Invalid cmd: profile [seconds] [hz] [collapsed stacks file]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = DEBUG_CMD_PROFILE;
+      result.Data.Profile.Milliseconds = strtod(strings[1], 0) * 1000.0;
+      result.Data.Profile.Hz = strtoll(strings[2], 0, 10);
+      if (strings.size() > 3)
+      {
+         result.Data.Profile.Size = strlen(strings[3]) + 1;
+         result.Data.Profile.Filename = new u8[result.Data.Profile.Size];
+         memcpy(result.Data.Profile.Filename, strings[3], result.Data.Profile.Size);
+      }
+      return result;
+   }
+   else if (strcmp(strings[0], "call") == 0)
+   {
+      std::string expression;
+
+      if (strings.size() < 2)
+      {
+         printf("Invalid cmd: call [function] [arguments]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      // the backend splits it again, "f(a, b)" and "f a b" both work
+      for (size_t i = 1; i < strings.size(); i++)
+         expression += std::string(i > 1 ? " " : "") + strings[i];
+
+      result.Command = DEBUG_CMD_CALL;
+      result.Data.String.Size = expression.length() + 1;
+      result.Data.String.String = new u8[result.Data.String.Size];
+      memcpy(result.Data.String.String, expression.c_str(), result.Data.String.Size);
+      return result;
+   }
+   else if (strcmp(strings[0], "find") == 0)
+   {
+      std::vector<u8> pattern;
+      u64             alignment = 1;
+      bool            valid = strings.size() > 2;
+
+      if (valid && strcmp(strings[1], "bytes") == 0)
+      {
+         for (size_t i = 2; i < strings.size() && valid; i++)
+         {
+            char* end;
+            u64   value = strtoull(strings[i], &end, 16);
+
+            valid = (*end == 0 && value <= 0xff);
+            pattern.push_back(value);
+         }
+      }
+      else if (valid && strcmp(strings[1], "string") == 0)
+      {
+         // the rest of the line, spaces included
+         for (size_t i = 2; i < strings.size(); i++)
+         {
+            if (i > 2)
+               pattern.push_back(' ');
+            pattern.insert(pattern.end(), strings[i], strings[i] + strlen(strings[i]));
+         }
+      }
+      else if (valid && strcmp(strings[1], "pointer") == 0 && strings.size() == 3)
+      {
+         u64 value = strtoull(strings[2], 0, 16);
+
+         pattern.insert(pattern.end(), (u8*)&value, (u8*)&value + sizeof(value));
+         alignment = sizeof(u64);
+      }
+      else
+      {
+         valid = false;
+      }
+
+      if (!valid)
+      {
+         printf("Invalid cmd:\r\n");
+         printf("  find bytes [hex byte] ...\r\n");
+         printf("  find string [text]\r\n");
+         printf("  find pointer [address]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = DEBUG_CMD_FIND;
+      result.Data.Find.Size = pattern.size();
+      result.Data.Find.Pattern = new u8[pattern.size()];
+      result.Data.Find.Alignment = alignment;
+      memcpy(result.Data.Find.Pattern, pattern.data(), pattern.size());
+      return result;
+   }
+   else if (strcmp(strings[0], "snapshot") == 0)
+   {
+      result.Command = DEBUG_CMD_SNAPSHOT;
+      return result;
+   }
+   else if (strcmp(strings[0], "diff") == 0)
+   {
+      result.Command = DEBUG_CMD_DIFF;
+      return result;
+   }
+   else if (strcmp(strings[0], "watch") == 0)
+   {
+      if (strings.size() == 2 && strcmp(strings[1], "list") == 0)
+         result.Command = DEBUG_CMD_LIST_WATCHPOINTS;
+      else if (strings.size() == 3 && strcmp(strings[1], "delete") == 0)
+      {
+         result.Command = DEBUG_CMD_DELETE_WATCHPOINT;
+         result.Data.BpIdx.Index = strtoll(strings[2], 0, 10) - 1;
+      }
+      else if (strings.size() == 2 || strings.size() == 3)
+      {
+         result.Command = DEBUG_CMD_SET_WATCHPOINT;
+         result.Data.Watch.Address = strtoull(strings[1], 0, 16);
+         result.Data.Watch.Size = (strings.size() > 2) ? strtoll(strings[2], 0, 10) : 0;
+      }
+      else
+      {
+         printf("Invalid cmd:\r\n");
+         printf("  watch [address] [bytes]\r\n");
+         printf("  watch list\r\n");
+         printf("  watch delete [watchpoint]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+      }
+
+      return result;
+   }
+   else if (strcmp(strings[0], "libraries") == 0)
+   {
+      result.Command = DEBUG_CMD_LIST_LIBRARIES;
+      return result;
+   }
+   else if (strcmp(strings[0], "stats") == 0)
+   {
+      if (strings.size() > 2)
+      {
+         printf("Invalid cmd:\r\n");
+         printf("  stats\r\n");
+         printf("  stats [json file]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = DEBUG_CMD_STATS;
+      if (strings.size() > 1)
+      {
+         result.Data.String.Size = strlen(strings[1]) + 1;
+         result.Data.String.String = new u8[result.Data.String.Size];
+         memcpy(result.Data.String.String, strings[1], result.Data.String.Size);
+      }
       return result;
    }
    else if (strcmp(strings[0], "b") == 0 || strcmp(strings[0], "break") == 0)
@@ -251,10 +599,44 @@ TDebugCommand GetCommand(CInputHandler& Input)
    }
    else if (strcmp(strings[0], "target") == 0)
    {
-      if (strings.size() > 2)
+      TLaunchSpec launch;
+      size_t      arg = 1;
+      bool        valid = true;
+
+      // options go in front of the executable, everything after it is passed to the target
+      while (valid && arg < strings.size() && strncmp(strings[arg], "--", 2) == 0)
+      {
+         valid = arg + 1 < strings.size();
+
+         if (valid && strcmp(strings[arg], "--env") == 0)
+            launch.Environment.push_back(strings[arg + 1]);
+         else if (valid && strcmp(strings[arg], "--cwd") == 0)
+            launch.WorkingDirectory = strings[arg + 1];
+         else if (valid && strcmp(strings[arg], "--core") == 0)
+            launch.Core = strings[arg + 1];
+         else
+            valid = false;
+
+         arg += 2;
+      }
+
+      if (valid && strings.size() > arg)
+      {
+         for (size_t i = arg + 1; i < strings.size(); i++)
+         {
+            if (strcmp(strings[i], "<") == 0 && i + 2 == strings.size())
+               launch.Input = strings[++i];
+            else
+               launch.Arguments.push_back(strings[i]);
+         }
+      }
+
+      if (!valid || (arg > 1 && arg >= strings.size()))
       {
          printf("Invalid cmd:\r\n");
-         printf("  target [executable]\r\n");
+         printf("  target\r\n");
+         printf("  target [--env NAME=value] [--cwd directory] [executable] [arguments] [< input]\r\n");
+         printf("  target --core [core file] [executable]\r\n");
          result.Command = DEBUG_CMD_UNKNOWN;
          return result;
       }
@@ -266,9 +648,10 @@ TDebugCommand GetCommand(CInputHandler& Input)
       else
       {
          result.Command = DEBUG_CMD_SET_TARGET;
-         result.Data.String.Size = strlen(strings[1]) + 1;
+         result.Data.String.Size = strlen(strings[arg]) + 1;
          result.Data.String.String = new u8[result.Data.String.Size];
-         memcpy(result.Data.String.String, strings[1], result.Data.String.Size);
+         result.Data.String.Launch = new TLaunchSpec(launch);
+         memcpy(result.Data.String.String, strings[arg], result.Data.String.Size);
       }
 
       return result;
@@ -299,6 +682,49 @@ TDebugCommand GetCommand(CInputHandler& Input)
       result.Command = DEBUG_CMD_STOP;
       return result;
    }
+   else if (strcmp(strings[0], "bt") == 0 || strcmp(strings[0], "backtrace") == 0)
+   {
+      size_t arg = 1;
+
+      result.Command = DEBUG_CMD_BACKTRACE;
+      result.Data.Backtrace.Mode = UNWIND_MODE_CFI;
+      result.Data.Backtrace.MaxFrames = 0;
+
+      if (arg < strings.size() && strcmp(strings[arg], "fp") == 0)
+      {
+         result.Data.Backtrace.Mode = UNWIND_MODE_FRAME_POINTER;
+         arg++;
+      }
+      else if (arg < strings.size() && strcmp(strings[arg], "cfi") == 0)
+      {
+         arg++;
+      }
+
+      if (arg < strings.size())
+         result.Data.Backtrace.MaxFrames = strtoll(strings[arg++], 0, 10);
+
+      if (arg != strings.size())
+      {
+         printf("Invalid cmd: backtrace [fp|cfi] [frames]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+      }
+
+      return result;
+   }
+   else if (strcmp(strings[0], "disas") == 0 || strcmp(strings[0], "disassemble") == 0)
+   {
+      if (strings.size() > 3)
+      {
+         printf("Invalid cmd: disassemble [address] [count]\r\n");
+         result.Command = DEBUG_CMD_UNKNOWN;
+         return result;
+      }
+
+      result.Command = DEBUG_CMD_DISASSEMBLE;
+      result.Data.Disassemble.Address = (strings.size() > 1) ? strtoll(strings[1], 0, 16) : 0;
+      result.Data.Disassemble.Count = (strings.size() > 2) ? strtoll(strings[2], 0, 10) : 10;
+      return result;
+   }
    else if (strcmp(strings[0], "attach") == 0)
    {
       if (strings.size() != 2)
@@ -318,6 +744,94 @@ TDebugCommand GetCommand(CInputHandler& Input)
    return result;
 };
 
+TDebugCommand GetCommand(CInputHandler& Input)
+{
+   char          input[CInputHandler::MAX_LINE] = {};
+   TDebugCommand result = {};
+
+   Input.GetInput(input);
+
+   if (input[0] == CInputHandler::KEY_CTRL_C)
+   {
+      result.Command = DEBUG_CMD_INTERRUPT;
+      result.Data.Integer.Value = -1; // Ctrl-C interrupt
+      return result;
+   }
+
+   return ParseCommand(input);
+}
+
+// prints any data output from backend
+void PrintBackendData(CDebugBackend& Debugger, pid_t* DebugPid)
+{
+   u8* data;
+   while ((data = Debugger.PopData()))
+   {
+      TBufferHeader* header = (TBufferHeader*)data;
+      switch (header->DataType)
+      {
+         case DATA_TYPE_STREAM_ERROR:
+         {
+            char* str = (char*)&data[sizeof(TBufferHeader)];
+            printf("ERROR: %.*s\r\n", header->Size, str);
+            break;
+         }
+         case DATA_TYPE_STREAM_WARNING:
+         {
+            char* str = (char*)&data[sizeof(TBufferHeader)];
+            printf("WARNING: %.*s\r\n", header->Size, str);
+            break;
+         }
+         case DATA_TYPE_STREAM_DEBUG:
+         {
+            char* str = (char*)&data[sizeof(TBufferHeader)];
+            printf("DEBUG: %.*s\r\n", header->Size, str);
+            break;
+         }
+         case DATA_TYPE_STREAM_INFO:
+         {
+            char* str = (char*)&data[sizeof(TBufferHeader)];
+            printf("\r%.*s\r\n", header->Size, str);
+            break;
+         }
+         case DATA_TYPE_STREAM_TARGET_OUTPUT:
+         {
+            char* str = (char*)&data[sizeof(TBufferHeader)];
+            printf("\rOUTPUT: %.*s\r\n", header->Size, str);
+            break;
+         }
+         case DATA_TYPE_REGISTERS:
+         {
+            TRegister* registers = (TRegister*)&data[sizeof(TBufferHeader)];
+            printf("Register values:\r\n");
+            for (int i = 0; i < REGISTER_COUNT; i++)
+               printf("  %s: %.*s 0x%08x\r\n", RegisterStr[i], 8 - strlen(RegisterStr[i]), "          ", registers->RegArray[i]);
+            break;
+         }
+         case DATA_TYPE_DATA:
+         {
+            data += sizeof(TBufferHeader);
+
+            u64 address = *(u64*)data;
+            data += sizeof(u64);
+
+            printf("Data read at address 0x%lx bytes %lu:\r\n", address, header->Size-sizeof(u64));
+            CPrintData::WriteData(stdout, data, header->Size-sizeof(u64), "\r\n", address);
+            printf("\r\n");
+            break;
+         }
+         case DATA_TYPE_PID:
+         {
+            data += sizeof(TBufferHeader);
+            *DebugPid = *(pid_t*)data;
+            break;
+         }
+         default:
+            break;
+      }
+   }
+}
+
 void RunConsole(CDebugBackend& Debugger, CInputHandler& Input)
 {
    TDebugCommand cmd;
@@ -335,8 +849,10 @@ void RunConsole(CDebugBackend& Debugger, CInputHandler& Input)
 
       if (cmd.Command == DEBUG_CMD_INTERRUPT && cmd.Data.Integer.Value == -1)
       {
+         // Ctrl-C stops a memory search first, the target otherwise
          //ptrace(PTRACE_INTERRUPT, debug_pid, 0, 0);
-         kill(debug_pid, SIGINT);
+         if (!Debugger.Cancel())
+            kill(debug_pid, SIGINT);
       }
       else if (cmd.Command != DEBUG_CMD_UNKNOWN)
       {
@@ -345,91 +861,117 @@ void RunConsole(CDebugBackend& Debugger, CInputHandler& Input)
          // wait for command to be processed by backend
          std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-         // process any data output from backend
-         u8* data;
-         while ((data = Debugger.PopData()))
-         {
-            TBufferHeader* header = (TBufferHeader*)data;
-            switch (header->DataType)
-            {
-               case DATA_TYPE_STREAM_ERROR:
-               {
-                  char* str = (char*)&data[sizeof(TBufferHeader)];
-                  printf("ERROR: %.*s\r\n", header->Size, str);
-                  break;
-               }
-               case DATA_TYPE_STREAM_WARNING:
-               {
-                  char* str = (char*)&data[sizeof(TBufferHeader)];
-                  printf("WARNING: %.*s\r\n", header->Size, str);
-                  break;
-               }
-               case DATA_TYPE_STREAM_DEBUG:
-               {
-                  char* str = (char*)&data[sizeof(TBufferHeader)];
-                  printf("DEBUG: %.*s\r\n", header->Size, str);
-                  break;
-               }
-               case DATA_TYPE_STREAM_INFO:
-               {
-                  char* str = (char*)&data[sizeof(TBufferHeader)];
-                  printf("\r%.*s\r\n", header->Size, str);
-                  break;
-               }
-               case DATA_TYPE_STREAM_TARGET_OUTPUT:
-               {
-                  char* str = (char*)&data[sizeof(TBufferHeader)];
-                  printf("\rOUTPUT: %.*s\r\n", header->Size, str);
-                  break;
-               }
-               case DATA_TYPE_REGISTERS:
-               {
-                  TRegister* registers = (TRegister*)&data[sizeof(TBufferHeader)];
-                  printf("Register values:\r\n");
-                  for (int i = 0; i < REGISTER_COUNT; i++)
-                     printf("  %s: %.*s 0x%08x\r\n", RegisterStr[i], 8 - strlen(RegisterStr[i]), "          ", registers->RegArray[i]);
-                  break;
-               }
-               case DATA_TYPE_DATA:
-               {
-                  data += sizeof(TBufferHeader);
+         PrintBackendData(Debugger, &debug_pid);
+      }
+   }
+}
 
-                  u64 address = *(u64*)data;
-                  data += sizeof(u64);
+// Runs the commands in a script file without the terminal, one line each, parsed the same way
+// as typed ones. Every command is sent once the one before it has been processed, and the time
+// each one took is listed at the end, from Start on when the debugger was started. Empty lines
+// and lines starting with # are skipped.
+void RunScript(CDebugBackend& Debugger, FILE* Script, std::chrono::steady_clock::time_point Start)
+{
+   struct TTiming
+   {
+      std::string Line;
+      f64         Milliseconds;
+   };
 
-                  printf("Data read at address 0x%x bytes %d:\r\n", address, header->Size-sizeof(u64));
-                  printf("%s\r\n", CPrintData::GetDataAsString((char*)data, header->Size-sizeof(u64), "\r\n", address));
-                  break;
-               }
-               case DATA_TYPE_PID:
-               {
-                  data += sizeof(TBufferHeader);
-                  debug_pid = *(pid_t*)data;
-                  break;
-               }
-               default:
-                  break;
-            }
-         }
-      }
+   std::vector<TTiming> timings;
+   char                 line[CInputHandler::MAX_LINE];
+   pid_t                debug_pid = 0;
+
+   while (!Debugger.WaitCommand(10))
+      PrintBackendData(Debugger, &debug_pid);
+   PrintBackendData(Debugger, &debug_pid);
+
+   timings.push_back({"(startup)", std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - Start).count()});
+
+   while (Debugger.IsRunning() && fgets(line, sizeof(line), Script))
+   {
+      size_t length = strlen(line);
+
+      while (length > 0 && isspace(line[length - 1]))
+         line[--length] = 0;
+
+      if (length == 0 || line[0] == '#')
+         continue;
+
+      std::string   text = line;
+      TDebugCommand cmd;
+
+      printf("dbg> %s\r\n", text.c_str());
+
+      // ParseCommand has already said what is wrong with it
+      cmd = ParseCommand(line);
+      if (cmd.Command == DEBUG_CMD_UNKNOWN)
+         continue;
+
+      auto command_start = std::chrono::steady_clock::now();
+
+      // messages and target output are printed while a command runs, a continue can take long
+      Debugger.SetCommand(cmd);
+      while (!Debugger.WaitCommand(10))
+         PrintBackendData(Debugger, &debug_pid);
+
+      auto command_end = std::chrono::steady_clock::now();
+
+      PrintBackendData(Debugger, &debug_pid);
+      timings.push_back({text, std::chrono::duration<f64, std::milli>(command_end - command_start).count()});
+   }
+
+   printf("Script timing:\r\n");
+   for (size_t i = 0; i < timings.size(); i++)
+      printf("  %10.3f ms  %s\r\n", timings[i].Milliseconds, timings[i].Line.c_str());
+   printf("  %10.3f ms  total for %lu commands\r\n",
+          std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - Start).count(), timings.size() - 1);
+
+   if (Debugger.IsRunning())
+   {
+      TDebugCommand quit = {};
+
+      quit.Command = DEBUG_CMD_QUIT;
+      Debugger.SetCommand(quit);
    }
 }
 
 int main(int argc, char** argv)
 {
    CDebugBackend debugger;
-   CInputHandler input("dbg> ", stdout);
+   FILE*         script = nullptr;
+   auto          start = std::chrono::steady_clock::now();
+   int           program = 1;
    bool          attach = false;
    bool          status = false;
 
+   // debugger script [file] [program] [arguments] runs the commands in file instead of the console
+   if (argc > 1 && strcmp(argv[1], "script") == 0)
+   {
+      if (argc < 4)
+      {
+         fprintf(stderr, "Expected a script file and a program name after script\r\n");
+         return -1;
+      }
+
+      script = fopen(argv[2], "re");
+      if (!script)
+      {
+         fprintf(stderr, "Couldn't read script %s: %s\r\n", argv[2], strerror(errno));
+         return -1;
+      }
+
+      program = 3;
+   }
+
    if (argc < 2)
    {
       fprintf(stderr, "Expected a program name as argument\r\n");
       return -1;
    }
-   else if (argc == 3)
+   else if (strcmp(argv[program], "attach") == 0)
    {
-      if (strcmp(argv[1], "attach") == 0)
+      if (argc == program + 2)
       {
          attach = true;
       }
@@ -442,25 +984,39 @@ int main(int argc, char** argv)
 
    if (attach)
    {
-      status = debugger.Attach(std::atoi(argv[2]));
+      status = debugger.Attach(std::atoi(argv[program + 1]));
       if (!status)
       {
-         fprintf(stderr, "Failed to attach to process %s\r\n", argv[2]);
+         fprintf(stderr, "Failed to attach to process %s\r\n", argv[program + 1]);
          return -1;
       }
    }
    else
    {
-      status = debugger.Run(argv[1]);
+      TLaunchSpec launch;
+
+      // anything after the program is passed on to it
+      for (int i = program + 1; i < argc; i++)
+         launch.Arguments.push_back(argv[i]);
+
+      status = debugger.Run(argv[program], &launch);
       if (!status)
       {
-         fprintf(stderr, "Failed to start debugger on %s\r\n", argv[1]);
+         fprintf(stderr, "Failed to start debugger on %s\r\n", argv[program]);
          return -1;
       }
    }
 
-   if (status)
-      RunConsole(debugger, input);
+   if (script)
+   {
+      RunScript(debugger, script, start);
+      fclose(script);
+      return 0;
+   }
+
+   CInputHandler input("dbg> ", stdout);
+
+   RunConsole(debugger, input);
 
    return 0;
 }
@@ -163,7 +163,8 @@ int main(int argc, char** argv)
    if (0)
    {
       // dump binary of file
-      printf("%s\n", CPrintData::GetDataAsString((char*)buffer.Data, buffer.Size));
+      CPrintData::WriteData(stdout, buffer.Data, buffer.Size);
+      printf("\n");
    }
    else if (buffer.Size)
    {
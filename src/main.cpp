@@ -11,6 +11,16 @@
 #include "imgui_impl_opengl3.cpp"
 
 #include "DebugUtils.cpp"
+#include "ElfFile.cpp"
+#include "Unwinder.cpp"
+#include "Decoder.cpp"
+#include "LineTable.cpp"
+#include "TraceFile.cpp"
+#include "CoreFile.cpp"
+#include "AddressSpace.cpp"
+#include "MemorySearch.cpp"
+#include "Snapshot.cpp"
+#include "Profile.cpp"
 #include "DebugBackend.cpp"
 #include "gui.cpp"
 